@@ -5,6 +5,7 @@
 #include "Holo2IRTracker.h"
 #include "IRTrackerUtils.h"
 #include "Shiny.h"
+#include <winrt/Windows.Storage.h>
 
 extern "C"
 HMODULE LoadLibraryA(
@@ -203,19 +204,18 @@ namespace winrt::HL2DinoPlugin::implementation
     {
         m_depthSensorLoopStarted = false;
 
-        if (m_RawDepthImgBuf)
         {
-            delete[] m_RawDepthImgBuf;
-            m_RawDepthImgBuf = nullptr;
-        }
-        if (m_8bitDepthImgBuf)
-        {
-            delete[] m_8bitDepthImgBuf;
-            m_8bitDepthImgBuf = nullptr;
-        }
+            std::lock_guard<std::mutex> l(m_imgMutex);
+            ReleaseDisplayFrame();
+
+            if (m_8bitDepthImgBuf)
+            {
+                delete[] m_8bitDepthImgBuf;
+                m_8bitDepthImgBuf = nullptr;
+            }
 
-        if (m_RawABImgBuf) { delete[] m_RawABImgBuf; m_RawABImgBuf = nullptr; }
-        if (m_8BitABImgBuf) { delete[] m_8BitABImgBuf; m_8BitABImgBuf = nullptr; }
+            if (m_8BitABImgBuf) { delete[] m_8BitABImgBuf; m_8BitABImgBuf = nullptr; }
+        }
 
         if (m_pSensorDevice) { m_pSensorDevice->Release(); m_pSensorDevice = nullptr; }
         if (m_pSensorDeviceConsent) { m_pSensorDeviceConsent->Release(); m_pSensorDeviceConsent = nullptr; }
@@ -239,6 +239,31 @@ namespace winrt::HL2DinoPlugin::implementation
         m_stashSensorImgs = showTextures;
     }
 
+    void HL2ResearchModeController::SetDisplayPreviewMode(int32_t previewMode)
+    {
+        using IRTrackerUtils::ImageProc::DisplayPreview;
+        if (previewMode < static_cast<int32_t>(DisplayPreview::Full) || previewMode > static_cast<int32_t>(DisplayPreview::ToolCrop)) return;
+
+        std::lock_guard<std::mutex> l(m_imgMutex);
+        m_displayPreview = static_cast<DisplayPreview>(previewMode);
+
+        // force the next getter calls to regenerate in the new format
+        m_8bitDepthFrameId = 0;
+        m_8BitABFrameId = 0;
+    }
+
+    int32_t HL2ResearchModeController::GetDisplayImageWidth()
+    {
+        std::lock_guard<std::mutex> l(m_imgMutex);
+        return Holo2IRTracker::GetDisplayImageSize(m_displayPreview).width;
+    }
+
+    int32_t HL2ResearchModeController::GetDisplayImageHeight()
+    {
+        std::lock_guard<std::mutex> l(m_imgMutex);
+        return Holo2IRTracker::GetDisplayImageSize(m_displayPreview).height;
+    }
+
     bool HL2ResearchModeController::ToolDictionaryUpdated()
     {
         std::lock_guard<std::mutex> l(m_toolDoubleVectorMutex);
@@ -270,12 +295,33 @@ namespace winrt::HL2DinoPlugin::implementation
         return tools2worldArr;
     }
 
+    com_array<double> HL2ResearchModeController::GetPredictedToolsPoseMatrices(uint64_t hostTicks)
+    {
+        std::lock_guard<std::mutex> l(m_toolDoubleVectorMutex);
+        std::vector<double> predicted(m_OutputToolPoseVector);
+
+        // same 18 doubles per tool : [id, visibleBit, 16 matrix elements], only the matrices of visible tools change
+        for (size_t i = 0; i + 18 <= predicted.size(); i += 18)
+        {
+            if (predicted[i + 1] == 0) continue;
+
+            const auto predictor = m_OutputPosePredictors.find(static_cast<uint8_t>(predicted[i]));
+            Eigen::Matrix4d pose;
+            if (predictor == m_OutputPosePredictors.end() || !predictor->second.Predict(hostTicks, pose)) continue;
+            std::copy(pose.data(), pose.data() + 16, predicted.begin() + i + 2);
+        }
+        return com_array<double>(predicted.begin(), predicted.end());
+    }
+
     com_array<uint16_t> HL2ResearchModeController::GetRawDepthImageBuffer()
     {
         std::lock_guard<std::mutex> l(m_imgMutex);
         if (!m_RawDepthImgBuf) return com_array<uint16_t>();
-        com_array<UINT16> tempBuffer = com_array<UINT16>(m_RawDepthImgBuf, m_RawDepthImgBuf + m_depthBufferSize);
 
+        // straight out of the held sensor frame, so this is the only copy made
+        com_array<UINT16> tempBuffer = com_array<UINT16>(m_RawDepthImgBuf, m_RawDepthImgBuf + m_displayBufferCount);
+
+        m_RawDepthImageUpdated.store(false, std::memory_order_relaxed);
         return tempBuffer;
     }
 
@@ -284,16 +330,29 @@ namespace winrt::HL2DinoPlugin::implementation
         std::lock_guard<std::mutex> l(m_imgMutex);
         if (!m_RawABImgBuf) return com_array<uint16_t>();
 
-        com_array<UINT16> tempBuffer = com_array<UINT16>(m_RawABImgBuf, m_RawABImgBuf + m_depthBufferSize);
+        com_array<UINT16> tempBuffer = com_array<UINT16>(m_RawABImgBuf, m_RawABImgBuf + m_displayBufferCount);
 
+        m_RawABImageUpdated.store(false, std::memory_order_relaxed);
         return tempBuffer;
     }
 
     com_array<uint8_t> HL2ResearchModeController::Get8BitDepthImageBuf()
     {
         std::lock_guard<std::mutex> l(m_imgMutex);
-        if (!m_8bitDepthImgBuf) return com_array<UINT8>();
-        com_array<UINT8> tempBuffer = com_array<UINT8>(std::move_iterator(m_8bitDepthImgBuf), std::move_iterator(m_8bitDepthImgBuf + m_depthBufferSize));
+        if (!m_RawDepthImgBuf) return com_array<UINT8>();
+
+        // only generated the first time it's asked for after a new frame. No profiler zones here, this runs on 
+        // the caller's thread and Shiny isn't thread-safe
+        if (m_8bitDepthFrameId != m_displayFrameId)
+        {
+            if (!m_8bitDepthImgBuf) { m_8bitDepthImgBuf = new UINT8[m_displayBufferCount]; }
+            m_IRTracker.RenderDepthDisplayImage(m_RawDepthImgBuf, m_displayToolSnapshot, m_8bitDepthImgBuf, m_displayPreview);
+            m_8bitDepthFrameId = m_displayFrameId;
+        }
+
+        // buffer is allocated for full frames, previews just use the start of it
+        const size_t imageLength = Holo2IRTracker::GetDisplayImageSize(m_displayPreview).area();
+        com_array<UINT8> tempBuffer = com_array<UINT8>(m_8bitDepthImgBuf, m_8bitDepthImgBuf + imageLength);
 
         m_Depth8BitImageUpdated.store(false, std::memory_order_relaxed);
         return tempBuffer;
@@ -302,14 +361,46 @@ namespace winrt::HL2DinoPlugin::implementation
     com_array<uint8_t> HL2ResearchModeController::Get8BitABImageBuf()
     {
         std::lock_guard<std::mutex> l(m_imgMutex);
-        if (!m_8BitABImgBuf) return com_array<UINT8>();
+        if (!m_RawABImgBuf) return com_array<UINT8>();
+
+        if (m_8BitABFrameId != m_displayFrameId)
+        {
+            if (!m_8BitABImgBuf) { m_8BitABImgBuf = new UINT8[m_displayBufferCount]; }
+            m_IRTracker.RenderABDisplayImage(m_RawABImgBuf, m_displayToolSnapshot, m_8BitABImgBuf, m_displayPreview);
+            m_8BitABFrameId = m_displayFrameId;
+        }
 
-        com_array<UINT8> tempBuffer = com_array<UINT8>(std::move_iterator(m_8BitABImgBuf), std::move_iterator(m_8BitABImgBuf + m_depthBufferSize));
+        const size_t imageLength = Holo2IRTracker::GetDisplayImageSize(m_displayPreview).area();
+        com_array<UINT8> tempBuffer = com_array<UINT8>(m_8BitABImgBuf, m_8BitABImgBuf + imageLength);
 
         m_AB8BitImageUpdated.store(false, std::memory_order_relaxed);
         return tempBuffer;
     }
 
+    void HL2ResearchModeController::HoldDisplayFrame(IResearchModeSensorFrame* pSensorFrame, IResearchModeSensorDepthFrame* pDepthFrame,
+        const UINT16* pAbImage, const UINT16* pDepth, size_t bufferCount)
+    {
+        ReleaseDisplayFrame();
+
+        // keeping a reference is enough for the buffer pointers to stay valid
+        pSensorFrame->AddRef();
+        pDepthFrame->AddRef();
+        m_pDisplaySensorFrame = pSensorFrame;
+        m_pDisplayDepthFrame = pDepthFrame;
+        m_RawABImgBuf = pAbImage;
+        m_RawDepthImgBuf = pDepth;
+        m_displayBufferCount = bufferCount;
+        ++m_displayFrameId;
+    }
+
+    void HL2ResearchModeController::ReleaseDisplayFrame()
+    {
+        if (m_pDisplayDepthFrame) { m_pDisplayDepthFrame->Release(); m_pDisplayDepthFrame = nullptr; }
+        if (m_pDisplaySensorFrame) { m_pDisplaySensorFrame->Release(); m_pDisplaySensorFrame = nullptr; }
+        m_RawABImgBuf = nullptr;
+        m_RawDepthImgBuf = nullptr;
+    }
+
     hstring HL2ResearchModeController::GetProfilerString()
     {
         PROFILE_UPDATE();
@@ -345,7 +436,39 @@ namespace winrt::HL2DinoPlugin::implementation
             else return false;
         };
 
-        pHL2ResearchMode->m_IRTracker.SetUnmapFunction(unmapLambda);
+        // and the opposite direction, so the tracker can project points back into the image
+        IRTrackerUtils::ProjectFunction projectLambda =
+            [&pDepthSensor = pHL2ResearchMode->m_pDepthCameraSensor](float(&xy)[2], float(&uv)[2])
+        {
+            return pDepthSensor && SUCCEEDED(pDepthSensor->MapCameraSpaceToImagePoint(xy, uv));
+        };
+
+        pHL2ResearchMode->m_IRTracker.SetUnmapFunction(
+            std::make_shared<IRTrackerUtils::ResearchModeCameraModel>(unmapLambda, projectLambda));
+
+        // Sampling the unmap function for every pixel is slow-ish, so the ray table is cached on disk and only
+        // rebuilt if this device's extrinsics don't match the saved copy
+        {
+            IRTrackerUtils::RayLookupTable rayTable;
+            IRTrackerUtils::RayLookupTable::ExtrinsicsKey extrinsicsKey;
+            for (int r = 0; r < 4; ++r)
+                for (int c = 0; c < 4; ++c) extrinsicsKey[r * 4 + c] = pHL2ResearchMode->m_depthCamExtrinsic.m[r][c];
+
+            std::string tablePath;
+            try
+            {
+                tablePath = winrt::to_string(winrt::Windows::Storage::ApplicationData::Current().LocalFolder().Path()) + "\\ahat_raylut.bin";
+            }
+            catch (...) {} // no app data folder, build in memory only
+
+            if (tablePath.empty() || !rayTable.Load(tablePath, extrinsicsKey))
+            {
+                if (rayTable.Build(unmapLambda) && !tablePath.empty()) rayTable.Save(tablePath, extrinsicsKey);
+            }
+
+            // an empty table leaves the tracker on the sensor's own functions
+            pHL2ResearchMode->m_IRTracker.SetRayLookupTable(rayTable);
+        }
 
         ResearchModeSensorTimestamp lastTimestamp = ResearchModeSensorTimestamp();
         lastTimestamp.HostTicks = 0;
@@ -395,6 +518,14 @@ namespace winrt::HL2DinoPlugin::implementation
                 const UINT16* pAbImage = nullptr;
                 pDepthFrame->GetAbDepthBuffer(&pAbImage, &outAbBufferCount);
 
+                // per-pixel invalidation flags, optional as not every sensor mode/firmware provides them
+                size_t outSigmaBufferCount = 0;
+                const BYTE* pSigma = nullptr;
+                if (FAILED(pDepthFrame->GetSigmaBuffer(&pSigma, &outSigmaBufferCount)) || outSigmaBufferCount != outBufferCount)
+                {
+                    pSigma = nullptr;
+                }
+
                 // get tracking transform
                 PROFILE_BEGIN(LocateWorld);
                 ResearchModeSensorTimestamp timestamp;
@@ -434,9 +565,16 @@ namespace winrt::HL2DinoPlugin::implementation
 
                 // Main logic:
                 // pass in the newest AB frame, depth Frame, and current pose matrix to the IR Tracking class
-                // internally, this will update its Tool Dictionary/Map structure
+                // internally, this will update its Tool Dictionary/Map structure. Display images are made later
+                // on demand by the getters, so the tracker always runs its lean path here
                 PROFILE_BEGIN(ImgProcessingPipeline);
-                pHL2ResearchMode->m_IRTracker.ProcessLatestFrames(pAbImage, pDepth, eig_depthToWorld, StashTexThisFrame);
+                IRTrackerUtils::SensorFrame sensorFrame;
+                sensorFrame.ABImage = pAbImage;
+                sensorFrame.DepthImage = pDepth;
+                sensorFrame.SigmaImage = pSigma;
+                sensorFrame.Timestamp = timestamp.HostTicks;
+                sensorFrame.Depth2World = eig_depthToWorld;
+                pHL2ResearchMode->m_IRTracker.ProcessLatestFrames(sensorFrame);
                 PROFILE_END();
 
                 // Serialize the values in the tool dictionary and output it into the double array
@@ -444,45 +582,23 @@ namespace winrt::HL2DinoPlugin::implementation
                 // coordinates and metres in this result
                 pHL2ResearchMode->m_toolDoubleVectorMutex.lock();
                 pHL2ResearchMode->m_IRTracker.GetSerializedToolDict(pHL2ResearchMode->m_OutputToolPoseVector);
+                pHL2ResearchMode->m_IRTracker.CopyPosePredictors(pHL2ResearchMode->m_OutputPosePredictors);
                 pHL2ResearchMode->m_toolDictUpdated.store(true, std::memory_order_relaxed);
                 pHL2ResearchMode->m_toolDoubleVectorMutex.unlock();
 
                 if (StashTexThisFrame) // set this to false externally to cut out img stashing operations 
                 {
                     PROFILE_BLOCK(SavingSensorImages);
-                    // Raw textures to store ab + depth frames as images
-                    auto pDepthTexture = std::make_unique<uint8_t[]>(outBufferCount);
-                    auto pAbTexture = std::make_unique<uint8_t[]>(outAbBufferCount);
-
-                    pHL2ResearchMode->m_IRTracker.RetrieveDisplayImages(pAbTexture.get(), pDepthTexture.get(), 512 * 512);
-
-                    // ------------------------------------------------
-
-                    // save data
-                    {
-                        std::lock_guard<std::mutex> l(pHL2ResearchMode->m_imgMutex);
-
-                        // save raw depth map
-                        if (!pHL2ResearchMode->m_RawDepthImgBuf) { pHL2ResearchMode->m_RawDepthImgBuf = new UINT16[outBufferCount]; }
-                        memcpy(pHL2ResearchMode->m_RawDepthImgBuf, pDepth, outBufferCount * sizeof(UINT16));
-
-                        // save pre-processed depth map texture (for visualization)
-                        if (!pHL2ResearchMode->m_8bitDepthImgBuf) { pHL2ResearchMode->m_8bitDepthImgBuf = new UINT8[outBufferCount]; }
-                        memcpy(pHL2ResearchMode->m_8bitDepthImgBuf, pDepthTexture.get(), outBufferCount * sizeof(UINT8));
-
-                        // save raw AbImage
-                        if (!pHL2ResearchMode->m_RawABImgBuf) { pHL2ResearchMode->m_RawABImgBuf = new UINT16[outBufferCount]; }
-                        memcpy(pHL2ResearchMode->m_RawABImgBuf, pAbImage, outBufferCount * sizeof(UINT16));
-
-                        // save pre-processed AbImage texture (for visualization)
-                        if (!pHL2ResearchMode->m_8BitABImgBuf) { pHL2ResearchMode->m_8BitABImgBuf = new UINT8[outBufferCount]; }
-                        memcpy(pHL2ResearchMode->m_8BitABImgBuf, pAbTexture.get(), outBufferCount * sizeof(UINT8));
-
-                        pHL2ResearchMode->m_AB8BitImageUpdated.store(true, std::memory_order_relaxed);
-                        pHL2ResearchMode->m_Depth8BitImageUpdated.store(true, std::memory_order_relaxed);
-                    }
-
-                    pDepthTexture.reset();
+                    // just hold on to this frame and the tool state that goes with it, nothing is copied or 
+                    // generated unless one of the image getters is actually called
+                    std::lock_guard<std::mutex> l(pHL2ResearchMode->m_imgMutex);
+                    pHL2ResearchMode->HoldDisplayFrame(pDepthSensorFrame, pDepthFrame, pAbImage, pDepth, outBufferCount);
+                    pHL2ResearchMode->m_IRTracker.CopyDisplayToolState(pHL2ResearchMode->m_displayToolSnapshot);
+
+                    pHL2ResearchMode->m_RawDepthImageUpdated.store(true, std::memory_order_relaxed);
+                    pHL2ResearchMode->m_RawABImageUpdated.store(true, std::memory_order_relaxed);
+                    pHL2ResearchMode->m_AB8BitImageUpdated.store(true, std::memory_order_relaxed);
+                    pHL2ResearchMode->m_Depth8BitImageUpdated.store(true, std::memory_order_relaxed);
                 }
 
                 // release space
@@ -491,6 +607,12 @@ namespace winrt::HL2DinoPlugin::implementation
             }
         }
         catch (...) {}
+
+        // the held display frame belongs to the stream, so let go of it first
+        {
+            std::lock_guard<std::mutex> l(pHL2ResearchMode->m_imgMutex);
+            pHL2ResearchMode->ReleaseDisplayFrame();
+        }
         pHL2ResearchMode->m_depthSensor->CloseStream();
         pHL2ResearchMode->m_depthSensor->Release();
         pHL2ResearchMode->m_depthSensor = nullptr;
@@ -57,6 +57,20 @@ namespace winrt::HL2DinoPlugin::implementation
          *  textures, so we can potentially run a little faster.
          */
         void ToggleDisplaySensorImages(bool showTextures);
+
+        //! Select the size of the 8-bit display images returned by the getters
+        /*! Smaller previews are produced straight from the raw sensor buffers, so they cut both the processing
+         *  and the bytes copied across to Unity. Raw 16-bit getters always return the full image.
+         *  @param previewMode  0: full 512x512, 1: 256x256, 2: 128x128, 3: 128x128 full resolution crop around 
+         *                      the visible tools (see IRTrackerUtils::ImageProc::DisplayPreview)
+         */
+        void SetDisplayPreviewMode(int32_t previewMode);
+
+        //! Width in pixels of the 8-bit display images for the current preview mode
+        int32_t GetDisplayImageWidth();
+
+        //! Height in pixels of the 8-bit display images for the current preview mode
+        int32_t GetDisplayImageHeight();
         ///@}
         //----------------------------------------------------------------------------------------------------------
 
@@ -109,6 +123,11 @@ namespace winrt::HL2DinoPlugin::implementation
         //! are visible to the HL2, and 16 doubles describing the 4x4 pose matrix (column-major)
         com_array<double> GetTrackedToolsPoseMatrices();
 
+        //! As \ref GetTrackedToolsPoseMatrices, but with each visible tool's pose extrapolated to \p hostTicks
+        //! (e.g. the predicted display time of the frame being rendered, in 100 ns QPC ticks) by its motion model.
+        //! Late-latches the latest tracking result without waiting on, or consuming, a new sensor frame.
+        com_array<double> GetPredictedToolsPoseMatrices(uint64_t hostTicks);
+
         //! 16-bit raw buffer of the depth values obtained from the AHAT sensor
         com_array<uint16_t> GetRawDepthImageBuffer();
 
@@ -143,6 +162,10 @@ namespace winrt::HL2DinoPlugin::implementation
              //! to the HL2
              std::vector <double> m_OutputToolPoseVector;
 
+             //! Each tool's motion model as of the frame in \ref m_OutputToolPoseVector, for \ref GetPredictedToolsPoseMatrices.
+             //! Updated in place by Holo2IRTracker::CopyPosePredictors
+             std::map<uint8_t, IRTrackerUtils::PosePredictor> m_OutputPosePredictors;
+
              //! Static implementation of the depth sensor loop function
              /*! @param pHL2ResearchMode Pass in the active instance of the @ref HL2ResearchMode class */
              static void DepthSensorLoop(HL2ResearchModeController* pHL2ResearchMode);
@@ -162,11 +185,24 @@ namespace winrt::HL2DinoPlugin::implementation
              //----------------------------------------------------------------------------------------------------------
 
              //----------------------------------------------------------------------------------------------------------
-             //! @name Raw 16-bit sensor image pointers 
-             //!       Obtained from ResearchModeAPI.h, can be copied for offline analysis later on Unity side
+             //! @name Latest display frame
+             //!       Instead of copying images every frame, the sensor loop keeps a reference to the latest frame
+             //!       (plus the tool keypoints found in it) and the getters produce images from it on demand
              ///@{
-             UINT16* m_RawDepthImgBuf = nullptr;
-             UINT16* m_RawABImgBuf = nullptr;
+             IResearchModeSensorFrame* m_pDisplaySensorFrame = nullptr;    //!< AddRef'd, keeps the buffers below alive
+             IResearchModeSensorDepthFrame* m_pDisplayDepthFrame = nullptr;  //!< AddRef'd, keeps the buffers below alive
+             const UINT16* m_RawDepthImgBuf = nullptr;  //!< Raw 16-bit depth buffer of the held frame
+             const UINT16* m_RawABImgBuf = nullptr;     //!< Raw 16-bit AB buffer of the held frame
+             size_t m_displayBufferCount = 0;           //!< Pixel count of the held frame's buffers
+             IRTrackerUtils::ToolDictionary m_displayToolSnapshot; //!< Keypoints and visibility for the held frame, updated in place
+             uint64_t m_displayFrameId = 0;             //!< Incremented each time a new frame is held
+
+             //! Swaps the held display frame for the given one (call with m_imgMutex locked)
+             void HoldDisplayFrame(IResearchModeSensorFrame* pSensorFrame, IResearchModeSensorDepthFrame* pDepthFrame,
+                 const UINT16* pAbImage, const UINT16* pDepth, size_t bufferCount);
+
+             //! Releases the held display frame, if any (call with m_imgMutex locked)
+             void ReleaseDisplayFrame();
              ///@}
              //----------------------------------------------------------------------------------------------------------
 
@@ -175,10 +211,14 @@ namespace winrt::HL2DinoPlugin::implementation
              //!       Processed sensor images for displaying in Unity. AB Image buffer has been brightened and
              //!       annotated with marker locations. Depth image has been processed to remove 'wrap-around' 
              //!       raw depth values above 4090 (set to 0). Used for pure display purposes, actual numeric
-             //!       values aren't strictly of significance.
+             //!       values aren't strictly of significance. Only generated when requested, at most once per 
+             //!       held frame.
              ///@{
              UINT8* m_8bitDepthImgBuf = nullptr;
              UINT8* m_8BitABImgBuf = nullptr;
+             uint64_t m_8bitDepthFrameId = 0;   //!< m_displayFrameId that m_8bitDepthImgBuf was generated from
+             uint64_t m_8BitABFrameId = 0;      //!< m_displayFrameId that m_8BitABImgBuf was generated from
+             IRTrackerUtils::ImageProc::DisplayPreview m_displayPreview = IRTrackerUtils::ImageProc::DisplayPreview::Full;
              ///@}
              //----------------------------------------------------------------------------------------------------------
 
@@ -0,0 +1,113 @@
+/** @file       CameraModel.h
+ *  @brief      Camera models used by the 3D stage to go between AHAT pixels and camera-frame rays
+ *
+ *  @author     Hisham Iqbal
+ *  @copyright  &copy; 2023 Hisham Iqbal
+ */
+
+#ifndef CAMERA_MODEL_H
+#define CAMERA_MODEL_H
+
+#include <Eigen/Dense>
+#include <opencv2/core.hpp>
+#include <cstdint>
+#include <functional>
+#include "IRTrackerUtils.h"
+
+namespace IRTrackerUtils
+{
+    //! Mimics the signature of the Research Mode API's MapCameraSpaceToImagePoint, unit plane (x,y,1) to pixel (u,v)
+    typedef std::function<bool(float(&)[2], float(&)[2])> ProjectFunction;
+
+    //-------------------------------------------------------------------------------------------------------------
+    //! @class  CameraModel
+    //! @brief  Interface for batched pixel to ray (unmap) and camera point to pixel (project) conversions
+    //!
+    //! Both calls work on whole arrays so implementations can vectorise, and so the caller pays for one virtual
+    //! call per frame rather than one per blob. Rays and points are in the camera frame (+z looking out of the
+    //! sensor), pixels use the image convention of the sensor frames (u right, v down, pixel centres at integers).
+    class CameraModel
+    {
+        public:
+            virtual ~CameraModel() = default;
+
+            //---------------------------------------------------------------------------------------------------------
+            //! Unit-length rays through \p count pixels.
+            //!
+            //! \param pixels       Input pixel locations
+            //! \param count        Number of entries in every array
+            //! \param outRays      Unit rays, zeroed where the pixel could not be unmapped
+            //! \param outValid     Set to 1 for each pixel that was unmapped, 0 otherwise
+            //! \return             Number of pixels unmapped
+            virtual size_t UnmapPoints(const cv::Point2f* pixels, size_t count,
+                Eigen::Vector3f* outRays, uint8_t* outValid) const = 0;
+
+            //! Pixel locations of \p count camera-frame points, the inverse of \ref UnmapPoints (up to scale).
+            //!
+            //! \param points       Input points, only the direction matters
+            //! \param count        Number of entries in every array
+            //! \param outPixels    Projected pixel locations, left at (-1, -1) where projection failed
+            //! \param outValid     Set to 1 for each point that projected into the image, 0 otherwise
+            //! \return             Number of points projected
+            virtual size_t ProjectPoints(const Eigen::Vector3f* points, size_t count,
+                cv::Point2f* outPixels, uint8_t* outValid) const = 0;
+            //---------------------------------------------------------------------------------------------------------
+    };
+    //-------------------------------------------------------------------------------------------------------------
+
+    //-------------------------------------------------------------------------------------------------------------
+    //! @class  ResearchModeCameraModel
+    //! @brief  Passthrough to the sensor's own MapImagePointToCameraUnitPlane/MapCameraSpaceToImagePoint calls
+    //!
+    //! One std::function (and COM) call per point. Either function may be empty, in which case that direction
+    //! reports every point as invalid.
+    class ResearchModeCameraModel : public CameraModel
+    {
+        public:
+            ResearchModeCameraModel(UnmapFunction unmapFunction, ProjectFunction projectFunction = nullptr);
+
+            size_t UnmapPoints(const cv::Point2f* pixels, size_t count,
+                Eigen::Vector3f* outRays, uint8_t* outValid) const override;
+            size_t ProjectPoints(const Eigen::Vector3f* points, size_t count,
+                cv::Point2f* outPixels, uint8_t* outValid) const override;
+
+        private:
+            UnmapFunction m_Unmap;
+            ProjectFunction m_Project;
+    };
+    //-------------------------------------------------------------------------------------------------------------
+
+    //-------------------------------------------------------------------------------------------------------------
+    //! @class  PinholeCameraModel
+    //! @brief  Pinhole intrinsics with Brown-Conrady radial (k1, k2, k3) and tangential (p1, p2) distortion
+    //!
+    //! Same conventions as OpenCV's camera model, so calibrations from cv::calibrateCamera can be used as-is.
+    //! Meant for replaying recordings and generating synthetic data off-device.
+    class PinholeCameraModel : public CameraModel
+    {
+        public:
+            struct Intrinsics
+            {
+                float Fx = 1.0f, Fy = 1.0f;             /*!< Focal lengths in pixels */
+                float Cx = 0.0f, Cy = 0.0f;             /*!< Principal point in pixels */
+                float K1 = 0.0f, K2 = 0.0f, K3 = 0.0f;  /*!< Radial distortion coefficients */
+                float P1 = 0.0f, P2 = 0.0f;             /*!< Tangential distortion coefficients */
+                int Width = 512, Height = 512;          /*!< Image size, pixels outside it are reported invalid */
+            };
+
+            explicit PinholeCameraModel(const Intrinsics& intrinsics);
+
+            size_t UnmapPoints(const cv::Point2f* pixels, size_t count,
+                Eigen::Vector3f* outRays, uint8_t* outValid) const override;
+            size_t ProjectPoints(const Eigen::Vector3f* points, size_t count,
+                cv::Point2f* outPixels, uint8_t* outValid) const override;
+
+            const Intrinsics& GetIntrinsics() const { return m_Intrinsics; }
+
+        private:
+            Intrinsics m_Intrinsics;
+    };
+    //-------------------------------------------------------------------------------------------------------------
+}
+
+#endif // CAMERA_MODEL_H
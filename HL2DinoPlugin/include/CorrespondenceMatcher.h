@@ -14,6 +14,7 @@
 #define CORRESPONDENCE_MATCHER_H
 
 #include <Eigen/Dense>
+#include <cstdint>
 #include <vector>
 
  /**
@@ -48,6 +49,181 @@ namespace CorrespondenceMatcher
         std::vector<Eigen::Vector3d>& inCollectedPoints,
         std::vector<std::vector<int>>& outCorrespondenceList);
     //-----------------------------------------------------------------------------------------------------------------------------------------------
+
+    //-----------------------------------------------------------------------------------------------------------------------------------------------
+    //! Which full match \ref FindPointCorrespondence settles on
+    enum class MatchMode
+    {
+        First,  /*!< Lowest indices first, the same match as \ref GetPointCorrespondence's first candidate */
+        Best    /*!< Smallest summed squared error over all pairwise distances, not only consecutive ones */
+    };
+
+    //! @struct PointDistanceMatrix
+    //! @brief Every pairwise distance of a point-set, worked out once and shared by every tool's search
+    //!
+    //! Stored as floats, row-major, with rows padded to a multiple of 8 so each row is filled by whole SIMD vectors.
+    struct PointDistanceMatrix
+    {
+        int                     Count = 0;          /*!< Number of points */
+        int                     Stride = 0;         /*!< Floats per row, Count rounded up to a multiple of 8 */
+        std::vector<float>      Distances;          /*!< Count x Stride, padding columns are left unset */
+        std::vector<float>      X, Y, Z;            /*!< Float copies of the points, Stride long */
+
+        //! Recompute from points stored as all x, then all y, then all z (e.g. IRTrackerUtils::BlobPoints3D)
+        void Compute(const double* x, const double* y, const double* z, int count);
+        void Compute(const std::vector<Eigen::Vector3d>& points);
+
+        float operator()(int i, int j) const { return Distances[static_cast<size_t>(i) * Stride + j]; }
+
+        private:
+            void Resize(int count);
+            void FillDistances();
+    };
+
+    //! Working buffers for \ref FindPointCorrespondence, kept between calls so matching doesn't allocate once warm
+    struct MatchScratch
+    {
+        std::vector<uint64_t>   UsedBlobs;          /*!< Bitset over the collected points */
+        std::vector<int>        Assignment;         /*!< Collected index per reference point on the current branch */
+        std::vector<double>     PartialCost;        /*!< MatchMode::Best error of the branch up to each depth */
+        std::vector<float>      RefDistances;       /*!< Reference point distance matrix, row-major */
+        PointDistanceMatrix     CollectedDistances; /*!< Only used by the point-list overload */
+    };
+
+    //! Depth-first backtracking version of \ref GetPointCorrespondence.
+    //!
+    //! Collected points are placed against reference points one at a time, and a branch is dropped as soon as the 
+    //! distance between consecutive reference points isn't matched, so only consistent partial matches are ever held. 
+    //! Nothing is erased from the inputs: collected points within a millimetre of an earlier one are skipped instead,
+    //! so the returned indices refer to \p inCollectedPoints as passed in.
+    //!
+    //! \param inReferencePoints        Original/known point-set in a fixed frame, at least three points
+    //! \param inCollectedPoints        Floating points we're trying to match to our known points
+    //! \param outIndices               On success, the index into \p inCollectedPoints for each reference point
+    //! \param scratch                  Reusable working buffers
+    //! \param mode                     Stop at the first full match, or search them all for the best fit
+    //!
+    //! \return                         True if a correspondence could be found
+    bool FindPointCorrespondence(
+        const std::vector<Eigen::Vector3d>& inReferencePoints,
+        const std::vector<Eigen::Vector3d>& inCollectedPoints,
+        std::vector<int>& outIndices,
+        MatchScratch& scratch,
+        MatchMode mode = MatchMode::First);
+
+    //! @struct ToolShortlist
+    //! @brief One frame's result of \ref ToolSignatureIndex::Query
+    struct ToolShortlist
+    {
+        int                     Words = 0;          /*!< 64-bit words per blob mask */
+        size_t                  Count = 0;          /*!< Number of tools shortlisted */
+        std::vector<int>        MarkerRow;          /*!< Per tool slot, -1 if ruled out, else its first row of MarkerBlobs */
+        std::vector<uint64_t>   MarkerBlobs;        /*!< Per marker of each shortlisted tool, the blobs that could be it */
+        std::vector<uint64_t>   PairBlobs;          /*!< Working rows, blobs found at each indexed marker distance */
+
+        bool IsCandidate(size_t slot) const { return slot < MarkerRow.size() && MarkerRow[slot] >= 0; }
+
+        //! Rows for \ref FindPointCorrespondence's \p inAllowedBlobs, null if \p slot was ruled out
+        const uint64_t* AllowedBlobs(size_t slot) const 
+        { 
+            return IsCandidate(slot) ? MarkerBlobs.data() + static_cast<size_t>(MarkerRow[slot]) * Words : nullptr; 
+        }
+    };
+
+    //! @class ToolSignatureIndex
+    //! @brief Load-time index of the consecutive marker distances of every tool in a catalogue
+    //!
+    //! Entries are kept sorted by distance under a table of fixed-width buckets, so each blob pair in a frame is looked
+    //! up in a couple of buckets however many tools are loaded. \ref Query shortlists the tools whose consecutive
+    //! marker distances all turn up among the blobs, and narrows each of their markers down to the blobs that could 
+    //! take its place. \ref FindPointCorrespondence only ever checks consecutive distances, so both are necessary 
+    //! conditions of a match and a seeded search finds exactly what a full one would.
+    class ToolSignatureIndex
+    {
+        public:
+            void Clear();
+
+            //! Adds a tool's geometry, returning its slot. Slots count up from 0 in the order tools are added.
+            size_t AddTool(const std::vector<Eigen::Vector3d>& geometry);
+
+            //! Sorts the entries and builds the bucket table, call once every tool has been added.
+            void Finalise();
+
+            size_t ToolCount() const { return m_Tools.size(); }
+
+            //! Shortlists the tools that could be among this frame's blobs.
+            //!
+            //! \param inBlobDistances     This frame's blob distance matrix
+            //! \param inExcluded          Empty, or one entry per blob with 1 for blobs to leave out
+            //! \param outShortlist        Tools still in the running and the candidate blobs for each of their markers
+            void Query(const PointDistanceMatrix& inBlobDistances, const std::vector<uint8_t>& inExcluded, ToolShortlist& outShortlist) const;
+
+        private:
+            struct Entry
+            {
+                float       Distance;               /*!< Same value FindPointCorrespondence compares against */
+                uint32_t    Pair;                   /*!< Row in ToolShortlist::PairBlobs */
+            };
+
+            struct ToolInfo
+            {
+                uint32_t    FirstPair = 0;          /*!< Pair k joins markers k and k+1 */
+                uint32_t    MarkerCount = 0;
+            };
+
+            std::vector<Entry>      m_Entries;      /*!< Sorted by distance */
+            std::vector<uint32_t>   m_BucketStart;  /*!< First entry of each bucket, plus an end sentinel */
+            std::vector<ToolInfo>   m_Tools;
+            uint32_t                m_PairCount = 0;
+    };
+
+    //! \ref FindPointCorrespondence against a precomputed distance matrix, so several tools can be matched against one
+    //! frame's blobs without redoing any distances.
+    //!
+    //! \param inReferencePoints        Original/known point-set in a fixed frame, at least three points
+    //! \param inCollectedDistances     Distance matrix of the collected points
+    //! \param inExcluded               Empty, or one entry per collected point with 1 for points not to match
+    //!                                 (e.g. already claimed by another tool)
+    //! \param outIndices               On success, the index of the collected point for each reference point
+    //! \param scratch                  Reusable working buffers
+    //! \param mode                     Stop at the first full match, or search them all for the best fit
+    //! \param inAllowedBlobs           Optional, one blob bitset per reference point (see \ref ToolShortlist) limiting
+    //!                                 which collected points each may be matched to
+    //!
+    //! \return                         True if a correspondence could be found
+    bool FindPointCorrespondence(
+        const std::vector<Eigen::Vector3d>& inReferencePoints,
+        const PointDistanceMatrix& inCollectedDistances,
+        const std::vector<uint8_t>& inExcluded,
+        std::vector<int>& outIndices,
+        MatchScratch& scratch,
+        MatchMode mode = MatchMode::First,
+        const uint64_t* inAllowedBlobs = nullptr);
+
+    //! Tracking counterpart of \ref FindPointCorrespondence, for a tool whose pose this frame can be predicted.
+    //!
+    //! Each predicted marker takes the nearest collected point within \p gateRadius, and the result is only accepted
+    //! if no point was taken twice and every pairwise distance (not only consecutive ones) matches the reference. 
+    //! Costs one pass over the collected points per marker, rather than a combinatorial search.
+    //!
+    //! \param inReferencePoints        Original/known point-set in a fixed frame
+    //! \param inPredictedPoints        \p inReferencePoints moved to where they're expected, in the collected points' frame
+    //! \param inCollectedDistances     Distance matrix of the collected points, its point copies are searched
+    //! \param inExcluded               Empty, or one entry per collected point with 1 for points not to match
+    //! \param gateRadius               Furthest a collected point may be from its prediction, in metres
+    //! \param outIndices               On success, the index of the collected point for each reference point
+    //! \param scratch                  Reusable working buffers
+    //!
+    //! \return                         True if every marker was found and the distances agree
+    bool TrackPointCorrespondence(
+        const std::vector<Eigen::Vector3d>& inReferencePoints,
+        const std::vector<Eigen::Vector3d>& inPredictedPoints,
+        const PointDistanceMatrix& inCollectedDistances,
+        const std::vector<uint8_t>& inExcluded,
+        double gateRadius,
+        std::vector<int>& outIndices,
+        MatchScratch& scratch);
+    //-----------------------------------------------------------------------------------------------------------------------------------------------
 };
 
 #endif // CORRESPONDENCE_MATCHER_H
\ No newline at end of file
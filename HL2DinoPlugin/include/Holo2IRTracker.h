@@ -13,7 +13,12 @@
 #include <map>
 #include <opencv2/core.hpp>   
 #include <functional>
+#include <memory>
+#include "CorrespondenceMatcher.h"
 #include "IRTrackerUtils.h"
+#include "PosePredictor.h"
+#include "RayLookupTable.h"
+#include "ReflectionBackgroundModel.h"
 
 class Holo2IRTracker
 {
@@ -53,12 +58,22 @@ class Holo2IRTracker
 		//!								without modification.
 		//! \param depth2world			Transform matrix from depth coordinates to holographic world frame.
 		//! \param UpdateDisplayImgs	If true, we will do some extra steps to visualize the processed sensor data.
-		//!								If false, run leaner and avoid making image copies.
+		//!								If false, run leaner and avoid making image copies. Only for callers that 
+		//!								read images back with \ref RetrieveDisplayImages, see there.
 		void ProcessLatestFrames(
 			const uint16_t*						ABImg,
 			const uint16_t*						DepthImg,
 			const Eigen::Ref<Eigen::Matrix4d>	depth2world,
 			const bool&							UpdateDisplayImgs);
+
+		//! Key function of this class, taking everything about the frame in one \ref IRTrackerUtils::SensorFrame. 
+		//! The other overloads forward to this one. A frame from a recording works the same as a live one.
+		//!
+		//! \param frame				Sensor buffers, pose and timestamp of the latest frame. If it carries a sigma 
+		//!								buffer, depth flagged invalid there is never used to place blobs in 3D.
+		//! \param UpdateDisplayImgs	If true, we will do some extra steps to visualize the processed sensor data
+		//!								for \ref RetrieveDisplayImages. Leave it false with the Render* getters.
+		void ProcessLatestFrames(const IRTrackerUtils::SensorFrame& frame, const bool& UpdateDisplayImgs = false);
 		//-------------------------------------------------------------------------------------------------------------
 
 		//-------------------------------------------------------------------------------------------------------------
@@ -67,8 +82,192 @@ class Holo2IRTracker
 		//! \param unmapFunction Properly initialized std::function pointer mimicking the function signature of 
 		//! MapImageToUnitPlane.
 		void SetUnmapFunction(IRTrackerUtils::UnmapFunction& unmapFunction);
+
+		//! Sets the camera model used to lift blobs to 3D (and project into the image), e.g. a 
+		//! \ref IRTrackerUtils::ResearchModeCameraModel, \ref IRTrackerUtils::RayLookupTable or 
+		//! \ref IRTrackerUtils::PinholeCameraModel for replayed/synthetic data. Replaces any earlier model or unmap function.
+		void SetUnmapFunction(std::shared_ptr<const IRTrackerUtils::CameraModel> cameraModel);
+		//-------------------------------------------------------------------------------------------------------------
+
+		//-------------------------------------------------------------------------------------------------------------
+		//! Convenience for \ref SetUnmapFunction with a copy of \p rayTable, ignored if the table is not valid.
+		//!
+		//! \param rayTable Table built (or loaded) for this sensor.
+		void SetRayLookupTable(const IRTrackerUtils::RayLookupTable& rayTable);
+
+		//! Timestamp of the last frame given to \ref ProcessLatestFrames, 0 if it didn't carry one.
+		uint64_t GetLatestFrameTimestamp() const { return m_LatestFrameTimestamp; }
+
+		//! Threshold, blob and tool counts of the last frame given to \ref ProcessLatestFrames. Read it on the 
+		//! processing thread (or copy it out there), it's overwritten every frame.
+		const IRTrackerUtils::FrameStatistics& GetLatestFrameStatistics() const { return m_LatestFrameStatistics; }
+
+		//! The camera model currently in use, may be null if none has been set yet.
+		std::shared_ptr<const IRTrackerUtils::CameraModel> GetCameraModel() const { return m_CameraModel; }
 		//-------------------------------------------------------------------------------------------------------------
 		
+		//-------------------------------------------------------------------------------------------------------------
+		//! Select the 2D blob detection method used in \ref ProcessLatestFrames (defaults to 
+		//! BlobDetectionMethod::Basic, or RefineByScaling if USE_REFINED_BLOB_DETECT is set).
+		//!
+		//! \param method Any of the implemented IRTrackerUtils::ImageProc::BlobDetectionMethod values.
+		void SetBlobDetectionMethod(IRTrackerUtils::ImageProc::BlobDetectionMethod method);
+		//-------------------------------------------------------------------------------------------------------------
+
+		//-------------------------------------------------------------------------------------------------------------
+		//! Toggle predictive ROI-restricted blob search.
+		//!
+		//! When enabled, and tools were visible in the last frame, only small windows around their last seen marker
+		//! positions are binarised and searched. A full frame scan is still done every \p fullScanInterval frames, 
+		//! and on the frame after any tracked tool is lost, so new tools can still be acquired.
+		//!
+		//! \param enable				Turn the ROI search mode on/off (off by default).
+		//! \param fullScanInterval		Maximum number of consecutive ROI-only frames before forcing a full scan.
+		//! \param windowHalfSize		Half the side length (pixels) of the square search window around each marker.
+		void SetPredictiveROISearch(bool enable, int fullScanInterval = 30, int windowHalfSize = 24);
+		//-------------------------------------------------------------------------------------------------------------
+
+		//-------------------------------------------------------------------------------------------------------------
+		//! Toggle zero-copy ingestion of the sensor buffers passed to \ref ProcessLatestFrames.
+		//!
+		//! When enabled (default, see USE_ZERO_COPY_INGESTION) the AB and depth buffers are wrapped in non-owning 
+		//! cv::Mat headers instead of being copied. No processing stage writes into them, and the headers are 
+		//! dropped before \ref ProcessLatestFrames returns, so the buffers only need to stay valid for that call.
+		//!
+		//! \param enable				Wrap (true) or copy (false) the incoming sensor buffers.
+		void SetZeroCopyIngestion(bool enable);
+		//-------------------------------------------------------------------------------------------------------------
+
+		//-------------------------------------------------------------------------------------------------------------
+		//! Set the depth range mapped onto the 8-bit depth display image (defaults to 0 - 1000 mm).
+		//!
+		//! \param nearMM				Depth shown as black, anything closer is also black.
+		//! \param farMM				Depth shown at full brightness, anything further is also saturated.
+		void SetDepthDisplayWindow(uint16_t nearMM, uint16_t farMM);
+		//-------------------------------------------------------------------------------------------------------------
+
+		//-------------------------------------------------------------------------------------------------------------
+		//! Split full-frame front-end and blob detection into horizontal strips processed on worker threads.
+		//!
+		//! Results are identical to the single-threaded path. Only applies to full-frame scans with the fused front-end 
+		//! and the labelling based detection methods (ConnectedComponents, IntensityWeighted, BlobPeak); ROI-only frames are 
+		//! small enough to stay serial. The strips run on OpenCV's shared worker pool, whose size is left alone.
+		//!
+		//! \param numThreads			Number of strips/threads, 1 (default) turns the multi-threaded path off.
+		void SetParallelDetection(int numThreads);
+		//-------------------------------------------------------------------------------------------------------------
+
+		//-------------------------------------------------------------------------------------------------------------
+		//! Toggle coarse-to-fine detection for frames that would otherwise scan the whole image.
+		//!
+		//! A max-pooled copy of the raw AB image is used to find candidate bright regions, and the full resolution 
+		//! front-end and blob detection then only run inside those (see IRTrackerUtils::ImageProc::FindCandidateROIs). 
+		//! Detected blobs are the same as with a full frame scan. Takes priority over \ref SetParallelDetection.
+		//!
+		//! \param enable				Turn coarse-to-fine detection on/off (off by default).
+		//! \param poolFactor			Downsampling factor of the coarse pass, e.g. 2 or 4.
+		void SetCoarseToFineSearch(bool enable, int poolFactor = 4);
+		//-------------------------------------------------------------------------------------------------------------
+
+		//-------------------------------------------------------------------------------------------------------------
+		//! Restrict marker detection to a working volume, e.g. 0.15 - 1.0 m for surgical tools.
+		//!
+		//! Bright pixels whose raw depth lies outside the range are dropped in the same pass that thresholds the 
+		//! AB image (see IRTrackerUtils::ImageProc::RebalanceAndBinarise), so out of range reflections never become 
+		//! blobs. Applies to the fused front-end and the coarse candidate search. Pass far <= near to turn it off (default).
+		//!
+		//! \param nearMetres			Closest depth a marker may be at.
+		//! \param farMetres			Furthest depth a marker may be at, clamped to the sensor's 4.09 m valid range.
+		void SetWorkingVolume(float nearMetres, float farMetres);
+		//-------------------------------------------------------------------------------------------------------------
+
+		//-------------------------------------------------------------------------------------------------------------
+		//! Reject blobs whose pixel area doesn't match a marker of the given size at their measured depth.
+		//!
+		//! The fixed area bounds of the 2D detectors hold at any depth, so a small glint off an instrument close to
+		//! the sensor passes them. This compares each blob with the area a sphere of \p markerDiameterMetres would 
+		//! cover at its depth (see IRTrackerUtils::ImageProc::MarkerSizeFilter), before any correspondence search.
+		//!
+		//! \param markerDiameterMetres	Marker sphere diameter, e.g. 0.012 for 12 mm spheres. 0 turns the filter off (default).
+		//! \param minAreaRatio			Smallest accepted measured/predicted area ratio.
+		//! \param maxAreaRatio			Largest accepted measured/predicted area ratio.
+		void SetMarkerSizeFilter(float markerDiameterMetres, float minAreaRatio = 0.25f, float maxAreaRatio = 3.5f);
+		//-------------------------------------------------------------------------------------------------------------
+
+		//-------------------------------------------------------------------------------------------------------------
+		//! Detect blobs straight from the raw 16-bit AB image rather than the shifted and saturated 8-bit one.
+		//!
+		//! Marker pixels are picked with a threshold in native sensor units (see IRTrackerUtils::ImageProc::BinariseRaw),
+		//! and the 8-bit AB image is then only made on frames that update the display textures. Near markers that would 
+		//! saturate at 255 keep their shading, which the IntensityWeighted and BlobPeak methods use for their centres.
+		//!
+		//! \param enable				Off by default.
+		//! \param rawThreshold			Raw AB cut-off, the default picks the same pixels as the 8-bit pipeline.
+		void SetDirect16BitDetection(bool enable, uint16_t rawThreshold = IRTrackerUtils::ImageProc::RAW_AB_THRESHOLD_DEFAULT);
+		//-------------------------------------------------------------------------------------------------------------
+
+		//-------------------------------------------------------------------------------------------------------------
+		//! Let the raw AB threshold follow the scene's ambient IR, see IRTrackerUtils::ImageProc::UpdateAdaptiveThreshold.
+		//!
+		//! Uses the direct 16-bit front-end (see \ref SetDirect16BitDetection) with a threshold picked from a running 
+		//! histogram, which is gathered during full frame and coarse searches and left alone on frames that only search 
+		//! around tracked tools. The threshold in use is reported in \ref GetLatestFrameStatistics.
+		//!
+		//! \param enable				Off by default. Enabling restarts from the default threshold.
+		//! \param settings				Target bright-pixel budget, limits and hysteresis.
+		void SetAdaptiveThreshold(bool enable, const IRTrackerUtils::ImageProc::AdaptiveThresholdSettings& settings = {});
+		//-------------------------------------------------------------------------------------------------------------
+
+		//-------------------------------------------------------------------------------------------------------------
+		//! Drop blobs on learned world-fixed reflections before correspondence matching, see 
+		//! IRTrackerUtils::ReflectionBackgroundModel. Blobs that keep turning up in the same world location without
+		//! being matched to a tool are learned as background, and blobs matched to tools clear it again.
+		//!
+		//! \param enable				Off by default. Disabling keeps what was learned, see \ref ResetBackgroundModel.
+		void SetBackgroundSuppression(bool enable);
+
+		//! Forgets all learned background and zeroes its counters.
+		void ResetBackgroundModel() { m_BackgroundModel.Reset(); }
+
+		//! Stops (or resumes) learning, the learned background keeps being suppressed while frozen.
+		void FreezeBackgroundModel(bool freeze) { m_BackgroundModel.SetFrozen(freeze); }
+
+		//! Read-only access to the background model, for its counters and settings.
+		const IRTrackerUtils::ReflectionBackgroundModel& GetBackgroundModel() const { return m_BackgroundModel; }
+		//-------------------------------------------------------------------------------------------------------------
+
+		//-------------------------------------------------------------------------------------------------------------
+		//! A visible tool's pose extrapolated to \p timestamp by its IRTrackerUtils::PosePredictor, e.g. to the time 
+		//! a rendered frame will be displayed. Falls back to the last measured pose when there is no motion model yet
+		//! (frames without timestamps never feed one).
+		//!
+		//! \param toolID				ID of the tool in the dictionary
+		//! \param timestamp			Time to predict at, in the sensor's 100 ns host ticks
+		//! \param outPose				Predicted tool to world transform
+		//! \return						False (leaving \p outPose alone) if the tool is unknown or wasn't seen last frame
+		bool GetPredictedToolPose(uint8_t toolID, uint64_t timestamp, Eigen::Matrix4d& outPose) const;
+
+		//! Motion models of every tool in the dictionary, by tool ID, as of the last \ref ProcessLatestFrames call.
+		const std::map<uint8_t, IRTrackerUtils::PosePredictor>& GetPosePredictors() const { return m_PosePredictors; }
+
+		//! Copies \ref GetPosePredictors into \p outPredictors, assigning over the existing entries so that once it 
+		//! holds every tool, calling this each frame with the same map allocates nothing.
+		void CopyPosePredictors(std::map<uint8_t, IRTrackerUtils::PosePredictor>& outPredictors) const;
+
+		//! Replaces every tool's filter noise and timing settings, and restarts the filters.
+		void SetPosePredictorSettings(const IRTrackerUtils::PosePredictor::Settings& settings);
+		//-------------------------------------------------------------------------------------------------------------
+
+		//-------------------------------------------------------------------------------------------------------------
+		//! Read-only access to the internal tool dictionary, as updated by the last \ref ProcessLatestFrames call.
+		const IRTrackerUtils::ToolDictionary& GetToolDictionary() const;
+
+		//! Copies just what \ref RenderABDisplayImage and \ref RenderDepthDisplayImage read from each tool (ID, 
+		//! visibility and image keypoints) into \p outSnapshot. Entries are updated in place, so once it holds every
+		//! tool, calling this each frame with the same snapshot allocates nothing.
+		void CopyDisplayToolState(IRTrackerUtils::ToolDictionary& outSnapshot) const;
+		//-------------------------------------------------------------------------------------------------------------
+
 		//-------------------------------------------------------------------------------------------------------------
 		//! Returns the current count of the internal tool dictionary structure.
 		//! \return
@@ -92,16 +291,45 @@ class Holo2IRTracker
 
 		//! Populate the passed in cv::Mats with the latest annotated/processed depth and AB images
 		//! 
+		//! Only filled by \ref ProcessLatestFrames calls with UpdateDisplayImgs set, which add the display work to 
+		//! every frame. Kept for callers that want the images made on the processing thread, otherwise hold on to
+		//! the raw frame and use \ref RenderABDisplayImage / \ref RenderDepthDisplayImage when they're needed.
+		//! 
 		//! @param abImage8bit		An 8-bit cv::Mat (512x512) 
 		//! @param depthImage8bit	An 8-bit cv::Mat (512x512) 
 		void RetrieveDisplayImages(cv::Mat& abImage8bit, cv::Mat& depthImage8bit);
 		
-		//! Populate the passed in cv::Mats with the latest annotated/processed depth and AB images
+		//! Populate the passed in buffers with the latest annotated/processed depth and AB images, see above
 		//!  
 		//! @param abImage8bit		Raw pointer to 8-bit buffer to store AB image into 
 		//! @param depthImage8bit	Raw pointer to 8-bit buffer to store depth image into 
 		//! @param img_BufLen		Length of \p abImage8bit and \p depthImage8bit buffers 
 		void RetrieveDisplayImages(uint8_t* abImage8bit, uint8_t* depthImage8bit, size_t img_BufLen);
+
+		//! Produce the 8-bit AB display image for a raw AB frame, on demand rather than in \ref ProcessLatestFrames.
+		//! 
+		//! Only reads the given buffers and tool data, so it can run on another thread while frames are processed.
+		//! Reduced size previews are generated straight from \p ABImg, reading only the pixels they show.
+		//! 
+		//! @param ABImg			Raw AB buffer (512x512) as passed to \ref ProcessLatestFrames
+		//! @param annotateTools	Tools whose marker keypoints are drawn on the image (and which DisplayPreview::ToolCrop
+		//!							centres on), e.g. from \ref CopyDisplayToolState for the same frame
+		//! @param abImage8bit		Output buffer, sized as given by \ref GetDisplayImageSize for \p preview
+		//! @param preview			Output format
+		void RenderABDisplayImage(const uint16_t* ABImg, const IRTrackerUtils::ToolDictionary& annotateTools, uint8_t* abImage8bit,
+			IRTrackerUtils::ImageProc::DisplayPreview preview = IRTrackerUtils::ImageProc::DisplayPreview::Full) const;
+
+		//! Produce the 8-bit depth display image for a raw depth frame, see \ref RenderABDisplayImage.
+		//! 
+		//! @param DepthImg			Raw depth buffer (512x512) as passed to \ref ProcessLatestFrames
+		//! @param cropTools		Tools DisplayPreview::ToolCrop centres on, pass the same as for the AB image
+		//! @param depthImage8bit	Output buffer, sized as given by \ref GetDisplayImageSize for \p preview
+		//! @param preview			Output format
+		void RenderDepthDisplayImage(const uint16_t* DepthImg, const IRTrackerUtils::ToolDictionary& cropTools, uint8_t* depthImage8bit,
+			IRTrackerUtils::ImageProc::DisplayPreview preview = IRTrackerUtils::ImageProc::DisplayPreview::Full) const;
+
+		//! Size of the images made by \ref RenderABDisplayImage / \ref RenderDepthDisplayImage for \p preview
+		static cv::Size GetDisplayImageSize(IRTrackerUtils::ImageProc::DisplayPreview preview);
 		//!@}
 		//-------------------------------------------------------------------------------------------------------------
 	
@@ -113,17 +341,139 @@ class Holo2IRTracker
 		//! @name Cache cv::Mat
 		//!@{
 		cv::Mat m_ABImg16bit, m_ABImg8bit, m_DepthImg16bit, m_DepthDisplayImg8bit, m_ABDisplayImg8bit;
+
+		//! Binary (0/255) mask of bright AB pixels written by the fused front-end pass
+		cv::Mat m_ABBinaryMask8bit;
+
+		//! Raw depth to display brightness mapping, see \ref SetDepthDisplayWindow
+		IRTrackerUtils::ImageProc::DisplayLUT m_DepthDisplayLUT;
+
+		//! Raw AB to display brightness mapping, for images rendered outside the fused front-end
+		IRTrackerUtils::ImageProc::DisplayLUT m_ABDisplayLUT;
+
+		//! Owned frame buffers for copying ingestion. In zero-copy mode m_ABImg16bit/m_DepthImg16bit are instead 
+		//! non-owning headers over the caller's buffers, and are pointed back at these once the frame is processed
+		cv::Mat m_ABImg16bitOwned, m_DepthImg16bitOwned;
+
+		//! This frame's sigma buffer (empty if it had none), borrowed or copied into m_SigmaImg8bitOwned as above
+		cv::Mat m_SigmaImg8bit, m_SigmaImg8bitOwned;
 		//!@}
+
+		//! Timestamp of the latest frame, see \ref GetLatestFrameTimestamp
+		uint64_t m_LatestFrameTimestamp = 0;
+
+		//! If true, sensor buffers are wrapped rather than copied for the duration of \ref ProcessLatestFrames
+		bool m_ZeroCopyIngestion;
+
+		//! Points m_ABImg16bit/m_DepthImg16bit/m_SigmaImg8bit at this frame's sensor data, wrapping or copying the buffers.
+		void IngestFrames(const IRTrackerUtils::SensorFrame& frame);
+
+		//! Drops any references to the caller's buffers taken by \ref IngestFrames.
+		void ReleaseFrames();
 				
 		//! @name Cache Vectors
 		//!@{
 		//! Used to cache data related to detected blobs in each frame
 		std::vector<cv::Point2f> m_cache_frameBlobPixelLocations;
-		std::vector<IRTrackerUtils::InfraBlobInfo> m_cache_frameBlobInfo;
+		std::vector<float> m_cache_frameBlobAreas;
+		IRTrackerUtils::BlobPoints3D m_cache_frameBlobs3D;
+		CorrespondenceMatcher::MatchScratch m_cache_matchScratch;
+		CorrespondenceMatcher::PointDistanceMatrix m_cache_blobDistances;
+		std::vector<uint8_t> m_cache_blobExcluded;
+		CorrespondenceMatcher::ToolShortlist m_cache_toolShortlist;
+
+		//! Distance signatures of m_ToolDictionary's tools, in map order, built once the dictionary is loaded
+		CorrespondenceMatcher::ToolSignatureIndex m_ToolIndex;
+
+		//! Motion model for each tool in m_ToolDictionary, updated with every pose it's found at
+		std::map<uint8_t, IRTrackerUtils::PosePredictor> m_PosePredictors;
+		//!@}
+
+		//! @name Predictive ROI search state
+		//!@{
+		bool m_UseROISearch = false;
+		bool m_ForceFullFrameScan = true;
+		int m_ROIFullScanInterval = 30;
+		int m_ROIWindowHalfSize = 24;
+		int m_FramesSinceFullScan = 0;
+		//! Search windows for the current frame, empty means search the whole frame
+		std::vector<cv::Rect> m_cache_searchROIs;
+		//! IDs of the tools visible before the current frame was processed
+		std::vector<uint8_t> m_cache_visibleToolsBefore;
+		std::vector<cv::Point2f> m_cache_predictedKeypoints;
+		std::vector<Eigen::Vector3f> m_cache_predictedCameraPoints;
+		std::vector<uint8_t> m_cache_predictedValid;
+		//!@}
+
+		//! Decides if this frame searches the full image or only ROIs (filling m_cache_searchROIs), and notes which
+		//! tools were visible before this frame in m_cache_visibleToolsBefore.
+		//! \param frame  This frame, whose timestamp and head pose place the windows when poses are predicted
+		void PrepareSearchROIs(const IRTrackerUtils::SensorFrame& frame);
+
+		//! Image locations of every visible tool's markers, projected from the pose predicted at \p frame's timestamp.
+		//! Markers without a prediction or a valid projection keep last frame's keypoint.
+		void PredictToolKeypoints(const IRTrackerUtils::SensorFrame& frame, std::vector<cv::Point2f>& outKeypoints);
+
+		//! Runs the AB front-end and 2D blob detection on the latest frame, over the full image or the search ROIs.
+		void DetectBlobsInLatestFrame(bool UpdateDisplayImages);
+
+		//! Raw AB cut-off for this frame: adaptive, user-set for the direct 16-bit path, or the 8-bit pipeline's equivalent.
+		uint16_t ActiveRawABThreshold() const;
+
+		//! Forces a full frame scan next frame if any tool in m_cache_visibleToolsBefore is no longer visible.
+		void CheckForLostTools();
+
+		//! Blob detection method used on each frame
+		IRTrackerUtils::ImageProc::BlobDetectionMethod m_BlobDetectionMethod;
+
+		//! Number of strips for multi-threaded full-frame detection, 1 means serial
+		int m_DetectionThreads = 1;
+
+		//! @name Coarse-to-fine search state
+		//!@{
+		bool m_UseCoarseToFine = false;
+		int m_CoarsePoolFactor = 4;
+		//!@}
+
+		//! Depth range marker pixels must fall in, disabled by default
+		IRTrackerUtils::ImageProc::DepthGate m_WorkingVolume;
+
+		//! Expected marker size for the 3D stage, disabled by default
+		IRTrackerUtils::ImageProc::MarkerSizeFilter m_MarkerSize;
+
+		//! @name Direct 16-bit Detection
+		//!@{
+		//! See \ref SetDirect16BitDetection
+		bool m_UseDirect16BitDetection = false;
+		uint16_t m_RawABThreshold = IRTrackerUtils::ImageProc::RAW_AB_THRESHOLD_DEFAULT;
 		//!@}
 
-		//! An std::function pointer which should mimic function signature of ResearchModeAPI's MapImageToUnitPlane
-		IRTrackerUtils::UnmapFunction m_MapImageToUnitPlane = nullptr;
+		//! @name Adaptive Threshold
+		//!@{
+		//! See \ref SetAdaptiveThreshold
+		bool m_UseAdaptiveThreshold = false;
+		IRTrackerUtils::ImageProc::AdaptiveThresholdSettings m_AdaptiveThresholdSettings;
+		IRTrackerUtils::ImageProc::AdaptiveThresholdState m_AdaptiveThresholdState;
+		IRTrackerUtils::ImageProc::ABHistogram m_cache_frameHistogram;
+		//!@}
+
+		//! @name Background Suppression
+		//!@{
+		//! See \ref SetBackgroundSuppression
+		bool m_UseBackgroundModel = false;
+		IRTrackerUtils::ReflectionBackgroundModel m_BackgroundModel;
+		std::vector<uint8_t> m_cache_backgroundSuppressed;
+		std::vector<uint8_t> m_cache_assignedToTool;
+		//!@}
+
+		//! See \ref GetLatestFrameStatistics
+		IRTrackerUtils::FrameStatistics m_LatestFrameStatistics;
+
+		//! Pixel to ray (and back) mapping of the AHAT camera, null until \ref SetUnmapFunction is called
+		std::shared_ptr<const IRTrackerUtils::CameraModel> m_CameraModel;
+
+		//! Lifts this frame's 2D blobs to 3D through m_CameraModel.
+		void ValidateLatestBlobs(const Eigen::Ref<Eigen::Matrix4d> depth2world);
 };	
 
 #endif // !HOLO2_IR_TRACKER_H
\ No newline at end of file
@@ -13,6 +13,10 @@
 #include "opencv2/core.hpp"
 #include <vector>
 #include <map>
+#include <climits>
+#include <functional>
+#include <algorithm>
+#include <iterator>
 
 /**
  * @namespace   IRTrackerUtils
@@ -33,6 +37,76 @@ namespace IRTrackerUtils
     };
     //-------------------------------------------------------------------------------------------------------------
 
+    //-------------------------------------------------------------------------------------------------------------
+    //! @struct BlobPoints3D
+    //! @brief Structure-of-arrays version of a list of \ref InfraBlobInfo
+    //! 
+    //! Coordinates are stored as all x, then all y, then all z, so a whole frame's points can be transformed with 
+    //! one matrix product through \ref DepthLocations / \ref WorldLocations. The buffers keep their capacity
+    //! between frames.
+    struct BlobPoints3D
+    {
+        typedef Eigen::Matrix<double, Eigen::Dynamic, 3>    PointMatrix;    /*!< N x 3, column-major */
+        typedef Eigen::Map<PointMatrix>                     PointMap;
+        typedef Eigen::Map<const PointMatrix>               ConstPointMap;
+
+        std::vector<cv::Point2f>    PixelCoordinates;   /*!< 2D location of each blob, stored for label purposes */
+        std::vector<double>         DepthXYZ;           /*!< Storage for \ref DepthLocations */
+        std::vector<double>         WorldXYZ;           /*!< Storage for \ref WorldLocations */
+
+        size_t Size() const { return PixelCoordinates.size(); }
+        void Resize(size_t count) { PixelCoordinates.resize(count); DepthXYZ.resize(count * 3); WorldXYZ.resize(count * 3); }
+        void Clear() { Resize(0); }
+
+        //! 3D locations in the sensor coordinate frame, one row per blob
+        PointMap DepthLocations() { return PointMap(DepthXYZ.data(), Size(), 3); }
+        ConstPointMap DepthLocations() const { return ConstPointMap(DepthXYZ.data(), Size(), 3); }
+
+        //! 3D locations in the world coordinate frame, one row per blob
+        PointMap WorldLocations() { return PointMap(WorldXYZ.data(), Size(), 3); }
+        ConstPointMap WorldLocations() const { return ConstPointMap(WorldXYZ.data(), Size(), 3); }
+
+        Eigen::Vector3d DepthLocation(size_t i) const { return DepthLocations().row(i).transpose(); }
+        Eigen::Vector3d WorldLocation(size_t i) const { return WorldLocations().row(i).transpose(); }
+    };
+    //-------------------------------------------------------------------------------------------------------------
+
+    //-------------------------------------------------------------------------------------------------------------
+    //! @struct SensorFrame
+    //! @brief One AHAT frame as handed to \ref Holo2IRTracker, whether it comes from the live sensor or a recording
+    //! 
+    //! Buffers are borrowed, and only need to stay alive for the duration of the call they're passed to.
+    struct SensorFrame
+    {
+        const uint16_t*     ABImage = nullptr;      /*!< Raw 16-bit active brightness image */
+        const uint16_t*     DepthImage = nullptr;   /*!< Raw 16-bit depth image in millimetres */
+        const uint8_t*      SigmaImage = nullptr;   /*!< Optional sigma/invalidation buffer, a set MSB marks the pixel's depth invalid */
+        uint64_t            Timestamp = 0;          /*!< Sensor timestamp in host ticks (100ns), 0 if unknown */
+        Eigen::Matrix4d     Depth2World = Eigen::Matrix4d::Identity(); /*!< Depth sensor to world transform for this frame */
+    };
+
+    //! Bit of a \ref SensorFrame::SigmaImage pixel which flags its depth as invalid
+    constexpr uint8_t SIGMA_INVALID_MASK = 0x80;
+    //-------------------------------------------------------------------------------------------------------------
+
+    //-------------------------------------------------------------------------------------------------------------
+    //! @struct FrameStatistics
+    //! @brief Summary of what \ref Holo2IRTracker did with one frame, for tuning and monitoring
+    struct FrameStatistics
+    {
+        uint64_t    Timestamp = 0;              /*!< \ref SensorFrame::Timestamp of the frame */
+        uint16_t    ABThreshold = 0;            /*!< Raw AB cut-off used for marker pixels in this frame */
+        bool        AdaptiveThreshold = false;  /*!< Whether \ref ABThreshold came from the adaptive threshold */
+        bool        FullFrameSearch = false;    /*!< Whole frame searched, rather than only windows around tracked tools */
+        size_t      Blobs2D = 0;                /*!< Blobs found by 2D detection */
+        size_t      Blobs3D = 0;                /*!< Blobs left after 3D validation */
+        size_t      TrackedTools = 0;           /*!< Tools found around their last pose, without a full search */
+        size_t      ShortlistedTools = 0;       /*!< Of the rest, tools whose marker distances were found among the blobs, and so searched for */
+        size_t      BackgroundSuppressed = 0;   /*!< Of \ref Blobs3D, dropped as learned background before matching */
+        size_t      VisibleTools = 0;           /*!< Tools visible after this frame */
+    };
+    //-------------------------------------------------------------------------------------------------------------
+
     //-------------------------------------------------------------------------------------------------------------------------------------------------------------------------
     //! @struct TrackedTool
     //! @brief Struct assigned once a tool has been detected and can be stored in an internal tool map/dictionary
@@ -54,6 +128,8 @@ namespace IRTrackerUtils
 
     //! Function pointer which mimics the signature of the Research Mode API's MapImagePointToUnitPlane function 
     typedef std::function<bool(float(&)[2], float(&)[2])> UnmapFunction;
+
+    class CameraModel; // CameraModel.h
 }
 
 //! @namespace IRTrackerUtils::JSONUtils
@@ -92,8 +168,162 @@ namespace IRTrackerUtils::ImageProc
     {
         Basic,              ///< Basic contour-detection filtering by thresholding, area and circularity 
                             ///< using cv::findContours
-        RefineByScaling     ///< Builds on the BlobDetectionMethod::Basic by enlarging the blob region to try 
+        RefineByScaling,    ///< Builds on the BlobDetectionMethod::Basic by enlarging the blob region to try 
                             ///< a sub-pixel refinement of centre-estimation.
+        ConnectedComponents,///< Single raster-scan run-length labelling of the binary mask, with area, moments and 
+                            ///< perimeter accumulated per component (see \ref LabelBlobComponents). Same area and
+                            ///< circularity filtering as BlobDetectionMethod::Basic, without any contour allocation.
+        IntensityWeighted,  ///< Builds on BlobDetectionMethod::ConnectedComponents, with the centre refined to sub-pixel
+                            ///< accuracy by a grey-level weighted centroid over the raw 16-bit AB pixels in each blob's
+                            ///< bounding box. Needs the raw AB image, no resampling involved.
+        BlobPeak            ///< Contour-free: each 8-connected blob of the mask is centred on its brightest pixel in the
+                            ///< raw AB image, refined by a quadratic fit over its 3x3 neighbourhood (one peak per blob,
+                            ///< found while labelling). Only isolated single pixels are dropped as sensor noise, with no
+                            ///< circularity filtering, so markers of 2-4 px (far away) are kept. Noise blobs that are
+                            ///< larger than that are left to \ref MarkerSizeFilter, which knows their depth. Needs the raw
+                            ///< AB image, falls back to the pixel centroid of a bare binary mask.
+    };
+    //-------------------------------------------------------------------------------------------------------------
+
+    //-------------------------------------------------------------------------------------------------------------
+    //! Output formats for display textures, see \ref GetPreviewRegion
+    enum class DisplayPreview
+    {
+        Full,               ///< Full resolution image (512x512)
+        Half,               ///< Every 2nd pixel of every 2nd row (256x256)
+        Quarter,            ///< Every 4th pixel of every 4th row (128x128)
+        ToolCrop            ///< Full resolution 128x128 crop centred on the visible tools' markers (image centre if none)
+    };
+    //-------------------------------------------------------------------------------------------------------------
+
+    //-------------------------------------------------------------------------------------------------------------
+    //! @struct BlobComponent
+    //! @brief  Statistics of one 8-connected component, accumulated while labelling a binary mask
+    //! 
+    //! Besides plain pixel sums, the 'contour' members describe the polygon joining the centres of the component's 
+    //! boundary pixels, i.e. what cv::findContours would return. These are exact for blobs with a single run of 
+    //! pixels per row (which covers marker blobs), and a close estimate otherwise. Contour terms are stored as 
+    //! scaled integers so that partial components can be merged in any order with identical results.
+    struct BlobComponent
+    {
+        int         PixelCount = 0;             /*!< Number of foreground pixels */
+        int64_t     PixelSumX = 0;              /*!< Sum of x coordinates of all foreground pixels */
+        int64_t     PixelSumY = 0;              /*!< Sum of y coordinates of all foreground pixels */
+        int         MinX = INT_MAX;             /*!< Bounding box, inclusive */
+        int         MinY = INT_MAX;             /*!< Bounding box, inclusive */
+        int         MaxX = -1;                  /*!< Bounding box, inclusive */
+        int         MaxY = -1;                  /*!< Bounding box, inclusive */
+        int64_t     ContourArea2 = 0;           /*!< 2x the area enclosed by the boundary polygon */
+        int64_t     ContourM10x6 = 0;           /*!< 6x the first x-moment of the boundary polygon */
+        int64_t     ContourM01x6 = 0;           /*!< 6x the first y-moment of the boundary polygon */
+        int         PerimeterStraight = 0;      /*!< Number of unit-length (horizontal/vertical) boundary steps */
+        int         PerimeterDiagonal = 0;      /*!< Number of diagonal (sqrt(2) length) boundary steps */
+        int         PeakX = -1;                 /*!< Brightest pixel in the labeller's value image, -1 without one */
+        int         PeakY = -1;                 /*!< Brightest pixel in the labeller's value image, -1 without one */
+        int         PeakValue = -1;             /*!< Value of that pixel, the first in raster order wins ties */
+
+        //! Area as cv::contourArea would report for this blob
+        double      Area() const { return 0.5 * static_cast<double>(ContourArea2); }
+        //! Perimeter as cv::arcLength would report for this blob
+        double      Perimeter() const { return PerimeterStraight + 1.4142135623730951 * PerimeterDiagonal; }
+        //! Centroid from the polygon moments (matches cv::moments on the contour), check Area() > 0 first
+        cv::Point2f Centroid() const
+        {
+            return cv::Point2f(static_cast<float>(static_cast<double>(ContourM10x6) / (3.0 * ContourArea2)),
+                               static_cast<float>(static_cast<double>(ContourM01x6) / (3.0 * ContourArea2)));
+        }
+        //! Bounding box as a cv::Rect
+        cv::Rect    BoundingBox() const { return cv::Rect(MinX, MinY, MaxX - MinX + 1, MaxY - MinY + 1); }
+    };
+    //-------------------------------------------------------------------------------------------------------------
+
+    //-------------------------------------------------------------------------------------------------------------
+    //! @struct DisplayLUT
+    //! @brief  Lookup table from a 12-bit sensor value to an 8-bit display value, see \ref ApplyDisplayLUT
+    //! 
+    //! Inputs above 4095 use the last entry, so tables should map it to whatever out-of-range values should show as.
+    struct DisplayLUT
+    {
+        static constexpr int Size = 4096;
+        uint8_t Values[Size + 3] = {};  /*!< Padded so a vectorised gather can read a whole 32-bit word at the last entry */
+    };
+    //-------------------------------------------------------------------------------------------------------------
+
+    //-------------------------------------------------------------------------------------------------------------
+    //! @struct DepthGate
+    //! @brief  Working volume for the front-end, pixels with raw depth outside [NearMM, FarMM] never become blobs
+    //! 
+    //! Keep FarMM at or below 4090 so invalid depth is gated out too. Disabled (the default) when FarMM <= NearMM.
+    struct DepthGate
+    {
+        uint16_t    NearMM = 0;     /*!< Closest depth a marker pixel may have, in millimetres */
+        uint16_t    FarMM = 0;      /*!< Furthest depth a marker pixel may have, in millimetres */
+
+        bool IsEnabled() const { return FarMM > NearMM; }
+    };
+    //-------------------------------------------------------------------------------------------------------------
+
+    //-------------------------------------------------------------------------------------------------------------
+    //! Raw AB value at which a pixel counts as part of a marker, in native sensor units. Picks the same pixels as
+    //! the 8-bit pipeline's cut-off ((raw >> 2) > 180), see \ref BinariseRaw
+    constexpr uint16_t RAW_AB_THRESHOLD_DEFAULT = 724;
+    //-------------------------------------------------------------------------------------------------------------
+
+    //-------------------------------------------------------------------------------------------------------------
+    //! @struct ABHistogram
+    //! @brief  Histogram of raw AB values, filled as a by-product of \ref BinariseRaw / \ref FindCandidateROIs
+    //! 
+    //! Only every few rows are sampled, which is plenty for picking a threshold. Values beyond the last bin are 
+    //! counted in it.
+    struct ABHistogram
+    {
+        static constexpr int BinShift = 3;      /*!< Each bin covers 8 raw units */
+        static constexpr int Bins = 1024;       /*!< So bins cover [0, 8192) */
+
+        uint32_t    Counts[Bins] = {};
+        uint32_t    Total = 0;                  /*!< Number of sampled pixels */
+
+        static int Bin(uint16_t raw) { return std::min(raw >> BinShift, Bins - 1); }
+        void Clear() { std::fill(std::begin(Counts), std::end(Counts), 0u); Total = 0; }
+    };
+
+    //! @struct AdaptiveThresholdSettings
+    //! @brief  Tuning for \ref UpdateAdaptiveThreshold
+    struct AdaptiveThresholdSettings
+    {
+        float       TargetBrightFraction = 0.005f;  /*!< Fraction of the image allowed above the threshold (~1300 px at 512x512) */
+        uint16_t    MinThreshold = 400;             /*!< Lowest raw cut-off, stops dark scenes pulling it into sensor noise */
+        uint16_t    MaxThreshold = 3000;            /*!< Highest raw cut-off, so markers can't be thresholded away entirely */
+        float       MinContrast = 2.0f;             /*!< Threshold is kept at least this many times the median (background) value */
+        float       Hysteresis = 0.1f;              /*!< Relative change needed before the threshold moves */
+        float       HistogramDecay = 0.25f;         /*!< Weight of the newest frame in the running histogram */
+    };
+
+    //! @struct AdaptiveThresholdState
+    //! @brief  Running state of \ref UpdateAdaptiveThreshold, carried from frame to frame
+    struct AdaptiveThresholdState
+    {
+        float       Running[ABHistogram::Bins] = {};            /*!< Running histogram, as fractions of a frame */
+        bool        Primed = false;                             /*!< Set once a frame has been added */
+        uint16_t    Threshold = RAW_AB_THRESHOLD_DEFAULT;       /*!< Current raw cut-off */
+    };
+    //-------------------------------------------------------------------------------------------------------------
+
+    //-------------------------------------------------------------------------------------------------------------
+    //! @struct MarkerSizeFilter
+    //! @brief  Expected marker size, used to reject blobs whose pixel area doesn't fit their measured depth
+    //! 
+    //! A blob passes if (measured pixel count / predicted silhouette area) lies in [MinAreaRatio, MaxAreaRatio]. 
+    //! A dim marker's binarised blob loses its rim, down to about 0.3 of the silhouette, while a saturated blob only 
+    //! 1-2 px across can cover up to 3x its silhouette once every touched pixel counts. Disabled (the default) while 
+    //! DiameterMetres is 0.
+    struct MarkerSizeFilter
+    {
+        float       DiameterMetres = 0.0f;  /*!< Diameter of the retro-reflective marker spheres */
+        float       MinAreaRatio = 0.25f;   /*!< Smallest accepted measured/predicted area ratio */
+        float       MaxAreaRatio = 3.5f;    /*!< Largest accepted measured/predicted area ratio */
+
+        bool IsEnabled() const { return DiameterMetres > 0.0f && MaxAreaRatio >= MinAreaRatio; }
     };
     //-------------------------------------------------------------------------------------------------------------
 
@@ -110,9 +340,9 @@ namespace IRTrackerUtils::ImageProc
 
     //-------------------------------------------------------------------------------------------------------------
     template <typename T> void NativeToCVMat(const T* src, cv::Mat& dst, int rows, int cols);        
-    // explicitly instantiate the templates we are likely to use to avoid linker errors
-    template void NativeToCVMat(const uint16_t* src, cv::Mat& dst, int rows, int cols);
-    template void NativeToCVMat(const uint8_t* src, cv::Mat& dst, int rows, int cols);
+    // explicitly instantiated in IRImageProcUtils.cpp for the types we are likely to use, to avoid linker errors
+    extern template void NativeToCVMat(const uint16_t* src, cv::Mat& dst, int rows, int cols);
+    extern template void NativeToCVMat(const uint8_t* src, cv::Mat& dst, int rows, int cols);
     //-------------------------------------------------------------------------------------------------------------
         
     //-------------------------------------------------------------------------------------------------------------
@@ -122,9 +352,98 @@ namespace IRTrackerUtils::ImageProc
     //! @param processedImage        Expecting an 8-bit image with a reasonable dynamic range 
     //! @param method                Choose from implemented methods for blob detection 
     //! @param outPixelLocations     Vector to be filled with pixel locations of detected blob centres
-    void DetectBlobs2D(cv::Mat& processedImage, BlobDetectionMethod method, std::vector<cv::Point2f>& outPixelLocations);
+    //! @param inputIsBinarised      Set true if \p processedImage is already a binary mask (e.g. from 
+    //!                              \ref RebalanceAndBinarise), which skips the internal thresholding pass
+    //! @param rawABImage            Raw 16-bit AB image (same size as \p processedImage), only needed by 
+    //!                              BlobDetectionMethod::IntensityWeighted
+    //! @param outBlobAreas          Optional, filled with each blob's pixel count (same order as \p outPixelLocations)
+    void DetectBlobs2D(cv::Mat& processedImage, BlobDetectionMethod method, std::vector<cv::Point2f>& outPixelLocations,
+        bool inputIsBinarised = false, const cv::Mat& rawABImage = cv::Mat(), std::vector<float>* outBlobAreas = nullptr);
     //-------------------------------------------------------------------------------------------------------------
         
+    //-------------------------------------------------------------------------------------------------------------
+    //! @brief   Same as \ref DetectBlobs2D, but only searching inside the given regions of \p processedImage
+    //! 
+    //! @param processedImage        Expecting an 8-bit image with a reasonable dynamic range (or a binary mask)
+    //! @param method                Choose from implemented methods for blob detection 
+    //! @param searchROIs            Non-overlapping regions to search (e.g. from \ref BuildSearchROIs)
+    //! @param outPixelLocations     Vector to be filled with full-frame pixel locations of detected blob centres
+    //! @param inputIsBinarised      Set true if \p processedImage is already a binary mask
+    //! @param rawABImage            Raw 16-bit AB image (full frame), only needed by BlobDetectionMethod::IntensityWeighted
+    //! @param outBlobAreas          Optional, filled with each blob's area in pixels (same order as \p outPixelLocations)
+    void DetectBlobs2DInROIs(cv::Mat& processedImage, BlobDetectionMethod method, const std::vector<cv::Rect>& searchROIs,
+        std::vector<cv::Point2f>& outPixelLocations, bool inputIsBinarised = false, const cv::Mat& rawABImage = cv::Mat(),
+        std::vector<float>* outBlobAreas = nullptr);
+    //-------------------------------------------------------------------------------------------------------------
+
+    //-------------------------------------------------------------------------------------------------------------
+    //! @brief   Builds small search windows around the image keypoints of all currently visible tools
+    //! 
+    //!  Windows are clipped to the image and any overlapping windows are merged, so each pixel is searched 
+    //!  at most once and no blob is reported twice.
+    //! 
+    //! @param toolDictionary        Tools to build windows for, only those flagged VisibleToHoloLens are used
+    //! @param windowHalfSize        Half the side length of the square window centred on each marker (pixels)
+    //! @param imageSize             Size of the image the windows will be applied to
+    //! @param outROIs               Filled with the merged search windows, empty if no tool is visible
+    void BuildSearchROIs(const ToolDictionary& toolDictionary, int windowHalfSize, cv::Size imageSize, std::vector<cv::Rect>& outROIs);
+
+    //! @brief   As above, but around arbitrary image locations, e.g. where a tool's markers are predicted to be
+    //! @param keypoints             Window centres (pixels)
+    void BuildSearchROIs(const std::vector<cv::Point2f>& keypoints, int windowHalfSize, cv::Size imageSize, std::vector<cv::Rect>& outROIs);
+    //-------------------------------------------------------------------------------------------------------------
+
+    //-------------------------------------------------------------------------------------------------------------
+    //! @brief   Coarse pass for coarse-to-fine detection: finds regions of the raw AB image that may contain blobs
+    //! 
+    //!  Max-pools the raw image by \p poolFactor (so even single bright pixels survive), thresholds it with the 
+    //!  same cut-off as the full resolution binarisation and labels the result. Each coarse component becomes a 
+    //!  slightly padded full resolution window, merged like \ref BuildSearchROIs. Every blob the full frame 
+    //!  detectors would see lies entirely inside one window, so running \ref DetectBlobs2DInROIs on these gives 
+    //!  the same blobs with the same area/circularity filtering.
+    //! 
+    //! @param inputRaw16BitImg      Expecting 16 bit AB image as obtained from HL2 AHAT depth sensor (left untouched)
+    //! @param poolFactor            Downsampling factor, e.g. 2 or 4
+    //! @param outROIs               Filled with non-overlapping candidate windows, empty if nothing is bright enough
+    //! @param inputRawDepthImg      Raw 16 bit depth image, only read if \p gate is enabled
+    //! @param gate                  Optional working volume, pixels outside it don't count towards any candidate
+    //! @param rawThreshold          Raw AB cut-off, should match the one the full resolution pass will use
+    //! @param outHistogram          Optional, cleared and filled with a histogram of the (ungated) raw AB values
+    void FindCandidateROIs(const cv::Mat& inputRaw16BitImg, int poolFactor, std::vector<cv::Rect>& outROIs,
+        const cv::Mat& inputRawDepthImg = cv::Mat(), DepthGate gate = DepthGate(), uint16_t rawThreshold = RAW_AB_THRESHOLD_DEFAULT,
+        ABHistogram* outHistogram = nullptr);
+    //-------------------------------------------------------------------------------------------------------------
+
+    //-------------------------------------------------------------------------------------------------------------
+    //! @brief   Labels 8-connected components of a binary mask in a single raster scan
+    //! 
+    //!  Run-length encodes each row and links runs to the previous row with a union-find structure, accumulating 
+    //!  everything in \ref BlobComponent on the way. No per-frame heap allocation once warmed up.
+    //! 
+    //! @param binaryMask            8-bit mask, any non-zero pixel is treated as foreground (ROI views are fine)
+    //! @param outComponents         Filled with one entry per component, in raster order of each component's first pixel
+    //! @param peakImage             Optional 8 or 16-bit single channel image the size of \p binaryMask, each component's
+    //!                              brightest pixel in it is recorded (BlobComponent::PeakX/PeakY/PeakValue)
+    void LabelBlobComponents(const cv::Mat& binaryMask, std::vector<BlobComponent>& outComponents, const cv::Mat& peakImage = cv::Mat());
+    //-------------------------------------------------------------------------------------------------------------
+
+    //-------------------------------------------------------------------------------------------------------------
+    //! @brief   Multi-threaded \ref LabelBlobComponents, splitting the mask into horizontal strips
+    //! 
+    //!  Each strip is a separate cv::parallel_for_ task on OpenCV's worker pool (sized by the application, not here), 
+    //!  then components touching a seam are stitched together on the calling thread. The component statistics are 
+    //!  integer sums, so the output is identical to the serial labeller regardless of the strip count.
+    //! 
+    //! @param binaryMask            8-bit mask, any non-zero pixel is treated as foreground
+    //! @param numStrips             Number of horizontal strips (clamped to [1, rows]), usually the thread count
+    //! @param outComponents         Filled with one entry per component, in raster order of each component's first pixel
+    //! @param prepareStrip          Optional work run on the worker for each strip's row range before it is labelled,
+    //!                              e.g. producing that part of \p binaryMask. Must not touch rows outside the range
+    //! @param peakImage             Optional, see \ref LabelBlobComponents
+    void LabelBlobComponentsParallel(const cv::Mat& binaryMask, int numStrips, std::vector<BlobComponent>& outComponents,
+        const std::function<void(const cv::Range&)>& prepareStrip = nullptr, const cv::Mat& peakImage = cv::Mat());
+    //-------------------------------------------------------------------------------------------------------------
+
     //-------------------------------------------------------------------------------------------------------------
     //! @brief   Constructs a vector of valid \ref InfraBlobInfo after cross-checking the depth values
     //! 
@@ -144,6 +463,49 @@ namespace IRTrackerUtils::ImageProc
         const UnmapFunction                  MapImagePointToUnitPlane, 
         std::vector<InfraBlobInfo>&          outBlobInfo
     );
+
+    //! Same as above but takes pixel rays from a \ref CameraModel, unmapping every blob in one batched call 
+    //! rather than a function call per blob.
+    void ValidateBlobs3D(
+        const cv::Mat&                       inDepthImg, 
+        const Eigen::Ref<Eigen::Matrix4d>    inDepth2World,
+        const std::vector<cv::Point2f>&      inblobPixels2D, 
+        const CameraModel&                   cameraModel, 
+        std::vector<InfraBlobInfo>&          outBlobInfo
+    );
+
+    //! @brief   Batched form of \ref ValidateBlobs3D writing structure-of-arrays output
+    //! 
+    //!  Samples the four depth taps for every blob straight from the 16-bit rows, drops blobs with invalid depth,
+    //!  unmaps the survivors in one \ref CameraModel call and moves them all to the world frame with one matrix 
+    //!  product. Blobs with no usable depth or ray are left out, as in \ref ValidateBlobs3D.
+    //! 
+    //!  If \p inSigmaImg is given, taps flagged invalid in it are dropped and the depth is interpolated from the 
+    //!  remaining ones, so a blob next to an invalid pixel keeps a clean depth value. Without it all four taps are 
+    //!  blended as in \ref BilinearInterpolation.
+    //! 
+    //!  If \p sizeFilter is enabled and \p inBlobAreas are given, each blob's pixel area is also compared with the 
+    //!  area a marker of that diameter would cover at the blob's measured depth (through \p cameraModel's local 
+    //!  pixel scale), and implausible blobs such as glints off instruments are dropped as well.
+    //! 
+    //! @param inDepthImg                    16-bit depth image from HL2 without any processing required 
+    //! @param inDepth2World                 Transform matrix of depth sensor to world coordinate system in this frame 
+    //! @param inblobPixels2D                Detected blob pixel locations (2D) to iterate over
+    //! @param cameraModel                   Camera model used to unmap the blob pixels
+    //! @param outBlobPoints                 Valid 3D blobs, previous contents are replaced
+    //! @param inSigmaImg                    Optional 8-bit sigma buffer, see \ref SensorFrame::SigmaImage
+    //! @param inBlobAreas                   Optional pixel area of each blob, as reported by the detectors (0 = unknown, not checked)
+    //! @param sizeFilter                    Optional marker size check, only applied when \p inBlobAreas matches \p inblobPixels2D
+    void ValidateBlobs3DBatch(
+        const cv::Mat&                       inDepthImg, 
+        const Eigen::Ref<Eigen::Matrix4d>    inDepth2World,
+        const std::vector<cv::Point2f>&      inblobPixels2D, 
+        const CameraModel&                   cameraModel, 
+        BlobPoints3D&                        outBlobPoints,
+        const cv::Mat&                       inSigmaImg = cv::Mat(),
+        const std::vector<float>&            inBlobAreas = std::vector<float>(),
+        MarkerSizeFilter                     sizeFilter = MarkerSizeFilter()
+    );
     //-------------------------------------------------------------------------------------------------------------
         
     //-------------------------------------------------------------------------------------------------------------
@@ -151,35 +513,193 @@ namespace IRTrackerUtils::ImageProc
     //! 
     //!  Internally scales each pixel by factor of 64 to 'brighten' and handles conversion from 16 to 8bit 
     //! 
-    //! @param inputRaw16BitImg      Expecting 16 bit AB image as obtained from HL2 AHAT depth sensor
+    //! @param inputRaw16BitImg      Expecting 16 bit AB image as obtained from HL2 AHAT depth sensor (left untouched)
     //! @param output8BitImg         A processed 8-bit AB image with an increased dynamic range 
-    void RebalanceImgAnd8Bit(cv::Mat& inputRaw16BitImg, cv::Mat& output8BitImg);
+    void RebalanceImgAnd8Bit(const cv::Mat& inputRaw16BitImg, cv::Mat& output8BitImg);
+    //-------------------------------------------------------------------------------------------------------------
+
+    //-------------------------------------------------------------------------------------------------------------
+    //! @brief Fused front-end kernel which reads the raw AB image once and writes the 8-bit and binarised images
+    //! 
+    //!  Bit-exact with \ref RebalanceImgAnd8Bit followed by the binary threshold applied in \ref DetectBlobs2D, 
+    //!  but done in a single pass and without modifying \p inputRaw16BitImg. Vectorised with NEON on ARM64 and 
+    //!  SSE2/AVX2 on x86/x64, with a scalar fallback. Works row-by-row, so ROI views are also accepted.
+    //! 
+    //!  With an enabled \p gate the mask also requires the pixel's raw depth to be inside the working volume, 
+    //!  tested in the same pass, so out of range reflections never reach blob detection. The 8-bit image is unaffected.
+    //! 
+    //! @param inputRaw16BitImg      Expecting 16 bit AB image as obtained from HL2 AHAT depth sensor (left untouched)
+    //! @param output8BitImg         A processed 8-bit AB image with an increased dynamic range, for display
+    //! @param outputBinaryMask      8-bit mask set to 255 for pixels bright enough to be part of a marker, 0 otherwise
+    //! @param inputRawDepthImg      Raw 16 bit depth image (or matching ROI view), only read if \p gate is enabled
+    //! @param gate                  Optional working volume
+    void RebalanceAndBinarise(const cv::Mat& inputRaw16BitImg, cv::Mat& output8BitImg, cv::Mat& outputBinaryMask,
+        const cv::Mat& inputRawDepthImg = cv::Mat(), DepthGate gate = DepthGate());
+    //-------------------------------------------------------------------------------------------------------------
+
+    //-------------------------------------------------------------------------------------------------------------
+    //! @brief   Full-frame front-end and blob detection split into horizontal strips across worker threads
+    //! 
+    //!  Each strip runs the fused front-end (\ref RebalanceAndBinarise) and labelling on its own worker, with the 
+    //!  seams merged afterwards (\ref LabelBlobComponentsParallel). Output is identical to running 
+    //!  \ref RebalanceAndBinarise then \ref DetectBlobs2D serially. Only the labelling based methods 
+    //!  (ConnectedComponents, IntensityWeighted, BlobPeak) are split, the others fall back to the serial path.
+    //! 
+    //! @param inputRaw16BitImg      Expecting 16 bit AB image as obtained from HL2 AHAT depth sensor (left untouched)
+    //! @param output8BitImg         A processed 8-bit AB image with an increased dynamic range, for display
+    //! @param outputBinaryMask      8-bit mask set to 255 for pixels bright enough to be part of a marker, 0 otherwise
+    //! @param method                Choose from implemented methods for blob detection 
+    //! @param numStrips             Number of horizontal strips, usually the thread count
+    //! @param outPixelLocations     Vector to be filled with pixel locations of detected blob centres
+    //! @param inputRawDepthImg      Raw 16 bit depth image, only read if \p gate is enabled
+    //! @param gate                  Optional working volume, see \ref RebalanceAndBinarise
+    //! @param outBlobAreas          Optional, filled with each blob's area in pixels (same order as \p outPixelLocations)
+    void DetectBlobs2DParallel(const cv::Mat& inputRaw16BitImg, cv::Mat& output8BitImg, cv::Mat& outputBinaryMask,
+        BlobDetectionMethod method, int numStrips, std::vector<cv::Point2f>& outPixelLocations,
+        const cv::Mat& inputRawDepthImg = cv::Mat(), DepthGate gate = DepthGate(), std::vector<float>* outBlobAreas = nullptr);
+    //-------------------------------------------------------------------------------------------------------------
+        
+    //-------------------------------------------------------------------------------------------------------------
+    //! @brief   Thresholds the raw AB image directly in sensor units, with no 8-bit conversion
+    //! 
+    //!  Unlike \ref RebalanceAndBinarise nothing is shifted or saturated first, so the cut-off can sit anywhere in 
+    //!  the sensor's range. Vectorised like the fused front-end, and gated the same way. ROI views are accepted.
+    //! 
+    //! @param inputRaw16BitImg      Expecting 16 bit AB image as obtained from HL2 AHAT depth sensor (left untouched)
+    //! @param outputBinaryMask      8-bit mask set to 255 where raw >= \p rawThreshold, 0 otherwise
+    //! @param rawThreshold          Cut-off in raw AB units
+    //! @param inputRawDepthImg      Raw 16 bit depth image (or matching ROI view), only read if \p gate is enabled
+    //! @param gate                  Optional working volume
+    //! @param outHistogram          Optional, cleared and filled with a histogram of the (ungated) raw AB values
+    void BinariseRaw(const cv::Mat& inputRaw16BitImg, cv::Mat& outputBinaryMask, uint16_t rawThreshold = RAW_AB_THRESHOLD_DEFAULT,
+        const cv::Mat& inputRawDepthImg = cv::Mat(), DepthGate gate = DepthGate(), ABHistogram* outHistogram = nullptr);
+    //-------------------------------------------------------------------------------------------------------------
+
+    //-------------------------------------------------------------------------------------------------------------
+    //! @brief   Full-frame blob detection straight from the raw 16-bit AB image
+    //! 
+    //!  \ref BinariseRaw followed by blob detection, split into strips like \ref DetectBlobs2DParallel for the 
+    //!  labelling based methods. No 8-bit image is produced, so produce one separately (e.g. \ref RebalanceImgAnd8Bit) 
+    //!  only when something needs to be displayed. Saturated near markers keep their shading in the raw data, so
+    //!  BlobDetectionMethod::IntensityWeighted and BlobDetectionMethod::BlobPeak get the most out of this path.
+    //! 
+    //! @param inputRaw16BitImg      Expecting 16 bit AB image as obtained from HL2 AHAT depth sensor (left untouched)
+    //! @param outputBinaryMask      8-bit mask set to 255 for pixels bright enough to be part of a marker, 0 otherwise
+    //! @param method                Choose from implemented methods for blob detection 
+    //! @param numStrips             Number of horizontal strips, usually the thread count
+    //! @param outPixelLocations     Vector to be filled with pixel locations of detected blob centres
+    //! @param rawThreshold          Cut-off in raw AB units
+    //! @param inputRawDepthImg      Raw 16 bit depth image, only read if \p gate is enabled
+    //! @param gate                  Optional working volume
+    //! @param outBlobAreas          Optional, filled with each blob's area in pixels (same order as \p outPixelLocations)
+    //! @param outHistogram          Optional, see \ref BinariseRaw
+    void DetectBlobs2DRaw(const cv::Mat& inputRaw16BitImg, cv::Mat& outputBinaryMask, BlobDetectionMethod method, int numStrips,
+        std::vector<cv::Point2f>& outPixelLocations, uint16_t rawThreshold = RAW_AB_THRESHOLD_DEFAULT,
+        const cv::Mat& inputRawDepthImg = cv::Mat(), DepthGate gate = DepthGate(), std::vector<float>* outBlobAreas = nullptr,
+        ABHistogram* outHistogram = nullptr);
+    //-------------------------------------------------------------------------------------------------------------
+
+    //-------------------------------------------------------------------------------------------------------------
+    //! @brief   Adds a frame's histogram to the running one and picks the raw AB threshold for the next frame
+    //! 
+    //!  The candidate is the lowest cut-off leaving at most AdaptiveThresholdSettings::TargetBrightFraction of the 
+    //!  running histogram above it, raised to MinContrast times the median if needed so it stays clear of the 
+    //!  background noise, and clamped to [MinThreshold, MaxThreshold]. It only replaces the current threshold 
+    //!  if it differs by more than the hysteresis, so the threshold (and the blob count) doesn't jitter from frame 
+    //!  to frame. Bright ambient IR raises it, keeping the number of candidate blobs bounded, and it falls back 
+    //!  towards MinThreshold once the scene is dark again.
+    //! 
+    //! @param frameHistogram        This frame's histogram, frames with no samples are ignored
+    //! @param settings              Tuning parameters
+    //! @param state                 Running histogram and current threshold, updated in place
+    //! @return                      The threshold to use for the next frame (also in \p state)
+    uint16_t UpdateAdaptiveThreshold(const ABHistogram& frameHistogram, const AdaptiveThresholdSettings& settings, 
+        AdaptiveThresholdState& state);
     //-------------------------------------------------------------------------------------------------------------
         
     //-------------------------------------------------------------------------------------------------------------
     //! @brief  Helper function to add annotations on \p Img2Label to draw crosses at any detected tool's marker centres
     //! 
+    //! Has no profiler zone, so it's safe to call from a different thread to the processing loop.
+    //! 
     //! @param toolDictionary 
     //! @param Img2Label 
-    void LabelImageWithToolDictData(const std::map<uint8_t, IRTrackerUtils::TrackedTool>& toolDictionary, cv::Mat Img2Label);
+    //! @param sourceOrigin      Top-left of the region of the full image that \p Img2Label shows (see \ref GetPreviewRegion)
+    //! @param sourceStep        Subsampling step between the full image and \p Img2Label, markers are scaled to suit
+    void LabelImageWithToolDictData(const std::map<uint8_t, IRTrackerUtils::TrackedTool>& toolDictionary, cv::Mat Img2Label,
+        cv::Point2i sourceOrigin = cv::Point2i(0, 0), int sourceStep = 1);
     //-------------------------------------------------------------------------------------------------------------
         
     //-------------------------------------------------------------------------------------------------------------
     //! @brief  Helper function which creates an 8-bit processed image of the depth map created by ResearchModeAPI
     //! 
-    //! Values above 4090 are floored to 0, and all other 16-bit values are linearly mapped to the 8-bit range.
+    //! Values above 4090 are floored to 0, and all other 16-bit values are linearly mapped to the 8-bit range 
+    //! (1m is full brightness). Done through a \ref DisplayLUT, see \ref BuildDepthDisplayLUT for other windows.
     //! 
     //! @param input16bitdepthImg   Raw 16-bit depth image from ResearchModeAPI without any processing 
     //! @param output8bitDepth      A ready to display image 
     void GetProcessed8BitDepthImg(const cv::Mat& input16bitdepthImg, cv::Mat& output8bitDepth);
     //-------------------------------------------------------------------------------------------------------------
+
+    //-------------------------------------------------------------------------------------------------------------
+    //! @brief  Fills \p outLUT to map raw depth (mm) to display brightness over the window [\p nearMM, \p farMM]
+    //! 
+    //! Invalid depths (above 4090) and anything up to \p nearMM map to 0, \p farMM and beyond to 255. The default 
+    //! 0 to 1000 mm window gives exactly what \ref GetProcessed8BitDepthImg always produced.
+    //! 
+    //! @param nearMM               Depth shown as black
+    //! @param farMM                Depth shown as full brightness, moved to \p nearMM + 1 if not beyond it
+    //! @param outLUT               Table to fill in
+    void BuildDepthDisplayLUT(uint16_t nearMM, uint16_t farMM, DisplayLUT& outLUT);
+    //-------------------------------------------------------------------------------------------------------------
+
+    //-------------------------------------------------------------------------------------------------------------
+    //! @brief  Fills \p outLUT with the AB rebalance of \ref RebalanceImgAnd8Bit, i.e. saturate_cast<uint8_t>(raw >> 2)
+    void BuildABDisplayLUT(DisplayLUT& outLUT);
+    //-------------------------------------------------------------------------------------------------------------
+
+    //-------------------------------------------------------------------------------------------------------------
+    //! @brief  Maps each pixel of a 16-bit sensor image through \p lut in a single allocation-free pass
+    //! 
+    //!  Uses AVX2 gathers where available and an unrolled scalar loop otherwise (NEON has no gather). Has no 
+    //!  profiler zone, so it's safe to call from a different thread to the processing loop.
+    //! 
+    //! @param inputRaw16BitImg     Raw 16-bit AB or depth image (left untouched), ROI views are fine
+    //! @param lut                  Table from \ref BuildDepthDisplayLUT or \ref BuildABDisplayLUT
+    //! @param output8BitImg        8-bit output, only (re)allocated if it doesn't already have the right size/type
+    void ApplyDisplayLUT(const cv::Mat& inputRaw16BitImg, const DisplayLUT& lut, cv::Mat& output8BitImg);
+    //-------------------------------------------------------------------------------------------------------------
+
+    //-------------------------------------------------------------------------------------------------------------
+    //! @brief  Same as \ref ApplyDisplayLUT, but only reading every \p step-th pixel of every \p step-th row
+    //! 
+    //! @param inputRaw16BitImg     Raw 16-bit AB or depth image (left untouched), ROI views are fine
+    //! @param lut                  Table from \ref BuildDepthDisplayLUT or \ref BuildABDisplayLUT
+    //! @param step                 Subsampling step, 1 is the same as \ref ApplyDisplayLUT
+    //! @param output8BitImg        8-bit output of size (cols / step, rows / step)
+    void ApplyDisplayLUTSubsampled(const cv::Mat& inputRaw16BitImg, const DisplayLUT& lut, int step, cv::Mat& output8BitImg);
+    //-------------------------------------------------------------------------------------------------------------
+
+    //-------------------------------------------------------------------------------------------------------------
+    //! @brief  Works out which part of the full sensor image a preview texture shows, and at what subsampling
+    //! 
+    //! @param preview              Preview format
+    //! @param toolDictionary       Tools used to centre DisplayPreview::ToolCrop, only visible ones are used
+    //! @param imageSize            Size of the full sensor image
+    //! @param outSourceRegion      Region of the full image to read
+    //! @param outStep              Subsampling step within \p outSourceRegion
+    //! @return                     Size of the resulting preview image
+    cv::Size GetPreviewRegion(DisplayPreview preview, const ToolDictionary& toolDictionary, cv::Size imageSize, 
+        cv::Rect& outSourceRegion, int& outStep);
+    //-------------------------------------------------------------------------------------------------------------
         
     //-------------------------------------------------------------------------------------------------------------
     //! @brief   Helper function to return interpolated image value in a grayscale image based on float indices
     //! 
     //! @param image     Image to read 
     //! @param point     cv::Point2f struct to support non-integer indices 
-    //! @return          Interpolated value based on bilinear interpolation of 4 surrounding pixels 
+    //! @return          Interpolated value based on bilinear interpolation of 4 surrounding pixels, -1 if \p point is
+    //!                  outside the image (NaN included) or the image isn't 8 or 16-bit single channel
     float BilinearInterpolation(const cv::Mat& image, const cv::Point2f& point);
     //-------------------------------------------------------------------------------------------------------------
 }
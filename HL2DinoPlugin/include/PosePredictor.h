@@ -0,0 +1,97 @@
+/** @file       PosePredictor.h
+ *  @brief      Constant-velocity Kalman filter over a tool's SE(3) pose, for predicting it at any timestamp
+ *
+ *  @author     Hisham Iqbal
+ *  @copyright  &copy; 2023 Hisham Iqbal
+ */
+
+#ifndef POSE_PREDICTOR_H
+#define POSE_PREDICTOR_H
+
+#include <Eigen/Dense>
+#include <cstdint>
+
+namespace IRTrackerUtils
+{
+    //-------------------------------------------------------------------------------------------------------------
+    //! @class  PosePredictor
+    //! @brief  Tracks one tool's pose and velocity from its measured poses, and extrapolates them to other times
+    //!
+    //! Translation and rotation each get a constant-velocity Kalman filter with white-noise acceleration. The
+    //! translation filter's state is (position, velocity). Rotation is filtered as an error state, a small
+    //! world-frame rotation vector and the angular velocity, about the current orientation estimate. Measurement
+    //! residuals are taken with the matrix log, so a pose on the far side of +-pi is handled like any other.
+    //!
+    //! Timestamps are in the sensor's 100 ns host ticks (\ref SensorFrame::Timestamp). Everything is plain Eigen, with
+    //! no dependence on the sensor or the tracker.
+    class PosePredictor
+    {
+        public:
+            typedef Eigen::Matrix<double, 6, 6> Matrix6d;
+
+            struct Settings
+            {
+                double PositionNoise = 0.0005;          /*!< Std-dev of a measured position, metres */
+                double RotationNoise = 0.005;           /*!< Std-dev of a measured orientation, radians */
+                double AccelerationNoise = 2.0;         /*!< Std-dev of the unmodelled acceleration, m/s^2 */
+                double AngularAccelerationNoise = 10.0; /*!< Std-dev of the unmodelled angular acceleration, rad/s^2 */
+                double MaxPredictionSeconds = 0.1;      /*!< Predictions further than this from the last update are clamped to it */
+                double ResetAfterSeconds = 0.5;         /*!< An update this long after the previous one restarts the filter */
+            };
+
+            PosePredictor() = default;
+            explicit PosePredictor(const Settings& settings) : m_Settings(settings) {}
+
+            //---------------------------------------------------------------------------------------------------------
+            //! Folds in a measured pose, e.g. from CorrespondenceMatcher::ComputeRigidTransform.
+            //!
+            //! The first update, one after a gap of Settings::ResetAfterSeconds, or one that isn't later than the
+            //! previous update starts the filter again from this pose at rest.
+            //!
+            //! \param pose         4x4 rigid transform
+            //! \param timestamp    When \p pose was observed, in 100 ns ticks
+            void Update(const Eigen::Matrix4d& pose, uint64_t timestamp);
+
+            //! Pose extrapolated to \p timestamp, which may be before or after the last update.
+            //!
+            //! \param timestamp        In 100 ns ticks
+            //! \param outPose          Predicted 4x4 rigid transform
+            //! \param outCovariance    Optional, covariance of (position, rotation vector) at \p timestamp
+            //! \return                 False (leaving the outputs alone) until the first update
+            bool Predict(uint64_t timestamp, Eigen::Matrix4d& outPose, Matrix6d* outCovariance = nullptr) const;
+            //---------------------------------------------------------------------------------------------------------
+
+            //---------------------------------------------------------------------------------------------------------
+            //! Forgets the tracked motion, the next update starts the filter again.
+            void Reset() { m_Initialised = false; }
+
+            bool IsInitialised() const { return m_Initialised; }
+            uint64_t GetLastTimestamp() const { return m_LastTimestamp; }
+
+            //! Estimated velocities as of the last update, m/s and rad/s (world frame)
+            const Eigen::Vector3d& GetLinearVelocity() const { return m_Velocity; }
+            const Eigen::Vector3d& GetAngularVelocity() const { return m_AngularVelocity; }
+
+            void SetSettings(const Settings& settings) { m_Settings = settings; }
+            const Settings& GetSettings() const { return m_Settings; }
+            //---------------------------------------------------------------------------------------------------------
+
+        private:
+            Settings m_Settings;
+            bool m_Initialised = false;
+            uint64_t m_LastTimestamp = 0;
+
+            //! @name State as of m_LastTimestamp
+            //!@{
+            Eigen::Vector3d m_Position = Eigen::Vector3d::Zero();
+            Eigen::Vector3d m_Velocity = Eigen::Vector3d::Zero();
+            Eigen::Matrix3d m_Orientation = Eigen::Matrix3d::Identity();
+            Eigen::Vector3d m_AngularVelocity = Eigen::Vector3d::Zero();
+            Matrix6d m_TranslationCovariance = Matrix6d::Zero();   /*!< Over (position, velocity) */
+            Matrix6d m_RotationCovariance = Matrix6d::Zero();      /*!< Over (rotation error, angular velocity) */
+            //!@}
+    };
+    //-------------------------------------------------------------------------------------------------------------
+}
+
+#endif // POSE_PREDICTOR_H
@@ -0,0 +1,93 @@
+/** @file       RayLookupTable.h
+ *  @brief      Precomputed table of unit rays for the AHAT camera, replacing per-pixel unmap calls
+ *
+ *  @author     Hisham Iqbal
+ *  @copyright  &copy; 2023 Hisham Iqbal
+ */
+
+#ifndef RAY_LOOKUP_TABLE_H
+#define RAY_LOOKUP_TABLE_H
+
+#include <Eigen/Dense>
+#include <array>
+#include <string>
+#include <vector>
+#include "CameraModel.h"
+
+namespace IRTrackerUtils
+{
+    //-------------------------------------------------------------------------------------------------------------
+    //! @class  RayLookupTable
+    //! @brief  Camera model answering pixel to ray queries from a table sampled once from an \ref UnmapFunction
+    //!
+    //! Nodes are placed every \p step pixels and hold the unit ray through that pixel, lookups in between are
+    //! bilinearly interpolated and re-normalised. Nodes the unmap function rejected are stored as NaN, and any
+    //! lookup that would touch one fails, just like the unmap call would. Plain data only, so it can be built
+    //! from a synthetic camera and used off-device. Projection inverts the table with a few Newton steps.
+    class RayLookupTable : public CameraModel
+    {
+        public:
+            //! Row-major 4x4 sensor extrinsics, used to check a saved table belongs to this sensor
+            typedef std::array<float, 16> ExtrinsicsKey;
+
+            //---------------------------------------------------------------------------------------------------------
+            //! Samples \p unmapFunction to fill the table, replacing any previous contents.
+            //!
+            //! \param unmapFunction    Pixel (u,v) to unit plane (x,y,1) mapping, e.g. MapImagePointToCameraUnitPlane
+            //! \param width            Image width in pixels
+            //! \param height           Image height in pixels
+            //! \param step             Node spacing in pixels, 1 samples every pixel
+            //! \return                 False if \p unmapFunction is empty or rejected every node
+            bool Build(const UnmapFunction& unmapFunction, int width = 512, int height = 512, int step = 4);
+            //---------------------------------------------------------------------------------------------------------
+
+            //---------------------------------------------------------------------------------------------------------
+            //! Unit ray in the camera frame through pixel (\p u, \p v), no virtual or COM calls involved.
+            //!
+            //! \return                 False if the table is empty, the pixel is outside the image or near a rejected node
+            bool GetUnitRay(float u, float v, Eigen::Vector3d& outRay) const;
+
+            //! Same signature as \ref UnmapFunction, so the table can stand in for the sensor's own function.
+            bool MapImagePointToUnitPlane(float(&uv)[2], float(&xy)[2]) const;
+
+            //! Inverse of \ref MapImagePointToUnitPlane, same signature as \ref ProjectFunction.
+            bool MapUnitPlaneToImagePoint(float(&xy)[2], float(&uv)[2]) const;
+
+            //! Wraps \ref MapImagePointToUnitPlane in an \ref UnmapFunction, the table must outlive it.
+            UnmapFunction AsUnmapFunction() const;
+
+            size_t UnmapPoints(const cv::Point2f* pixels, size_t count,
+                Eigen::Vector3f* outRays, uint8_t* outValid) const override;
+            size_t ProjectPoints(const Eigen::Vector3f* points, size_t count,
+                cv::Point2f* outPixels, uint8_t* outValid) const override;
+            //---------------------------------------------------------------------------------------------------------
+
+            //---------------------------------------------------------------------------------------------------------
+            //! Writes the table to a binary file tagged with the sensor extrinsics it was built for.
+            bool Save(const std::string& filePath, const ExtrinsicsKey& extrinsics) const;
+
+            //! Reads a table written by \ref Save, rejecting it if it was built for different extrinsics.
+            //! The current contents are left untouched on failure.
+            bool Load(const std::string& filePath, const ExtrinsicsKey& extrinsics);
+            //---------------------------------------------------------------------------------------------------------
+
+            //! True once built or loaded.
+            bool IsValid() const { return !m_Rays.empty(); }
+
+            int Width() const { return m_Width; }
+            int Height() const { return m_Height; }
+
+        private:
+            int m_Width = 0;
+            int m_Height = 0;
+            int m_Step = 1;
+            int m_NodesX = 0;
+            int m_NodesY = 0;
+
+            //! Unit rays at each node, xyz interleaved, node (i, j) is pixel (i * step, j * step)
+            std::vector<float> m_Rays;
+    };
+    //-------------------------------------------------------------------------------------------------------------
+}
+
+#endif // RAY_LOOKUP_TABLE_H
@@ -0,0 +1,117 @@
+/** @file       ReflectionBackgroundModel.h
+ *  @brief      Learns world-fixed reflections (bezels, trays, ...) so their blobs can be dropped before matching
+ *
+ *  @author     Hisham Iqbal
+ *  @copyright  &copy; 2023 Hisham Iqbal
+ */
+
+#ifndef REFLECTION_BACKGROUND_MODEL_H
+#define REFLECTION_BACKGROUND_MODEL_H
+
+#include <Eigen/Dense>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "IRTrackerUtils.h"
+
+namespace IRTrackerUtils
+{
+    //-------------------------------------------------------------------------------------------------------------
+    //! @class  ReflectionBackgroundModel
+    //! @brief  Voxel map of world positions where blobs keep appearing without ever belonging to a tool
+    //!
+    //! Works on world-frame blob locations, so a reflector stays in the same cell however the headset moves. A cell
+    //! is learned once a blob that wasn't assigned to any tool has shown up in it for Settings::LearnFrames frames
+    //! in a row (allowing a couple of dropped frames), and forgotten once nothing has been seen there for
+    //! Settings::ForgetFrames frames. Any cell a tool's marker is matched in is cleared, since tools are never
+    //! background.
+    //!
+    //! A tool left out of sight of its matcher (e.g. half occluded) in one place for longer than LearnFrames will
+    //! be learned too. Where that's a risk, let the model learn the empty scene and then \ref SetFrozen.
+    class ReflectionBackgroundModel
+    {
+        public:
+            struct Settings
+            {
+                double      VoxelSize = 0.01;           /*!< Cell edge length in metres, also the suppression radius */
+                uint32_t    LearnFrames = 90;           /*!< Consecutive unassigned sightings before a cell is learned */
+                uint32_t    MaxGapFrames = 2;           /*!< Missed frames that don't break a run of sightings */
+                uint32_t    ForgetFrames = 900;         /*!< Frames without a sighting before a cell is dropped */
+            };
+
+            ReflectionBackgroundModel() = default;
+            explicit ReflectionBackgroundModel(const Settings& settings) : m_Settings(settings) {}
+
+            //---------------------------------------------------------------------------------------------------------
+            //! Flags the blobs that lie on learned reflections.
+            //!
+            //! \param blobs            This frame's validated blobs
+            //! \param outSuppressed    Resized to blobs.Size(), 1 for each blob to drop before matching
+            //! \return                 Number of blobs flagged, also kept for \ref GetSuppressedLastFrame
+            size_t Suppress(const BlobPoints3D& blobs, std::vector<uint8_t>& outSuppressed);
+
+            //! Adds this frame's blobs to the model, does nothing while frozen.
+            //!
+            //! \param blobs            This frame's validated blobs, including any that were suppressed
+            //! \param assignedToTool   Same size as \p blobs, 1 for each blob matched to a tool's marker
+            void Update(const BlobPoints3D& blobs, const std::vector<uint8_t>& assignedToTool);
+            //---------------------------------------------------------------------------------------------------------
+
+            //---------------------------------------------------------------------------------------------------------
+            //! Forgets everything learned and zeroes the counters, the frozen state is kept.
+            void Reset();
+
+            //! While frozen the learned cells are kept as they are, they still suppress blobs.
+            void SetFrozen(bool frozen) { m_Frozen = frozen; }
+            bool IsFrozen() const { return m_Frozen; }
+
+            void SetSettings(const Settings& settings) { m_Settings = settings; }
+            const Settings& GetSettings() const { return m_Settings; }
+            //---------------------------------------------------------------------------------------------------------
+
+            //---------------------------------------------------------------------------------------------------------
+            //! Blobs flagged by the last \ref Suppress call.
+            size_t GetSuppressedLastFrame() const { return m_SuppressedLastFrame; }
+
+            //! Blobs flagged since construction or the last \ref Reset.
+            uint64_t GetSuppressedTotal() const { return m_SuppressedTotal; }
+
+            //! Cells currently learned as background.
+            size_t GetLearnedCount() const { return m_LearnedCount; }
+            //---------------------------------------------------------------------------------------------------------
+
+        private:
+            struct Cell
+            {
+                Eigen::Vector3d     MeanPosition = Eigen::Vector3d::Zero();     /*!< Running mean of the sightings */
+                uint32_t            Sightings = 0;                              /*!< Length of the current run */
+                uint64_t            LastSeenFrame = 0;
+                bool                Learned = false;
+            };
+
+            //! Integer voxel coordinates packed into 21 bits each, +-10 km at 1 cm voxels
+            typedef uint64_t VoxelKey;
+            Eigen::Vector3i VoxelOf(const Eigen::Vector3d& worldPosition) const;
+            static VoxelKey Pack(const Eigen::Vector3i& voxel);
+
+            //! Learned cell within VoxelSize of \p worldPosition, checking the neighbouring voxels too
+            bool NearLearnedCell(const Eigen::Vector3d& worldPosition) const;
+
+            //! Removes every cell within VoxelSize of \p worldPosition
+            void ClearAround(const Eigen::Vector3d& worldPosition);
+
+            void EraseCell(std::unordered_map<VoxelKey, Cell>::iterator it);
+
+            Settings m_Settings;
+            std::unordered_map<VoxelKey, Cell> m_Cells;
+            uint64_t m_Frame = 0;
+            bool m_Frozen = false;
+
+            size_t m_LearnedCount = 0;
+            size_t m_SuppressedLastFrame = 0;
+            uint64_t m_SuppressedTotal = 0;
+    };
+    //-------------------------------------------------------------------------------------------------------------
+}
+
+#endif // REFLECTION_BACKGROUND_MODEL_H
@@ -0,0 +1,153 @@
+#include "pch.h"
+#include "CameraModel.h"
+#include <cmath>
+
+/**
+ * @file        CameraModel.cpp
+ * @brief       Implementations of the \ref IRTrackerUtils::CameraModel types
+ * @author      Hisham Iqbal
+ * @copyright   &copy; Hisham Iqbal 2023
+ *
+ */
+
+namespace // Anonymous helpers
+{
+    //! Newton iterations used to invert the distortion polynomial, converges in a handful for AHAT-like lenses
+    constexpr int UNDISTORT_MAX_ITERATIONS = 20;
+    constexpr float UNDISTORT_TOLERANCE = 1e-6f;
+
+    inline bool InsideImage(float u, float v, int width, int height)
+    {
+        // also false for NaN
+        return u >= -0.5f && v >= -0.5f && u <= width - 0.5f && v <= height - 0.5f;
+    }
+
+    inline void SetInvalid(Eigen::Vector3f& ray, uint8_t& valid) { ray.setZero(); valid = 0; }
+    inline void SetInvalid(cv::Point2f& pixel, uint8_t& valid) { pixel = cv::Point2f(-1.0f, -1.0f); valid = 0; }
+}
+
+namespace IRTrackerUtils
+{
+    ResearchModeCameraModel::ResearchModeCameraModel(UnmapFunction unmapFunction, ProjectFunction projectFunction)
+        : m_Unmap(std::move(unmapFunction)), m_Project(std::move(projectFunction))
+    {
+    }
+
+    size_t ResearchModeCameraModel::UnmapPoints(const cv::Point2f* pixels, size_t count,
+        Eigen::Vector3f* outRays, uint8_t* outValid) const
+    {
+        size_t numValid = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            float uv[2] = { pixels[i].x, pixels[i].y };
+            float xy[2] = { 0.0f, 0.0f };
+            if (!m_Unmap || !m_Unmap(uv, xy)) { SetInvalid(outRays[i], outValid[i]); continue; }
+
+            outRays[i] = Eigen::Vector3f(xy[0], xy[1], 1.0f).normalized();
+            outValid[i] = 1;
+            ++numValid;
+        }
+        return numValid;
+    }
+
+    size_t ResearchModeCameraModel::ProjectPoints(const Eigen::Vector3f* points, size_t count,
+        cv::Point2f* outPixels, uint8_t* outValid) const
+    {
+        size_t numValid = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            const Eigen::Vector3f& p = points[i];
+            if (!m_Project || !(p.z() > 0.0f)) { SetInvalid(outPixels[i], outValid[i]); continue; }
+
+            float xy[2] = { p.x() / p.z(), p.y() / p.z() };
+            float uv[2] = { 0.0f, 0.0f };
+            if (!m_Project(xy, uv)) { SetInvalid(outPixels[i], outValid[i]); continue; }
+
+            outPixels[i] = cv::Point2f(uv[0], uv[1]);
+            outValid[i] = 1;
+            ++numValid;
+        }
+        return numValid;
+    }
+
+    PinholeCameraModel::PinholeCameraModel(const Intrinsics& intrinsics) : m_Intrinsics(intrinsics)
+    {
+    }
+
+    size_t PinholeCameraModel::UnmapPoints(const cv::Point2f* pixels, size_t count,
+        Eigen::Vector3f* outRays, uint8_t* outValid) const
+    {
+        const Intrinsics& k = m_Intrinsics;
+        const float invFx = 1.0f / k.Fx, invFy = 1.0f / k.Fy;
+
+        size_t numValid = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (!InsideImage(pixels[i].x, pixels[i].y, k.Width, k.Height)) { SetInvalid(outRays[i], outValid[i]); continue; }
+
+            const float xd = (pixels[i].x - k.Cx) * invFx;
+            const float yd = (pixels[i].y - k.Cy) * invFy;
+
+            // Newton's method on the distortion polynomial, starting from the distorted location. Unlike the
+            // fixed-point scheme in cv::undistortPoints this still converges towards the edge of wide lenses
+            float x = xd, y = yd;
+            bool converged = false;
+            for (int it = 0; it < UNDISTORT_MAX_ITERATIONS; ++it)
+            {
+                const float r2 = x * x + y * y;
+                const float radial = 1.0f + r2 * (k.K1 + r2 * (k.K2 + r2 * k.K3));
+                const float dRadial = k.K1 + r2 * (2.0f * k.K2 + r2 * 3.0f * k.K3); // d(radial)/d(r2)
+
+                const float ex = x * radial + 2.0f * k.P1 * x * y + k.P2 * (r2 + 2.0f * x * x) - xd;
+                const float ey = y * radial + k.P1 * (r2 + 2.0f * y * y) + 2.0f * k.P2 * x * y - yd;
+
+                const float jxx = radial + 2.0f * x * x * dRadial + 2.0f * k.P1 * y + 6.0f * k.P2 * x;
+                const float jxy = 2.0f * x * y * dRadial + 2.0f * k.P1 * x + 2.0f * k.P2 * y;
+                const float jyx = jxy;
+                const float jyy = radial + 2.0f * y * y * dRadial + 6.0f * k.P1 * y + 2.0f * k.P2 * x;
+                const float det = jxx * jyy - jxy * jyx;
+                if (!(det > 0.0f)) break; // past the fold of the polynomial, the pixel has no unique ray
+
+                const float dx = (jyy * ex - jxy * ey) / det;
+                const float dy = (jxx * ey - jyx * ex) / det;
+                x -= dx; y -= dy;
+                if (std::fabs(dx) + std::fabs(dy) < UNDISTORT_TOLERANCE) { converged = true; break; }
+            }
+
+            if (!converged || !std::isfinite(x) || !std::isfinite(y)) { SetInvalid(outRays[i], outValid[i]); continue; }
+
+            outRays[i] = Eigen::Vector3f(x, y, 1.0f).normalized();
+            outValid[i] = 1;
+            ++numValid;
+        }
+        return numValid;
+    }
+
+    size_t PinholeCameraModel::ProjectPoints(const Eigen::Vector3f* points, size_t count,
+        cv::Point2f* outPixels, uint8_t* outValid) const
+    {
+        const Intrinsics& k = m_Intrinsics;
+
+        size_t numValid = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            const Eigen::Vector3f& p = points[i];
+            if (!(p.z() > 0.0f)) { SetInvalid(outPixels[i], outValid[i]); continue; }
+
+            const float x = p.x() / p.z(), y = p.y() / p.z();
+            const float r2 = x * x + y * y;
+            const float radial = 1.0f + r2 * (k.K1 + r2 * (k.K2 + r2 * k.K3));
+            const float xd = x * radial + 2.0f * k.P1 * x * y + k.P2 * (r2 + 2.0f * x * x);
+            const float yd = y * radial + k.P1 * (r2 + 2.0f * y * y) + 2.0f * k.P2 * x * y;
+
+            const float u = k.Fx * xd + k.Cx;
+            const float v = k.Fy * yd + k.Cy;
+            if (!InsideImage(u, v, k.Width, k.Height)) { SetInvalid(outPixels[i], outValid[i]); continue; }
+
+            outPixels[i] = cv::Point2f(u, v);
+            outValid[i] = 1;
+            ++numValid;
+        }
+        return numValid;
+    }
+}
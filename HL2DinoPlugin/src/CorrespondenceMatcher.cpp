@@ -1,5 +1,19 @@
 #include "pch.h"
 #include "CorrespondenceMatcher.h"
+#include <algorithm>
+#include <limits>
+
+// SIMD path for the distance matrix rows, scalar code is always kept as a fallback/tail handler
+#if defined(_M_ARM64) || defined(__aarch64__)
+#include <arm_neon.h>
+#define IRTRACKER_SIMD_NEON
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define IRTRACKER_SIMD_AVX2
+#elif defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define IRTRACKER_SIMD_SSE2
+#endif
 /**
  * @file        CorrespondenceMatcher.cpp
  * @brief       Implementations for \p CorrespondenceMatcher
@@ -14,6 +28,9 @@ namespace
     // Threshold static definitions, can be tuned to convenience
     static constexpr float  THRESH_FOR_DISTANCE = 0.0025; // metres
     static constexpr double THRESH_FOR_DUPLICATES = 0.001; // metres
+
+    // Width of the distance buckets in ToolSignatureIndex, each lookup then spans two or three of them
+    static constexpr float  SIGNATURE_BUCKET_WIDTH = 2.0f * THRESH_FOR_DISTANCE; // metres
     
     //! @brief Util function for updating a working copy of an index list
     //! @param inputList            List of potential index configurations
@@ -136,6 +153,70 @@ namespace
 
         return true;
     }
+
+    //! @brief Same test \ref FilterByDistance applies, on single precision distances
+    inline bool DistanceMatches(float distance, float refDistance)
+    {
+        return std::fabs(distance - refDistance) <= THRESH_FOR_DISTANCE;
+    }
+
+    //! @brief Row-major distance matrix of \p points, in the single precision the matchers compare in
+    void FillReferenceDistances(const std::vector<Eigen::Vector3d>& points, std::vector<float>& out)
+    {
+        const size_t count = points.size();
+        out.resize(count * count);
+        for (size_t i = 0; i < count; ++i)
+            for (size_t j = 0; j < count; ++j)
+                out[i * count + j] = static_cast<float>((points[i] - points[j]).norm());
+    }
+
+    //! @brief Distances from (\p xi, \p yi, \p zi) to the first \p count points of \p X / \p Y / \p Z
+    void DistanceRow(const float* X, const float* Y, const float* Z, float xi, float yi, float zi, int count, float* out)
+    {
+        int j = 0;
+#if defined(IRTRACKER_SIMD_NEON)
+        const float32x4_t vx = vdupq_n_f32(xi), vy = vdupq_n_f32(yi), vz = vdupq_n_f32(zi);
+        for (; j + 4 <= count; j += 4)
+        {
+            const float32x4_t dx = vsubq_f32(vld1q_f32(X + j), vx);
+            const float32x4_t dy = vsubq_f32(vld1q_f32(Y + j), vy);
+            const float32x4_t dz = vsubq_f32(vld1q_f32(Z + j), vz);
+            const float32x4_t sq = vmlaq_f32(vmlaq_f32(vmulq_f32(dx, dx), dy, dy), dz, dz);
+            vst1q_f32(out + j, vsqrtq_f32(sq));
+        }
+#elif defined(IRTRACKER_SIMD_AVX2)
+        const __m256 vx = _mm256_set1_ps(xi), vy = _mm256_set1_ps(yi), vz = _mm256_set1_ps(zi);
+        for (; j + 8 <= count; j += 8)
+        {
+            const __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(X + j), vx);
+            const __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(Y + j), vy);
+            const __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(Z + j), vz);
+            const __m256 sq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+            _mm256_storeu_ps(out + j, _mm256_sqrt_ps(sq));
+        }
+#elif defined(IRTRACKER_SIMD_SSE2)
+        const __m128 vx = _mm_set1_ps(xi), vy = _mm_set1_ps(yi), vz = _mm_set1_ps(zi);
+        for (; j + 4 <= count; j += 4)
+        {
+            const __m128 dx = _mm_sub_ps(_mm_loadu_ps(X + j), vx);
+            const __m128 dy = _mm_sub_ps(_mm_loadu_ps(Y + j), vy);
+            const __m128 dz = _mm_sub_ps(_mm_loadu_ps(Z + j), vz);
+            const __m128 sq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+            _mm_storeu_ps(out + j, _mm_sqrt_ps(sq));
+        }
+#endif
+        for (; j < count; ++j)
+        {
+            const float dx = X[j] - xi, dy = Y[j] - yi, dz = Z[j] - zi;
+            out[j] = std::sqrt(dx * dx + dy * dy + dz * dz);
+        }
+    }
+
+    inline bool TestBit(const uint64_t* bits, int i) { return (bits[i >> 6] >> (i & 63)) & 1u; }
+    inline bool TestBit(const std::vector<uint64_t>& bits, int i) { return TestBit(bits.data(), i); }
+    inline void SetBit(uint64_t* bits, int i) { bits[i >> 6] |= uint64_t(1) << (i & 63); }
+    inline void SetBit(std::vector<uint64_t>& bits, int i) { bits[i >> 6] |= uint64_t(1) << (i & 63); }
+    inline void ClearBit(std::vector<uint64_t>& bits, int i) { bits[i >> 6] &= ~(uint64_t(1) << (i & 63)); }
 }
 
 namespace CorrespondenceMatcher 
@@ -259,10 +340,317 @@ namespace CorrespondenceMatcher
 
             // Prune options depending on distance between first two points
             FilterByDistance(eucDistMagnitude, indicesList, &CollectedPoints[0]);
+
+            // Nothing left to extend, and CreateIndexList would otherwise start over from an empty list, leaving a 
+            // partial match that looks like a correspondence
+            if (indicesList.empty()) { return false; }
         }
 
         CorrespondenceList = indicesList;
 
         return (CorrespondenceList.size() > 0); // List non-zero if a correspondence was found        
     }    
+
+    void PointDistanceMatrix::Compute(const double* x, const double* y, const double* z, int count)
+    {
+        Resize(count);
+        for (int i = 0; i < count; ++i)
+        {
+            X[i] = static_cast<float>(x[i]);
+            Y[i] = static_cast<float>(y[i]);
+            Z[i] = static_cast<float>(z[i]);
+        }
+        FillDistances();
+    }
+
+    void PointDistanceMatrix::Compute(const std::vector<Eigen::Vector3d>& points)
+    {
+        Resize(static_cast<int>(points.size()));
+        for (int i = 0; i < Count; ++i)
+        {
+            X[i] = static_cast<float>(points[i].x());
+            Y[i] = static_cast<float>(points[i].y());
+            Z[i] = static_cast<float>(points[i].z());
+        }
+        FillDistances();
+    }
+
+    void PointDistanceMatrix::Resize(int count)
+    {
+        Count = count;
+        Stride = (count + 7) & ~7;
+        X.assign(Stride, 0.0f); Y.assign(Stride, 0.0f); Z.assign(Stride, 0.0f);
+        Distances.resize(static_cast<size_t>(count) * Stride);
+    }
+
+    void PointDistanceMatrix::FillDistances()
+    {
+        // a frame rarely has more than ~100 blobs, so the full matrix (rather than one triangle) is still tiny,
+        // and it leaves every lookup a plain row/column read
+        for (int i = 0; i < Count; ++i)
+            DistanceRow(X.data(), Y.data(), Z.data(), X[i], Y[i], Z[i], Count, &Distances[static_cast<size_t>(i) * Stride]);
+    }
+
+    void ToolSignatureIndex::Clear()
+    {
+        m_Entries.clear();
+        m_BucketStart.clear();
+        m_Tools.clear();
+        m_PairCount = 0;
+    }
+
+    size_t ToolSignatureIndex::AddTool(const std::vector<Eigen::Vector3d>& geometry)
+    {
+        ToolInfo info;
+        info.FirstPair = m_PairCount;
+        info.MarkerCount = static_cast<uint32_t>(geometry.size());
+        for (size_t k = 1; k < geometry.size(); ++k)
+            m_Entries.push_back({ static_cast<float>((geometry[k] - geometry[k - 1]).norm()), m_PairCount++ });
+
+        m_Tools.push_back(info);
+        return m_Tools.size() - 1;
+    }
+
+    void ToolSignatureIndex::Finalise()
+    {
+        std::sort(m_Entries.begin(), m_Entries.end(), [](const Entry& a, const Entry& b) { return a.Distance < b.Distance; });
+
+        const size_t buckets = m_Entries.empty() ? 0 : static_cast<size_t>(m_Entries.back().Distance / SIGNATURE_BUCKET_WIDTH) + 1;
+        m_BucketStart.resize(buckets + 1);
+        size_t entry = 0;
+        for (size_t b = 0; b <= buckets; ++b)
+        {
+            const float bucketLow = b * SIGNATURE_BUCKET_WIDTH;
+            while (entry < m_Entries.size() && m_Entries[entry].Distance < bucketLow) ++entry;
+            m_BucketStart[b] = static_cast<uint32_t>(entry);
+        }
+    }
+
+    void ToolSignatureIndex::Query(const PointDistanceMatrix& BlobDistances, const std::vector<uint8_t>& Excluded, ToolShortlist& out) const
+    {
+        const int blobCount = BlobDistances.Count;
+        const int words = (blobCount + 63) / 64;
+        const bool haveExclusions = Excluded.size() == static_cast<size_t>(blobCount);
+        const int buckets = static_cast<int>(m_BucketStart.size()) - 1;
+
+        out.Words = words;
+        out.Count = 0;
+        out.PairBlobs.assign(static_cast<size_t>(m_PairCount) * words, 0);
+        out.MarkerRow.assign(m_Tools.size(), -1);
+        out.MarkerBlobs.clear();
+        if (buckets <= 0) return;
+
+        // every blob pair against the entries near its distance. The bucket either side is checked too, so rounding
+        // at a bucket edge can't hide an entry that DistanceMatches would accept
+        for (int i = 0; i < blobCount; ++i)
+        {
+            if (haveExclusions && Excluded[i]) continue;
+            for (int j = i + 1; j < blobCount; ++j)
+            {
+                if (haveExclusions && Excluded[j]) continue;
+
+                const float distance = BlobDistances(i, j);
+                const int firstBucket = std::max(static_cast<int>((distance - THRESH_FOR_DISTANCE) / SIGNATURE_BUCKET_WIDTH) - 1, 0);
+                if (firstBucket >= buckets) continue;
+
+                for (uint32_t e = m_BucketStart[firstBucket]; e < m_Entries.size(); ++e)
+                {
+                    const Entry& entry = m_Entries[e];
+                    if (entry.Distance > distance + SIGNATURE_BUCKET_WIDTH) break;
+                    if (!DistanceMatches(distance, entry.Distance)) continue;
+
+                    uint64_t* row = &out.PairBlobs[static_cast<size_t>(entry.Pair) * words];
+                    SetBit(row, i);
+                    SetBit(row, j);
+                }
+            }
+        }
+
+        // a blob can only take marker k if it's at the right distance from some blob for marker k-1 and for k+1
+        int rows = 0;
+        for (size_t t = 0; t < m_Tools.size(); ++t)
+        {
+            const ToolInfo& tool = m_Tools[t];
+            if (tool.MarkerCount < 3) continue;
+
+            out.MarkerRow[t] = rows;
+            out.MarkerBlobs.resize(static_cast<size_t>(rows + tool.MarkerCount) * words);
+
+            bool possible = true;
+            for (uint32_t k = 0; k < tool.MarkerCount && possible; ++k)
+            {
+                uint64_t* markerRow = &out.MarkerBlobs[static_cast<size_t>(rows + k) * words];
+                const uint64_t* before = (k > 0) ? &out.PairBlobs[static_cast<size_t>(tool.FirstPair + k - 1) * words] : nullptr;
+                const uint64_t* after = (k + 1 < tool.MarkerCount) ? &out.PairBlobs[static_cast<size_t>(tool.FirstPair + k) * words] : nullptr;
+
+                uint64_t any = 0;
+                for (int w = 0; w < words; ++w)
+                {
+                    markerRow[w] = (before ? before[w] : ~uint64_t(0)) & (after ? after[w] : ~uint64_t(0));
+                    any |= markerRow[w];
+                }
+                possible = any != 0;
+            }
+
+            if (!possible) { out.MarkerRow[t] = -1; continue; }
+            rows += tool.MarkerCount;
+            ++out.Count;
+        }
+        out.MarkerBlobs.resize(static_cast<size_t>(rows) * words);
+    }
+
+    bool FindPointCorrespondence(const std::vector<Eigen::Vector3d>& ReferencePoints,
+        const std::vector<Eigen::Vector3d>& CollectedPoints,
+        std::vector<int>& outIndices,
+        MatchScratch& scratch,
+        MatchMode mode)
+    {
+        // Need at least three points to match
+        if (ReferencePoints.size() < 3 || CollectedPoints.size() < 3) return false;
+
+        scratch.CollectedDistances.Compute(CollectedPoints);
+        static const std::vector<uint8_t> noExclusions;
+        return FindPointCorrespondence(ReferencePoints, scratch.CollectedDistances, noExclusions, outIndices, scratch, mode);
+    }
+
+    bool FindPointCorrespondence(const std::vector<Eigen::Vector3d>& ReferencePoints,
+        const PointDistanceMatrix& CollectedDistances,
+        const std::vector<uint8_t>& Excluded,
+        std::vector<int>& outIndices,
+        MatchScratch& scratch,
+        MatchMode mode,
+        const uint64_t* AllowedBlobs)
+    {
+        const int refCount = static_cast<int>(ReferencePoints.size());
+        const int blobCount = CollectedDistances.Count;
+        const int words = (blobCount + 63) / 64;
+        const bool haveExclusions = Excluded.size() == static_cast<size_t>(blobCount);
+
+        // Need at least three points to match
+        if (refCount < 3 || blobCount < 3) return false;
+
+        // assign() keeps capacity, so after the first few frames none of this allocates
+        scratch.UsedBlobs.assign(words, 0);
+        scratch.Assignment.assign(refCount, -1);
+        scratch.PartialCost.assign(refCount + 1, 0.0);
+        FillReferenceDistances(ReferencePoints, scratch.RefDistances);
+
+        // excluded points and duplicates are marked as used up front rather than erased, which would shift the 
+        // caller's indices
+        int available = blobCount;
+        for (int i = 0; i < blobCount; ++i)
+        {
+            if (haveExclusions && Excluded[i]) { SetBit(scratch.UsedBlobs, i); --available; continue; }
+            for (int j = 0; j < i; ++j)
+            {
+                if (TestBit(scratch.UsedBlobs, j) || CollectedDistances(i, j) >= THRESH_FOR_DUPLICATES) continue;
+                SetBit(scratch.UsedBlobs, i);
+                --available;
+                break;
+            }
+        }
+        if (available < refCount) return false;
+
+        std::vector<int>& assignment = scratch.Assignment;
+        double bestCost = std::numeric_limits<double>::infinity();
+        bool found = false;
+
+        int depth = 0;
+        while (depth >= 0)
+        {
+            // step this depth on to its next candidate, releasing whichever blob it held
+            int candidate = assignment[depth];
+            if (candidate >= 0) ClearBit(scratch.UsedBlobs, candidate);
+
+            for (++candidate; candidate < blobCount; ++candidate)
+            {
+                if (TestBit(scratch.UsedBlobs, candidate)) continue;
+                if (AllowedBlobs && !TestBit(AllowedBlobs + static_cast<size_t>(depth) * words, candidate)) continue;
+                if (depth > 0 && !DistanceMatches(CollectedDistances(candidate, assignment[depth - 1]),
+                    scratch.RefDistances[depth * refCount + depth - 1])) continue;
+
+                if (mode == MatchMode::Best)
+                {
+                    // error against every point already placed, a branch that's already worse than the best can't recover
+                    double cost = scratch.PartialCost[depth];
+                    for (int k = 0; k < depth; ++k)
+                    {
+                        const double residual = CollectedDistances(candidate, assignment[k]) - scratch.RefDistances[depth * refCount + k];
+                        cost += residual * residual;
+                    }
+                    if (cost >= bestCost) continue;
+                    scratch.PartialCost[depth + 1] = cost;
+                }
+                break;
+            }
+
+            if (candidate >= blobCount) // this depth is exhausted, backtrack
+            {
+                assignment[depth] = -1;
+                --depth;
+                continue;
+            }
+
+            assignment[depth] = candidate;
+            SetBit(scratch.UsedBlobs, candidate);
+
+            if (depth + 1 < refCount) { ++depth; continue; }
+
+            // full match, the bitset bit is released when this depth steps on
+            outIndices.assign(assignment.begin(), assignment.end());
+            found = true;
+            if (mode == MatchMode::First) break;
+            bestCost = scratch.PartialCost[refCount];
+        }
+
+        return found;
+    }
+
+    bool TrackPointCorrespondence(const std::vector<Eigen::Vector3d>& ReferencePoints,
+        const std::vector<Eigen::Vector3d>& PredictedPoints,
+        const PointDistanceMatrix& CollectedDistances,
+        const std::vector<uint8_t>& Excluded,
+        double gateRadius,
+        std::vector<int>& outIndices,
+        MatchScratch& scratch)
+    {
+        const int refCount = static_cast<int>(ReferencePoints.size());
+        const int blobCount = CollectedDistances.Count;
+        const bool haveExclusions = Excluded.size() == static_cast<size_t>(blobCount);
+        if (refCount < 3 || blobCount < refCount || PredictedPoints.size() != ReferencePoints.size()) return false;
+
+        // nearest neighbour per predicted marker, a blob taken twice means the prediction is too far off to trust
+        const float gate2 = static_cast<float>(gateRadius * gateRadius);
+        scratch.UsedBlobs.assign((blobCount + 63) / 64, 0);
+        scratch.Assignment.assign(refCount, -1);
+        for (int k = 0; k < refCount; ++k)
+        {
+            const float px = static_cast<float>(PredictedPoints[k].x());
+            const float py = static_cast<float>(PredictedPoints[k].y());
+            const float pz = static_cast<float>(PredictedPoints[k].z());
+
+            int nearest = -1;
+            float nearest2 = gate2;
+            for (int j = 0; j < blobCount; ++j)
+            {
+                if (haveExclusions && Excluded[j]) continue;
+                const float dx = CollectedDistances.X[j] - px, dy = CollectedDistances.Y[j] - py, dz = CollectedDistances.Z[j] - pz;
+                const float d2 = dx * dx + dy * dy + dz * dz;
+                if (d2 <= nearest2) { nearest2 = d2; nearest = j; }
+            }
+
+            if (nearest < 0 || TestBit(scratch.UsedBlobs, nearest)) return false;
+            SetBit(scratch.UsedBlobs, nearest);
+            scratch.Assignment[k] = nearest;
+        }
+
+        // the same distance test as the search, over every pair so a marker that snapped to a stray blob is caught
+        FillReferenceDistances(ReferencePoints, scratch.RefDistances);
+        for (int i = 1; i < refCount; ++i)
+            for (int j = 0; j < i; ++j)
+                if (!DistanceMatches(CollectedDistances(scratch.Assignment[i], scratch.Assignment[j]), scratch.RefDistances[i * refCount + j])) return false;
+
+        outIndices.assign(scratch.Assignment.begin(), scratch.Assignment.end());
+        return true;
+    }
 }
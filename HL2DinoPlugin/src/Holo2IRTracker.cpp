@@ -4,6 +4,7 @@
 #include "Eigen/Dense"
 #include <vector>
 #include <map>
+#include <algorithm>
 #include <opencv2/core.hpp>   
 #include <functional>
 #include "Shiny.h"
@@ -24,69 +25,89 @@ constexpr int IMG_HEIGHT = 512;
 
 constexpr bool USE_REFINED_BLOB_DETECT = false;
 
+// If true, the AB image is rebalanced and binarised in a single vectorised pass (see
+// IRTrackerUtils::ImageProc::RebalanceAndBinarise), otherwise the original shift/convert/threshold chain is used
+constexpr bool USE_FUSED_AB_FRONTEND = true;
+
+// If true, ProcessLatestFrames wraps the sensor buffers it's given instead of copying them, see
+// Holo2IRTracker::SetZeroCopyIngestion
+constexpr bool USE_ZERO_COPY_INGESTION = true;
+
+// First takes the lowest-index match, the same one the original list-based matcher picked. Best scores every 
+// pairwise distance, which tells apart tools whose consecutive marker distances are alike
+constexpr CorrespondenceMatcher::MatchMode CORRESPONDENCE_MATCH_MODE = CorrespondenceMatcher::MatchMode::First;
+
+// If true, tools visible last frame are first looked for around their last pose (see 
+// CorrespondenceMatcher::TrackPointCorrespondence), and only searched for in full if that fails
+constexpr bool USE_TEMPORAL_SEEDING = true;
+
+// Furthest a marker may move between frames and still be tracked, ~0.9 m/s at 45 fps. Kept below the usual marker
+// spacing, so a prediction rarely has two blobs to choose between
+constexpr double TRACKING_GATE_RADIUS = 0.02; // metres
+
+// If true (and frames carry timestamps), every tool's pose is filtered by an IRTrackerUtils::PosePredictor. Its
+// prediction for the new frame places the ROI search windows and seeds the tracking above, in place of the last pose
+constexpr bool USE_POSE_PREDICTION = true;
+
 namespace // Anonymous Helper Functions
 {
     //! @brief Walk through \p validBlobData to figure out if there are any blobs corresponding to tools in the \p toolDictionary
     //! @param validBlobData    Info about blobs detected in the latest frame
     //! @param toolDictionary   Tool dictionary that we will transform if there are any blobs from tools stored in the dictionary
-    void TryUpdatingToolDictionary(std::vector<IRTrackerUtils::InfraBlobInfo>& validBlobData, std::map<uint8_t, IRTrackerUtils::TrackedTool>& toolDictionary)
+    //! @param matchScratch     Working buffers for CorrespondenceMatcher::FindPointCorrespondence
+    //! @param blobDistances    Filled with this frame's blob-to-blob distances, shared by every tool's search
+    //! @param blobExcluded     Filled with 1 for each blob that's suppressed or already claimed by a tool
+    //! @param toolIndex        Distance signatures of the tools in \p toolDictionary, in map order, or empty to search for every tool
+    //! @param shortlist        Filled with the tools \p toolIndex finds could be present
+    //! @param suppressed       Optional, same size as \p validBlobData, blobs flagged 1 are left out of the matching
+    //! @param outAssigned      Optional, resized to validBlobData.Size() with 1 for each blob matched to a tool
+    //! @param predictors       Optional, per tool ID, tracking starts from their pose at \p timestamp instead of the last pose
+    //! @param timestamp        This frame's timestamp, in 100 ns ticks
+    //! @return                 Number of tools found by tracking from their last pose, rather than by a full search
+    size_t TryUpdatingToolDictionary(const IRTrackerUtils::BlobPoints3D& validBlobData, std::map<uint8_t, IRTrackerUtils::TrackedTool>& toolDictionary,
+        CorrespondenceMatcher::MatchScratch& matchScratch, CorrespondenceMatcher::PointDistanceMatrix& blobDistances, 
+        std::vector<uint8_t>& blobExcluded, const CorrespondenceMatcher::ToolSignatureIndex& toolIndex, CorrespondenceMatcher::ToolShortlist& shortlist,
+        const std::vector<uint8_t>* suppressed = nullptr, std::vector<uint8_t>* outAssigned = nullptr, 
+        const std::map<uint8_t, IRTrackerUtils::PosePredictor>* predictors = nullptr, uint64_t timestamp = 0)
     {
         PROFILE_BLOCK(ToolDictionaryUpdate);
-        using namespace Eigen;
         using namespace IRTrackerUtils;
-        // vectorise validBlobData members for easy access later
-        // cache these vectors?
-        std::vector<Vector3d> collectedPoints; collectedPoints.reserve(validBlobData.size());
-        std::vector<Vector3d> collectedDepthPoints; collectedDepthPoints.reserve(validBlobData.size());
-        std::vector<cv::Point2i> blobPixelLocations; blobPixelLocations.reserve(validBlobData.size());
+        const size_t blobCount = validBlobData.Size();
 
-        for (const InfraBlobInfo& blob : validBlobData)
-        {
-            // used for registration to holographic world frame
-            collectedPoints.emplace_back(blob.WorldLocation);
+        // every distance between this frame's blobs, once, in place of each tool's search working them out again
+        PROFILE_BEGIN(ComputingBlobDistances);
+        const auto world = validBlobData.WorldLocations();
+        blobDistances.Compute(world.col(0).data(), world.col(1).data(), world.col(2).data(), static_cast<int>(blobCount));
+        PROFILE_END();
 
-            // stored in case we do any depth cam specific calculations
-            collectedDepthPoints.emplace_back(blob.DepthLocation);
+        // blobs found to belong to a tool are masked out for the tools after it, rather than erased
+        if (suppressed && suppressed->size() == blobCount) blobExcluded = *suppressed;
+        else blobExcluded.assign(blobCount, 0);
+        if (outAssigned) outAssigned->assign(blobCount, 0);
 
-            // stored for image labelling purpose
-            blobPixelLocations.emplace_back(blob.PixelCoordinate);
-        }
+        std::vector<int> indexList;
+        std::vector<Eigen::Vector3d> predictedPoints;
+        size_t trackedTools = 0;
 
-        typedef std::vector<std::vector<int>> ConfigurationList;
-        for (auto& [_, tool] : toolDictionary)
+        // fills in the tool's observations and pose from indexList, and claims its blobs from the tools after it
+        auto acceptMatch = [&](TrackedTool& tool)
         {
-            // initialise / zero appropriate values
-            tool.PoseMatrix_HoloWorld = Eigen::Matrix4d::Identity();
-            tool.VisibleToHoloLens = false;
-            tool.ObservedImgKeypoints.clear();
-            tool.ObservedPoints_Depth.clear();
-            tool.ObservedPoints_World.clear();
-
-            ConfigurationList candidateList;
-            PROFILE_BEGIN(FindingPointCorrespondence);
-            bool toolNotFound = !CorrespondenceMatcher::GetPointCorrespondence(tool.GeometryPoints, collectedPoints, candidateList);
-            PROFILE_END();
-            if (toolNotFound) { continue; }
-
-            if (candidateList.size() == 0) { continue; } // this shouldn't happen, but just in case
-            std::vector<int> indexList = candidateList[0];
-
             /**
              * for loop which correctly assigns and orders observed points so it
              * matches the correspondence order of the reference points
              */
             for (const auto& idx : indexList)
             {
-                if (idx > -1 && idx < collectedPoints.size())
+                if (idx > -1 && idx < blobCount)
                 {
-                    tool.ObservedPoints_World.emplace_back(collectedPoints[idx]);
-                    tool.ObservedPoints_Depth.emplace_back(collectedDepthPoints[idx]);
-                    tool.ObservedImgKeypoints.emplace_back(blobPixelLocations[idx]);
+                    tool.ObservedPoints_World.emplace_back(validBlobData.WorldLocation(idx));
+                    tool.ObservedPoints_Depth.emplace_back(validBlobData.DepthLocation(idx));
+                    tool.ObservedImgKeypoints.emplace_back(cv::Point2i(validBlobData.PixelCoordinates[idx]));
                 }
             }
 
             // this shouldn't be the case, but just for safety
-            if (tool.GeometryPoints.size() != tool.ObservedPoints_World.size()) continue;
+            if (tool.GeometryPoints.size() != tool.ObservedPoints_World.size()) return;
 
             // gives us the transform from tool coordinate frame to HL2 world frame, aka, the pose of the
             // tool in the virtual world
@@ -98,22 +119,74 @@ namespace // Anonymous Helper Functions
 
             tool.VisibleToHoloLens = true; // hooray
 
-            /// Section:Remove points associated with a found tool to reduce our search size 
+            /// Section:Mask out points associated with a found tool to reduce our search size 
             /// in the next loop
+            for (const int idx : indexList)
+            {
+                blobExcluded[idx] = 1;
+                if (outAssigned) (*outAssigned)[idx] = 1;
+            }
+        };
 
-            // sorts smallest to largest
-            std::sort(indexList.begin(), indexList.end());
-
-            // iterate from right to left to delete largest indices first
-            for (auto it = indexList.crbegin(); it != indexList.crend(); ++it)
+        // 1) tools seen last frame barely move between frames, so their markers are looked for where last frame's
+        // pose, or the motion model's prediction from it, puts them. Tracked tools claim their blobs before any search runs
+        for (auto& [id, tool] : toolDictionary)
+        {
+            const bool wasVisible = tool.VisibleToHoloLens;
+            Eigen::Matrix4d lastPose = tool.PoseMatrix_HoloWorld;
+            if (wasVisible && predictors)
             {
-                const int idx = *(it);
-                validBlobData.erase(validBlobData.begin() + idx);
-                collectedPoints.erase(collectedPoints.begin() + idx);
-                blobPixelLocations.erase(blobPixelLocations.begin() + idx);
-                collectedDepthPoints.erase(collectedDepthPoints.begin() + idx);
+                const auto predictor = predictors->find(id);
+                if (predictor != predictors->end()) predictor->second.Predict(timestamp, lastPose);
             }
+
+            // initialise / zero appropriate values
+            tool.PoseMatrix_HoloWorld = Eigen::Matrix4d::Identity();
+            tool.VisibleToHoloLens = false;
+            tool.ObservedImgKeypoints.clear();
+            tool.ObservedPoints_Depth.clear();
+            tool.ObservedPoints_World.clear();
+            if (!USE_TEMPORAL_SEEDING || !wasVisible) { continue; }
+
+            predictedPoints.clear();
+            for (const auto& point : tool.GeometryPoints) predictedPoints.emplace_back(lastPose.topLeftCorner<3, 3>() * point + lastPose.topRightCorner<3, 1>());
+
+            PROFILE_BEGIN(TrackingPointCorrespondence);
+            const bool tracked = CorrespondenceMatcher::TrackPointCorrespondence(tool.GeometryPoints, predictedPoints, blobDistances, 
+                blobExcluded, TRACKING_GATE_RADIUS, indexList, matchScratch);
+            PROFILE_END();
+            if (!tracked) { continue; }
+
+            acceptMatch(tool);
+            if (tool.VisibleToHoloLens) ++trackedTools;
+        }
+
+        // 2) full search for everything else, after ruling out tools whose marker distances aren't among the blobs
+        const bool useShortlist = toolIndex.ToolCount() == toolDictionary.size();
+        if (useShortlist)
+        {
+            PROFILE_BEGIN(ShortlistingTools);
+            toolIndex.Query(blobDistances, blobExcluded, shortlist);
+            PROFILE_END();
+        }
+
+        size_t slot = 0;
+        for (auto& [_, tool] : toolDictionary)
+        {
+            const size_t toolSlot = slot++;
+            if (tool.VisibleToHoloLens) { continue; } // tracked above
+            if (useShortlist && !shortlist.IsCandidate(toolSlot)) { continue; }
+
+            PROFILE_BEGIN(FindingPointCorrespondence);
+            bool toolNotFound = !CorrespondenceMatcher::FindPointCorrespondence(tool.GeometryPoints, blobDistances, blobExcluded, 
+                indexList, matchScratch, CORRESPONDENCE_MATCH_MODE, useShortlist ? shortlist.AllowedBlobs(toolSlot) : nullptr);
+            PROFILE_END();
+            if (toolNotFound) { continue; }
+
+            acceptMatch(tool);
         }
+
+        return trackedTools;
     }
     
     // could be deprecated in final version
@@ -192,93 +265,420 @@ namespace // Anonymous Helper Functions
 Holo2IRTracker::Holo2IRTracker()
 {
     // initialise caches
-	m_cache_frameBlobInfo.reserve(100);
+	m_cache_frameBlobs3D.PixelCoordinates.reserve(100);
+	m_cache_frameBlobs3D.DepthXYZ.reserve(300);
+	m_cache_frameBlobs3D.WorldXYZ.reserve(300);
 	m_cache_frameBlobPixelLocations.reserve(100);
+	m_cache_frameBlobAreas.reserve(100);
 
     // assign space for these 'cache' cv::Mats
-    m_ABImg16bit = cv::Mat(IMG_HEIGHT,IMG_WIDTH, CV_16UC1);
-    m_DepthImg16bit = cv::Mat(IMG_HEIGHT,IMG_WIDTH, CV_16UC1);
+    m_ABImg16bitOwned = cv::Mat(IMG_HEIGHT,IMG_WIDTH, CV_16UC1);
+    m_DepthImg16bitOwned = cv::Mat(IMG_HEIGHT,IMG_WIDTH, CV_16UC1);
+    m_SigmaImg8bitOwned = cv::Mat(IMG_HEIGHT,IMG_WIDTH, CV_8UC1);
+    m_ABImg16bit = m_ABImg16bitOwned;
+    m_DepthImg16bit = m_DepthImg16bitOwned;
+    m_ZeroCopyIngestion = USE_ZERO_COPY_INGESTION;
+    IRTrackerUtils::ImageProc::BuildDepthDisplayLUT(0, 1000, m_DepthDisplayLUT);
+    IRTrackerUtils::ImageProc::BuildABDisplayLUT(m_ABDisplayLUT);
     
     m_ABImg8bit = cv::Mat(IMG_HEIGHT,IMG_WIDTH, CV_8UC1);
+    m_ABBinaryMask8bit = cv::Mat(IMG_HEIGHT,IMG_WIDTH, CV_8UC1);
 
     m_DepthDisplayImg8bit = cv::Mat(IMG_HEIGHT,IMG_WIDTH, CV_8UC1);
     m_ABDisplayImg8bit = cv::Mat(IMG_HEIGHT,IMG_WIDTH, CV_8UC1);
+
+    using IRTrackerUtils::ImageProc::BlobDetectionMethod;
+    if constexpr (USE_REFINED_BLOB_DETECT) { m_BlobDetectionMethod = BlobDetectionMethod::RefineByScaling; }
+    else m_BlobDetectionMethod = BlobDetectionMethod::Basic;
 }
 
 Holo2IRTracker::Holo2IRTracker(const std::string& encodedString, bool JSONString) : Holo2IRTracker()
 {
     if (!JSONString) SetToolListFromString(encodedString, m_ToolDictionary);
     else IRTrackerUtils::JSONUtils::FillToolDictionaryFromJSONString(encodedString, m_ToolDictionary);
+
+    // the catalogue is fixed from here on, so its distance signatures are indexed once. Slots follow map order
+    for (const auto& [_, tool] : m_ToolDictionary) m_ToolIndex.AddTool(tool.GeometryPoints);
+    m_ToolIndex.Finalise();
+
+    // one motion model per tool, all made here so the map never changes shape while frames are processed
+    for (const auto& [id, _] : m_ToolDictionary) m_PosePredictors.emplace(id, IRTrackerUtils::PosePredictor());
 }
 
-void Holo2IRTracker::ProcessLatestFrames(const uint16_t* ABImg, const uint16_t* DepthImg, 
-    const Eigen::Ref<Eigen::Matrix4d> depth2world, const bool& UpdateDisplayImages)
+void Holo2IRTracker::ProcessLatestFrames(const IRTrackerUtils::SensorFrame& frame, const bool& UpdateDisplayImages)
 {
     // main control loop function of this class
     using namespace IRTrackerUtils::ImageProc;
 
     // 1) Clear caches
-    m_cache_frameBlobInfo.clear();
+    m_cache_frameBlobs3D.Clear();
     m_cache_frameBlobPixelLocations.clear();
+    m_cache_frameBlobAreas.clear();
 
     // 2) Convert our sensor images to cv::Mats
-    PROFILE_BEGIN(CVMatCreation);
-    NativeToCVMat(ABImg, m_ABImg16bit, IMG_HEIGHT, IMG_WIDTH);
-    NativeToCVMat(DepthImg, m_DepthImg16bit, IMG_HEIGHT, IMG_WIDTH);
-    PROFILE_END();
+    IngestFrames(frame);
 
-    // 3) Process the IR image to brighten it so we can detect contours
-    RebalanceImgAnd8Bit(m_ABImg16bit, m_ABImg8bit);
-    
-    if (UpdateDisplayImages) { 
-        // clone it before blob detection does any more processing on m_ABImg8bit
-        std::copy(m_ABImg8bit.datastart, m_ABImg8bit.dataend, m_ABDisplayImg8bit.data);        
-    }
+    // 3) & 4) Brighten/binarise the IR image and find some circular looking blobs in 2D, either over the whole
+    // frame or only around the markers we tracked last frame
+    PrepareSearchROIs(frame);
+    DetectBlobsInLatestFrame(UpdateDisplayImages);
 
-    BlobDetectionMethod method;
-    if constexpr (USE_REFINED_BLOB_DETECT) { method = BlobDetectionMethod::RefineByScaling; }
-    else method = BlobDetectionMethod::Basic;
-
-    // 4) Find some circular looking blobs in 2D
-    DetectBlobs2D(m_ABImg8bit, method, m_cache_frameBlobPixelLocations);
+    // next frame's threshold, from whatever this frame contributed to the running histogram
+    if (m_UseAdaptiveThreshold) UpdateAdaptiveThreshold(m_cache_frameHistogram, m_AdaptiveThresholdSettings, m_AdaptiveThresholdState);
     
     // 5) Check if these circular blobs have meaningful depth locations and thus if they're 'valid' or not
-    ValidateBlobs3D(m_DepthImg16bit, depth2world, m_cache_frameBlobPixelLocations, m_MapImageToUnitPlane, m_cache_frameBlobInfo);
+    Eigen::Matrix4d depth2world = frame.Depth2World; // the utils take a mutable Ref
+    ValidateLatestBlobs(depth2world);
+    const auto* posePredictors = (USE_POSE_PREDICTION && frame.Timestamp != 0) ? &m_PosePredictors : nullptr;
+
+    // 6) Examine all the valid 3D blobs in this frame, less any on learned background reflections, and then check
+    // if they correspond to tools we're tracking
+    if (m_UseBackgroundModel)
+    {
+        PROFILE_BEGIN(BackgroundSuppression);
+        m_BackgroundModel.Suppress(m_cache_frameBlobs3D, m_cache_backgroundSuppressed);
+        PROFILE_END();
+        m_LatestFrameStatistics.TrackedTools = TryUpdatingToolDictionary(m_cache_frameBlobs3D, m_ToolDictionary, m_cache_matchScratch, 
+            m_cache_blobDistances, m_cache_blobExcluded, m_ToolIndex, m_cache_toolShortlist, &m_cache_backgroundSuppressed, &m_cache_assignedToTool, 
+            posePredictors, frame.Timestamp);
+        m_BackgroundModel.Update(m_cache_frameBlobs3D, m_cache_assignedToTool);
+    }
+    else m_LatestFrameStatistics.TrackedTools = TryUpdatingToolDictionary(m_cache_frameBlobs3D, m_ToolDictionary, m_cache_matchScratch, 
+        m_cache_blobDistances, m_cache_blobExcluded, m_ToolIndex, m_cache_toolShortlist, nullptr, nullptr, posePredictors, frame.Timestamp);
+    CheckForLostTools();
 
-    // 6) Examine all the valid 3D blobs in this frame, and then check if they correspond to tools we're tracking
-    TryUpdatingToolDictionary(m_cache_frameBlobInfo, m_ToolDictionary);
+    // fold this frame's poses into the motion models, tools that weren't seen coast until they time out
+    if (posePredictors)
+    {
+        for (const auto& [id, tool] : m_ToolDictionary)
+        {
+            if (tool.VisibleToHoloLens) m_PosePredictors[id].Update(tool.PoseMatrix_HoloWorld, frame.Timestamp);
+        }
+    }
 
-    // 7) Optionally label and store our images for display elsewhere
+    m_LatestFrameStatistics.Timestamp = frame.Timestamp;
+    m_LatestFrameStatistics.Blobs2D = m_cache_frameBlobPixelLocations.size();
+    m_LatestFrameStatistics.Blobs3D = m_cache_frameBlobs3D.Size();
+    m_LatestFrameStatistics.ShortlistedTools = (m_ToolIndex.ToolCount() == m_ToolDictionary.size()) ? 
+        m_cache_toolShortlist.Count : m_ToolDictionary.size() - m_LatestFrameStatistics.TrackedTools;
+    m_LatestFrameStatistics.BackgroundSuppressed = m_UseBackgroundModel ? m_BackgroundModel.GetSuppressedLastFrame() : 0;
+    m_LatestFrameStatistics.VisibleTools = 0;
+    for (const auto& [_, tool] : m_ToolDictionary) { if (tool.VisibleToHoloLens) ++m_LatestFrameStatistics.VisibleTools; }
+
+    // 7) Optionally label and store our images for RetrieveDisplayImages, the Render* getters don't need this
     if (UpdateDisplayImages)
     {
         // add crosses at tool marker centres on the IR response image 
+        PROFILE_BEGIN(AnnotatingImages);
         LabelImageWithToolDictData(m_ToolDictionary, m_ABDisplayImg8bit);
+        PROFILE_END();
 
         // process the depth image to produce an 8bit depth display texture
-        GetProcessed8BitDepthImg(m_DepthImg16bit, m_DepthDisplayImg8bit);
+        PROFILE_BEGIN(ProcessingDepthImg);
+        ApplyDisplayLUT(m_DepthImg16bit, m_DepthDisplayLUT, m_DepthDisplayImg8bit);
+        PROFILE_END();
     }
+
+    ReleaseFrames();
+}
+
+void Holo2IRTracker::ProcessLatestFrames(const uint16_t* ABImg, const uint16_t* DepthImg, 
+    const Eigen::Ref<Eigen::Matrix4d> depth2world, const bool& UpdateDisplayImages)
+{
+    IRTrackerUtils::SensorFrame frame;
+    frame.ABImage = ABImg;
+    frame.DepthImage = DepthImg;
+    frame.Depth2World = depth2world;
+    ProcessLatestFrames(frame, UpdateDisplayImages);
 }
 
 void Holo2IRTracker::ProcessLatestFrames(const uint16_t* ABImg, const uint16_t* DepthImg, const Eigen::Ref<Eigen::Matrix4d> depth2world)
 {
-	using namespace IRTrackerUtils::ImageProc;
+    ProcessLatestFrames(ABImg, DepthImg, depth2world, false);
+}
 
-    m_cache_frameBlobInfo.clear();
-    m_cache_frameBlobPixelLocations.clear();
+void Holo2IRTracker::ValidateLatestBlobs(const Eigen::Ref<Eigen::Matrix4d> depth2world)
+{
+    using namespace IRTrackerUtils::ImageProc;
+    // without a camera model we can't place anything in 3D
+    if (!m_CameraModel) { m_cache_frameBlobs3D.Clear(); return; }
+    ValidateBlobs3DBatch(m_DepthImg16bit, depth2world, m_cache_frameBlobPixelLocations, *m_CameraModel, m_cache_frameBlobs3D, 
+        m_SigmaImg8bit, m_cache_frameBlobAreas, m_MarkerSize);
+}
+
+void Holo2IRTracker::IngestFrames(const IRTrackerUtils::SensorFrame& frame)
+{
+    using namespace IRTrackerUtils::ImageProc;
+    PROFILE_BEGIN(CVMatCreation);
+    m_LatestFrameTimestamp = frame.Timestamp;
+    if (m_ZeroCopyIngestion)
+    {
+        // headers only, nothing downstream writes into its input so casting away const here is safe
+        m_ABImg16bit = cv::Mat(IMG_HEIGHT, IMG_WIDTH, CV_16UC1, const_cast<uint16_t*>(frame.ABImage));
+        m_DepthImg16bit = cv::Mat(IMG_HEIGHT, IMG_WIDTH, CV_16UC1, const_cast<uint16_t*>(frame.DepthImage));
+        m_SigmaImg8bit = frame.SigmaImage ? cv::Mat(IMG_HEIGHT, IMG_WIDTH, CV_8UC1, const_cast<uint8_t*>(frame.SigmaImage)) : cv::Mat();
+    }
+    else
+    {
+        NativeToCVMat(frame.ABImage, m_ABImg16bitOwned, IMG_HEIGHT, IMG_WIDTH);
+        NativeToCVMat(frame.DepthImage, m_DepthImg16bitOwned, IMG_HEIGHT, IMG_WIDTH);
+        if (frame.SigmaImage) NativeToCVMat(frame.SigmaImage, m_SigmaImg8bitOwned, IMG_HEIGHT, IMG_WIDTH);
+        m_SigmaImg8bit = frame.SigmaImage ? m_SigmaImg8bitOwned : cv::Mat();
+    }
+    PROFILE_END();
+}
 
-    NativeToCVMat(ABImg, m_ABImg16bit, IMG_HEIGHT, IMG_WIDTH);
-    NativeToCVMat(DepthImg, m_DepthImg16bit, IMG_HEIGHT, IMG_WIDTH);
+void Holo2IRTracker::ReleaseFrames()
+{
+    // the caller is free to release its sensor frame once ProcessLatestFrames returns
+    m_ABImg16bit = m_ABImg16bitOwned;
+    m_DepthImg16bit = m_DepthImg16bitOwned;
+    m_SigmaImg8bit = cv::Mat();
+}
+
+void Holo2IRTracker::PrepareSearchROIs(const IRTrackerUtils::SensorFrame& frame)
+{
+    using namespace IRTrackerUtils::ImageProc;
+    m_cache_searchROIs.clear();
 
-    RebalanceImgAnd8Bit(m_ABImg16bit, m_ABImg8bit);
+    m_cache_visibleToolsBefore.clear();
+    for (const auto& [id, tool] : m_ToolDictionary) { if (tool.VisibleToHoloLens) m_cache_visibleToolsBefore.push_back(id); }
 
-    BlobDetectionMethod method;
-    if (USE_REFINED_BLOB_DETECT) method = BlobDetectionMethod::RefineByScaling;
-    else method = BlobDetectionMethod::Basic;
-    
-    DetectBlobs2D(m_ABImg8bit, method, m_cache_frameBlobPixelLocations);
-    ValidateBlobs3D(m_DepthImg16bit, depth2world, m_cache_frameBlobPixelLocations, m_MapImageToUnitPlane, m_cache_frameBlobInfo);
+    if (!m_UseROISearch) return;
+
+    // periodic full frame scans let us acquire tools which weren't visible before
+    if (m_ForceFullFrameScan || m_FramesSinceFullScan >= m_ROIFullScanInterval)
+    {
+        m_ForceFullFrameScan = false;
+        m_FramesSinceFullScan = 0;
+        return;
+    }
+
+    // with nothing currently tracked this stays empty and we fall back to the full frame. Windows go where the
+    // markers are predicted to be this frame when we can, rather than where they were last frame
+    if (USE_POSE_PREDICTION && frame.Timestamp != 0 && m_CameraModel)
+    {
+        PredictToolKeypoints(frame, m_cache_predictedKeypoints);
+        BuildSearchROIs(m_cache_predictedKeypoints, m_ROIWindowHalfSize, cv::Size(IMG_WIDTH, IMG_HEIGHT), m_cache_searchROIs);
+    }
+    else BuildSearchROIs(m_ToolDictionary, m_ROIWindowHalfSize, cv::Size(IMG_WIDTH, IMG_HEIGHT), m_cache_searchROIs);
+    if (m_cache_searchROIs.empty()) m_FramesSinceFullScan = 0;
+    else ++m_FramesSinceFullScan;
+}
+
+void Holo2IRTracker::PredictToolKeypoints(const IRTrackerUtils::SensorFrame& frame, std::vector<cv::Point2f>& outKeypoints)
+{
+    outKeypoints.clear();
+    const Eigen::Matrix3d world2depthRotation = frame.Depth2World.topLeftCorner<3, 3>().transpose();
+    const Eigen::Vector3d depthOrigin = frame.Depth2World.topRightCorner<3, 1>();
+
+    for (const auto& [id, tool] : m_ToolDictionary)
+    {
+        if (!tool.VisibleToHoloLens) continue;
+
+        Eigen::Matrix4d predictedPose;
+        const auto predictor = m_PosePredictors.find(id);
+        const bool predicted = predictor != m_PosePredictors.end() && predictor->second.Predict(frame.Timestamp, predictedPose);
+        if (!predicted || tool.ObservedImgKeypoints.size() != tool.GeometryPoints.size())
+        {
+            for (const cv::Point2i& keypoint : tool.ObservedImgKeypoints) outKeypoints.emplace_back(keypoint);
+            continue;
+        }
 
-    TryUpdatingToolDictionary(m_cache_frameBlobInfo, m_ToolDictionary);
+        // markers where the motion model expects them at this frame's time, seen from this frame's head pose
+        m_cache_predictedCameraPoints.clear();
+        for (const auto& point : tool.GeometryPoints)
+        {
+            const Eigen::Vector3d world = predictedPose.topLeftCorner<3, 3>() * point + predictedPose.topRightCorner<3, 1>();
+            m_cache_predictedCameraPoints.emplace_back((world2depthRotation * (world - depthOrigin)).cast<float>());
+        }
+
+        const size_t first = outKeypoints.size();
+        const size_t count = m_cache_predictedCameraPoints.size();
+        outKeypoints.resize(first + count);
+        m_cache_predictedValid.resize(count);
+        m_CameraModel->ProjectPoints(m_cache_predictedCameraPoints.data(), count, &outKeypoints[first], m_cache_predictedValid.data());
+
+        // anything that didn't project falls back to where the marker was last seen
+        for (size_t k = 0; k < count; ++k)
+        {
+            if (!m_cache_predictedValid[k]) outKeypoints[first + k] = cv::Point2f(tool.ObservedImgKeypoints[k]);
+        }
+    }
+}
+
+bool Holo2IRTracker::GetPredictedToolPose(uint8_t toolID, uint64_t timestamp, Eigen::Matrix4d& outPose) const
+{
+    const auto tool = m_ToolDictionary.find(toolID);
+    if (tool == m_ToolDictionary.end() || !tool->second.VisibleToHoloLens) return false;
+
+    const auto predictor = m_PosePredictors.find(toolID);
+    if (predictor == m_PosePredictors.end() || !predictor->second.Predict(timestamp, outPose)) outPose = tool->second.PoseMatrix_HoloWorld;
+    return true;
+}
+
+void Holo2IRTracker::CopyPosePredictors(std::map<uint8_t, IRTrackerUtils::PosePredictor>& outPredictors) const
+{
+    // same keys as the tool dictionary, so like CopyDisplayToolState the map is only rebuilt when a tool list is loaded
+    const bool sameTools = outPredictors.size() == m_PosePredictors.size() && std::equal(outPredictors.begin(), outPredictors.end(),
+        m_PosePredictors.begin(), [](const auto& a, const auto& b) { return a.first == b.first; });
+    if (!sameTools)
+    {
+        outPredictors = m_PosePredictors;
+        return;
+    }
+
+    // predictors are fixed size, so assigning them allocates nothing
+    auto copy = outPredictors.begin();
+    for (const auto& [_, predictor] : m_PosePredictors) (copy++)->second = predictor;
+}
+
+void Holo2IRTracker::SetPosePredictorSettings(const IRTrackerUtils::PosePredictor::Settings& settings)
+{
+    for (auto& [_, predictor] : m_PosePredictors)
+    {
+        predictor.SetSettings(settings);
+        predictor.Reset();
+    }
+}
+
+void Holo2IRTracker::DetectBlobsInLatestFrame(bool UpdateDisplayImages)
+{
+    using namespace IRTrackerUtils::ImageProc;
+    const BlobDetectionMethod method = m_BlobDetectionMethod;
+    // areas are only needed by the marker size check
+    std::vector<float>* blobAreas = m_MarkerSize.IsEnabled() ? &m_cache_frameBlobAreas : nullptr;
+
+    // the adaptive threshold only learns from passes that see the whole frame, tracked-tool windows would bias it
+    const uint16_t rawThreshold = ActiveRawABThreshold();
+    ABHistogram* histogram = m_UseAdaptiveThreshold ? &m_cache_frameHistogram : nullptr;
+    m_cache_frameHistogram.Clear();
+
+    m_LatestFrameStatistics.ABThreshold = rawThreshold;
+    m_LatestFrameStatistics.AdaptiveThreshold = m_UseAdaptiveThreshold;
+    m_LatestFrameStatistics.FullFrameSearch = m_cache_searchROIs.empty();
+
+    // with no tracked-tool windows, coarse-to-fine mode narrows the full frame down to candidate regions instead,
+    // an empty candidate list then just means nothing in view is bright enough to be a marker
+    bool searchROIsOnly = !m_cache_searchROIs.empty();
+    if (!searchROIsOnly && m_UseCoarseToFine)
+    {
+        FindCandidateROIs(m_ABImg16bit, m_CoarsePoolFactor, m_cache_searchROIs, m_DepthImg16bit, m_WorkingVolume, rawThreshold, histogram);
+        searchROIsOnly = true;
+    }
+
+    // the adaptive threshold needs a cut-off in raw units, which only the direct 16-bit front-end takes
+    if (m_UseDirect16BitDetection || m_UseAdaptiveThreshold)
+    {
+        // the 8-bit image is display-only here, so skip it on frames nobody will look at
+        if (UpdateDisplayImages) RebalanceImgAnd8Bit(m_ABImg16bit, m_ABDisplayImg8bit);
+
+        if (searchROIsOnly)
+        {
+            for (const cv::Rect& roi : m_cache_searchROIs)
+            {
+                cv::Mat ABBinaryMaskROI = m_ABBinaryMask8bit(roi);
+                BinariseRaw(m_ABImg16bit(roi), ABBinaryMaskROI, rawThreshold, m_DepthImg16bit(roi), m_WorkingVolume);
+            }
+            DetectBlobs2DInROIs(m_ABBinaryMask8bit, method, m_cache_searchROIs, m_cache_frameBlobPixelLocations, true, m_ABImg16bit, blobAreas);
+        }
+        else
+        {
+            DetectBlobs2DRaw(m_ABImg16bit, m_ABBinaryMask8bit, method, m_DetectionThreads, m_cache_frameBlobPixelLocations, 
+                rawThreshold, m_DepthImg16bit, m_WorkingVolume, blobAreas, histogram);
+        }
+        return;
+    }
+
+    if constexpr (USE_FUSED_AB_FRONTEND)
+    {
+        // one pass gives the 8-bit image (straight into the display buffer if needed) and the binary mask
+        cv::Mat& ABImg8bit = UpdateDisplayImages ? m_ABDisplayImg8bit : m_ABImg8bit;
+
+        // display textures need the whole frame, otherwise only touch the pixels we're going to search
+        if (searchROIsOnly && !UpdateDisplayImages)
+        {
+            for (const cv::Rect& roi : m_cache_searchROIs)
+            {
+                cv::Mat ABImg8bitROI = ABImg8bit(roi);
+                cv::Mat ABBinaryMaskROI = m_ABBinaryMask8bit(roi);
+                RebalanceAndBinarise(m_ABImg16bit(roi), ABImg8bitROI, ABBinaryMaskROI, m_DepthImg16bit(roi), m_WorkingVolume);
+            }
+        }
+        else if (!searchROIsOnly && m_DetectionThreads > 1)
+        {
+            // front-end and labelling both split across strips
+            DetectBlobs2DParallel(m_ABImg16bit, ABImg8bit, m_ABBinaryMask8bit, method, m_DetectionThreads, m_cache_frameBlobPixelLocations,
+                m_DepthImg16bit, m_WorkingVolume, blobAreas);
+            return;
+        }
+        else RebalanceAndBinarise(m_ABImg16bit, ABImg8bit, m_ABBinaryMask8bit, m_DepthImg16bit, m_WorkingVolume);
+
+        if (searchROIsOnly) DetectBlobs2DInROIs(m_ABBinaryMask8bit, method, m_cache_searchROIs, m_cache_frameBlobPixelLocations, true, m_ABImg16bit, blobAreas);
+        else DetectBlobs2D(m_ABBinaryMask8bit, method, m_cache_frameBlobPixelLocations, true, m_ABImg16bit, blobAreas);
+    }
+    else
+    {
+        RebalanceImgAnd8Bit(m_ABImg16bit, m_ABImg8bit);
+
+        if (UpdateDisplayImages) {
+            // clone it before blob detection does any more processing on m_ABImg8bit
+            std::copy(m_ABImg8bit.datastart, m_ABImg8bit.dataend, m_ABDisplayImg8bit.data);
+        }
+
+        if (searchROIsOnly) DetectBlobs2DInROIs(m_ABImg8bit, method, m_cache_searchROIs, m_cache_frameBlobPixelLocations, false, m_ABImg16bit, blobAreas);
+        else DetectBlobs2D(m_ABImg8bit, method, m_cache_frameBlobPixelLocations, false, m_ABImg16bit, blobAreas);
+    }
+}
+
+uint16_t Holo2IRTracker::ActiveRawABThreshold() const
+{
+    if (m_UseAdaptiveThreshold) return m_AdaptiveThresholdState.Threshold;
+    if (m_UseDirect16BitDetection) return m_RawABThreshold;
+    return IRTrackerUtils::ImageProc::RAW_AB_THRESHOLD_DEFAULT;
+}
+
+void Holo2IRTracker::CheckForLostTools()
+{
+    if (!m_UseROISearch) return;
+
+    // a tool dropped out, so its markers may have left the search windows: look everywhere next frame. Checked per 
+    // tool, as another tool being picked up in the same windows would hide the loss from a simple count
+    for (const uint8_t id : m_cache_visibleToolsBefore)
+    {
+        const auto tool = m_ToolDictionary.find(id);
+        if (tool != m_ToolDictionary.end() && tool->second.VisibleToHoloLens) continue;
+
+        m_ForceFullFrameScan = true;
+        return;
+    }
+}
+
+const IRTrackerUtils::ToolDictionary& Holo2IRTracker::GetToolDictionary() const
+{
+    return m_ToolDictionary;
+}
+
+void Holo2IRTracker::CopyDisplayToolState(IRTrackerUtils::ToolDictionary& outSnapshot) const
+{
+    // the dictionary only changes shape when a tool list is loaded, so this rebuild is a one-off
+    const bool sameTools = outSnapshot.size() == m_ToolDictionary.size() && std::equal(outSnapshot.begin(), outSnapshot.end(), 
+        m_ToolDictionary.begin(), [](const auto& a, const auto& b) { return a.first == b.first; });
+    if (!sameTools)
+    {
+        outSnapshot.clear();
+        for (const auto& [id, _] : m_ToolDictionary) outSnapshot[id].ID = id;
+    }
+
+    // assign reuses each keypoint vector's capacity
+    auto snapshot = outSnapshot.begin();
+    for (const auto& [_, tool] : m_ToolDictionary)
+    {
+        snapshot->second.ID = tool.ID;
+        snapshot->second.VisibleToHoloLens = tool.VisibleToHoloLens;
+        snapshot->second.ObservedImgKeypoints.assign(tool.ObservedImgKeypoints.begin(), tool.ObservedImgKeypoints.end());
+        ++snapshot;
+    }
 }
 
 int Holo2IRTracker::TrackedToolsCount()
@@ -324,8 +724,122 @@ void Holo2IRTracker::RetrieveDisplayImages(uint8_t* abImage8bit, uint8_t* depthI
     }
 }
 
+void Holo2IRTracker::RenderABDisplayImage(const uint16_t* ABImg, const IRTrackerUtils::ToolDictionary& annotateTools, uint8_t* abImage8bit,
+    IRTrackerUtils::ImageProc::DisplayPreview preview) const
+{
+    using namespace IRTrackerUtils::ImageProc;
+    // headers over the caller's buffers, and no profiler zones as this may not be on the processing thread
+    cv::Rect sourceRegion; int step;
+    const cv::Size outSize = GetPreviewRegion(preview, annotateTools, cv::Size(IMG_WIDTH, IMG_HEIGHT), sourceRegion, step);
+    const cv::Mat rawAB(IMG_HEIGHT, IMG_WIDTH, CV_16UC1, const_cast<uint16_t*>(ABImg));
+    cv::Mat displayAB(outSize.height, outSize.width, CV_8UC1, abImage8bit);
+
+    ApplyDisplayLUTSubsampled(rawAB(sourceRegion), m_ABDisplayLUT, step, displayAB);
+    LabelImageWithToolDictData(annotateTools, displayAB, sourceRegion.tl(), step);
+}
+
+void Holo2IRTracker::RenderDepthDisplayImage(const uint16_t* DepthImg, const IRTrackerUtils::ToolDictionary& cropTools, uint8_t* depthImage8bit,
+    IRTrackerUtils::ImageProc::DisplayPreview preview) const
+{
+    using namespace IRTrackerUtils::ImageProc;
+    cv::Rect sourceRegion; int step;
+    const cv::Size outSize = GetPreviewRegion(preview, cropTools, cv::Size(IMG_WIDTH, IMG_HEIGHT), sourceRegion, step);
+    const cv::Mat rawDepth(IMG_HEIGHT, IMG_WIDTH, CV_16UC1, const_cast<uint16_t*>(DepthImg));
+    cv::Mat displayDepth(outSize.height, outSize.width, CV_8UC1, depthImage8bit);
+
+    ApplyDisplayLUTSubsampled(rawDepth(sourceRegion), m_DepthDisplayLUT, step, displayDepth);
+}
+
+cv::Size Holo2IRTracker::GetDisplayImageSize(IRTrackerUtils::ImageProc::DisplayPreview preview)
+{
+    // the region depends on the tools, but its size doesn't
+    cv::Rect sourceRegion; int step;
+    return IRTrackerUtils::ImageProc::GetPreviewRegion(preview, IRTrackerUtils::ToolDictionary(), cv::Size(IMG_WIDTH, IMG_HEIGHT), sourceRegion, step);
+}
+
+void Holo2IRTracker::SetBlobDetectionMethod(IRTrackerUtils::ImageProc::BlobDetectionMethod method)
+{
+    m_BlobDetectionMethod = method;
+}
+
+void Holo2IRTracker::SetPredictiveROISearch(bool enable, int fullScanInterval, int windowHalfSize)
+{
+    m_UseROISearch = enable;
+    m_ROIFullScanInterval = std::max(fullScanInterval, 1);
+    m_ROIWindowHalfSize = std::max(windowHalfSize, 1);
+    m_ForceFullFrameScan = true;
+}
+
+void Holo2IRTracker::SetZeroCopyIngestion(bool enable)
+{
+    m_ZeroCopyIngestion = enable;
+}
+
+void Holo2IRTracker::SetDepthDisplayWindow(uint16_t nearMM, uint16_t farMM)
+{
+    IRTrackerUtils::ImageProc::BuildDepthDisplayLUT(nearMM, farMM, m_DepthDisplayLUT);
+}
+
+void Holo2IRTracker::SetParallelDetection(int numThreads)
+{
+    m_DetectionThreads = std::max(numThreads, 1);
+}
+
+void Holo2IRTracker::SetCoarseToFineSearch(bool enable, int poolFactor)
+{
+    m_UseCoarseToFine = enable;
+    m_CoarsePoolFactor = std::max(poolFactor, 1);
+}
+
+void Holo2IRTracker::SetWorkingVolume(float nearMetres, float farMetres)
+{
+    // 4090 is the largest valid AHAT depth, so invalid pixels are gated out as well
+    const auto toMM = [](float metres) { return static_cast<uint16_t>(std::clamp(metres * 1000.0f, 0.0f, 4090.0f) + 0.5f); };
+    m_WorkingVolume.NearMM = toMM(nearMetres);
+    m_WorkingVolume.FarMM = toMM(farMetres);
+}
+
+void Holo2IRTracker::SetDirect16BitDetection(bool enable, uint16_t rawThreshold)
+{
+    m_UseDirect16BitDetection = enable;
+    m_RawABThreshold = std::max<uint16_t>(rawThreshold, 1); // a 0 cut-off would mark every pixel
+}
+
+void Holo2IRTracker::SetAdaptiveThreshold(bool enable, const IRTrackerUtils::ImageProc::AdaptiveThresholdSettings& settings)
+{
+    m_UseAdaptiveThreshold = enable;
+    m_AdaptiveThresholdSettings = settings;
+    m_AdaptiveThresholdState = IRTrackerUtils::ImageProc::AdaptiveThresholdState();
+    m_AdaptiveThresholdState.Threshold = std::clamp(m_AdaptiveThresholdState.Threshold, settings.MinThreshold, 
+        std::max(settings.MinThreshold, settings.MaxThreshold));
+}
+
+void Holo2IRTracker::SetBackgroundSuppression(bool enable)
+{
+    m_UseBackgroundModel = enable;
+    m_cache_backgroundSuppressed.clear();
+    m_cache_assignedToTool.clear();
+}
+
+void Holo2IRTracker::SetMarkerSizeFilter(float markerDiameterMetres, float minAreaRatio, float maxAreaRatio)
+{
+    m_MarkerSize.DiameterMetres = std::max(markerDiameterMetres, 0.0f);
+    m_MarkerSize.MinAreaRatio = std::max(minAreaRatio, 0.0f);
+    m_MarkerSize.MaxAreaRatio = maxAreaRatio;
+}
+
 void Holo2IRTracker::SetUnmapFunction(IRTrackerUtils::UnmapFunction& unmapFunction)
 {
     // should be attached to the depth sensor's unmap function
-	m_MapImageToUnitPlane = unmapFunction;
+	m_CameraModel = std::make_shared<IRTrackerUtils::ResearchModeCameraModel>(unmapFunction);
+}
+
+void Holo2IRTracker::SetUnmapFunction(std::shared_ptr<const IRTrackerUtils::CameraModel> cameraModel)
+{
+    m_CameraModel = std::move(cameraModel);
+}
+
+void Holo2IRTracker::SetRayLookupTable(const IRTrackerUtils::RayLookupTable& rayTable)
+{
+    if (rayTable.IsValid()) m_CameraModel = std::make_shared<IRTrackerUtils::RayLookupTable>(rayTable);
 }
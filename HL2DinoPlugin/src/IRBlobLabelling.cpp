@@ -0,0 +1,360 @@
+#include "pch.h"
+#include "IRTrackerUtils.h"
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <cstring>
+#include "Shiny.h"
+
+/**
+ * @file        IRBlobLabelling.cpp
+ * @brief       Single-pass connected-component labelling of binary blob masks
+ * @author      Hisham Iqbal
+ * @copyright   &copy; Hisham Iqbal 2023
+ *
+ */
+
+namespace // Anonymous labelling helpers
+{
+    using IRTrackerUtils::ImageProc::BlobComponent;
+
+    //! A horizontal run of foreground pixels in one row, inclusive on both ends
+    struct PixelRun
+    {
+        int     Start;
+        int     End;
+        int     Label;
+        bool    Linked; // true once connected to a run in the neighbouring row being compared against
+    };
+
+    //! Scratch memory for the labeller, kept alive between frames so the vectors keep their capacity
+    struct LabellingScratch
+    {
+        std::vector<PixelRun>       PreviousRuns;   // after labelling: runs of the last row
+        std::vector<PixelRun>       CurrentRuns;
+        std::vector<PixelRun>       FirstRowRuns;   // after labelling: runs of the first row, needed to merge strips
+        std::vector<int>            Parent;
+        std::vector<BlobComponent>  Components;
+    };
+
+    int FindRoot(std::vector<int>& parent, int label)
+    {
+        while (parent[label] != label)
+        {
+            parent[label] = parent[parent[label]]; // path halving
+            label = parent[label];
+        }
+        return label;
+    }
+
+    //! True if \p a's peak beats \p b's, ties going to the first pixel in raster order so that components can be 
+    //! merged in any order (and across strips) with the same result
+    bool IsBrighterPeak(const BlobComponent& a, const BlobComponent& b)
+    {
+        if (a.PeakValue != b.PeakValue) return a.PeakValue > b.PeakValue;
+        return a.PeakY < b.PeakY || (a.PeakY == b.PeakY && a.PeakX < b.PeakX);
+    }
+
+    void MergeComponentInto(BlobComponent& dst, const BlobComponent& src)
+    {
+        dst.PixelCount          += src.PixelCount;
+        dst.PixelSumX           += src.PixelSumX;
+        dst.PixelSumY           += src.PixelSumY;
+        dst.MinX                = std::min(dst.MinX, src.MinX);
+        dst.MinY                = std::min(dst.MinY, src.MinY);
+        dst.MaxX                = std::max(dst.MaxX, src.MaxX);
+        dst.MaxY                = std::max(dst.MaxY, src.MaxY);
+        dst.ContourArea2        += src.ContourArea2;
+        dst.ContourM10x6        += src.ContourM10x6;
+        dst.ContourM01x6        += src.ContourM01x6;
+        dst.PerimeterStraight   += src.PerimeterStraight;
+        dst.PerimeterDiagonal   += src.PerimeterDiagonal;
+        if (IsBrighterPeak(src, dst))
+        {
+            dst.PeakX           = src.PeakX;
+            dst.PeakY           = src.PeakY;
+            dst.PeakValue       = src.PeakValue;
+        }
+    }
+
+    //! Joins the sets containing \p a and \p b, the smaller label (i.e. first seen in raster order) stays the root
+    int UnionLabels(LabellingScratch& scratch, int a, int b)
+    {
+        int rootA = FindRoot(scratch.Parent, a);
+        int rootB = FindRoot(scratch.Parent, b);
+        if (rootA == rootB) return rootA;
+        if (rootB < rootA) std::swap(rootA, rootB);
+
+        scratch.Parent[rootB] = rootA;
+        MergeComponentInto(scratch.Components[rootA], scratch.Components[rootB]);
+        return rootA;
+    }
+
+    //! Boundary step on one side of the blob when moving down a row, with the side shifting by \p shift pixels
+    void AddSideStep(BlobComponent& component, int shift)
+    {
+        if (shift == 0) { component.PerimeterStraight += 1; return; }
+
+        // one diagonal step onto the new row, then walk along it for the remainder
+        component.PerimeterDiagonal += 1;
+        component.PerimeterStraight += std::abs(shift) - 1;
+    }
+
+    //! Adds the slice of boundary polygon between run \p above (in row \p yAbove) and 8-connected run \p below
+    void AddRunTransition(BlobComponent& component, const PixelRun& above, const PixelRun& below, int yAbove)
+    {
+        // x-extent of the polygon at the top and bottom of this slice, horizontal boundary
+        // segments lie exactly on a row so they enclose no area
+        const int rightTop = std::min(above.End, below.End + 1);
+        const int rightBot = std::min(below.End, above.End + 1);
+        const int leftTop = std::max(above.Start, below.Start - 1);
+        const int leftBot = std::max(below.Start, above.Start - 1);
+        const int widthTop = rightTop - leftTop;
+        const int widthBot = rightBot - leftBot;
+
+        // trapezoid of unit height: closed form integrals of 1, x and y, scaled to stay integer
+        component.ContourArea2 += widthTop + widthBot;
+        component.ContourM10x6 += static_cast<int64_t>(rightTop * rightTop + rightTop * rightBot + rightBot * rightBot) -
+                                  static_cast<int64_t>(leftTop * leftTop + leftTop * leftBot + leftBot * leftBot);
+        component.ContourM01x6 += 3LL * yAbove * (widthTop + widthBot) + 3LL * widthTop + 2LL * (widthBot - widthTop);
+
+        AddSideStep(component, below.End - above.End);
+        AddSideStep(component, below.Start - above.Start);
+    }
+
+    void AddRunPixels(BlobComponent& component, const PixelRun& run, int y)
+    {
+        const int length = run.End - run.Start + 1;
+        component.PixelCount += length;
+        component.PixelSumX += static_cast<int64_t>(run.Start + run.End) * length / 2;
+        component.PixelSumY += static_cast<int64_t>(y) * length;
+        component.MinX = std::min(component.MinX, run.Start);
+        component.MaxX = std::max(component.MaxX, run.End);
+        component.MinY = std::min(component.MinY, y);
+        component.MaxY = std::max(component.MaxY, y);
+    }
+
+    //! Raises the component's peak to the brightest pixel of \p run in \p valueRow. Runs reach a component in raster
+    //! order, so an equal value found later never replaces the current peak
+    template <typename T>
+    void AddRunPeak(BlobComponent& component, const PixelRun& run, int y, const T* valueRow)
+    {
+        int brightest = run.Start;
+        for (int x = run.Start + 1; x <= run.End; ++x)
+        {
+            if (valueRow[x] > valueRow[brightest]) brightest = x;
+        }
+        if (valueRow[brightest] > component.PeakValue)
+        {
+            component.PeakX = brightest;
+            component.PeakY = y;
+            component.PeakValue = valueRow[brightest];
+        }
+    }
+
+    //! Run-length encodes one row of the mask
+    void ExtractRuns(const uint8_t* row, int cols, std::vector<PixelRun>& outRuns)
+    {
+        outRuns.clear();
+        int x = 0;
+        while (x < cols)
+        {
+            // most of the frame is background, so skip it 8 pixels at a time
+            while (x + 8 <= cols)
+            {
+                uint64_t block;
+                std::memcpy(&block, row + x, sizeof(block));
+                if (block != 0) break;
+                x += 8;
+            }
+            while (x < cols && row[x] == 0) ++x;
+            if (x >= cols) break;
+
+            const int start = x;
+            while (x < cols && row[x] != 0) ++x;
+            outRuns.push_back({ start, x - 1, -1, false });
+        }
+    }
+
+    //! @brief  Labels rows [rowBegin, rowEnd) of \p binaryMask into \p scratch, without any profiling so this
+    //!         is safe to call from worker threads. Peaks are only tracked if \p peakImage isn't empty
+    void LabelRows(const cv::Mat& binaryMask, int rowBegin, int rowEnd, LabellingScratch& scratch, const cv::Mat& peakImage)
+    {
+        scratch.PreviousRuns.clear();
+        scratch.FirstRowRuns.clear();
+        scratch.Parent.clear();
+        scratch.Components.clear();
+
+        for (int y = rowBegin; y < rowEnd; ++y)
+        {
+            ExtractRuns(binaryMask.ptr<uint8_t>(y), binaryMask.cols, scratch.CurrentRuns);
+
+            // runs are sorted by x, so a single forward sweep over the previous row finds all 8-connected pairs
+            size_t firstCandidate = 0;
+            for (PixelRun& run : scratch.CurrentRuns)
+            {
+                while (firstCandidate < scratch.PreviousRuns.size() &&
+                       scratch.PreviousRuns[firstCandidate].End < run.Start - 1) { ++firstCandidate; }
+
+                for (size_t k = firstCandidate; k < scratch.PreviousRuns.size() &&
+                     scratch.PreviousRuns[k].Start <= run.End + 1; ++k)
+                {
+                    PixelRun& above = scratch.PreviousRuns[k];
+                    run.Label = (run.Label < 0) ? FindRoot(scratch.Parent, above.Label) : UnionLabels(scratch, run.Label, above.Label);
+                    AddRunTransition(scratch.Components[run.Label], above, run, y - 1);
+                    above.Linked = true;
+                    run.Linked = true;
+                }
+
+                if (run.Label < 0)
+                {
+                    // new component
+                    run.Label = static_cast<int>(scratch.Parent.size());
+                    scratch.Parent.push_back(run.Label);
+                    scratch.Components.emplace_back();
+                }
+
+                BlobComponent& component = scratch.Components[run.Label];
+                AddRunPixels(component, run, y);
+                if (!peakImage.empty())
+                {
+                    if (peakImage.depth() == CV_16U) AddRunPeak(component, run, y, peakImage.ptr<uint16_t>(y));
+                    else AddRunPeak(component, run, y, peakImage.ptr<uint8_t>(y));
+                }
+
+                // nothing above, so this run is the top edge of the boundary polygon
+                if (!run.Linked) component.PerimeterStraight += run.End - run.Start;
+            }
+
+            if (y == rowBegin) scratch.FirstRowRuns = scratch.CurrentRuns;
+
+            // nothing below, so these runs are a bottom edge
+            for (const PixelRun& above : scratch.PreviousRuns)
+            {
+                if (!above.Linked) scratch.Components[FindRoot(scratch.Parent, above.Label)].PerimeterStraight += above.End - above.Start;
+            }
+
+            // current row becomes the previous row, and the link flags now refer to the next row
+            std::swap(scratch.PreviousRuns, scratch.CurrentRuns);
+            for (PixelRun& run : scratch.PreviousRuns) run.Linked = false;
+        }
+
+        // close off the last row
+        for (const PixelRun& above : scratch.PreviousRuns)
+        {
+            scratch.Components[FindRoot(scratch.Parent, above.Label)].PerimeterStraight += above.End - above.Start;
+        }
+    }
+
+    //! Copies the root components out, labels were created in raster order so the output is ordered by
+    //! each component's first pixel
+    void CollectRootComponents(const LabellingScratch& scratch, std::vector<BlobComponent>& outComponents)
+    {
+        for (size_t label = 0; label < scratch.Parent.size(); ++label)
+        {
+            if (scratch.Parent[label] == static_cast<int>(label)) outComponents.push_back(scratch.Components[label]);
+        }
+    }
+
+    //! \p peakImage if it can be used alongside \p binaryMask, an empty image otherwise
+    cv::Mat UsablePeakImage(const cv::Mat& binaryMask, const cv::Mat& peakImage)
+    {
+        const bool usable = (peakImage.type() == CV_16UC1 || peakImage.type() == CV_8UC1) && peakImage.size() == binaryMask.size();
+        return usable ? peakImage : cv::Mat();
+    }
+}
+
+namespace IRTrackerUtils
+{
+    void ImageProc::LabelBlobComponents(const cv::Mat& binaryMask, std::vector<BlobComponent>& outComponents, const cv::Mat& peakImage)
+    {
+        PROFILE_BLOCK(LabelBlobComponents);
+        outComponents.clear();
+        if (binaryMask.empty() || binaryMask.type() != CV_8UC1) return;
+
+        thread_local LabellingScratch scratch;
+        LabelRows(binaryMask, 0, binaryMask.rows, scratch, UsablePeakImage(binaryMask, peakImage));
+        CollectRootComponents(scratch, outComponents);
+    }
+
+    void ImageProc::LabelBlobComponentsParallel(const cv::Mat& binaryMask, int numStrips, std::vector<BlobComponent>& outComponents,
+        const std::function<void(const cv::Range&)>& prepareStrip, const cv::Mat& peakImage)
+    {
+        PROFILE_BLOCK(LabelBlobComponentsParallel);
+        outComponents.clear();
+        if (binaryMask.empty() || binaryMask.type() != CV_8UC1) return;
+
+        numStrips = std::clamp(numStrips, 1, binaryMask.rows);
+        const cv::Mat stripPeakImage = UsablePeakImage(binaryMask, peakImage);
+        auto stripRows = [&](int strip)
+        {
+            return cv::Range(strip * binaryMask.rows / numStrips, (strip + 1) * binaryMask.rows / numStrips);
+        };
+
+        // per-strip results have to outlive the worker tasks, so they're owned by the calling thread. Workers must
+        // go through this reference, naming the thread_local inside the lambda would give them their own instance
+        thread_local std::vector<LabellingScratch> callerStripScratch;
+        thread_local LabellingScratch merged;
+        std::vector<LabellingScratch>& stripScratch = callerStripScratch;
+        if (stripScratch.size() < static_cast<size_t>(numStrips)) stripScratch.resize(numStrips);
+
+        cv::parallel_for_(cv::Range(0, numStrips), [&](const cv::Range& strips)
+        {
+            for (int strip = strips.start; strip < strips.end; ++strip)
+            {
+                const cv::Range rows = stripRows(strip);
+                if (prepareStrip) prepareStrip(rows);
+                LabelRows(binaryMask, rows.start, rows.end, stripScratch[strip], stripPeakImage);
+            }
+        }, numStrips);
+
+        // gather all strip components into one union-find, offsetting each strip's labels so they stay in
+        // raster order, which keeps the output identical to the serial labeller
+        merged.Parent.clear();
+        merged.Components.clear();
+        thread_local std::vector<int> offsets;
+        offsets.assign(numStrips, 0);
+        for (int strip = 0; strip < numStrips; ++strip)
+        {
+            offsets[strip] = static_cast<int>(merged.Components.size());
+            LabellingScratch& local = stripScratch[strip];
+            for (size_t label = 0; label < local.Parent.size(); ++label)
+            {
+                merged.Parent.push_back(offsets[strip] + FindRoot(local.Parent, static_cast<int>(label)));
+                merged.Components.push_back(local.Components[label]);
+            }
+        }
+
+        // stitch the seams, undoing the top/bottom edges each strip added at its borders where runs actually join
+        for (int strip = 0; strip + 1 < numStrips; ++strip)
+        {
+            std::vector<PixelRun>& aboveRuns = stripScratch[strip].PreviousRuns;
+            std::vector<PixelRun>& belowRuns = stripScratch[strip + 1].FirstRowRuns;
+            const int yAbove = stripRows(strip).end - 1;
+
+            size_t firstCandidate = 0;
+            for (PixelRun& run : belowRuns)
+            {
+                const int belowLabel = offsets[strip + 1] + run.Label;
+                while (firstCandidate < aboveRuns.size() && aboveRuns[firstCandidate].End < run.Start - 1) { ++firstCandidate; }
+
+                for (size_t k = firstCandidate; k < aboveRuns.size() && aboveRuns[k].Start <= run.End + 1; ++k)
+                {
+                    PixelRun& above = aboveRuns[k];
+                    const int root = UnionLabels(merged, belowLabel, offsets[strip] + above.Label);
+                    AddRunTransition(merged.Components[root], above, run, yAbove);
+                    above.Linked = true;
+                    run.Linked = true;
+                }
+
+                if (run.Linked) merged.Components[FindRoot(merged.Parent, belowLabel)].PerimeterStraight -= run.End - run.Start;
+            }
+
+            for (const PixelRun& above : aboveRuns)
+            {
+                if (above.Linked) merged.Components[FindRoot(merged.Parent, offsets[strip] + above.Label)].PerimeterStraight -= above.End - above.Start;
+            }
+        }
+
+        CollectRootComponents(merged, outComponents);
+    }
+}
@@ -1,10 +1,25 @@
 #include "pch.h"
 #include "IRTrackerUtils.h"
+#include "CameraModel.h"
 #include <iostream>
 #include <opencv2/core.hpp>
 #include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <mutex>
 #include "Shiny.h"
 
+// SIMD paths for the per-pixel front-end kernels, scalar code is always kept as a fallback/tail handler
+#if defined(_M_ARM64) || defined(__aarch64__)
+#include <arm_neon.h>
+#define IRTRACKER_SIMD_NEON
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define IRTRACKER_SIMD_AVX2
+#elif defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define IRTRACKER_SIMD_SSE2
+#endif
+
 /**
  * @file        IRImageProcUtils.cpp
  * @brief       Utility image processing functions
@@ -19,14 +34,309 @@ namespace // Anonymous ImageProc
     static constexpr uint8_t BINARY_THRESH_8BIT = 180;
     static constexpr uint16_t THRESH_RAW_DEPTH_16BIT = 4090;
     static constexpr double PI = 3.141592653589793238462;
+
+    // blob filtering criteria shared by the detectors
+    static constexpr double BLOB_AREA_MIN = 5;              // pixels
+    static constexpr double BLOB_AREA_MAX = 16384;          // pixels, 1/16th of the total image
+    static constexpr double BLOB_CIRCULARITY_MIN = 0.7;
+
+    // vectorised compare below relies on (thresh + 1) still fitting into 8 bits
+    static_assert(BINARY_THRESH_8BIT < 255, "Binary threshold must leave room for an 'above threshold' value");
+
+    // (raw >> 2) > BINARY_THRESH_8BIT is the same as raw >= this, lets the coarse search threshold the raw data directly
+    static constexpr uint16_t BINARY_THRESH_RAW_AB_16BIT = (BINARY_THRESH_8BIT + 1) << 2;
+    static_assert(BINARY_THRESH_RAW_AB_16BIT == IRTrackerUtils::ImageProc::RAW_AB_THRESHOLD_DEFAULT, 
+        "Default 16-bit threshold should pick the same pixels as the 8-bit pipeline");
+
+    // side length of the DisplayPreview::ToolCrop texture
+    static constexpr int PREVIEW_CROP_SIZE = 128;
+
+    // full resolution margin around coarse candidates, keeps each blob and the ring used by the weighted centroid inside
+    static constexpr int COARSE_ROI_PADDING = 2;
+
+    // peak detector: each blob's centre comes from a least-squares quadratic over the (2r+1)^2 window around its 
+    // brightest pixel, 1 -> 3x3 (best for the few-pixel blobs it's aimed at) or 2 -> 5x5
+    static constexpr int PEAK_FIT_RADIUS = 1;
+
+    // peak detector keeps blobs down to this size, below BLOB_AREA_MIN for far markers, but a lone pixel over the
+    // threshold is far more often shot noise or a speck of glare than a marker
+    static constexpr int PEAK_BLOB_PIXELS_MIN = 2;
+
+    // every n-th row goes into the AB histogram, 1/4 of a frame is still ~65k samples
+    static constexpr int HISTOGRAM_ROW_STEP = 4;
+
+    //! Adds one row of raw AB values to \p histogram
+    inline void AccumulateHistogramRow(const uint16_t* row, int length, IRTrackerUtils::ImageProc::ABHistogram& histogram)
+    {
+        using IRTrackerUtils::ImageProc::ABHistogram;
+        for (int x = 0; x < length; ++x) ++histogram.Counts[ABHistogram::Bin(row[x])];
+        histogram.Total += static_cast<uint32_t>(length);
+    }
+
+    //! @brief  Row worker for \ref IRTrackerUtils::ImageProc::RebalanceAndBinarise
+    //! 
+    //! Per pixel: v = saturate_cast<uint8_t>(raw >> 2), mask = (v > BINARY_THRESH_8BIT) ? 255 : 0. This is exactly
+    //! what the old shift + cv::convertTo + cv::threshold chain produced, just without the intermediate passes.
+    //! With \p Gated the mask is also cleared wherever depth[i] is outside [nearMM, nearMM + rangeMM], in the same pass.
+    template <bool Gated>
+    void RebalanceAndBinariseRowImpl(const uint16_t* src, const uint16_t* depth, uint8_t* dst8, uint8_t* dstMask, int length,
+        uint16_t nearMM, uint16_t rangeMM)
+    {
+        int i = 0;
+#if defined(IRTRACKER_SIMD_NEON)
+        const uint8x16_t thresh = vdupq_n_u8(BINARY_THRESH_8BIT);
+        const uint16x8_t nearV = vdupq_n_u16(nearMM), rangeV = vdupq_n_u16(rangeMM);
+        for (; i <= length - 16; i += 16)
+        {
+            // unsigned saturating shift-right-narrow does the shift and the saturate_cast in one go
+            const uint8x16_t v = vcombine_u8(vqshrn_n_u16(vld1q_u16(src + i), 2), vqshrn_n_u16(vld1q_u16(src + i + 8), 2));
+            vst1q_u8(dst8 + i, v);
+            uint8x16_t mask = vcgtq_u8(v, thresh);
+            if constexpr (Gated)
+            {
+                // (d - near) wraps around for d < near, so one unsigned compare checks both ends of the range
+                const uint16x8_t in0 = vcleq_u16(vsubq_u16(vld1q_u16(depth + i), nearV), rangeV);
+                const uint16x8_t in1 = vcleq_u16(vsubq_u16(vld1q_u16(depth + i + 8), nearV), rangeV);
+                mask = vandq_u8(mask, vcombine_u8(vmovn_u16(in0), vmovn_u16(in1)));
+            }
+            vst1q_u8(dstMask + i, mask);
+        }
+#elif defined(IRTRACKER_SIMD_AVX2)
+        const __m256i threshPlusOne = _mm256_set1_epi8(static_cast<char>(BINARY_THRESH_8BIT + 1));
+        const __m256i nearV = _mm256_set1_epi16(static_cast<short>(nearMM)), rangeV = _mm256_set1_epi16(static_cast<short>(rangeMM));
+        const __m256i zero = _mm256_setzero_si256();
+        for (; i <= length - 32; i += 32)
+        {
+            const __m256i a0 = _mm256_srli_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i)), 2);
+            const __m256i a1 = _mm256_srli_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 16)), 2);
+            // values are <= 16383 after the shift, so the signed pack saturates the same way as saturate_cast,
+            // packs are done per 128-bit lane, so put the 64-bit blocks back into order afterwards
+            const __m256i v = _mm256_permute4x64_epi64(_mm256_packus_epi16(a0, a1), 0xD8);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst8 + i), v);
+            // unsigned (v > thresh) is the same as max(v, thresh + 1) == v
+            __m256i mask = _mm256_cmpeq_epi8(_mm256_max_epu8(v, threshPlusOne), v);
+            if constexpr (Gated)
+            {
+                // unsigned (d - near) <= range is the same as saturating (d - near) - range == 0
+                const __m256i d0 = _mm256_sub_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(depth + i)), nearV);
+                const __m256i d1 = _mm256_sub_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(depth + i + 16)), nearV);
+                const __m256i in0 = _mm256_cmpeq_epi16(_mm256_subs_epu16(d0, rangeV), zero);
+                const __m256i in1 = _mm256_cmpeq_epi16(_mm256_subs_epu16(d1, rangeV), zero);
+                mask = _mm256_and_si256(mask, _mm256_permute4x64_epi64(_mm256_packs_epi16(in0, in1), 0xD8));
+            }
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dstMask + i), mask);
+        }
+#elif defined(IRTRACKER_SIMD_SSE2)
+        const __m128i threshPlusOne = _mm_set1_epi8(static_cast<char>(BINARY_THRESH_8BIT + 1));
+        const __m128i nearV = _mm_set1_epi16(static_cast<short>(nearMM)), rangeV = _mm_set1_epi16(static_cast<short>(rangeMM));
+        const __m128i zero = _mm_setzero_si128();
+        for (; i <= length - 16; i += 16)
+        {
+            const __m128i a0 = _mm_srli_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)), 2);
+            const __m128i a1 = _mm_srli_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 8)), 2);
+            const __m128i v = _mm_packus_epi16(a0, a1);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst8 + i), v);
+            __m128i mask = _mm_cmpeq_epi8(_mm_max_epu8(v, threshPlusOne), v);
+            if constexpr (Gated)
+            {
+                const __m128i d0 = _mm_sub_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(depth + i)), nearV);
+                const __m128i d1 = _mm_sub_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(depth + i + 8)), nearV);
+                const __m128i in0 = _mm_cmpeq_epi16(_mm_subs_epu16(d0, rangeV), zero);
+                const __m128i in1 = _mm_cmpeq_epi16(_mm_subs_epu16(d1, rangeV), zero);
+                mask = _mm_and_si128(mask, _mm_packs_epi16(in0, in1));
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dstMask + i), mask);
+        }
+#endif
+        for (; i < length; ++i)
+        {
+            const uint8_t v = static_cast<uint8_t>(std::min<uint16_t>(src[i] >> 2, 255));
+            dst8[i] = v;
+            bool isMarker = v > BINARY_THRESH_8BIT;
+            if constexpr (Gated) isMarker = isMarker && static_cast<uint16_t>(depth[i] - nearMM) <= rangeMM;
+            dstMask[i] = isMarker ? 255 : 0;
+        }
+    }
+
+    //! @brief  Row worker for \ref IRTrackerUtils::ImageProc::BinariseRaw
+    //! 
+    //! Per pixel: mask = (raw >= thresh) ? 255 : 0, gated by depth exactly like \ref RebalanceAndBinariseRowImpl
+    template <bool Gated>
+    void BinariseRawRowImpl(const uint16_t* src, const uint16_t* depth, uint8_t* dstMask, int length, uint16_t thresh,
+        uint16_t nearMM, uint16_t rangeMM)
+    {
+        int i = 0;
+#if defined(IRTRACKER_SIMD_NEON)
+        const uint16x8_t threshV = vdupq_n_u16(thresh);
+        const uint16x8_t nearV = vdupq_n_u16(nearMM), rangeV = vdupq_n_u16(rangeMM);
+        for (; i <= length - 16; i += 16)
+        {
+            uint16x8_t m0 = vcgeq_u16(vld1q_u16(src + i), threshV);
+            uint16x8_t m1 = vcgeq_u16(vld1q_u16(src + i + 8), threshV);
+            if constexpr (Gated)
+            {
+                m0 = vandq_u16(m0, vcleq_u16(vsubq_u16(vld1q_u16(depth + i), nearV), rangeV));
+                m1 = vandq_u16(m1, vcleq_u16(vsubq_u16(vld1q_u16(depth + i + 8), nearV), rangeV));
+            }
+            vst1q_u8(dstMask + i, vcombine_u8(vmovn_u16(m0), vmovn_u16(m1)));
+        }
+#elif defined(IRTRACKER_SIMD_AVX2)
+        const __m256i threshV = _mm256_set1_epi16(static_cast<short>(thresh));
+        const __m256i nearV = _mm256_set1_epi16(static_cast<short>(nearMM)), rangeV = _mm256_set1_epi16(static_cast<short>(rangeMM));
+        const __m256i zero = _mm256_setzero_si256();
+        for (; i <= length - 32; i += 32)
+        {
+            // no unsigned 16-bit compare, but raw >= thresh is the same as saturating (thresh - raw) == 0
+            const __m256i a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+            const __m256i a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 16));
+            __m256i m0 = _mm256_cmpeq_epi16(_mm256_subs_epu16(threshV, a0), zero);
+            __m256i m1 = _mm256_cmpeq_epi16(_mm256_subs_epu16(threshV, a1), zero);
+            if constexpr (Gated)
+            {
+                const __m256i d0 = _mm256_sub_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(depth + i)), nearV);
+                const __m256i d1 = _mm256_sub_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(depth + i + 16)), nearV);
+                m0 = _mm256_and_si256(m0, _mm256_cmpeq_epi16(_mm256_subs_epu16(d0, rangeV), zero));
+                m1 = _mm256_and_si256(m1, _mm256_cmpeq_epi16(_mm256_subs_epu16(d1, rangeV), zero));
+            }
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dstMask + i), _mm256_permute4x64_epi64(_mm256_packs_epi16(m0, m1), 0xD8));
+        }
+#elif defined(IRTRACKER_SIMD_SSE2)
+        const __m128i threshV = _mm_set1_epi16(static_cast<short>(thresh));
+        const __m128i nearV = _mm_set1_epi16(static_cast<short>(nearMM)), rangeV = _mm_set1_epi16(static_cast<short>(rangeMM));
+        const __m128i zero = _mm_setzero_si128();
+        for (; i <= length - 16; i += 16)
+        {
+            const __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            const __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 8));
+            __m128i m0 = _mm_cmpeq_epi16(_mm_subs_epu16(threshV, a0), zero);
+            __m128i m1 = _mm_cmpeq_epi16(_mm_subs_epu16(threshV, a1), zero);
+            if constexpr (Gated)
+            {
+                const __m128i d0 = _mm_sub_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(depth + i)), nearV);
+                const __m128i d1 = _mm_sub_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(depth + i + 8)), nearV);
+                m0 = _mm_and_si128(m0, _mm_cmpeq_epi16(_mm_subs_epu16(d0, rangeV), zero));
+                m1 = _mm_and_si128(m1, _mm_cmpeq_epi16(_mm_subs_epu16(d1, rangeV), zero));
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dstMask + i), _mm_packs_epi16(m0, m1));
+        }
+#endif
+        for (; i < length; ++i)
+        {
+            bool isMarker = src[i] >= thresh;
+            if constexpr (Gated) isMarker = isMarker && static_cast<uint16_t>(depth[i] - nearMM) <= rangeMM;
+            dstMask[i] = isMarker ? 255 : 0;
+        }
+    }
+
+    //! Row \p r of \ref IRTrackerUtils::ImageProc::BinariseRaw, \p gated should only be set for a usable depth image.
+    //! Sampled rows also go into \p histogram (if given) while they're still in cache
+    void BinariseRawRow(const cv::Mat& inputRaw16BitImg, const cv::Mat& inputRawDepthImg, cv::Mat& outputBinaryMask, int r,
+        uint16_t rawThreshold, bool gated, const IRTrackerUtils::ImageProc::DepthGate& gate, IRTrackerUtils::ImageProc::ABHistogram* histogram)
+    {
+        if (gated)
+        {
+            BinariseRawRowImpl<true>(inputRaw16BitImg.ptr<uint16_t>(r), inputRawDepthImg.ptr<uint16_t>(r), outputBinaryMask.ptr<uint8_t>(r),
+                inputRaw16BitImg.cols, rawThreshold, gate.NearMM, static_cast<uint16_t>(gate.FarMM - gate.NearMM));
+        }
+        else
+        {
+            BinariseRawRowImpl<false>(inputRaw16BitImg.ptr<uint16_t>(r), nullptr, outputBinaryMask.ptr<uint8_t>(r),
+                inputRaw16BitImg.cols, rawThreshold, 0, 0);
+        }
+
+        if (histogram && r % HISTOGRAM_ROW_STEP == 0) AccumulateHistogramRow(inputRaw16BitImg.ptr<uint16_t>(r), inputRaw16BitImg.cols, *histogram);
+    }
+
+    void RebalanceAndBinariseRow(const uint16_t* src, uint8_t* dst8, uint8_t* dstMask, int length)
+    {
+        RebalanceAndBinariseRowImpl<false>(src, nullptr, dst8, dstMask, length, 0, 0);
+    }
+
+    //! Gated row worker, \p gate must be enabled
+    void RebalanceAndBinariseRow(const uint16_t* src, const uint16_t* depth, uint8_t* dst8, uint8_t* dstMask, int length,
+        const IRTrackerUtils::ImageProc::DepthGate& gate)
+    {
+        RebalanceAndBinariseRowImpl<true>(src, depth, dst8, dstMask, length, gate.NearMM, static_cast<uint16_t>(gate.FarMM - gate.NearMM));
+    }
     
-    void DetectBlobs2DBasic(cv::Mat& processed_image, std::vector<cv::Point2f>& outPixelLocations)
+    //! @brief  Row worker for \ref IRTrackerUtils::ImageProc::ApplyDisplayLUT, dst[i] = lut[min(src[i], 4095)]
+    void ApplyDisplayLUTRow(const uint16_t* src, uint8_t* dst, const uint8_t* lut, int length)
+    {
+        constexpr uint16_t maxIndex = IRTrackerUtils::ImageProc::DisplayLUT::Size - 1;
+        int i = 0;
+#if defined(IRTRACKER_SIMD_AVX2)
+        const __m256i maxIdx = _mm256_set1_epi32(maxIndex);
+        const __m256i lowByte = _mm256_set1_epi32(0xFF);
+        const int* lutWords = reinterpret_cast<const int*>(lut);
+        for (; i <= length - 16; i += 16)
+        {
+            const __m256i idx0 = _mm256_min_epu32(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i))), maxIdx);
+            const __m256i idx1 = _mm256_min_epu32(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 8))), maxIdx);
+            // byte-scaled gathers read a 32-bit word starting at each entry (the table is padded for this), keep the low byte
+            const __m256i v0 = _mm256_and_si256(_mm256_i32gather_epi32(lutWords, idx0, 1), lowByte);
+            const __m256i v1 = _mm256_and_si256(_mm256_i32gather_epi32(lutWords, idx1, 1), lowByte);
+            // packs work per 128-bit lane, so restore the order before the final narrowing
+            const __m256i v16 = _mm256_permute4x64_epi64(_mm256_packus_epi32(v0, v1), 0xD8);
+            const __m128i v8 = _mm_packus_epi16(_mm256_castsi256_si128(v16), _mm256_extracti128_si256(v16, 1));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), v8);
+        }
+#else
+        for (; i <= length - 4; i += 4)
+        {
+            dst[i]     = lut[std::min(src[i], maxIndex)];
+            dst[i + 1] = lut[std::min(src[i + 1], maxIndex)];
+            dst[i + 2] = lut[std::min(src[i + 2], maxIndex)];
+            dst[i + 3] = lut[std::min(src[i + 3], maxIndex)];
+        }
+#endif
+        for (; i < length; ++i) dst[i] = lut[std::min(src[i], maxIndex)];
+    }
+
+    //! Tables used by the fixed-mapping display functions, built on first use
+    const IRTrackerUtils::ImageProc::DisplayLUT& DefaultDepthDisplayLUT()
+    {
+        static const IRTrackerUtils::ImageProc::DisplayLUT lut = [] {
+            IRTrackerUtils::ImageProc::DisplayLUT table;
+            IRTrackerUtils::ImageProc::BuildDepthDisplayLUT(0, 1000, table); // so a depth value of 1m is max brightness
+            return table;
+        }();
+        return lut;
+    }
+
+    const IRTrackerUtils::ImageProc::DisplayLUT& ABDisplayLUT()
+    {
+        static const IRTrackerUtils::ImageProc::DisplayLUT lut = [] {
+            IRTrackerUtils::ImageProc::DisplayLUT table;
+            IRTrackerUtils::ImageProc::BuildABDisplayLUT(table);
+            return table;
+        }();
+        return lut;
+    }
+
+    //! @brief  Number of pixels covered by the blob that \p contour (from cv::findContours) outlines, boundary included
+    //! 
+    //! Pick's theorem on the polygon through the boundary pixel centres: pixels = area + boundary steps / 2 + 1. Exact
+    //! for blobs without holes, whereas the polygon \p area alone misses half the boundary (a 3x3 blob reads as 4, not 9).
+    double ContourPixelCount(const std::vector<cv::Point>& contour, double area)
+    {
+        int64_t steps = 0; // chain approximated edges are straight or diagonal, so each spans max(|dx|, |dy|) steps
+        for (size_t i = 0; i < contour.size(); ++i)
+        {
+            const cv::Point edge = contour[(i + 1) % contour.size()] - contour[i];
+            steps += std::max(std::abs(edge.x), std::abs(edge.y));
+        }
+        return area + 0.5 * static_cast<double>(steps) + 1.0;
+    }
+
+    void DetectBlobs2DBasic(cv::Mat& processed_image, std::vector<cv::Point2f>& outPixelLocations, bool inputIsBinarised,
+        std::vector<float>* outBlobAreas)
     {
         PROFILE_BLOCK(DetectBlobsBasic);
         if (outPixelLocations.size() > 0) outPixelLocations.clear();
+        if (outBlobAreas) outBlobAreas->clear();
 
         // binarisation to speed up contour detect
-        cv::threshold(processed_image, processed_image, BINARY_THRESH_8BIT, 255, cv::THRESH_BINARY);
+        if (!inputIsBinarised) cv::threshold(processed_image, processed_image, BINARY_THRESH_8BIT, 255, cv::THRESH_BINARY);
 
         // external contours of interest in this scenario
         std::vector<std::vector<cv::Point>> contours;
@@ -41,12 +351,12 @@ namespace // Anonymous ImageProc
             perimeter = cv::arcLength(contour, true);
 
             /* filter by area. max: 1/16th of total image   */
-            if (area < 5 || area > 16384) continue;
+            if (area < BLOB_AREA_MIN || area > BLOB_AREA_MAX) continue;
 
             /* see https://en.wikipedia.org/wiki/Roundness  */
             /* for definition of roundedness formula used   */
             circ = (4 * PI * area) / (perimeter * perimeter);
-            if (circ < 0.7f) continue; // filter by circularity
+            if (circ < BLOB_CIRCULARITY_MIN) continue; // filter by circularity
 
             // see https://en.wikipedia.org/wiki/Image_moment 
             // for defining a centroid from an image moment
@@ -54,17 +364,20 @@ namespace // Anonymous ImageProc
             blobX = M.m10 / M.m00;
             blobY = M.m01 / M.m00;
             outPixelLocations.emplace_back(blobX, blobY);
+            if (outBlobAreas) outBlobAreas->push_back(static_cast<float>(ContourPixelCount(contour, area)));
         }
     }
 
-    void DetectBlobs2DRefined(cv::Mat& processed_image, std::vector<cv::Point2f>& outPixelLocations)
+    void DetectBlobs2DRefined(cv::Mat& processed_image, std::vector<cv::Point2f>& outPixelLocations, bool inputIsBinarised,
+        std::vector<float>* outBlobAreas)
     {
         PROFILE_BLOCK(DetectBlobsRefined);
         using namespace Eigen;
         if (outPixelLocations.size() > 0) outPixelLocations.clear();
+        if (outBlobAreas) outBlobAreas->clear();
 
         // binarisation for helping contour detection, floor all below BINARY_THRESH to 0, and ceil above to 255
-        cv::threshold(processed_image, processed_image, BINARY_THRESH_8BIT, 255, cv::THRESH_BINARY);
+        if (!inputIsBinarised) cv::threshold(processed_image, processed_image, BINARY_THRESH_8BIT, 255, cv::THRESH_BINARY);
 
         std::vector<std::vector<cv::Point>> contours;
         cv::findContours(processed_image, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
@@ -78,7 +391,8 @@ namespace // Anonymous ImageProc
             perimeter = cv::arcLength(contour, true);
 
             // filter by area, dropped
-            if (area < 5 || area > 16384) continue;
+            if (area < BLOB_AREA_MIN || area > BLOB_AREA_MAX) continue;
+            const double pixelArea = ContourPixelCount(contour, area); // the refined contour is in upscaled pixels
 
             auto boundRect = cv::boundingRect(contour);
             auto xmin = boundRect.x; auto xmax = xmin + boundRect.width;
@@ -119,17 +433,292 @@ namespace // Anonymous ImageProc
                 area = cv::contourArea(new_contour);
                 perimeter = cv::arcLength(new_contour, true);
                 circ = (4 * PI * area) / (perimeter * perimeter);
-                if (circ < 0.7f) continue; // filter by circularity
+                if (circ < BLOB_CIRCULARITY_MIN) continue; // filter by circularity
 
                 auto Ellipse = cv::fitEllipseDirect(new_contour);
 
-                float blobX = Ellipse.center.x; blobX /= sf; blobX += xmin;
-                float blobY = Ellipse.center.y; blobY /= sf; blobY += ymin;
+                // cv::resize maps pixel centres (x + 0.5) / sf - 0.5, undo the same way or the centre drifts half a pixel
+                float blobX = (Ellipse.center.x + 0.5f) / sf - 0.5f + xmin;
+                float blobY = (Ellipse.center.y + 0.5f) / sf - 0.5f + ymin;
 
                 outPixelLocations.emplace_back(blobX, blobY);
+                if (outBlobAreas) outBlobAreas->push_back(static_cast<float>(pixelArea));
             }
         }
     }
+
+    //! @brief  Grey-level weighted centroid of \p rawABImage inside the bounding box of \p component (plus a 1 px margin)
+    //! 
+    //! The mean of the margin ring is used as the local background and subtracted from each pixel, so the faint 
+    //! edges of the blob pull the estimate towards the true centre without the dark surroundings biasing it. 
+    //! Falls back to the contour centroid if there's no usable signal.
+    cv::Point2f WeightedCentroid(const cv::Mat& rawABImage, const IRTrackerUtils::ImageProc::BlobComponent& component)
+    {
+        const int xmin = std::max(component.MinX - 1, 0);
+        const int ymin = std::max(component.MinY - 1, 0);
+        const int xmax = std::min(component.MaxX + 1, rawABImage.cols - 1);
+        const int ymax = std::min(component.MaxY + 1, rawABImage.rows - 1);
+
+        // local background from the ring of pixels around the bounding box
+        double ringSum = 0;
+        int ringCount = 0;
+        for (int y = ymin; y <= ymax; ++y)
+        {
+            const uint16_t* row = rawABImage.ptr<uint16_t>(y);
+            if (y == ymin || y == ymax)
+            {
+                for (int x = xmin; x <= xmax; ++x) ringSum += row[x];
+                ringCount += xmax - xmin + 1;
+            }
+            else
+            {
+                ringSum += row[xmin] + row[xmax];
+                ringCount += 2;
+            }
+        }
+        const double background = (ringCount > 0) ? ringSum / ringCount : 0.0;
+
+        double sumW = 0, sumWX = 0, sumWY = 0;
+        for (int y = ymin; y <= ymax; ++y)
+        {
+            const uint16_t* row = rawABImage.ptr<uint16_t>(y);
+            double rowW = 0, rowWX = 0;
+            for (int x = xmin; x <= xmax; ++x)
+            {
+                const double w = row[x] - background;
+                if (w <= 0) continue;
+                rowW += w;
+                rowWX += w * x;
+            }
+            sumW += rowW;
+            sumWX += rowWX;
+            sumWY += rowW * y;
+        }
+
+        if (sumW <= 0) return component.Centroid();
+        return cv::Point2f(static_cast<float>(sumWX / sumW), static_cast<float>(sumWY / sumW));
+    }
+
+    //! @brief  Shared by the labelling based detectors: applies the area/circularity filters to \p components and
+    //!         writes out their centres (and areas, if asked for). Uses \ref WeightedCentroid when \p rawABImage is 
+    //!         given, else the contour centroid
+    void FilterBlobComponents(const std::vector<IRTrackerUtils::ImageProc::BlobComponent>& components, const cv::Mat& rawABImage,
+        std::vector<cv::Point2f>& outPixelLocations, std::vector<float>* outBlobAreas)
+    {
+        using IRTrackerUtils::ImageProc::BlobComponent;
+        for (const BlobComponent& component : components)
+        {
+            // area/perimeter are already accumulated, so the filters are O(1) per blob
+            const double area = component.Area();
+            if (area < BLOB_AREA_MIN || area > BLOB_AREA_MAX) continue;
+
+            const double perimeter = component.Perimeter();
+            const double circ = (4 * PI * area) / (perimeter * perimeter);
+            if (circ < BLOB_CIRCULARITY_MIN) continue;
+
+            outPixelLocations.emplace_back(rawABImage.empty() ? component.Centroid() : WeightedCentroid(rawABImage, component));
+            if (outBlobAreas) outBlobAreas->push_back(static_cast<float>(component.PixelCount));
+        }
+    }
+
+    void DetectBlobs2DConnected(cv::Mat& processed_image, std::vector<cv::Point2f>& outPixelLocations, bool inputIsBinarised,
+        std::vector<float>* outBlobAreas)
+    {
+        PROFILE_BLOCK(DetectBlobsConnected);
+        using IRTrackerUtils::ImageProc::BlobComponent;
+        if (outPixelLocations.size() > 0) outPixelLocations.clear();
+        if (outBlobAreas) outBlobAreas->clear();
+
+        if (!inputIsBinarised) cv::threshold(processed_image, processed_image, BINARY_THRESH_8BIT, 255, cv::THRESH_BINARY);
+
+        // reused between frames to avoid re-allocating
+        thread_local std::vector<BlobComponent> components;
+        IRTrackerUtils::ImageProc::LabelBlobComponents(processed_image, components);
+        FilterBlobComponents(components, cv::Mat(), outPixelLocations, outBlobAreas);
+    }
+
+    void DetectBlobs2DWeighted(cv::Mat& processed_image, const cv::Mat& rawABImage, std::vector<cv::Point2f>& outPixelLocations, bool inputIsBinarised,
+        std::vector<float>* outBlobAreas)
+    {
+        PROFILE_BLOCK(DetectBlobsWeighted);
+        using IRTrackerUtils::ImageProc::BlobComponent;
+        if (outPixelLocations.size() > 0) outPixelLocations.clear();
+        if (outBlobAreas) outBlobAreas->clear();
+
+        if (!inputIsBinarised) cv::threshold(processed_image, processed_image, BINARY_THRESH_8BIT, 255, cv::THRESH_BINARY);
+
+        thread_local std::vector<BlobComponent> components;
+        IRTrackerUtils::ImageProc::LabelBlobComponents(processed_image, components);
+
+        // without the raw data this is the same as the connected components method
+        const bool haveRawData = rawABImage.type() == CV_16UC1 && rawABImage.size() == processed_image.size();
+        FilterBlobComponents(components, haveRawData ? rawABImage : cv::Mat(), outPixelLocations, outBlobAreas);
+    }
+
+    //! @brief  Sub-pixel peak location from a least-squares quadratic f = a + bx + cy + dx^2 + exy + fy^2 over the 
+    //!         PEAK_FIT_RADIUS window around (x, y)
+    //! 
+    //! The grid is symmetric, so the odd terms decouple and only (a, d, f) need solving together. Falls back to
+    //! separate fits along each axis if the surface isn't a clean maximum, and to the integer location at the border.
+    template <typename T>
+    cv::Point2f QuadraticPeakFit(const cv::Mat& image, int x, int y)
+    {
+        constexpr int r = PEAK_FIT_RADIUS;
+        if (x < r || y < r || x >= image.cols - r || y >= image.rows - r) return cv::Point2f(static_cast<float>(x), static_cast<float>(y));
+
+        // moments of the grid coordinates
+        constexpr double n = (2 * r + 1) * (2 * r + 1);
+        double sumX2 = 0, sumX4 = 0;
+        for (int i = -r; i <= r; ++i) { sumX2 += i * i; sumX4 += i * i * i * i; }
+        const double s2 = (2 * r + 1) * sumX2, s4 = (2 * r + 1) * sumX4, s22 = sumX2 * sumX2;
+
+        double sumI = 0, sumXI = 0, sumYI = 0, sumXXI = 0, sumYYI = 0, sumXYI = 0;
+        for (int j = -r; j <= r; ++j)
+        {
+            const T* row = image.ptr<T>(y + j);
+            for (int i = -r; i <= r; ++i)
+            {
+                const double I = row[x + i];
+                sumI += I; sumXI += i * I; sumYI += j * I;
+                sumXXI += i * i * I; sumYYI += j * j * I; sumXYI += i * j * I;
+            }
+        }
+
+        const double b = sumXI / s2, c = sumYI / s2, e = sumXYI / s22;
+        // eliminate a, leaving [A B; B A][d f] = [u w]
+        const double A = s4 - s2 * s2 / n, B = s22 - s2 * s2 / n;
+        const double u = sumXXI - s2 * sumI / n, w = sumYYI - s2 * sumI / n;
+        const double d = (A * u - B * w) / (A * A - B * B), f = (A * w - B * u) / (A * A - B * B);
+
+        // stationary point of the quadratic: [2d e; e 2f] * offset = -[b c]
+        double ox = 0, oy = 0;
+        const double det = 4 * d * f - e * e;
+        if (d < 0 && det > 0)
+        {
+            ox = (-b * 2 * f + c * e) / det;
+            oy = (-c * 2 * d + b * e) / det;
+        }
+        if (!(std::abs(ox) <= 0.5 && std::abs(oy) <= 0.5))
+        {
+            ox = (d < 0) ? std::clamp(b / (-2 * d), -0.5, 0.5) : 0.0;
+            oy = (f < 0) ? std::clamp(c / (-2 * f), -0.5, 0.5) : 0.0;
+        }
+        return cv::Point2f(static_cast<float>(x + ox), static_cast<float>(y + oy));
+    }
+
+    //! @brief  One centre per component, at its brightest pixel of \p valueImage (as recorded by the labeller) refined by
+    //!         \ref QuadraticPeakFit. Only components under PEAK_BLOB_PIXELS_MIN are dropped, so blobs of two pixels are kept
+    //! 
+    //! A bare binary mask has no peak to fit, so if \p valueImage is empty the pixel centroid is used instead.
+    void PeaksFromComponents(const std::vector<IRTrackerUtils::ImageProc::BlobComponent>& components, const cv::Mat& valueImage,
+        std::vector<cv::Point2f>& outPixelLocations, std::vector<float>* outBlobAreas)
+    {
+        using IRTrackerUtils::ImageProc::BlobComponent;
+        for (const BlobComponent& component : components)
+        {
+            if (component.PixelCount < PEAK_BLOB_PIXELS_MIN) continue;
+            if (valueImage.empty())
+            {
+                outPixelLocations.emplace_back(static_cast<float>(static_cast<double>(component.PixelSumX) / component.PixelCount),
+                                               static_cast<float>(static_cast<double>(component.PixelSumY) / component.PixelCount));
+            }
+            else if (valueImage.depth() == CV_16U) outPixelLocations.push_back(QuadraticPeakFit<uint16_t>(valueImage, component.PeakX, component.PeakY));
+            else outPixelLocations.push_back(QuadraticPeakFit<uint8_t>(valueImage, component.PeakX, component.PeakY));
+
+            if (outBlobAreas) outBlobAreas->push_back(static_cast<float>(component.PixelCount));
+        }
+    }
+
+    void DetectBlobs2DPeaks(cv::Mat& processed_image, const cv::Mat& rawABImage, std::vector<cv::Point2f>& outPixelLocations, bool inputIsBinarised,
+        std::vector<float>* outBlobAreas)
+    {
+        PROFILE_BLOCK(DetectBlobsPeaks);
+        using IRTrackerUtils::ImageProc::BlobComponent;
+        if (outPixelLocations.size() > 0) outPixelLocations.clear();
+        if (outBlobAreas) outBlobAreas->clear();
+        if (processed_image.type() != CV_8UC1) return;
+
+        // peaks are found on the raw data where available since the 8-bit image saturates. Without it they're found
+        // on the 8-bit image itself, so unlike the other methods it can't be thresholded in place
+        const bool haveRawData = rawABImage.type() == CV_16UC1 && rawABImage.size() == processed_image.size();
+        thread_local cv::Mat thresholded;
+        if (!inputIsBinarised) cv::threshold(processed_image, thresholded, BINARY_THRESH_8BIT, 255, cv::THRESH_BINARY);
+        const cv::Mat& mask = inputIsBinarised ? processed_image : thresholded;
+        const cv::Mat valueImage = haveRawData ? rawABImage : (inputIsBinarised ? cv::Mat() : processed_image);
+
+        // one pass of the labeller finds every blob and its brightest pixel, so a blob gives exactly one peak
+        thread_local std::vector<BlobComponent> components;
+        IRTrackerUtils::ImageProc::LabelBlobComponents(mask, components, valueImage);
+        PeaksFromComponents(components, valueImage, outPixelLocations, outBlobAreas);
+    }
+
+    //! Adds \p window to \p rois, first absorbing any windows it overlaps, so the list stays non-overlapping
+    void MergeIntoROIs(cv::Rect window, std::vector<cv::Rect>& rois)
+    {
+        // repeat as the grown window may now touch others
+        bool merged = true;
+        while (merged)
+        {
+            merged = false;
+            for (auto it = rois.begin(); it != rois.end(); ++it)
+            {
+                if ((window & *it).empty()) continue;
+                window = window | *it;
+                rois.erase(it);
+                merged = true;
+                break;
+            }
+        }
+        rois.push_back(window);
+    }
+
+    //! @brief  Pixel area a marker sphere of \p radiusMetres should cover when its front surface is \p rangeMetres away
+    //! 
+    //! The pixel scale comes from the rays through the points half a pixel either side of the blob centre, so it 
+    //! follows the lens distortion of whichever camera model produced them.
+    double PredictedMarkerArea(const Eigen::Vector3f& left, const Eigen::Vector3f& right, const Eigen::Vector3f& up,
+        const Eigen::Vector3f& down, double rangeMetres, double radiusMetres)
+    {
+        const Eigen::Vector3d l = left.cast<double>(), r = right.cast<double>(), u = up.cast<double>(), d = down.cast<double>();
+        const double pixelAngleX = std::atan2(l.cross(r).norm(), l.dot(r));
+        const double pixelAngleY = std::atan2(u.cross(d).norm(), u.dot(d));
+        if (!(pixelAngleX > 0.0) || !(pixelAngleY > 0.0)) return 0.0;
+
+        // half-angle the sphere subtends, measured from its centre which is one radius behind the surface
+        const double angularRadius = std::asin(radiusMetres / (rangeMetres + radiusMetres));
+        return PI * (angularRadius / pixelAngleX) * (angularRadius / pixelAngleY);
+    }
+
+    //! Shared body of the ValidateBlobs3D overloads, \p getUnitRay(index, pixel, ray) supplies the camera-frame 
+    //! unit ray through each blob and returns false for pixels the camera model can't map
+    template <typename RayFunction>
+    void ValidateBlobs3DWithRays(const cv::Mat&                                     inDepthImg,
+                                 const Eigen::Ref<Eigen::Matrix4d>                  inDepth2World,
+                                 const std::vector<cv::Point2f>&                    inBlobPixels2D,
+                                 std::vector<IRTrackerUtils::InfraBlobInfo>&        outBlobInfo,
+                                 RayFunction&&                                      getUnitRay)
+    {
+        using namespace Eigen;
+        Vector3d pointInDepth, pointInWorld;
+        Eigen::Affine3d transform(inDepth2World);
+        for (size_t i = 0; i < inBlobPixels2D.size(); ++i)
+        {
+            const cv::Point2f& pixelLocation = inBlobPixels2D[i];
+            const float depthVal = IRTrackerUtils::ImageProc::BilinearInterpolation(inDepthImg, pixelLocation);
+
+            // check: https://github.com/microsoft/HoloLens2ForCV/blob/main/Samples/SensorVisualization/SensorVisualization/Content/SlateCameraRenderer.cpp
+            // for the magic val of 4090 for depth AHAT. -1 means the pixel is off the depth image
+            if (!(depthVal > 0) || depthVal > 4090) { continue; }
+
+            if (!getUnitRay(i, pixelLocation, pointInDepth)) continue;
+
+            pointInDepth *= (static_cast<double>(depthVal) / 1000.0); // convert into metres
+            pointInWorld = transform * pointInDepth.homogeneous();
+
+            IRTrackerUtils::InfraBlobInfo valid_blob{ cv::Point2f(pixelLocation.x, pixelLocation.y), pointInDepth, pointInWorld };
+            outBlobInfo.emplace_back(valid_blob);
+        }
+    }
 }
 
 namespace IRTrackerUtils
@@ -143,7 +732,8 @@ namespace IRTrackerUtils
         int x0 = static_cast<int>(x);
         int y0 = static_cast<int>(y);
        
-        if (x0 < 0 || y0 < 0 || x >= image.cols || y >= image.rows) { return -1; }
+        // x0/y0 truncate towards zero, so test the coordinates themselves: (-1, 0) would otherwise extrapolate
+        if (!(x >= 0 && y >= 0 && x < image.cols && y < image.rows)) { return -1; }
         int x1 = std::min(x0 + 1, image.cols - 1);
         int y1 = std::min(y0 + 1, image.rows - 1);
 
@@ -188,25 +778,166 @@ namespace IRTrackerUtils
 
 		std::memcpy(dst.data, src, static_cast<unsigned long long>(rows) * cols * chs * sizeof(T));
 	}
+	template void ImageProc::NativeToCVMat(const uint16_t* src, cv::Mat& dst, int rows, int cols);
+	template void ImageProc::NativeToCVMat(const uint8_t* src, cv::Mat& dst, int rows, int cols);
    
-	void ImageProc::DetectBlobs2D(cv::Mat& processed_image, BlobDetectionMethod method, std::vector<cv::Point2f>& outPixelLocations)
+	void ImageProc::DetectBlobs2D(cv::Mat& processed_image, BlobDetectionMethod method, std::vector<cv::Point2f>& outPixelLocations,
+        bool inputIsBinarised, const cv::Mat& rawABImage, std::vector<float>* outBlobAreas)
 	{
 		switch (method) 
 		{
 		    case BlobDetectionMethod::Basic:
-                DetectBlobs2DBasic(processed_image, outPixelLocations);
+                DetectBlobs2DBasic(processed_image, outPixelLocations, inputIsBinarised, outBlobAreas);
 			    break;
 
 		    case BlobDetectionMethod::RefineByScaling:
-                DetectBlobs2DRefined(processed_image, outPixelLocations);
+                DetectBlobs2DRefined(processed_image, outPixelLocations, inputIsBinarised, outBlobAreas);
+			    break;
+
+		    case BlobDetectionMethod::ConnectedComponents:
+                DetectBlobs2DConnected(processed_image, outPixelLocations, inputIsBinarised, outBlobAreas);
+			    break;
+
+		    case BlobDetectionMethod::IntensityWeighted:
+                DetectBlobs2DWeighted(processed_image, rawABImage, outPixelLocations, inputIsBinarised, outBlobAreas);
+			    break;
+
+		    case BlobDetectionMethod::BlobPeak:
+                DetectBlobs2DPeaks(processed_image, rawABImage, outPixelLocations, inputIsBinarised, outBlobAreas);
 			    break;
 
 		    default:
-                DetectBlobs2DBasic(processed_image, outPixelLocations);
+                DetectBlobs2DBasic(processed_image, outPixelLocations, inputIsBinarised, outBlobAreas);
                 break;
 		}
 	}
 
+    void ImageProc::DetectBlobs2DInROIs(cv::Mat& processed_image, BlobDetectionMethod method, const std::vector<cv::Rect>& searchROIs,
+        std::vector<cv::Point2f>& outPixelLocations, bool inputIsBinarised, const cv::Mat& rawABImage, std::vector<float>* outBlobAreas)
+    {
+        PROFILE_BLOCK(DetectBlobsInROIs);
+        if (outPixelLocations.size() > 0) outPixelLocations.clear();
+        if (outBlobAreas) outBlobAreas->clear();
+
+        thread_local std::vector<cv::Point2f> roiPixelLocations;
+        thread_local std::vector<float> roiBlobAreas;
+        for (const cv::Rect& roi : searchROIs)
+        {
+            // a view into the full image, no pixels are copied
+            cv::Mat roiImage = processed_image(roi);
+            DetectBlobs2D(roiImage, method, roiPixelLocations, inputIsBinarised, rawABImage.empty() ? rawABImage : rawABImage(roi),
+                outBlobAreas ? &roiBlobAreas : nullptr);
+
+            for (const cv::Point2f& location : roiPixelLocations)
+            {
+                outPixelLocations.emplace_back(location.x + roi.x, location.y + roi.y);
+            }
+            if (outBlobAreas) outBlobAreas->insert(outBlobAreas->end(), roiBlobAreas.begin(), roiBlobAreas.end());
+        }
+    }
+
+    void ImageProc::BuildSearchROIs(const ToolDictionary& toolDictionary, int windowHalfSize, cv::Size imageSize, std::vector<cv::Rect>& outROIs)
+    {
+        outROIs.clear();
+        const cv::Rect imageRect(0, 0, imageSize.width, imageSize.height);
+        const int windowSize = 2 * windowHalfSize + 1;
+
+        for (const auto& [_, tool] : toolDictionary)
+        {
+            if (!tool.VisibleToHoloLens) continue;
+
+            for (const cv::Point2i& keypoint : tool.ObservedImgKeypoints)
+            {
+                const cv::Rect window = cv::Rect(keypoint.x - windowHalfSize, keypoint.y - windowHalfSize, windowSize, windowSize) & imageRect;
+                if (!window.empty()) MergeIntoROIs(window, outROIs);
+            }
+        }
+    }
+
+    void ImageProc::BuildSearchROIs(const std::vector<cv::Point2f>& keypoints, int windowHalfSize, cv::Size imageSize, std::vector<cv::Rect>& outROIs)
+    {
+        outROIs.clear();
+        const cv::Rect imageRect(0, 0, imageSize.width, imageSize.height);
+        const int windowSize = 2 * windowHalfSize + 1;
+
+        for (const cv::Point2f& keypoint : keypoints)
+        {
+            const cv::Rect window = cv::Rect(cvRound(keypoint.x) - windowHalfSize, cvRound(keypoint.y) - windowHalfSize, windowSize, windowSize) & imageRect;
+            if (!window.empty()) MergeIntoROIs(window, outROIs);
+        }
+    }
+
+    void ImageProc::FindCandidateROIs(const cv::Mat& inputRaw16BitImg, int poolFactor, std::vector<cv::Rect>& outROIs,
+        const cv::Mat& inputRawDepthImg, DepthGate gate, uint16_t rawThreshold, ABHistogram* outHistogram)
+    {
+        PROFILE_BLOCK(FindCandidateROIs);
+        outROIs.clear();
+        if (outHistogram) outHistogram->Clear();
+        if (inputRaw16BitImg.type() != CV_16UC1) return;
+        const bool gated = gate.IsEnabled() && inputRawDepthImg.type() == CV_16UC1 && inputRawDepthImg.size() == inputRaw16BitImg.size();
+        const uint16_t gateRange = static_cast<uint16_t>(gate.FarMM - gate.NearMM);
+
+        poolFactor = std::max(poolFactor, 1);
+        const int coarseRows = (inputRaw16BitImg.rows + poolFactor - 1) / poolFactor;
+        const int coarseCols = (inputRaw16BitImg.cols + poolFactor - 1) / poolFactor;
+
+        // max-pooled binary mask, a coarse cell is set if any pixel in it would pass the full resolution threshold
+        thread_local cv::Mat coarseMask;
+        thread_local std::vector<uint16_t> blockMax;
+        coarseMask.create(coarseRows, coarseCols, CV_8UC1);
+        blockMax.resize(coarseCols);
+
+        for (int cy = 0; cy < coarseRows; ++cy)
+        {
+            std::fill(blockMax.begin(), blockMax.end(), uint16_t(0));
+            const int yEnd = std::min((cy + 1) * poolFactor, inputRaw16BitImg.rows);
+            for (int y = cy * poolFactor; y < yEnd; ++y)
+            {
+                const uint16_t* row = inputRaw16BitImg.ptr<uint16_t>(y);
+                if (outHistogram && y % HISTOGRAM_ROW_STEP == 0) AccumulateHistogramRow(row, inputRaw16BitImg.cols, *outHistogram);
+                if (!gated)
+                {
+                    for (int x = 0; x < inputRaw16BitImg.cols; ++x)
+                    {
+                        uint16_t& m = blockMax[x / poolFactor];
+                        m = std::max(m, row[x]);
+                    }
+                    continue;
+                }
+
+                // out of range pixels pool as dark, same test as the gated front-end
+                const uint16_t* depthRow = inputRawDepthImg.ptr<uint16_t>(y);
+                for (int x = 0; x < inputRaw16BitImg.cols; ++x)
+                {
+                    const uint16_t value = (static_cast<uint16_t>(depthRow[x] - gate.NearMM) <= gateRange) ? row[x] : 0;
+                    uint16_t& m = blockMax[x / poolFactor];
+                    m = std::max(m, value);
+                }
+            }
+
+            uint8_t* maskRow = coarseMask.ptr<uint8_t>(cy);
+            for (int cx = 0; cx < coarseCols; ++cx) maskRow[cx] = (blockMax[cx] >= rawThreshold) ? 255 : 0;
+        }
+
+        // 8-connected pixels land in the same or 8-adjacent cells, so each full resolution blob is entirely 
+        // inside the bounding box of one coarse component
+        thread_local std::vector<BlobComponent> components;
+        LabelBlobComponents(coarseMask, components);
+
+        const cv::Rect imageRect(0, 0, inputRaw16BitImg.cols, inputRaw16BitImg.rows);
+        for (const BlobComponent& component : components)
+        {
+            const cv::Rect window = cv::Rect(
+                component.MinX * poolFactor - COARSE_ROI_PADDING, 
+                component.MinY * poolFactor - COARSE_ROI_PADDING,
+                (component.MaxX - component.MinX + 1) * poolFactor + 2 * COARSE_ROI_PADDING,
+                (component.MaxY - component.MinY + 1) * poolFactor + 2 * COARSE_ROI_PADDING) & imageRect;
+
+            // merging also pulls in neighbouring blobs that fall inside the padding, so nothing gets cut in half
+            if (!window.empty()) MergeIntoROIs(window, outROIs);
+        }
+    }
+
     void ImageProc::ValidateBlobs3D(const cv::Mat&                      inDepthImg, 
                                     const Eigen::Ref<Eigen::Matrix4d>   inDepth2World, 
                                     const std::vector<cv::Point2f>&     inBlobPixels2D, 
@@ -214,69 +945,387 @@ namespace IRTrackerUtils
                                     std::vector<InfraBlobInfo>&         outBlobInfo)
     {
         PROFILE_BLOCK(ValidateBlobs3D);
-        using namespace Eigen;
         if (outBlobInfo.size() > 0) outBlobInfo.clear();
 
         // if we can't access the depth-camera's unmap function, exit
         if (!MapImagePointToCameraUnitPlane) { return; }
 
-        Vector3d pointInDepth, pointInWorld;
-        Eigen::Affine3d transform(inDepth2World);
-        for (const auto& pixelLocation : inBlobPixels2D)
+        ValidateBlobs3DWithRays(inDepthImg, inDepth2World, inBlobPixels2D, outBlobInfo,
+            [&](size_t, const cv::Point2f& pixelLocation, Eigen::Vector3d& unitRay)
+            {
+                float xy[2] = { 0.0,0.0 };
+                float uv[2] = { pixelLocation.x, pixelLocation.y };
+
+                // unmap to unit plane, function should return false in case
+                // of any 'bad' inputs
+                if (!MapImagePointToCameraUnitPlane(uv, xy)) return false;
+
+                unitRay = Eigen::Vector3d(static_cast<double>(xy[0]), 
+                                          static_cast<double>(xy[1]), 
+                                                                 1);
+                unitRay.normalize(); // turn it into a unit vector
+                return true;
+            });
+    }
+
+    void ImageProc::ValidateBlobs3D(const cv::Mat&                      inDepthImg, 
+                                    const Eigen::Ref<Eigen::Matrix4d>   inDepth2World, 
+                                    const std::vector<cv::Point2f>&     inBlobPixels2D, 
+                                    const CameraModel&                  cameraModel, 
+                                    std::vector<InfraBlobInfo>&         outBlobInfo)
+    {
+        PROFILE_BLOCK(ValidateBlobs3D);
+        if (outBlobInfo.size() > 0) outBlobInfo.clear();
+
+        // one batched unmap for the whole frame, rather than a call per blob
+        thread_local std::vector<Eigen::Vector3f> unitRays;
+        thread_local std::vector<uint8_t> rayValid;
+        unitRays.resize(inBlobPixels2D.size());
+        rayValid.resize(inBlobPixels2D.size());
+        if (cameraModel.UnmapPoints(inBlobPixels2D.data(), inBlobPixels2D.size(), unitRays.data(), rayValid.data()) == 0) return;
+
+        ValidateBlobs3DWithRays(inDepthImg, inDepth2World, inBlobPixels2D, outBlobInfo,
+            [&](size_t index, const cv::Point2f&, Eigen::Vector3d& unitRay)
+            {
+                if (!rayValid[index]) return false;
+                unitRay = unitRays[index].cast<double>();
+                return true;
+            });
+    }
+
+    void ImageProc::ValidateBlobs3DBatch(const cv::Mat&                     inDepthImg, 
+                                         const Eigen::Ref<Eigen::Matrix4d>  inDepth2World, 
+                                         const std::vector<cv::Point2f>&    inBlobPixels2D, 
+                                         const CameraModel&                 cameraModel, 
+                                         BlobPoints3D&                      outBlobPoints,
+                                         const cv::Mat&                     inSigmaImg,
+                                         const std::vector<float>&          inBlobAreas,
+                                         MarkerSizeFilter                   sizeFilter)
+    {
+        PROFILE_BLOCK(ValidateBlobs3D);
+        outBlobPoints.Clear();
+        if (inBlobPixels2D.empty() || inDepthImg.type() != CV_16UC1) return;
+        const bool haveSigma = inSigmaImg.type() == CV_8UC1 && inSigmaImg.size() == inDepthImg.size();
+        const bool checkSize = sizeFilter.IsEnabled() && inBlobAreas.size() == inBlobPixels2D.size();
+
+        thread_local std::vector<cv::Point2f> keptPixels;
+        thread_local std::vector<float> keptDepths;
+        thread_local std::vector<float> keptAreas;
+        thread_local std::vector<Eigen::Vector3f> unitRays;
+        thread_local std::vector<uint8_t> rayValid;
+        keptPixels.clear();
+        keptDepths.clear();
+        keptAreas.clear();
+
+        // 1) depth at every blob, type and size are checked once above rather than per tap
+        const int cols = inDepthImg.cols, rows = inDepthImg.rows;
+        for (size_t i = 0; i < inBlobPixels2D.size(); ++i)
         {
-            const float depthVal = BilinearInterpolation(inDepthImg, pixelLocation);
-            
-            // check: https://github.com/microsoft/HoloLens2ForCV/blob/main/Samples/SensorVisualization/SensorVisualization/Content/SlateCameraRenderer.cpp
-            // for the magic val of 4090 for depth AHAT
-            if (depthVal == 0 || depthVal > 4090) { continue; }
+            const cv::Point2f& pixel = inBlobPixels2D[i];
+            if (!(pixel.x >= 0.0f && pixel.y >= 0.0f && pixel.x < cols && pixel.y < rows)) continue;
 
-            float xy[2] = { 0.0,0.0 };
-            float uv[2] = { pixelLocation.x, pixelLocation.y };
+            const int x0 = static_cast<int>(pixel.x), y0 = static_cast<int>(pixel.y);
+            const int x1 = std::min(x0 + 1, cols - 1), y1 = std::min(y0 + 1, rows - 1);
+            const float dx = pixel.x - x0, dy = pixel.y - y0;
+            const uint16_t* row0 = inDepthImg.ptr<uint16_t>(y0);
+            const uint16_t* row1 = inDepthImg.ptr<uint16_t>(y1);
 
-            // unmap to unit plane, function should return false in case
-            // of any 'bad' inputs
-            if (!MapImagePointToCameraUnitPlane(uv, xy)) continue;
-            
-            pointInDepth = Vector3d(static_cast<double>(xy[0]), 
-                                    static_cast<double>(xy[1]), 
-                                                           1);
+            float depthVal = 0.0f;
+            if (!haveSigma)
+            {
+                // same weights as BilinearInterpolation
+                depthVal = row0[x0] * (1 - dx) * (1 - dy) + row0[x1] * dx * (1 - dy) +
+                           row1[x0] * (1 - dx) * dy       + row1[x1] * dx * dy;
+            }
+            else
+            {
+                // only blend the taps the sensor vouches for, renormalising their weights
+                const uint8_t* sigma0 = inSigmaImg.ptr<uint8_t>(y0);
+                const uint8_t* sigma1 = inSigmaImg.ptr<uint8_t>(y1);
+                const float w00 = (sigma0[x0] & SIGMA_INVALID_MASK) ? 0.0f : (1 - dx) * (1 - dy);
+                const float w01 = (sigma0[x1] & SIGMA_INVALID_MASK) ? 0.0f : dx * (1 - dy);
+                const float w10 = (sigma1[x0] & SIGMA_INVALID_MASK) ? 0.0f : (1 - dx) * dy;
+                const float w11 = (sigma1[x1] & SIGMA_INVALID_MASK) ? 0.0f : dx * dy;
+                const float weightSum = w00 + w01 + w10 + w11;
+                if (!(weightSum > 0.0f)) continue; // no valid depth near this blob, skip before any unmapping
 
-            pointInDepth.normalize(); // turn it into a unit vector
-            pointInDepth *= (static_cast<double>(depthVal) / 1000.0); // convert into metres
-            pointInWorld = transform * pointInDepth.homogeneous();
+                depthVal = (row0[x0] * w00 + row0[x1] * w01 + row1[x0] * w10 + row1[x1] * w11) / weightSum;
+            }
 
-            InfraBlobInfo valid_blob{ cv::Point2f(pixelLocation.x, pixelLocation.y), pointInDepth, pointInWorld };
-            outBlobInfo.emplace_back(valid_blob);
+            // 4090 is the AHAT invalid-depth marker, see ValidateBlobs3D
+            if (depthVal == 0 || depthVal > THRESH_RAW_DEPTH_16BIT) continue;
+            keptPixels.push_back(pixel);
+            keptDepths.push_back(depthVal);
+            if (checkSize) keptAreas.push_back(inBlobAreas[i]);
+        }
+        if (keptPixels.empty()) return;
+
+        // 2) one unmap call for all blobs with usable depth, plus the half-pixel neighbours for the size check
+        const size_t numKept = keptPixels.size();
+        const size_t raysPerBlob = checkSize ? 5 : 1;
+        if (checkSize)
+        {
+            keptPixels.resize(numKept * raysPerBlob);
+            for (size_t k = 0; k < numKept; ++k)
+            {
+                const cv::Point2f centre = keptPixels[k];
+                cv::Point2f* probes = &keptPixels[numKept + 4 * k];
+                probes[0] = centre - cv::Point2f(0.5f, 0.0f); probes[1] = centre + cv::Point2f(0.5f, 0.0f);
+                probes[2] = centre - cv::Point2f(0.0f, 0.5f); probes[3] = centre + cv::Point2f(0.0f, 0.5f);
+            }
+        }
+        unitRays.resize(numKept * raysPerBlob);
+        rayValid.resize(numKept * raysPerBlob);
+        if (cameraModel.UnmapPoints(keptPixels.data(), keptPixels.size(), unitRays.data(), rayValid.data()) == 0) return;
+
+        size_t numValid = 0;
+        const double markerRadius = 0.5 * sizeFilter.DiameterMetres;
+        for (size_t k = 0; k < numKept; ++k)
+        {
+            if (!rayValid[k]) continue;
+
+            // blobs with no measured area, or whose neighbourhood can't be unmapped (image border), are let through unchecked
+            const size_t probe = numKept + 4 * k;
+            if (checkSize && keptAreas[k] > 0.0f && rayValid[probe] && rayValid[probe + 1] && rayValid[probe + 2] && rayValid[probe + 3])
+            {
+                const double predicted = PredictedMarkerArea(unitRays[probe], unitRays[probe + 1], unitRays[probe + 2],
+                    unitRays[probe + 3], keptDepths[k] / 1000.0, markerRadius);
+                const double ratio = keptAreas[k] / predicted;
+                if (predicted > 0.0 && !(ratio >= sizeFilter.MinAreaRatio && ratio <= sizeFilter.MaxAreaRatio))
+                {
+                    rayValid[k] = 0;
+                    continue;
+                }
+            }
+            ++numValid;
         }
+        if (numValid == 0) return;
+
+        // 3) scale rays to metres, written column by column into the SoA output
+        outBlobPoints.Resize(numValid);
+        BlobPoints3D::PointMap depthPoints = outBlobPoints.DepthLocations();
+        for (size_t k = 0, j = 0; k < numKept; ++k)
+        {
+            if (!rayValid[k]) continue;
+            const double metres = static_cast<double>(keptDepths[k]) / 1000.0;
+            outBlobPoints.PixelCoordinates[j] = keptPixels[k];
+            depthPoints(j, 0) = unitRays[k].x() * metres;
+            depthPoints(j, 1) = unitRays[k].y() * metres;
+            depthPoints(j, 2) = unitRays[k].z() * metres;
+            ++j;
+        }
+
+        // 4) whole frame to world coordinates in one product, rows are points so the rotation is transposed
+        BlobPoints3D::PointMap worldPoints = outBlobPoints.WorldLocations();
+        worldPoints.noalias() = depthPoints * inDepth2World.topLeftCorner<3, 3>().transpose();
+        worldPoints.rowwise() += inDepth2World.topRightCorner<3, 1>().transpose();
     }
 
-    void ImageProc::RebalanceImgAnd8Bit(cv::Mat& inputRaw16BitImg, cv::Mat& output8BitImg)
+    void ImageProc::RebalanceImgAnd8Bit(const cv::Mat& inputRaw16BitImg, cv::Mat& output8BitImg)
     {
         if (inputRaw16BitImg.type() != CV_16UC1) return; // routine is optimised for this
-        if (output8BitImg.type() != CV_8UC1) output8BitImg = cv::Mat(inputRaw16BitImg.rows, inputRaw16BitImg.cols, CV_8UC1);
         PROFILE_BEGIN(ABImageProcessing);
-        // first and last elements of image
-        uint16_t* pStart = (uint16_t*)inputRaw16BitImg.data;
-        const uint16_t* pEnd = pStart + (static_cast<size_t>(inputRaw16BitImg.rows) * inputRaw16BitImg.cols);
 
-        for (uint16_t* ptr = pStart; ptr != pEnd; ++ptr) *(ptr) >>= 2;
+        /// same result as shifting the input in place and letting cv::convertTo saturate_cast it, but written
+        /// straight to the output so the (possibly borrowed) input buffer is never modified
+        ApplyDisplayLUT(inputRaw16BitImg, ABDisplayLUT(), output8BitImg);
+        PROFILE_END();
+    }
 
-        /// cv::convertTo will internally use OpenCV's saturateCast 
-        /// function. So linear remapping needed from above to avoid
-        /// accidentally maxing out loads of pixels
+    void ImageProc::RebalanceAndBinarise(const cv::Mat& inputRaw16BitImg, cv::Mat& output8BitImg, cv::Mat& outputBinaryMask,
+        const cv::Mat& inputRawDepthImg, DepthGate gate)
+    {
+        if (inputRaw16BitImg.type() != CV_16UC1) return; // routine is optimised for this
+        const bool gated = gate.IsEnabled() && inputRawDepthImg.type() == CV_16UC1 && inputRawDepthImg.size() == inputRaw16BitImg.size();
 
-        inputRaw16BitImg.convertTo(output8BitImg, CV_8UC1);
-        PROFILE_END();
+        // create() is a no-op if the outputs (or ROI views) already have the right size/type
+        output8BitImg.create(inputRaw16BitImg.size(), CV_8UC1);
+        outputBinaryMask.create(inputRaw16BitImg.size(), CV_8UC1);
+
+        PROFILE_BLOCK(ABFusedFrontEnd);
+        int rows = inputRaw16BitImg.rows;
+        int cols = inputRaw16BitImg.cols;
+
+        // full frames can be walked as one long row
+        if (inputRaw16BitImg.isContinuous() && output8BitImg.isContinuous() && outputBinaryMask.isContinuous() &&
+            (!gated || inputRawDepthImg.isContinuous()))
+        {
+            cols *= rows;
+            rows = 1;
+        }
+
+        for (int r = 0; r < rows; ++r)
+        {
+            if (gated)
+            {
+                RebalanceAndBinariseRow(inputRaw16BitImg.ptr<uint16_t>(r), inputRawDepthImg.ptr<uint16_t>(r), 
+                                        output8BitImg.ptr<uint8_t>(r), outputBinaryMask.ptr<uint8_t>(r), cols, gate);
+            }
+            else
+            {
+                RebalanceAndBinariseRow(inputRaw16BitImg.ptr<uint16_t>(r), output8BitImg.ptr<uint8_t>(r), 
+                                        outputBinaryMask.ptr<uint8_t>(r), cols);
+            }
+        }
+    }
+
+    void ImageProc::DetectBlobs2DParallel(const cv::Mat& inputRaw16BitImg, cv::Mat& output8BitImg, cv::Mat& outputBinaryMask,
+        BlobDetectionMethod method, int numStrips, std::vector<cv::Point2f>& outPixelLocations,
+        const cv::Mat& inputRawDepthImg, DepthGate gate, std::vector<float>* outBlobAreas)
+    {
+        if (outPixelLocations.size() > 0) outPixelLocations.clear();
+        if (outBlobAreas) outBlobAreas->clear();
+        if (inputRaw16BitImg.type() != CV_16UC1) return;
+        const bool gated = gate.IsEnabled() && inputRawDepthImg.type() == CV_16UC1 && inputRawDepthImg.size() == inputRaw16BitImg.size();
+
+        if (method != BlobDetectionMethod::ConnectedComponents && method != BlobDetectionMethod::IntensityWeighted &&
+            method != BlobDetectionMethod::BlobPeak)
+        {
+            // contour tracing can't be split at the seams, so these stay serial
+            RebalanceAndBinarise(inputRaw16BitImg, output8BitImg, outputBinaryMask, inputRawDepthImg, gate);
+            DetectBlobs2D(outputBinaryMask, method, outPixelLocations, true, inputRaw16BitImg, outBlobAreas);
+            return;
+        }
+
+        PROFILE_BLOCK(DetectBlobsParallel);
+        output8BitImg.create(inputRaw16BitImg.size(), CV_8UC1);
+        outputBinaryMask.create(inputRaw16BitImg.size(), CV_8UC1);
+
+        // front-end for each strip runs on the same worker that labels it, so the mask rows are still in cache.
+        // Profiler zones aren't thread-safe, hence calling the row kernel directly rather than RebalanceAndBinarise
+        thread_local std::vector<BlobComponent> components;
+        LabelBlobComponentsParallel(outputBinaryMask, numStrips, components, [&](const cv::Range& rows)
+        {
+            for (int r = rows.start; r < rows.end; ++r)
+            {
+                if (gated)
+                {
+                    RebalanceAndBinariseRow(inputRaw16BitImg.ptr<uint16_t>(r), inputRawDepthImg.ptr<uint16_t>(r),
+                                            output8BitImg.ptr<uint8_t>(r), outputBinaryMask.ptr<uint8_t>(r), inputRaw16BitImg.cols, gate);
+                }
+                else
+                {
+                    RebalanceAndBinariseRow(inputRaw16BitImg.ptr<uint16_t>(r), output8BitImg.ptr<uint8_t>(r),
+                                            outputBinaryMask.ptr<uint8_t>(r), inputRaw16BitImg.cols);
+                }
+            }
+        }, (method == BlobDetectionMethod::BlobPeak) ? inputRaw16BitImg : cv::Mat());
+
+        if (method == BlobDetectionMethod::BlobPeak) PeaksFromComponents(components, inputRaw16BitImg, outPixelLocations, outBlobAreas);
+        else FilterBlobComponents(components, (method == BlobDetectionMethod::IntensityWeighted) ? inputRaw16BitImg : cv::Mat(),
+                                  outPixelLocations, outBlobAreas);
+    }
+
+    void ImageProc::BinariseRaw(const cv::Mat& inputRaw16BitImg, cv::Mat& outputBinaryMask, uint16_t rawThreshold,
+        const cv::Mat& inputRawDepthImg, DepthGate gate, ABHistogram* outHistogram)
+    {
+        if (outHistogram) outHistogram->Clear();
+        if (inputRaw16BitImg.type() != CV_16UC1) return;
+        PROFILE_BLOCK(BinariseRaw);
+        const bool gated = gate.IsEnabled() && inputRawDepthImg.type() == CV_16UC1 && inputRawDepthImg.size() == inputRaw16BitImg.size();
+        outputBinaryMask.create(inputRaw16BitImg.size(), CV_8UC1);
+
+        for (int r = 0; r < inputRaw16BitImg.rows; ++r)
+        {
+            BinariseRawRow(inputRaw16BitImg, inputRawDepthImg, outputBinaryMask, r, rawThreshold, gated, gate, outHistogram);
+        }
+    }
+
+    void ImageProc::DetectBlobs2DRaw(const cv::Mat& inputRaw16BitImg, cv::Mat& outputBinaryMask, BlobDetectionMethod method, 
+        int numStrips, std::vector<cv::Point2f>& outPixelLocations, uint16_t rawThreshold, const cv::Mat& inputRawDepthImg, 
+        DepthGate gate, std::vector<float>* outBlobAreas, ABHistogram* outHistogram)
+    {
+        if (outPixelLocations.size() > 0) outPixelLocations.clear();
+        if (outBlobAreas) outBlobAreas->clear();
+        if (outHistogram) outHistogram->Clear();
+        if (inputRaw16BitImg.type() != CV_16UC1) return;
+        const bool gated = gate.IsEnabled() && inputRawDepthImg.type() == CV_16UC1 && inputRawDepthImg.size() == inputRaw16BitImg.size();
+
+        if (method != BlobDetectionMethod::ConnectedComponents && method != BlobDetectionMethod::IntensityWeighted &&
+            method != BlobDetectionMethod::BlobPeak)
+        {
+            BinariseRaw(inputRaw16BitImg, outputBinaryMask, rawThreshold, inputRawDepthImg, gate, outHistogram);
+            DetectBlobs2D(outputBinaryMask, method, outPixelLocations, true, inputRaw16BitImg, outBlobAreas);
+            return;
+        }
+
+        PROFILE_BLOCK(DetectBlobsRaw);
+        outputBinaryMask.create(inputRaw16BitImg.size(), CV_8UC1);
+
+        // same split as DetectBlobs2DParallel, minus the 8-bit image. Each strip fills its own histogram, 
+        // merged once per strip
+        std::mutex histogramMutex;
+        thread_local std::vector<BlobComponent> components;
+        LabelBlobComponentsParallel(outputBinaryMask, numStrips, components, [&](const cv::Range& rows)
+        {
+            ABHistogram stripHistogram;
+            for (int r = rows.start; r < rows.end; ++r)
+            {
+                BinariseRawRow(inputRaw16BitImg, inputRawDepthImg, outputBinaryMask, r, rawThreshold, gated, gate,
+                    outHistogram ? &stripHistogram : nullptr);
+            }
+            if (!outHistogram) return;
+
+            std::lock_guard<std::mutex> lock(histogramMutex);
+            for (int b = 0; b < ABHistogram::Bins; ++b) outHistogram->Counts[b] += stripHistogram.Counts[b];
+            outHistogram->Total += stripHistogram.Total;
+        }, (method == BlobDetectionMethod::BlobPeak) ? inputRaw16BitImg : cv::Mat());
+
+        if (method == BlobDetectionMethod::BlobPeak) PeaksFromComponents(components, inputRaw16BitImg, outPixelLocations, outBlobAreas);
+        else FilterBlobComponents(components, (method == BlobDetectionMethod::IntensityWeighted) ? inputRaw16BitImg : cv::Mat(),
+                                  outPixelLocations, outBlobAreas);
+    }
+
+    uint16_t ImageProc::UpdateAdaptiveThreshold(const ABHistogram& frameHistogram, const AdaptiveThresholdSettings& settings, 
+        AdaptiveThresholdState& state)
+    {
+        if (frameHistogram.Total == 0) return state.Threshold;
+
+        // running histogram in fractions of a frame, so the sample count doesn't matter. First frame replaces it
+        const float decay = state.Primed ? std::clamp(settings.HistogramDecay, 0.0f, 1.0f) : 1.0f;
+        const float scale = 1.0f / static_cast<float>(frameHistogram.Total);
+        for (int b = 0; b < ABHistogram::Bins; ++b)
+        {
+            state.Running[b] += decay * (frameHistogram.Counts[b] * scale - state.Running[b]);
+        }
+        state.Primed = true;
+
+        // walk down from the brightest bin while the pixels above stay within budget, the cut-off is then the 
+        // lower edge of the last bin taken
+        int bin = ABHistogram::Bins;
+        float brightFraction = 0.0f;
+        while (bin > 0 && brightFraction + state.Running[bin - 1] <= settings.TargetBrightFraction)
+        {
+            brightFraction += state.Running[--bin];
+        }
+
+        // a dark scene has fewer bright pixels than the budget, keep clear of the background there
+        int medianBin = 0;
+        for (float below = state.Running[0]; medianBin < ABHistogram::Bins - 1 && below < 0.5f; below += state.Running[++medianBin]) {}
+        const float contrastFloor = settings.MinContrast * ((medianBin << ABHistogram::BinShift) + (1 << ABHistogram::BinShift) / 2);
+        const int cutoff = std::max(bin << ABHistogram::BinShift, static_cast<int>(contrastFloor));
+
+        const int candidate = std::clamp(cutoff, static_cast<int>(settings.MinThreshold), 
+            static_cast<int>(std::max(settings.MinThreshold, settings.MaxThreshold)));
+        const int change = std::abs(candidate - static_cast<int>(state.Threshold));
+        if (change > settings.Hysteresis * state.Threshold) state.Threshold = static_cast<uint16_t>(candidate);
+        return state.Threshold;
     }
 
-    void ImageProc::LabelImageWithToolDictData(const std::map<uint8_t, IRTrackerUtils::TrackedTool>& toolDictionary, cv::Mat Img2Label)
+    void ImageProc::LabelImageWithToolDictData(const std::map<uint8_t, IRTrackerUtils::TrackedTool>& toolDictionary, cv::Mat Img2Label,
+        cv::Point2i sourceOrigin, int sourceStep)
     {
-        PROFILE_BLOCK(AnnotatingImages);
+        // no profiler zone in here (see header), callers time it instead
+        sourceStep = std::max(sourceStep, 1);
+        const int markerSize = std::max(25 / sourceStep, 5);
+        const int thickness = std::max(5 / sourceStep, 1);
+
         for (const auto& [_, tool] : toolDictionary)
         {
             for (const auto& MarkerCentre : tool.ObservedImgKeypoints)
             {
-                cv::drawMarker(Img2Label, MarkerCentre, cv::Scalar(100, 100, 100), cv::MARKER_CROSS, 25, 5);
+                const cv::Point2i previewCentre((MarkerCentre.x - sourceOrigin.x) / sourceStep, (MarkerCentre.y - sourceOrigin.y) / sourceStep);
+                cv::drawMarker(Img2Label, previewCentre, cv::Scalar(100, 100, 100), cv::MARKER_CROSS, markerSize, thickness);
             }           
         }
     }
@@ -284,13 +1333,108 @@ namespace IRTrackerUtils
     void ImageProc::GetProcessed8BitDepthImg(const cv::Mat& input16bitdepthImg, cv::Mat& output8bitDepth)
     {
         PROFILE_BLOCK(ProcessingDepthImg);
-        cv::Mat processed16Bit = cv::Mat(input16bitdepthImg.rows, input16bitdepthImg.cols, CV_16UC1);
         // should set any pixels above 4090 to 0 and leave everything else untouched
         // magic val of 4090 comes from ResearchModeForCV 
         // https://github.com/microsoft/HoloLens2ForCV/blob/main/Samples/SensorVisualization/SensorVisualization/Content/SlateCameraRenderer.cpp
-           
-        cv::threshold(input16bitdepthImg, processed16Bit, THRESH_RAW_DEPTH_16BIT, 0, cv::THRESH_TOZERO_INV);
-        processed16Bit.convertTo(output8bitDepth, CV_8UC1, 255.0f/1000); // so a depth value of 1m is max brightness
+        ApplyDisplayLUT(input16bitdepthImg, DefaultDepthDisplayLUT(), output8bitDepth);
+    }
+
+    void ImageProc::ApplyDisplayLUTSubsampled(const cv::Mat& inputRaw16BitImg, const DisplayLUT& lut, int step, cv::Mat& output8BitImg)
+    {
+        if (step <= 1) { ApplyDisplayLUT(inputRaw16BitImg, lut, output8BitImg); return; }
+        if (inputRaw16BitImg.type() != CV_16UC1) return;
+        output8BitImg.create(inputRaw16BitImg.rows / step, inputRaw16BitImg.cols / step, CV_8UC1);
+
+        constexpr uint16_t maxIndex = DisplayLUT::Size - 1;
+        for (int r = 0; r < output8BitImg.rows; ++r)
+        {
+            // skipped rows are never read
+            const uint16_t* src = inputRaw16BitImg.ptr<uint16_t>(r * step);
+            uint8_t* dst = output8BitImg.ptr<uint8_t>(r);
+            for (int c = 0; c < output8BitImg.cols; ++c) dst[c] = lut.Values[std::min(src[c * step], maxIndex)];
+        }
+    }
+
+    cv::Size ImageProc::GetPreviewRegion(DisplayPreview preview, const ToolDictionary& toolDictionary, cv::Size imageSize,
+        cv::Rect& outSourceRegion, int& outStep)
+    {
+        outSourceRegion = cv::Rect(0, 0, imageSize.width, imageSize.height);
+        outStep = 1;
+
+        switch (preview)
+        {
+            case DisplayPreview::Full:
+                break;
+
+            case DisplayPreview::Half:
+                outStep = 2;
+                break;
+
+            case DisplayPreview::Quarter:
+                outStep = 4;
+                break;
+
+            case DisplayPreview::ToolCrop:
+            {
+                // centre on the mean of all visible markers
+                cv::Point2i centre(imageSize.width / 2, imageSize.height / 2);
+                int64_t sumX = 0, sumY = 0, count = 0;
+                for (const auto& [_, tool] : toolDictionary)
+                {
+                    if (!tool.VisibleToHoloLens) continue;
+                    for (const cv::Point2i& keypoint : tool.ObservedImgKeypoints) { sumX += keypoint.x; sumY += keypoint.y; ++count; }
+                }
+                if (count > 0) centre = cv::Point2i(static_cast<int>(sumX / count), static_cast<int>(sumY / count));
+
+                // shifted back inside the image rather than clipped, so the texture size never changes
+                const int width = std::min(PREVIEW_CROP_SIZE, imageSize.width);
+                const int height = std::min(PREVIEW_CROP_SIZE, imageSize.height);
+                outSourceRegion.x = std::clamp(centre.x - width / 2, 0, imageSize.width - width);
+                outSourceRegion.y = std::clamp(centre.y - height / 2, 0, imageSize.height - height);
+                outSourceRegion.width = width;
+                outSourceRegion.height = height;
+                break;
+            }
+        }
+        return cv::Size(outSourceRegion.width / outStep, outSourceRegion.height / outStep);
+    }
+
+    void ImageProc::BuildDepthDisplayLUT(uint16_t nearMM, uint16_t farMM, DisplayLUT& outLUT)
+    {
+        if (farMM <= nearMM) farMM = nearMM + 1;
+
+        // float scale and saturate_cast rounding as cv::convertTo uses, so the 0-1000mm window matches the old path
+        const float scale = 255.0f / (farMM - nearMM);
+        for (int v = 0; v < DisplayLUT::Size; ++v)
+        {
+            if (v > THRESH_RAW_DEPTH_16BIT || v <= nearMM) outLUT.Values[v] = 0;
+            else outLUT.Values[v] = cv::saturate_cast<uint8_t>(static_cast<float>(v - nearMM) * scale);
+        }
+    }
+
+    void ImageProc::BuildABDisplayLUT(DisplayLUT& outLUT)
+    {
+        for (int v = 0; v < DisplayLUT::Size; ++v) outLUT.Values[v] = static_cast<uint8_t>(std::min(v >> 2, 255));
+    }
+
+    void ImageProc::ApplyDisplayLUT(const cv::Mat& inputRaw16BitImg, const DisplayLUT& lut, cv::Mat& output8BitImg)
+    {
+        if (inputRaw16BitImg.type() != CV_16UC1) return;
+        output8BitImg.create(inputRaw16BitImg.size(), CV_8UC1);
+
+        // no profiler zone in here (see header), callers time it instead
+        int rows = inputRaw16BitImg.rows;
+        int cols = inputRaw16BitImg.cols;
+        if (inputRaw16BitImg.isContinuous() && output8BitImg.isContinuous())
+        {
+            cols *= rows;
+            rows = 1;
+        }
+
+        for (int r = 0; r < rows; ++r)
+        {
+            ApplyDisplayLUTRow(inputRaw16BitImg.ptr<uint16_t>(r), output8BitImg.ptr<uint8_t>(r), lut.Values, cols);
+        }
     }
 }
 
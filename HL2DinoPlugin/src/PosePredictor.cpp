@@ -0,0 +1,141 @@
+#include "pch.h"
+#include "PosePredictor.h"
+#include <algorithm>
+#include <cmath>
+
+/**
+ * @file        PosePredictor.cpp
+ * @brief       Implementations for \ref IRTrackerUtils::PosePredictor
+ * @author      Hisham Iqbal
+ * @copyright   &copy; Hisham Iqbal 2023
+ *
+ */
+
+namespace // Anonymous helpers
+{
+    typedef IRTrackerUtils::PosePredictor::Matrix6d Matrix6d;
+
+    constexpr double TICKS_PER_SECOND = 1e7; // 100 ns host ticks
+
+    //! Starting uncertainty of the velocities, the filter knows nothing about the motion at its first pose
+    constexpr double INITIAL_VELOCITY_SIGMA = 1.0;          // m/s
+    constexpr double INITIAL_ANGULAR_VELOCITY_SIGMA = 3.0;  // rad/s
+
+    //! Constant-velocity transition over (value, rate) for three axes
+    Matrix6d Transition(double dt)
+    {
+        Matrix6d F = Matrix6d::Identity();
+        F.topRightCorner<3, 3>() = dt * Eigen::Matrix3d::Identity();
+        return F;
+    }
+
+    //! Process noise of a white acceleration with std-dev \p sigma held over one step of \p dt
+    Matrix6d ProcessNoise(double dt, double sigma)
+    {
+        const double q = sigma * sigma;
+        const double dt2 = dt * dt;
+        Matrix6d Q;
+        Q << Eigen::Matrix3d::Identity() * (0.25 * dt2 * dt2 * q), Eigen::Matrix3d::Identity() * (0.5 * dt2 * dt * q),
+             Eigen::Matrix3d::Identity() * (0.5 * dt2 * dt * q),   Eigen::Matrix3d::Identity() * (dt2 * q);
+        return Q;
+    }
+
+    Eigen::Matrix3d ExpSO3(const Eigen::Vector3d& rotationVector)
+    {
+        const double angle = rotationVector.norm();
+        if (angle < 1e-12) return Eigen::Matrix3d::Identity();
+        return Eigen::AngleAxisd(angle, rotationVector / angle).toRotationMatrix();
+    }
+
+    Eigen::Vector3d LogSO3(const Eigen::Matrix3d& rotation)
+    {
+        const Eigen::AngleAxisd angleAxis(rotation);
+        return angleAxis.angle() * angleAxis.axis();
+    }
+
+    //! Kalman correction for a direct measurement of the first three states, returns the state correction
+    Eigen::Matrix<double, 6, 1> Correct(Matrix6d& P, const Eigen::Vector3d& residual, double sigma)
+    {
+        const Eigen::Matrix3d S = P.topLeftCorner<3, 3>() + sigma * sigma * Eigen::Matrix3d::Identity();
+        const Eigen::Matrix<double, 6, 3> K = P.leftCols<3>() * S.inverse();
+
+        Matrix6d IKH = Matrix6d::Identity();
+        IKH.leftCols<3>() -= K;
+        P = IKH * P;
+        P = 0.5 * (P + P.transpose()); // keep it symmetric against rounding
+        return K * residual;
+    }
+}
+
+namespace IRTrackerUtils
+{
+    void PosePredictor::Update(const Eigen::Matrix4d& pose, uint64_t timestamp)
+    {
+        const Eigen::Vector3d measuredPosition = pose.topRightCorner<3, 1>();
+        const Eigen::Matrix3d measuredOrientation = pose.topLeftCorner<3, 3>();
+        const double dt = (timestamp > m_LastTimestamp) ? static_cast<double>(timestamp - m_LastTimestamp) / TICKS_PER_SECOND : -1.0;
+
+        if (!m_Initialised || dt <= 0.0 || dt > m_Settings.ResetAfterSeconds)
+        {
+            m_Position = measuredPosition;
+            m_Orientation = measuredOrientation;
+            m_Velocity.setZero();
+            m_AngularVelocity.setZero();
+
+            const double p2 = m_Settings.PositionNoise * m_Settings.PositionNoise;
+            const double r2 = m_Settings.RotationNoise * m_Settings.RotationNoise;
+            m_TranslationCovariance.setZero();
+            m_TranslationCovariance.diagonal() << p2, p2, p2, Eigen::Vector3d::Constant(INITIAL_VELOCITY_SIGMA * INITIAL_VELOCITY_SIGMA);
+            m_RotationCovariance.setZero();
+            m_RotationCovariance.diagonal() << r2, r2, r2, Eigen::Vector3d::Constant(INITIAL_ANGULAR_VELOCITY_SIGMA * INITIAL_ANGULAR_VELOCITY_SIGMA);
+
+            m_LastTimestamp = timestamp;
+            m_Initialised = true;
+            return;
+        }
+
+        // 1) predict both filters forward to this measurement
+        const Matrix6d F = Transition(dt);
+        m_Position += m_Velocity * dt;
+        m_TranslationCovariance = F * m_TranslationCovariance * F.transpose() + ProcessNoise(dt, m_Settings.AccelerationNoise);
+        m_Orientation = ExpSO3(m_AngularVelocity * dt) * m_Orientation;
+        m_RotationCovariance = F * m_RotationCovariance * F.transpose() + ProcessNoise(dt, m_Settings.AngularAccelerationNoise);
+
+        // 2) correct them, the rotation residual is the world-frame rotation taking the prediction onto the measurement
+        const Eigen::Matrix<double, 6, 1> translationCorrection = Correct(m_TranslationCovariance, measuredPosition - m_Position, m_Settings.PositionNoise);
+        m_Position += translationCorrection.head<3>();
+        m_Velocity += translationCorrection.tail<3>();
+
+        const Eigen::Vector3d rotationResidual = LogSO3(measuredOrientation * m_Orientation.transpose());
+        const Eigen::Matrix<double, 6, 1> rotationCorrection = Correct(m_RotationCovariance, rotationResidual, m_Settings.RotationNoise);
+        m_Orientation = ExpSO3(rotationCorrection.head<3>()) * m_Orientation;
+        m_AngularVelocity += rotationCorrection.tail<3>();
+
+        // repeated products drift off SO(3) slowly, a quaternion round trip pulls it back
+        m_Orientation = Eigen::Quaterniond(m_Orientation).normalized().toRotationMatrix();
+        m_LastTimestamp = timestamp;
+    }
+
+    bool PosePredictor::Predict(uint64_t timestamp, Eigen::Matrix4d& outPose, Matrix6d* outCovariance) const
+    {
+        if (!m_Initialised) return false;
+
+        const double ticks = (timestamp >= m_LastTimestamp) ? static_cast<double>(timestamp - m_LastTimestamp) : -static_cast<double>(m_LastTimestamp - timestamp);
+        const double dt = std::clamp(ticks / TICKS_PER_SECOND, -m_Settings.MaxPredictionSeconds, m_Settings.MaxPredictionSeconds);
+
+        outPose = Eigen::Matrix4d::Identity();
+        outPose.topLeftCorner<3, 3>() = ExpSO3(m_AngularVelocity * dt) * m_Orientation;
+        outPose.topRightCorner<3, 1>() = m_Position + m_Velocity * dt;
+
+        if (outCovariance)
+        {
+            // the two filters are independent, so the pose covariance is block diagonal
+            const Matrix6d F = Transition(dt);
+            const double span = std::abs(dt);
+            outCovariance->setZero();
+            outCovariance->topLeftCorner<3, 3>() = (F * m_TranslationCovariance * F.transpose() + ProcessNoise(span, m_Settings.AccelerationNoise)).topLeftCorner<3, 3>();
+            outCovariance->bottomRightCorner<3, 3>() = (F * m_RotationCovariance * F.transpose() + ProcessNoise(span, m_Settings.AngularAccelerationNoise)).topLeftCorner<3, 3>();
+        }
+        return true;
+    }
+}
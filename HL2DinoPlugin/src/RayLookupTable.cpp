@@ -0,0 +1,302 @@
+#include "pch.h"
+#include "RayLookupTable.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+/**
+ * @file        RayLookupTable.cpp
+ * @brief       Implementations for \ref IRTrackerUtils::RayLookupTable
+ * @author      Hisham Iqbal
+ * @copyright   &copy; Hisham Iqbal 2023
+ *
+ */
+
+namespace // Anonymous helpers
+{
+    //! Identifies the file type and layout, bump the version if the layout changes
+    constexpr char RAY_LUT_FILE_MAGIC[8] = { 'H', 'L', '2', 'R', 'A', 'Y', 'L', 'T' };
+    constexpr uint32_t RAY_LUT_FILE_VERSION = 1;
+
+    //! Newton iterations used to invert the table, pixel-level steps converge in 3-4 for AHAT-like lenses
+    constexpr int PROJECT_MAX_ITERATIONS = 15;
+    constexpr float PROJECT_TOLERANCE_PX = 1e-3f;
+    constexpr float PROJECT_JACOBIAN_STEP_PX = 0.5f;
+    constexpr int PROJECT_MAX_HALVINGS = 8;
+
+    // saved extrinsics come from the same API call each session, this only allows for float formatting noise
+    constexpr float EXTRINSICS_MATCH_TOLERANCE = 1e-6f;
+
+    struct RayLUTFileHeader
+    {
+        char        Magic[8];
+        uint32_t    Version;
+        int32_t     Width;
+        int32_t     Height;
+        int32_t     Step;
+        float       Extrinsics[16];
+    };
+}
+
+namespace IRTrackerUtils
+{
+    bool RayLookupTable::Build(const UnmapFunction& unmapFunction, int width, int height, int step)
+    {
+        if (!unmapFunction || width < 2 || height < 2) return false;
+
+        m_Width = width;
+        m_Height = height;
+        m_Step = std::max(step, 1);
+        // last node sits on or just past the last pixel, so every pixel has nodes on both sides
+        m_NodesX = (width - 1 + m_Step - 1) / m_Step + 1;
+        m_NodesY = (height - 1 + m_Step - 1) / m_Step + 1;
+        m_Rays.assign(static_cast<size_t>(m_NodesX) * m_NodesY * 3, std::numeric_limits<float>::quiet_NaN());
+
+        bool anyValid = false;
+        for (int j = 0; j < m_NodesY; ++j)
+        {
+            for (int i = 0; i < m_NodesX; ++i)
+            {
+                float uv[2] = { static_cast<float>(i * m_Step), static_cast<float>(j * m_Step) };
+                float xy[2] = { 0.0f, 0.0f };
+                if (!unmapFunction(uv, xy)) continue; // left as NaN
+
+                const Eigen::Vector3d ray = Eigen::Vector3d(xy[0], xy[1], 1.0).normalized();
+                float* node = &m_Rays[(static_cast<size_t>(j) * m_NodesX + i) * 3];
+                node[0] = static_cast<float>(ray.x());
+                node[1] = static_cast<float>(ray.y());
+                node[2] = static_cast<float>(ray.z());
+                anyValid = true;
+            }
+        }
+
+        // when step doesn't divide the image size the last column/row of nodes lies past the image, where the
+        // unmap function may refuse to answer, so continue the trend of the nodes before it instead. A quadratic
+        // through the previous three keeps the last cell as accurate as the interior, a line is off by the curvature
+        auto extrapolate = [this](size_t node, size_t prev, ptrdiff_t stride, bool quadratic)
+        {
+            float* n0 = &m_Rays[node * 3];
+            const float* n1 = &m_Rays[prev * 3];
+            const float* n2 = n1 - stride * 3;
+            const float* n3 = quadratic ? n2 - stride * 3 : n2;
+            if (!std::isnan(n0[0]) || std::isnan(n1[0]) || std::isnan(n2[0]) || std::isnan(n3[0])) return;
+
+            Eigen::Vector3d ray;
+            for (int k = 0; k < 3; ++k) ray[k] = quadratic ? 3.0 * n1[k] - 3.0 * n2[k] + n3[k] : 2.0 * n1[k] - n2[k];
+            ray.normalize();
+            n0[0] = static_cast<float>(ray.x());
+            n0[1] = static_cast<float>(ray.y());
+            n0[2] = static_cast<float>(ray.z());
+        };
+
+        if (anyValid && (m_NodesX - 1) * m_Step > width - 1 && m_NodesX >= 3)
+        {
+            for (int j = 0; j < m_NodesY; ++j)
+            {
+                const size_t row = static_cast<size_t>(j) * m_NodesX;
+                extrapolate(row + m_NodesX - 1, row + m_NodesX - 2, 1, m_NodesX >= 4);
+            }
+        }
+        if (anyValid && (m_NodesY - 1) * m_Step > height - 1 && m_NodesY >= 3)
+        {
+            for (int i = 0; i < m_NodesX; ++i)
+            {
+                extrapolate(static_cast<size_t>(m_NodesY - 1) * m_NodesX + i, static_cast<size_t>(m_NodesY - 2) * m_NodesX + i, 
+                    m_NodesX, m_NodesY >= 4);
+            }
+        }
+
+        if (!anyValid) m_Rays.clear();
+        return anyValid;
+    }
+
+    bool RayLookupTable::GetUnitRay(float u, float v, Eigen::Vector3d& outRay) const
+    {
+        if (m_Rays.empty()) return false;
+        if (!(u >= -0.5f && v >= -0.5f && u <= m_Width - 0.5f && v <= m_Height - 0.5f)) return false; // also catches NaN
+
+        // within half a pixel of the border the edge cell's weights just run slightly outside [0, 1]
+        const float fx = u / m_Step;
+        const float fy = v / m_Step;
+        const int i0 = std::clamp(static_cast<int>(fx), 0, m_NodesX - 2);
+        const int j0 = std::clamp(static_cast<int>(fy), 0, m_NodesY - 2);
+        const float tx = fx - i0;
+        const float ty = fy - j0;
+
+        const float* n00 = &m_Rays[(static_cast<size_t>(j0) * m_NodesX + i0) * 3];
+        const float* n10 = n00 + 3;
+        const float* n01 = n00 + static_cast<size_t>(m_NodesX) * 3;
+        const float* n11 = n01 + 3;
+        if (std::isnan(n00[0]) || std::isnan(n10[0]) || std::isnan(n01[0]) || std::isnan(n11[0])) return false;
+
+        for (int k = 0; k < 3; ++k)
+        {
+            const float top = n00[k] + tx * (n10[k] - n00[k]);
+            const float bottom = n01[k] + tx * (n11[k] - n01[k]);
+            outRay[k] = static_cast<double>(top + ty * (bottom - top));
+        }
+
+        const double norm = outRay.norm();
+        if (norm <= 0.0) return false;
+        outRay /= norm;
+        return true;
+    }
+
+    bool RayLookupTable::MapImagePointToUnitPlane(float(&uv)[2], float(&xy)[2]) const
+    {
+        Eigen::Vector3d ray;
+        if (!GetUnitRay(uv[0], uv[1], ray) || ray.z() <= 0.0) return false;
+
+        xy[0] = static_cast<float>(ray.x() / ray.z());
+        xy[1] = static_cast<float>(ray.y() / ray.z());
+        return true;
+    }
+
+    bool RayLookupTable::MapUnitPlaneToImagePoint(float(&xy)[2], float(&uv)[2]) const
+    {
+        if (m_Rays.empty() || !std::isfinite(xy[0]) || !std::isfinite(xy[1])) return false;
+
+        const float minU = -0.5f, maxU = m_Width - 0.5f, minV = -0.5f, maxV = m_Height - 0.5f;
+        float p0[2] = { 0.5f * (m_Width - 1), 0.5f * (m_Height - 1) }; // start from the image centre
+        float f0[2];
+        if (!MapImagePointToUnitPlane(p0, f0)) return false;
+
+        for (int it = 0; it < PROJECT_MAX_ITERATIONS; ++it)
+        {
+            // finite-difference jacobian, flipping the step if it would leave the image or touch a rejected node
+            float h[2] = { PROJECT_JACOBIAN_STEP_PX, PROJECT_JACOBIAN_STEP_PX };
+            float fu[2], fv[2];
+            float pu[2] = { p0[0] + h[0], p0[1] }, pv[2] = { p0[0], p0[1] + h[1] };
+            if (pu[0] > maxU || !MapImagePointToUnitPlane(pu, fu)) { h[0] = -h[0]; pu[0] = p0[0] + h[0]; if (!MapImagePointToUnitPlane(pu, fu)) return false; }
+            if (pv[1] > maxV || !MapImagePointToUnitPlane(pv, fv)) { h[1] = -h[1]; pv[1] = p0[1] + h[1]; if (!MapImagePointToUnitPlane(pv, fv)) return false; }
+
+            const float j00 = (fu[0] - f0[0]) / h[0], j01 = (fv[0] - f0[0]) / h[1];
+            const float j10 = (fu[1] - f0[1]) / h[0], j11 = (fv[1] - f0[1]) / h[1];
+            const float det = j00 * j11 - j01 * j10;
+            if (!(std::fabs(det) > 0.0f)) return false;
+
+            const float ex = xy[0] - f0[0], ey = xy[1] - f0[1];
+            const float du = ( j11 * ex - j01 * ey) / det;
+            const float dv = (-j10 * ex + j00 * ey) / det;
+
+            // halve the step until it lands somewhere the table can answer, points outside the image pin against
+            // the border and never converge
+            // convergence is judged on the requested step, so a point pinned at the border isn't mistaken for a solution
+            float stepSize = -1.0f;
+            float scale = 1.0f;
+            for (int halving = 0; halving < PROJECT_MAX_HALVINGS; ++halving, scale *= 0.5f)
+            {
+                float p1[2] = { std::clamp(p0[0] + scale * du, minU, maxU), std::clamp(p0[1] + scale * dv, minV, maxV) };
+                if (!MapImagePointToUnitPlane(p1, f0)) continue;
+                stepSize = scale * (std::fabs(du) + std::fabs(dv));
+                p0[0] = p1[0]; p0[1] = p1[1];
+                break;
+            }
+            if (stepSize < 0.0f) return false;
+
+            if (stepSize < PROJECT_TOLERANCE_PX)
+            {
+                uv[0] = p0[0]; uv[1] = p0[1];
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t RayLookupTable::UnmapPoints(const cv::Point2f* pixels, size_t count,
+        Eigen::Vector3f* outRays, uint8_t* outValid) const
+    {
+        size_t numValid = 0;
+        Eigen::Vector3d ray;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (!GetUnitRay(pixels[i].x, pixels[i].y, ray)) { outRays[i].setZero(); outValid[i] = 0; continue; }
+
+            outRays[i] = ray.cast<float>();
+            outValid[i] = 1;
+            ++numValid;
+        }
+        return numValid;
+    }
+
+    size_t RayLookupTable::ProjectPoints(const Eigen::Vector3f* points, size_t count,
+        cv::Point2f* outPixels, uint8_t* outValid) const
+    {
+        size_t numValid = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            const Eigen::Vector3f& p = points[i];
+            float xy[2] = { p.x() / p.z(), p.y() / p.z() };
+            float uv[2];
+            if (!(p.z() > 0.0f) || !MapUnitPlaneToImagePoint(xy, uv)) 
+            { 
+                outPixels[i] = cv::Point2f(-1.0f, -1.0f); 
+                outValid[i] = 0; 
+                continue; 
+            }
+
+            outPixels[i] = cv::Point2f(uv[0], uv[1]);
+            outValid[i] = 1;
+            ++numValid;
+        }
+        return numValid;
+    }
+
+    UnmapFunction RayLookupTable::AsUnmapFunction() const
+    {
+        return [this](float(&uv)[2], float(&xy)[2]) { return MapImagePointToUnitPlane(uv, xy); };
+    }
+
+    bool RayLookupTable::Save(const std::string& filePath, const ExtrinsicsKey& extrinsics) const
+    {
+        if (m_Rays.empty()) return false;
+
+        RayLUTFileHeader header{};
+        std::memcpy(header.Magic, RAY_LUT_FILE_MAGIC, sizeof(header.Magic));
+        header.Version = RAY_LUT_FILE_VERSION;
+        header.Width = m_Width;
+        header.Height = m_Height;
+        header.Step = m_Step;
+        std::copy(extrinsics.begin(), extrinsics.end(), header.Extrinsics);
+
+        std::ofstream file(filePath, std::ios::binary | std::ios::trunc);
+        if (!file) return false;
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(m_Rays.data()), static_cast<std::streamsize>(m_Rays.size() * sizeof(float)));
+        return static_cast<bool>(file);
+    }
+
+    bool RayLookupTable::Load(const std::string& filePath, const ExtrinsicsKey& extrinsics)
+    {
+        std::ifstream file(filePath, std::ios::binary);
+        if (!file) return false;
+
+        RayLUTFileHeader header{};
+        if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))) return false;
+        if (std::memcmp(header.Magic, RAY_LUT_FILE_MAGIC, sizeof(header.Magic)) != 0) return false;
+        if (header.Version != RAY_LUT_FILE_VERSION) return false;
+        if (header.Width < 2 || header.Height < 2 || header.Step < 1) return false;
+
+        // a table for a different sensor/calibration is no use to us
+        for (size_t k = 0; k < extrinsics.size(); ++k)
+        {
+            if (std::fabs(header.Extrinsics[k] - extrinsics[k]) > EXTRINSICS_MATCH_TOLERANCE) return false;
+        }
+
+        const int nodesX = (header.Width - 1 + header.Step - 1) / header.Step + 1;
+        const int nodesY = (header.Height - 1 + header.Step - 1) / header.Step + 1;
+        std::vector<float> rays(static_cast<size_t>(nodesX) * nodesY * 3);
+        if (!file.read(reinterpret_cast<char*>(rays.data()), static_cast<std::streamsize>(rays.size() * sizeof(float)))) return false;
+
+        m_Width = header.Width;
+        m_Height = header.Height;
+        m_Step = header.Step;
+        m_NodesX = nodesX;
+        m_NodesY = nodesY;
+        m_Rays = std::move(rays);
+        return true;
+    }
+}
@@ -0,0 +1,140 @@
+#include "pch.h"
+#include "ReflectionBackgroundModel.h"
+#include <cmath>
+
+/**
+ * @file        ReflectionBackgroundModel.cpp
+ * @brief       Implementations for \ref IRTrackerUtils::ReflectionBackgroundModel
+ * @author      Hisham Iqbal
+ * @copyright   &copy; Hisham Iqbal 2023
+ *
+ */
+
+namespace // Anonymous helpers
+{
+    constexpr int VOXEL_BITS = 21;
+    constexpr int64_t VOXEL_BIAS = int64_t(1) << (VOXEL_BITS - 1);
+    constexpr uint64_t VOXEL_MASK = (uint64_t(1) << VOXEL_BITS) - 1;
+
+    //! Forgotten cells are swept out every this many frames rather than every frame
+    constexpr uint64_t PRUNE_INTERVAL_FRAMES = 64;
+}
+
+namespace IRTrackerUtils
+{
+    Eigen::Vector3i ReflectionBackgroundModel::VoxelOf(const Eigen::Vector3d& worldPosition) const
+    {
+        const Eigen::Vector3d scaled = worldPosition / m_Settings.VoxelSize;
+        return Eigen::Vector3i(static_cast<int>(std::floor(scaled.x())), static_cast<int>(std::floor(scaled.y())),
+            static_cast<int>(std::floor(scaled.z())));
+    }
+
+    ReflectionBackgroundModel::VoxelKey ReflectionBackgroundModel::Pack(const Eigen::Vector3i& voxel)
+    {
+        // out of range coordinates wrap, which at worst shares a cell with something ~20 km away
+        return ((static_cast<uint64_t>(voxel.x() + VOXEL_BIAS) & VOXEL_MASK) << (2 * VOXEL_BITS)) |
+               ((static_cast<uint64_t>(voxel.y() + VOXEL_BIAS) & VOXEL_MASK) << VOXEL_BITS) |
+                (static_cast<uint64_t>(voxel.z() + VOXEL_BIAS) & VOXEL_MASK);
+    }
+
+    bool ReflectionBackgroundModel::NearLearnedCell(const Eigen::Vector3d& worldPosition) const
+    {
+        if (m_LearnedCount == 0) return false;
+
+        const Eigen::Vector3i voxel = VoxelOf(worldPosition);
+        const double radius2 = m_Settings.VoxelSize * m_Settings.VoxelSize;
+        for (int dz = -1; dz <= 1; ++dz)
+            for (int dy = -1; dy <= 1; ++dy)
+                for (int dx = -1; dx <= 1; ++dx)
+                {
+                    const auto it = m_Cells.find(Pack(voxel + Eigen::Vector3i(dx, dy, dz)));
+                    if (it == m_Cells.end() || !it->second.Learned) continue;
+                    if ((it->second.MeanPosition - worldPosition).squaredNorm() <= radius2) return true;
+                }
+        return false;
+    }
+
+    void ReflectionBackgroundModel::ClearAround(const Eigen::Vector3d& worldPosition)
+    {
+        const Eigen::Vector3i voxel = VoxelOf(worldPosition);
+        const double radius2 = m_Settings.VoxelSize * m_Settings.VoxelSize;
+        for (int dz = -1; dz <= 1; ++dz)
+            for (int dy = -1; dy <= 1; ++dy)
+                for (int dx = -1; dx <= 1; ++dx)
+                {
+                    const auto it = m_Cells.find(Pack(voxel + Eigen::Vector3i(dx, dy, dz)));
+                    if (it == m_Cells.end()) continue;
+                    if ((it->second.MeanPosition - worldPosition).squaredNorm() <= radius2) EraseCell(it);
+                }
+    }
+
+    void ReflectionBackgroundModel::EraseCell(std::unordered_map<VoxelKey, Cell>::iterator it)
+    {
+        if (it->second.Learned) --m_LearnedCount;
+        m_Cells.erase(it);
+    }
+
+    size_t ReflectionBackgroundModel::Suppress(const BlobPoints3D& blobs, std::vector<uint8_t>& outSuppressed)
+    {
+        outSuppressed.assign(blobs.Size(), 0);
+        m_SuppressedLastFrame = 0;
+        if (m_LearnedCount == 0) return 0;
+
+        for (size_t i = 0; i < blobs.Size(); ++i)
+        {
+            if (!NearLearnedCell(blobs.WorldLocation(i))) continue;
+            outSuppressed[i] = 1;
+            ++m_SuppressedLastFrame;
+        }
+        m_SuppressedTotal += m_SuppressedLastFrame;
+        return m_SuppressedLastFrame;
+    }
+
+    void ReflectionBackgroundModel::Update(const BlobPoints3D& blobs, const std::vector<uint8_t>& assignedToTool)
+    {
+        if (m_Frozen) return;
+        ++m_Frame;
+
+        const bool haveAssignments = assignedToTool.size() == blobs.Size();
+        for (size_t i = 0; i < blobs.Size(); ++i)
+        {
+            const Eigen::Vector3d position = blobs.WorldLocation(i);
+            if (haveAssignments && assignedToTool[i]) { ClearAround(position); continue; }
+
+            Cell& cell = m_Cells[Pack(VoxelOf(position))];
+            if (cell.LastSeenFrame == m_Frame) continue; // two blobs in one cell, count the frame once
+
+            // a run of sightings survives a few dropped frames, anything longer starts it again
+            const bool continuesRun = cell.Sightings > 0 && m_Frame - cell.LastSeenFrame <= m_Settings.MaxGapFrames + 1;
+            cell.Sightings = continuesRun ? cell.Sightings + 1 : 1;
+            cell.LastSeenFrame = m_Frame;
+            cell.MeanPosition = (cell.Sightings == 1) ? position :
+                cell.MeanPosition + (position - cell.MeanPosition) / static_cast<double>(std::min<uint32_t>(cell.Sightings, m_Settings.LearnFrames));
+
+            if (!cell.Learned && cell.Sightings >= m_Settings.LearnFrames)
+            {
+                cell.Learned = true;
+                ++m_LearnedCount;
+            }
+        }
+
+        if (m_Frame % PRUNE_INTERVAL_FRAMES != 0) return;
+        for (auto it = m_Cells.begin(); it != m_Cells.end();)
+        {
+            const uint64_t unseenFor = m_Frame - it->second.LastSeenFrame;
+            // runs that broke off before being learned are dropped too, so one-off blobs don't pile up
+            const bool expired = it->second.Learned ? unseenFor > m_Settings.ForgetFrames : unseenFor > m_Settings.MaxGapFrames + 1;
+            if (expired) { auto next = std::next(it); EraseCell(it); it = next; }
+            else ++it;
+        }
+    }
+
+    void ReflectionBackgroundModel::Reset()
+    {
+        m_Cells.clear();
+        m_Frame = 0;
+        m_LearnedCount = 0;
+        m_SuppressedLastFrame = 0;
+        m_SuppressedTotal = 0;
+    }
+}
@@ -0,0 +1,196 @@
+/**
+ * @file        AdaptiveThresholdTests.cpp
+ * @brief       Checks \ref IRTrackerUtils::ImageProc::UpdateAdaptiveThreshold on synthetic histograms of dark and
+ *              glaring scenes, and the sampling of the histograms the front-end fills
+ * @author      Hisham Iqbal
+ * @copyright   &copy; Hisham Iqbal 2023
+ *
+ */
+
+#include "IRTrackerUtils.h"
+#include "TestUtils.h"
+#include <algorithm>
+#include <numeric>
+
+using namespace IRTrackerUtils::ImageProc;
+
+namespace
+{
+    //! Samples in a histogram of a 512 x 512 frame, every 4th row
+    constexpr uint32_t FRAME_SAMPLES = 512 * 128;
+
+    void Add(ABHistogram& histogram, uint16_t raw, uint32_t count)
+    {
+        histogram.Counts[ABHistogram::Bin(raw)] += count;
+        histogram.Total += count;
+    }
+
+    //! Ambient IR at 360 with 0.1% of the frame on markers at 3000. The median is then in the 360-367 bin, so the
+    //! contrast floor is 2 x 364 = 728
+    ABHistogram DarkScene()
+    {
+        ABHistogram histogram;
+        const uint32_t markers = FRAME_SAMPLES / 1000;
+        Add(histogram, 3000, markers);
+        Add(histogram, 360, FRAME_SAMPLES - markers);
+        return histogram;
+    }
+
+    //! The dark scene with 3% of the frame glaring between 1200 and 1263, most of it at the top of that range
+    ABHistogram GlaringScene()
+    {
+        ABHistogram histogram = DarkScene();
+        const uint32_t glare = FRAME_SAMPLES * 3 / 100, top = glare * 4 / 5, perBin = (glare - top) / 7;
+        histogram.Counts[ABHistogram::Bin(360)] -= glare;
+        histogram.Counts[ABHistogram::Bin(1260)] += top;
+        for (uint16_t raw = 1200; raw < 1256; raw += 8) histogram.Counts[ABHistogram::Bin(raw)] += perBin;
+        histogram.Counts[ABHistogram::Bin(360)] += glare - top - 7 * perBin;
+        return histogram;
+    }
+
+    void TestDarkScene()
+    {
+        std::printf("adaptive threshold in a dark scene\n");
+        const AdaptiveThresholdSettings settings;
+        AdaptiveThresholdState state;
+
+        // the contrast floor is within the hysteresis of the default, so the threshold stays put
+        const ABHistogram dark = DarkScene();
+        for (int frame = 0; frame < 20; ++frame) CHECK(UpdateAdaptiveThreshold(dark, settings, state) == 724);
+        CHECK(state.Primed && state.Threshold == 724);
+        CHECK(std::abs(std::accumulate(std::begin(state.Running), std::end(state.Running), 0.0f) - 1.0f) < 1e-4f);
+
+        // started from elsewhere it settles on the floor itself
+        AdaptiveThresholdState high;
+        high.Threshold = 2000;
+        CHECK(UpdateAdaptiveThreshold(dark, settings, high) == 728);
+    }
+
+    void TestGlare()
+    {
+        std::printf("adaptive threshold rising under glare and decaying back\n");
+        const AdaptiveThresholdSettings settings;
+        AdaptiveThresholdState state;
+        const ABHistogram dark = DarkScene(), glaring = GlaringScene();
+        for (int frame = 0; frame < 10; ++frame) UpdateAdaptiveThreshold(dark, settings, state);
+
+        // a quarter of the top glare bin already exceeds the 0.5% budget left after the markers, so the cut-off goes
+        // straight to the top of the glare and stays there
+        for (int frame = 0; frame < 20; ++frame) CHECK(UpdateAdaptiveThreshold(glaring, settings, state) == 1264);
+
+        // as the glare fades from the running histogram the cut-off walks back down through it, never rising, and
+        // ends at the dark scene's floor
+        uint16_t previous = state.Threshold;
+        int frames = 0;
+        for (; frames < 60 && state.Threshold != 728; ++frames)
+        {
+            const uint16_t threshold = UpdateAdaptiveThreshold(dark, settings, state);
+            CHECK(threshold <= previous);
+            previous = threshold;
+        }
+        std::printf("  back to %d after %d dark frames\n", state.Threshold, frames);
+        CHECK(state.Threshold == 728 && frames > 5);
+    }
+
+    void TestEmptyHistogram()
+    {
+        std::printf("adaptive threshold with no samples\n");
+        const AdaptiveThresholdSettings settings;
+        AdaptiveThresholdState state;
+        state.Threshold = 1000;
+
+        // an empty frame neither primes the state nor moves the threshold
+        CHECK(UpdateAdaptiveThreshold(ABHistogram(), settings, state) == 1000);
+        CHECK(!state.Primed && std::all_of(std::begin(state.Running), std::end(state.Running), [](float f) { return f == 0.0f; }));
+
+        // nor does it dilute the running histogram once there is one
+        UpdateAdaptiveThreshold(GlaringScene(), settings, state);
+        const AdaptiveThresholdState before = state;
+        CHECK(UpdateAdaptiveThreshold(ABHistogram(), settings, state) == before.Threshold);
+        CHECK(std::equal(std::begin(state.Running), std::end(state.Running), std::begin(before.Running)));
+    }
+
+    void TestLimits()
+    {
+        std::printf("adaptive threshold limits and hysteresis\n");
+        AdaptiveThresholdSettings settings;
+
+        // a bright scene is held at MaxThreshold, a black one at MinThreshold
+        ABHistogram bright, black;
+        Add(bright, 5000, FRAME_SAMPLES);
+        Add(black, 0, FRAME_SAMPLES);
+        AdaptiveThresholdState state;
+        CHECK(UpdateAdaptiveThreshold(bright, settings, state) == settings.MaxThreshold);
+        state = AdaptiveThresholdState();
+        CHECK(UpdateAdaptiveThreshold(black, settings, state) == settings.MinThreshold);
+
+        // with MinThreshold above MaxThreshold every scene gets MinThreshold
+        settings.MinThreshold = 1000;
+        settings.MaxThreshold = 500;
+        for (const ABHistogram& scene : { DarkScene(), GlaringScene(), bright, black })
+        {
+            state = AdaptiveThresholdState();
+            CHECK(UpdateAdaptiveThreshold(scene, settings, state) == 1000);
+        }
+
+        // changes within the hysteresis are ignored, larger ones taken whole
+        settings = AdaptiveThresholdSettings();
+        state = AdaptiveThresholdState();
+        state.Threshold = 800;
+        CHECK(UpdateAdaptiveThreshold(DarkScene(), settings, state) == 800);
+        settings.Hysteresis = 0.0f;
+        CHECK(UpdateAdaptiveThreshold(DarkScene(), settings, state) == 728);
+
+        // a change of exactly the hysteresis isn't enough, 832 - 728 = 832 / 8
+        settings.Hysteresis = 0.125f;
+        state.Threshold = 832;
+        CHECK(UpdateAdaptiveThreshold(DarkScene(), settings, state) == 832);
+        state.Threshold = 833;
+        CHECK(UpdateAdaptiveThreshold(DarkScene(), settings, state) == 728);
+
+        // bright pixels within the budget stay above the cut-off, one more pixel and the cut-off moves above them
+        settings = AdaptiveThresholdSettings();
+        settings.Hysteresis = 0.0f;
+        const uint32_t budget = static_cast<uint32_t>(settings.TargetBrightFraction * FRAME_SAMPLES);
+        for (const uint32_t brightPixels : { budget, budget + 1 })
+        {
+            ABHistogram scene;
+            Add(scene, 2000, brightPixels);
+            Add(scene, 360, FRAME_SAMPLES - brightPixels);
+            state = AdaptiveThresholdState();
+            CHECK(UpdateAdaptiveThreshold(scene, settings, state) == (brightPixels == budget ? 728 : 2008));
+        }
+    }
+
+    void TestFrontEndSampling()
+    {
+        std::printf("histograms filled by the front-end\n");
+        cv::Mat raw(37, 50, CV_16UC1), mask;
+        for (int y = 0; y < raw.rows; ++y)
+            for (int x = 0; x < raw.cols; ++x) raw.at<uint16_t>(y, x) = static_cast<uint16_t>(y * 300 + x);
+
+        // every 4th row from the first, values past the last bin land in it
+        ABHistogram histogram;
+        BinariseRaw(raw, mask, RAW_AB_THRESHOLD_DEFAULT, cv::Mat(), DepthGate(), &histogram);
+        CHECK(histogram.Total == 10 * 50);
+        ABHistogram expected;
+        for (int y = 0; y < raw.rows; y += 4)
+            for (int x = 0; x < raw.cols; ++x) Add(expected, raw.at<uint16_t>(y, x), 1);
+        CHECK(std::equal(std::begin(histogram.Counts), std::end(histogram.Counts), std::begin(expected.Counts)));
+        CHECK(histogram.Counts[ABHistogram::Bins - 1] > 0);
+
+        // and it's replaced each frame, not added to
+        BinariseRaw(raw, mask, RAW_AB_THRESHOLD_DEFAULT, cv::Mat(), DepthGate(), &histogram);
+        CHECK(histogram.Total == 10 * 50 && std::equal(std::begin(histogram.Counts), std::end(histogram.Counts), std::begin(expected.Counts)));
+    }
+}
+
+int main()
+{
+    TestDarkScene();
+    TestGlare();
+    TestEmptyHistogram();
+    TestLimits();
+    TestFrontEndSampling();
+    return TestUtils::Report("AdaptiveThresholdTests");
+}
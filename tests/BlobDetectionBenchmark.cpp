@@ -0,0 +1,178 @@
+/**
+ * @file        BlobDetectionBenchmark.cpp
+ * @brief       Times the 2D blob detectors on synthetic 512x512 frames with 5, 20 and 100 markers, and measures
+ *              their centre accuracy against the frames' known sub-pixel marker centres
+ * @author      Hisham Iqbal
+ * @copyright   &copy; Hisham Iqbal 2023
+ *
+ */
+
+#include "IRTrackerUtils.h"
+#include "SyntheticFrames.h"
+#include "TestUtils.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+
+using namespace IRTrackerUtils::ImageProc;
+
+namespace
+{
+    constexpr int REPEATS = 200;
+    const cv::Size IMAGE_SIZE(512, 512);
+
+    //! Detectors compared on raw AB frames
+    const std::pair<BlobDetectionMethod, const char*> RAW_FRAME_METHODS[] = {
+        { BlobDetectionMethod::Basic, "Basic" },
+        { BlobDetectionMethod::RefineByScaling, "RefineByScaling" },
+        { BlobDetectionMethod::IntensityWeighted, "IntensityWeighted" } };
+
+    //! Contour tracing (BlobDetectionMethod::Basic) against single-pass labelling (BlobDetectionMethod::ConnectedComponents)
+    //! on ready-made binary masks, so only the detection itself is timed
+    void BenchmarkLabelling(std::mt19937& rng)
+    {
+        std::printf("\nBinary mask -> blob centres (median of %d runs)\n", REPEATS);
+        std::printf("%8s %14s %14s %10s %10s\n", "blobs", "Basic [us]", "Connected [us]", "speed-up", "found");
+
+        for (const int count : { 5, 20, 100 })
+        {
+            cv::Mat mask;
+            TestUtils::DrawBinaryDiscs(TestUtils::ScatterBlobs(count, 2.0f, 8.0f, IMAGE_SIZE, rng), IMAGE_SIZE, mask);
+
+            std::vector<cv::Point2f> basic, connected;
+            const double basicTime = TestUtils::MedianMicroseconds([&] { DetectBlobs2D(mask, BlobDetectionMethod::Basic, basic, true); }, REPEATS);
+            const double connectedTime = TestUtils::MedianMicroseconds([&] { DetectBlobs2D(mask, BlobDetectionMethod::ConnectedComponents, connected, true); }, REPEATS);
+
+            std::printf("%8d %14.1f %14.1f %9.1fx %5zu/%-4zu\n", count, basicTime, connectedTime, basicTime / connectedTime, connected.size(), basic.size());
+        }
+    }
+
+    //! Accumulated centre error of one method against the ground truth
+    struct AccuracyStats
+    {
+        double  SquaredErrorSum = 0.0;
+        double  MaxError = 0.0;
+        int     Matched = 0;
+        int     Missed = 0;
+        int     Spurious = 0;
+
+        //! Pairs each true centre with the nearest detection within \p gate pixels
+        void Add(const std::vector<TestUtils::SyntheticBlob>& truth, const std::vector<cv::Point2f>& detected, float gate = 2.0f)
+        {
+            std::vector<bool> used(detected.size(), false);
+            for (const TestUtils::SyntheticBlob& blob : truth)
+            {
+                int best = -1;
+                float bestDistance = gate;
+                for (size_t i = 0; i < detected.size(); ++i)
+                {
+                    const float distance = std::hypot(detected[i].x - blob.Centre.x, detected[i].y - blob.Centre.y);
+                    if (!used[i] && distance < bestDistance) { best = static_cast<int>(i); bestDistance = distance; }
+                }
+                if (best < 0) { ++Missed; continue; }
+                used[best] = true;
+                ++Matched;
+                SquaredErrorSum += static_cast<double>(bestDistance) * bestDistance;
+                MaxError = std::max(MaxError, static_cast<double>(bestDistance));
+            }
+            Spurious += static_cast<int>(std::count(used.begin(), used.end(), false));
+        }
+
+        double RMS() const { return Matched > 0 ? std::sqrt(SquaredErrorSum / Matched) : 0.0; }
+    };
+
+    //! Whole frame to centres path as the tracker runs it: fused front-end, then detection on the binary mask
+    void DetectFromRaw(const cv::Mat& raw, BlobDetectionMethod method, std::vector<cv::Point2f>& outCentres)
+    {
+        cv::Mat image8bit, mask;
+        RebalanceAndBinarise(raw, image8bit, mask);
+        DetectBlobs2D(mask, method, outCentres, true, raw);
+    }
+
+    //! BlobDetectionMethod::Basic, RefineByScaling and IntensityWeighted on rendered raw AB frames, for near (large)
+    //! to far (small) markers, timed over the whole frame and scored against the true centres
+    void BenchmarkAccuracy(std::mt19937& rng)
+    {
+        constexpr int FRAMES = 20;
+        constexpr int BLOBS = 20;
+        const std::pair<float, float> radii[] = { { 1.5f, 3.0f }, { 3.0f, 6.0f }, { 6.0f, 12.0f } };
+
+        std::printf("\nRaw AB frame -> blob centres, %d frames of %d markers (time is the median over all frames)\n", FRAMES, BLOBS);
+        std::printf("%10s %18s %10s %10s %10s %8s %9s\n", "radius", "method", "time [us]", "RMS [px]", "max [px]", "missed", "spurious");
+
+        for (const auto& radius : radii)
+        {
+            std::vector<std::vector<TestUtils::SyntheticBlob>> truth(FRAMES);
+            std::vector<cv::Mat> frames(FRAMES);
+            for (int f = 0; f < FRAMES; ++f)
+            {
+                truth[f] = TestUtils::ScatterBlobs(BLOBS, radius.first, radius.second, IMAGE_SIZE, rng);
+                TestUtils::RenderRawAB(truth[f], IMAGE_SIZE, rng, frames[f]);
+            }
+
+            for (const auto& method : RAW_FRAME_METHODS)
+            {
+                AccuracyStats stats;
+                std::vector<double> times;
+                std::vector<cv::Point2f> centres;
+                for (int f = 0; f < FRAMES; ++f)
+                {
+                    times.push_back(TestUtils::MedianMicroseconds([&] { DetectFromRaw(frames[f], method.first, centres); }, REPEATS / FRAMES));
+                    stats.Add(truth[f], centres);
+                }
+                std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+
+                std::printf("%4.1f-%-5.1f %18s %10.1f %10.3f %10.3f %8d %9d\n", radius.first, radius.second, method.second,
+                    times[times.size() / 2], stats.RMS(), stats.MaxError, stats.Missed, stats.Spurious);
+            }
+        }
+    }
+
+    //! Recorded frames have no ground truth, so each method is scored by how far its centres sit from the
+    //! BlobDetectionMethod::IntensityWeighted ones. A frame is a raw dump of the 512x512 uint16 AB buffer
+    void BenchmarkRecorded(int count, char** paths)
+    {
+        std::printf("\nRecorded raw AB frames (median of %d runs, offset is the mean distance to IntensityWeighted)\n", REPEATS);
+        std::printf("%24s %18s %10s %8s %12s\n", "frame", "method", "time [us]", "found", "offset [px]");
+
+        for (int i = 0; i < count; ++i)
+        {
+            cv::Mat raw(IMAGE_SIZE, CV_16UC1);
+            std::ifstream file(paths[i], std::ios::binary);
+            if (!file.read(reinterpret_cast<char*>(raw.data), raw.total() * raw.elemSize()))
+            {
+                std::printf("%24s could not read %d x %d uint16 values\n", paths[i], IMAGE_SIZE.width, IMAGE_SIZE.height);
+                continue;
+            }
+
+            std::vector<cv::Point2f> reference;
+            DetectFromRaw(raw, BlobDetectionMethod::IntensityWeighted, reference);
+            for (const auto& method : RAW_FRAME_METHODS)
+            {
+                std::vector<cv::Point2f> centres;
+                const double time = TestUtils::MedianMicroseconds([&] { DetectFromRaw(raw, method.first, centres); }, REPEATS);
+
+                double offsetSum = 0.0;
+                for (const cv::Point2f& centre : centres)
+                {
+                    float nearest = std::numeric_limits<float>::max();
+                    for (const cv::Point2f& other : reference) nearest = std::min(nearest, std::hypot(centre.x - other.x, centre.y - other.y));
+                    offsetSum += nearest;
+                }
+                std::printf("%24.24s %18s %10.1f %8zu %12.3f\n", paths[i], method.second, time, centres.size(), centres.empty() ? 0.0 : offsetSum / centres.size());
+            }
+        }
+    }
+}
+
+//! Usage: BlobDetectionBenchmark [seed] [recorded AB frame ...]
+int main(int argc, char** argv)
+{
+    std::mt19937 rng(argc > 1 ? static_cast<unsigned>(std::atoi(argv[1])) : 1u);
+    BenchmarkLabelling(rng);
+    BenchmarkAccuracy(rng);
+    if (argc > 2) BenchmarkRecorded(argc - 2, argv + 2);
+    return 0;
+}
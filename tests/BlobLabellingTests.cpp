@@ -0,0 +1,301 @@
+/**
+ * @file        BlobLabellingTests.cpp
+ * @brief       Checks \ref IRTrackerUtils::ImageProc::LabelBlobComponents against OpenCV's own labelling and
+ *              contour measurements, which BlobDetectionMethod::ConnectedComponents has to reproduce to filter
+ *              blobs identically to BlobDetectionMethod::Basic
+ * @author      Hisham Iqbal
+ * @copyright   &copy; Hisham Iqbal 2023
+ *
+ */
+
+#include "IRTrackerUtils.h"
+#include "SyntheticFrames.h"
+#include "TestUtils.h"
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <map>
+#include <tuple>
+
+using IRTrackerUtils::ImageProc::BlobComponent;
+
+namespace
+{
+    typedef std::tuple<int, int, int, int, int> ComponentKey; // bounding box and pixel count
+
+    //! Pixel statistics must match cv::connectedComponentsWithStats (8-connected) for any mask
+    void CheckPixelStatistics(const cv::Mat& mask, const std::vector<BlobComponent>& components)
+    {
+        cv::Mat labels, stats, centroids;
+        const int count = cv::connectedComponentsWithStats(mask, labels, stats, centroids, 8, CV_32S) - 1; // minus background
+        if (!CHECK(static_cast<int>(components.size()) == count)) return;
+
+        std::map<ComponentKey, cv::Point2d> expected;
+        for (int label = 1; label <= count; ++label)
+        {
+            const int* s = stats.ptr<int>(label);
+            const ComponentKey key(s[cv::CC_STAT_LEFT], s[cv::CC_STAT_TOP], s[cv::CC_STAT_WIDTH], s[cv::CC_STAT_HEIGHT], s[cv::CC_STAT_AREA]);
+            expected[key] = cv::Point2d(centroids.at<double>(label, 0), centroids.at<double>(label, 1));
+        }
+
+        for (const BlobComponent& component : components)
+        {
+            const cv::Rect box = component.BoundingBox();
+            const auto match = expected.find(ComponentKey(box.x, box.y, box.width, box.height, component.PixelCount));
+            if (!CHECK(match != expected.end())) continue;
+            CHECK_NEAR(static_cast<double>(component.PixelSumX) / component.PixelCount, match->second.x, 1e-9);
+            CHECK_NEAR(static_cast<double>(component.PixelSumY) / component.PixelCount, match->second.y, 1e-9);
+        }
+    }
+
+    //! Contour statistics must match cv::contourArea / cv::arcLength / cv::moments on the external contour. Only
+    //! exact for blobs with one run of pixels per row, which is what \p mask must contain
+    void CheckContourStatistics(const cv::Mat& mask, const std::vector<BlobComponent>& components)
+    {
+        // traced on a zero-padded copy, shifted back, so blobs on the image border are traced in full
+        cv::Mat padded;
+        cv::copyMakeBorder(mask, padded, 1, 1, 1, 1, cv::BORDER_CONSTANT, cv::Scalar(0));
+        std::vector<std::vector<cv::Point>> contours;
+        cv::findContours(padded, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE, cv::Point(-1, -1));
+        if (!CHECK(contours.size() == components.size())) return;
+
+        std::map<std::tuple<int, int, int, int>, const std::vector<cv::Point>*> byBox;
+        for (const auto& contour : contours)
+        {
+            const cv::Rect box = cv::boundingRect(contour);
+            byBox[std::make_tuple(box.x, box.y, box.width, box.height)] = &contour;
+        }
+
+        for (const BlobComponent& component : components)
+        {
+            const cv::Rect box = component.BoundingBox();
+            const auto match = byBox.find(std::make_tuple(box.x, box.y, box.width, box.height));
+            if (!CHECK(match != byBox.end())) continue;
+            const std::vector<cv::Point>& contour = *match->second;
+
+            CHECK_NEAR(component.Area(), cv::contourArea(contour), 1e-9);
+            CHECK_NEAR(component.Perimeter(), cv::arcLength(contour, true), 1e-6);
+            if (component.Area() <= 0.0) continue;
+
+            const cv::Moments moments = cv::moments(contour);
+            const cv::Point2f centroid = component.Centroid();
+            CHECK_NEAR(centroid.x, moments.m10 / moments.m00, 1e-4);
+            CHECK_NEAR(centroid.y, moments.m01 / moments.m00, 1e-4);
+        }
+    }
+
+    void TestDiscMasks()
+    {
+        std::printf("discs of radius 0.5-12 px\n");
+        std::mt19937 rng(2);
+        for (int frame = 0; frame < 50; ++frame)
+        {
+            const auto blobs = TestUtils::ScatterBlobs(40, 0.5f, 12.0f, cv::Size(512, 512), rng);
+            cv::Mat mask;
+            TestUtils::DrawBinaryDiscs(blobs, cv::Size(512, 512), mask);
+
+            std::vector<BlobComponent> components;
+            IRTrackerUtils::ImageProc::LabelBlobComponents(mask, components);
+            CheckPixelStatistics(mask, components);
+            CheckContourStatistics(mask, components);
+        }
+    }
+
+    void TestSimpleShapes()
+    {
+        std::printf("lines, single pixels, rectangles and ellipses\n");
+        cv::Mat mask(120, 160, CV_8UC1, cv::Scalar(0));
+        mask.at<uint8_t>(5, 5) = 255;                                                   // single pixel
+        cv::line(mask, cv::Point(20, 5), cv::Point(40, 5), cv::Scalar(255));            // horizontal
+        cv::line(mask, cv::Point(50, 2), cv::Point(50, 20), cv::Scalar(255));           // vertical
+        cv::line(mask, cv::Point(60, 2), cv::Point(75, 17), cv::Scalar(255));           // diagonal
+        cv::line(mask, cv::Point(100, 2), cv::Point(85, 17), cv::Scalar(255));          // anti-diagonal
+        cv::rectangle(mask, cv::Rect(110, 3, 12, 7), cv::Scalar(255), cv::FILLED);
+        cv::ellipse(mask, cv::Point(30, 60), cv::Size(20, 8), 30.0, 0.0, 360.0, cv::Scalar(255), cv::FILLED);
+        cv::ellipse(mask, cv::Point(90, 70), cv::Size(6, 25), -65.0, 0.0, 360.0, cv::Scalar(255), cv::FILLED);
+        cv::circle(mask, cv::Point(140, 95), 11, cv::Scalar(255), cv::FILLED);
+
+        std::vector<BlobComponent> components;
+        IRTrackerUtils::ImageProc::LabelBlobComponents(mask, components);
+        CheckPixelStatistics(mask, components);
+        CheckContourStatistics(mask, components);
+
+        // a blob touching the image border, and an ROI view whose rows aren't contiguous
+        cv::Mat border(40, 40, CV_8UC1, cv::Scalar(0));
+        cv::circle(border, cv::Point(0, 39), 9, cv::Scalar(255), cv::FILLED);
+        IRTrackerUtils::ImageProc::LabelBlobComponents(border, components);
+        CheckPixelStatistics(border, components);
+        CheckContourStatistics(border, components);
+
+        const cv::Mat view = mask(cv::Rect(15, 40, 100, 60));
+        IRTrackerUtils::ImageProc::LabelBlobComponents(view, components);
+        CheckPixelStatistics(view.clone(), components);
+        CheckContourStatistics(view, components);
+    }
+
+    void TestReportedAreas()
+    {
+        // every detector reports a blob's pixel count, which the marker size check compares with the silhouette
+        std::printf("reported blob areas\n");
+        cv::Mat square(20, 20, CV_8UC1, cv::Scalar(0));
+        square(cv::Rect(8, 8, 4, 4)).setTo(cv::Scalar(255)); // contour area 9, 16 pixels
+
+        std::mt19937 rng(4);
+        cv::Mat discs;
+        TestUtils::DrawBinaryDiscs(TestUtils::ScatterBlobs(40, 1.5f, 12.0f, cv::Size(512, 512), rng), cv::Size(512, 512), discs);
+
+        using IRTrackerUtils::ImageProc::BlobDetectionMethod;
+        for (const cv::Mat& mask : { square, discs })
+        {
+            std::vector<BlobComponent> components;
+            IRTrackerUtils::ImageProc::LabelBlobComponents(mask, components);
+
+            for (const BlobDetectionMethod method : { BlobDetectionMethod::Basic, BlobDetectionMethod::RefineByScaling, BlobDetectionMethod::ConnectedComponents })
+            {
+                std::vector<cv::Point2f> centres;
+                std::vector<float> areas;
+                cv::Mat input = mask.clone();
+                IRTrackerUtils::ImageProc::DetectBlobs2D(input, method, centres, true, cv::Mat(), &areas);
+                if (!CHECK(!centres.empty() && areas.size() == centres.size())) continue;
+
+                for (size_t i = 0; i < centres.size(); ++i)
+                {
+                    const auto owner = std::find_if(components.begin(), components.end(), [&](const BlobComponent& component)
+                    {
+                        return component.BoundingBox().contains(cv::Point(cvRound(centres[i].x), cvRound(centres[i].y)));
+                    });
+                    if (CHECK(owner != components.end())) CHECK_NEAR(areas[i], owner->PixelCount, 1e-3);
+                }
+            }
+        }
+    }
+
+    void TestComponentPeaks()
+    {
+        // brightest pixel per component against a brute force search over cv::connectedComponents' labels. Values
+        // from a handful of levels give plenty of ties, which must go to the first pixel in raster order
+        std::printf("component peaks\n");
+        std::mt19937 rng(7);
+        std::uniform_int_distribution<int> level(0, 3);
+        for (const double density : { 0.3, 0.6 })
+        {
+            cv::Mat mask, values(256, 256, CV_8UC1);
+            TestUtils::DrawNoiseMask(values.size(), density, rng, mask);
+            for (int y = 0; y < values.rows; ++y)
+                for (int x = 0; x < values.cols; ++x) values.at<uint8_t>(y, x) = static_cast<uint8_t>(level(rng));
+
+            cv::Mat labels, stats, centroids;
+            const int count = cv::connectedComponentsWithStats(mask, labels, stats, centroids, 8, CV_32S);
+            std::vector<cv::Point> expected(count, cv::Point(-1, -1));
+            for (int y = 0; y < mask.rows; ++y)
+            {
+                for (int x = 0; x < mask.cols; ++x)
+                {
+                    const int label = labels.at<int>(y, x);
+                    cv::Point& best = expected[label];
+                    if (label > 0 && (best.x < 0 || values.at<uint8_t>(y, x) > values.at<uint8_t>(best))) best = cv::Point(x, y);
+                }
+            }
+
+            std::vector<BlobComponent> components;
+            IRTrackerUtils::ImageProc::LabelBlobComponents(mask, components, values);
+            if (!CHECK(static_cast<int>(components.size()) == count - 1)) continue;
+            for (const BlobComponent& component : components)
+            {
+                // labels are numbered in raster order like the components, but match on the peak's own label to be safe
+                const cv::Point peak(component.PeakX, component.PeakY);
+                if (!CHECK(peak.x >= 0 && peak.y >= 0)) continue;
+                CHECK(expected[labels.at<int>(peak)] == peak);
+                CHECK(component.PeakValue == values.at<uint8_t>(peak));
+            }
+        }
+    }
+
+    void TestBlobPeakOnePerBlob()
+    {
+        // large, noisy blobs have many 5x5 local maxima, but each blob must still give exactly one centre
+        std::printf("blob peaks, one peak per blob\n");
+        std::mt19937 rng(8);
+        const cv::Size size(512, 512);
+        for (int frame = 0; frame < 10; ++frame)
+        {
+            const auto blobs = TestUtils::ScatterBlobs(25, 1.0f, 20.0f, size, rng);
+            cv::Mat raw, image8bit, mask;
+            TestUtils::RenderRawAB(blobs, size, rng, raw, 150.0f, 3000.0f, 40.0f);
+            IRTrackerUtils::ImageProc::RebalanceAndBinarise(raw, image8bit, mask);
+
+            std::vector<BlobComponent> components;
+            IRTrackerUtils::ImageProc::LabelBlobComponents(mask, components);
+
+            std::vector<cv::Point2f> centres;
+            std::vector<float> areas;
+            IRTrackerUtils::ImageProc::DetectBlobs2D(mask, IRTrackerUtils::ImageProc::BlobDetectionMethod::BlobPeak, centres, true, raw, &areas);
+            if (!CHECK(centres.size() == blobs.size() && components.size() == blobs.size() && areas.size() == centres.size())) continue;
+
+            for (size_t i = 0; i < centres.size(); ++i)
+            {
+                // components and centres are both in raster order of each blob's first pixel
+                CHECK(components[i].BoundingBox().contains(cv::Point(cvRound(centres[i].x), cvRound(centres[i].y))));
+                CHECK(areas[i] == static_cast<float>(components[i].PixelCount));
+            }
+        }
+    }
+
+    void TestBlobPeakDropsSinglePixels()
+    {
+        // lone pixels over the threshold are noise, but anything from two pixels up is kept whatever its shape
+        std::printf("blob peaks, single pixel noise\n");
+        cv::Mat raw(64, 64, CV_16UC1, cv::Scalar(100)), mask(64, 64, CV_8UC1, cv::Scalar(0));
+        const cv::Point specks[] = { { 3, 3 }, { 60, 10 }, { 30, 62 } };
+        for (const cv::Point& speck : specks)
+        {
+            raw.at<uint16_t>(speck) = 4000;
+            mask.at<uint8_t>(speck) = 255;
+        }
+        const cv::Rect pair(10, 20, 2, 1), diagonal(40, 40, 2, 2), bar(20, 50, 6, 1);
+        raw(pair).setTo(cv::Scalar(900));
+        mask(pair).setTo(cv::Scalar(255));
+        raw.at<uint16_t>(40, 40) = raw.at<uint16_t>(41, 41) = 1500;
+        mask.at<uint8_t>(40, 40) = mask.at<uint8_t>(41, 41) = 255;
+        raw(bar).setTo(cv::Scalar(800));
+        mask(bar).setTo(cv::Scalar(255));
+
+        for (const bool withRaw : { true, false })
+        {
+            std::vector<cv::Point2f> centres;
+            std::vector<float> areas;
+            IRTrackerUtils::ImageProc::DetectBlobs2D(mask, IRTrackerUtils::ImageProc::BlobDetectionMethod::BlobPeak, centres, true,
+                withRaw ? raw : cv::Mat(), &areas);
+            if (!CHECK(centres.size() == 3 && areas.size() == 3)) continue;
+            CHECK(pair.contains(cv::Point(cvRound(centres[0].x), cvRound(centres[0].y))) && areas[0] == 2.0f);
+            CHECK(diagonal.contains(cv::Point(cvRound(centres[1].x), cvRound(centres[1].y))) && areas[1] == 2.0f);
+            CHECK(bar.contains(cv::Point(cvRound(centres[2].x), cvRound(centres[2].y))) && areas[2] == 6.0f);
+        }
+    }
+
+    void TestRaggedMasks()
+    {
+        // components of every shape, including holes and several runs per row: pixel statistics stay exact
+        std::printf("random noise masks\n");
+        std::mt19937 rng(3);
+        for (const double density : { 0.05, 0.3, 0.6 })
+        {
+            cv::Mat mask;
+            TestUtils::DrawNoiseMask(cv::Size(256, 256), density, rng, mask);
+            std::vector<BlobComponent> components;
+            IRTrackerUtils::ImageProc::LabelBlobComponents(mask, components);
+            CheckPixelStatistics(mask, components);
+        }
+    }
+}
+
+int main()
+{
+    TestDiscMasks();
+    TestSimpleShapes();
+    TestReportedAreas();
+    TestComponentPeaks();
+    TestBlobPeakOnePerBlob();
+    TestBlobPeakDropsSinglePixels();
+    TestRaggedMasks();
+    return TestUtils::Report("BlobLabellingTests");
+}
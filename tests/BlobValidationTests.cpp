@@ -0,0 +1,310 @@
+/**
+ * @file        BlobValidationTests.cpp
+ * @brief       Checks \ref IRTrackerUtils::ImageProc::ValidateBlobs3DBatch against the per-blob
+ *              \ref IRTrackerUtils::ImageProc::ValidateBlobs3D it replaced, its sigma-weighted depth taps and its
+ *              marker size check
+ * @author      Hisham Iqbal
+ * @copyright   &copy; Hisham Iqbal 2023
+ *
+ */
+
+#include "CameraModel.h"
+#include "SyntheticCamera.h"
+#include "TestUtils.h"
+#include <random>
+
+using namespace IRTrackerUtils::ImageProc;
+using IRTrackerUtils::BlobPoints3D;
+using IRTrackerUtils::InfraBlobInfo;
+using IRTrackerUtils::PinholeCameraModel;
+
+namespace
+{
+    Eigen::Matrix4d SomeDepth2World()
+    {
+        Eigen::Matrix4d depth2World = Eigen::Matrix4d::Identity();
+        depth2World.topLeftCorner<3, 3>() = Eigen::AngleAxisd(0.7, Eigen::Vector3d(1.0, -2.0, 0.5).normalized()).toRotationMatrix();
+        depth2World.topRightCorner<3, 1>() = Eigen::Vector3d(0.3, -1.2, 2.0);
+        return depth2World;
+    }
+
+    //! Depth map of plausible ranges, with holes (0), the sensor's invalid range (> 4090) and the values either side of it
+    cv::Mat RandomDepth(std::mt19937& rng)
+    {
+        std::uniform_int_distribution<int> kind(0, 9), range(200, 1000), invalid(4091, 65535);
+        cv::Mat depth(512, 512, CV_16UC1);
+        for (int y = 0; y < depth.rows; ++y)
+        {
+            for (int x = 0; x < depth.cols; ++x)
+            {
+                const int k = kind(rng);
+                depth.at<uint16_t>(y, x) = static_cast<uint16_t>(k == 0 ? 0 : k == 1 ? invalid(rng) : k == 2 ? 4090 + (x & 1) : range(rng));
+            }
+        }
+        return depth;
+    }
+
+    //! Random blob centres, a few outside the image, plus the border cases
+    std::vector<cv::Point2f> RandomBlobs(int count, std::mt19937& rng)
+    {
+        std::uniform_real_distribution<float> coordinate(-20.0f, 531.0f);
+        std::vector<cv::Point2f> blobs;
+        for (int i = 0; i < count; ++i) blobs.emplace_back(coordinate(rng), coordinate(rng));
+        for (const cv::Point2f& border : { cv::Point2f(0.0f, 0.0f), cv::Point2f(511.0f, 511.0f), cv::Point2f(511.4f, 100.0f),
+            cv::Point2f(100.0f, 511.6f), cv::Point2f(-0.3f, 50.0f), cv::Point2f(50.0f, -0.2f), cv::Point2f(-1.0f, -1.0f), cv::Point2f(512.0f, 0.0f) })
+        {
+            blobs.push_back(border);
+        }
+        return blobs;
+    }
+
+    //! The per-blob and batched results hold the same blobs, in the same order, at the same positions
+    bool SameResult(const std::vector<InfraBlobInfo>& perBlob, const BlobPoints3D& batch)
+    {
+        if (perBlob.size() != batch.Size()) return false;
+        for (size_t i = 0; i < perBlob.size(); ++i)
+        {
+            if (perBlob[i].PixelCoordinate != batch.PixelCoordinates[i]) return false;
+            if (perBlob[i].DepthLocation != batch.DepthLocation(i)) return false;
+            if ((perBlob[i].WorldLocation - batch.WorldLocation(i)).norm() > 1e-12) return false;
+        }
+        return true;
+    }
+
+    void TestMatchesPerBlob()
+    {
+        std::printf("ValidateBlobs3DBatch against ValidateBlobs3D\n");
+        std::mt19937 rng(13);
+        const PinholeCameraModel model(TestUtils::AhatLikeIntrinsics());
+        Eigen::Matrix4d depth2World = SomeDepth2World();
+
+        BlobPoints3D batch;
+        std::vector<InfraBlobInfo> perBlob;
+        size_t kept = 0, total = 0;
+        for (int frame = 0; frame < 20; ++frame)
+        {
+            const cv::Mat depth = RandomDepth(rng);
+            const std::vector<cv::Point2f> blobs = RandomBlobs(500, rng);
+            ValidateBlobs3D(depth, depth2World, blobs, model, perBlob);
+            ValidateBlobs3DBatch(depth, depth2World, blobs, model, batch);
+            CHECK(SameResult(perBlob, batch));
+            kept += batch.Size();
+            total += blobs.size();
+        }
+        std::printf("  %zu of %zu blobs kept\n", kept, total);
+        CHECK(kept > total / 2 && kept < total);
+
+        // every depth is one the per-blob path calls valid, and the transform is applied as a 4x4 would
+        for (size_t i = 0; i < batch.Size(); ++i)
+        {
+            const double range = batch.DepthLocation(i).norm();
+            CHECK(range > 0.0 && range <= 4.090 + 1e-9);
+            const Eigen::Vector3d world = (depth2World * batch.DepthLocation(i).homogeneous()).head<3>();
+            CHECK((world - batch.WorldLocation(i)).norm() < 1e-12);
+        }
+    }
+
+    //! Forwards to another model, counting the pixels it's asked to unmap
+    class CountingCameraModel : public IRTrackerUtils::CameraModel
+    {
+        public:
+            explicit CountingCameraModel(const IRTrackerUtils::CameraModel& model) : m_Model(model) {}
+
+            size_t UnmapPoints(const cv::Point2f* pixels, size_t count, Eigen::Vector3f* outRays, uint8_t* outValid) const override
+            {
+                UnmappedPixels += count;
+                return m_Model.UnmapPoints(pixels, count, outRays, outValid);
+            }
+            size_t ProjectPoints(const Eigen::Vector3f* points, size_t count, cv::Point2f* outPixels, uint8_t* outValid) const override
+            {
+                return m_Model.ProjectPoints(points, count, outPixels, outValid);
+            }
+
+            mutable size_t UnmappedPixels = 0;
+
+        private:
+            const IRTrackerUtils::CameraModel& m_Model;
+    };
+
+    void TestSigmaWeightedTaps()
+    {
+        std::printf("depth taps flagged invalid in the sigma buffer\n");
+        const PinholeCameraModel model(TestUtils::AhatLikeIntrinsics());
+        const CountingCameraModel counting(model);
+        Eigen::Matrix4d depth2World = SomeDepth2World();
+        using IRTrackerUtils::SIGMA_INVALID_MASK;
+
+        // a marker 1 m away, one of whose four taps reads 4095 and is flagged by the sensor
+        cv::Mat depth(512, 512, CV_16UC1, cv::Scalar(1000)), sigma(512, 512, CV_8UC1, cv::Scalar(0));
+        depth.at<uint16_t>(100, 101) = 4095;
+        sigma.at<uint8_t>(100, 101) = SIGMA_INVALID_MASK | 0x05;
+        const std::vector<cv::Point2f> centre = { cv::Point2f(100.5f, 100.5f) };
+
+        // blending all four taps pulls it out to 1.77 m, the three valid ones give the true 1.00 m
+        BlobPoints3D batch;
+        ValidateBlobs3DBatch(depth, depth2World, centre, model, batch);
+        CHECK(batch.Size() == 1 && std::abs(batch.DepthLocation(0).norm() - 1.77375) < 1e-6);
+        ValidateBlobs3DBatch(depth, depth2World, centre, model, batch, sigma);
+        CHECK(batch.Size() == 1 && std::abs(batch.DepthLocation(0).norm() - 1.0) < 1e-6);
+
+        // the remaining weights are renormalised wherever the blob sits between them
+        depth.at<uint16_t>(101, 100) = 2000;
+        const std::vector<cv::Point2f> offCentre = { cv::Point2f(100.25f, 100.75f) };
+        ValidateBlobs3DBatch(depth, depth2World, offCentre, model, batch, sigma);
+        const double w00 = 0.75 * 0.25, w10 = 0.75 * 0.75, w11 = 0.25 * 0.75;
+        CHECK(batch.Size() == 1 && std::abs(batch.DepthLocation(0).norm() - (1000 * w00 + 2000 * w10 + 1000 * w11) / (w00 + w10 + w11) / 1000.0) < 1e-6);
+        depth.at<uint16_t>(101, 100) = 1000;
+
+        // only the top bit counts as invalid
+        sigma.at<uint8_t>(100, 101) = 0x7F;
+        ValidateBlobs3DBatch(depth, depth2World, centre, model, batch, sigma);
+        CHECK(batch.Size() == 1 && std::abs(batch.DepthLocation(0).norm() - 1.77375) < 1e-6);
+
+        // with every tap flagged the blob is dropped before it's unmapped, so only the other one reaches the camera
+        sigma(cv::Rect(100, 100, 2, 2)).setTo(cv::Scalar(SIGMA_INVALID_MASK));
+        const std::vector<cv::Point2f> blobs = { cv::Point2f(100.5f, 100.5f), cv::Point2f(300.0f, 200.0f) };
+        counting.UnmappedPixels = 0;
+        ValidateBlobs3DBatch(depth, depth2World, blobs, counting, batch, sigma);
+        CHECK(batch.Size() == 1 && batch.PixelCoordinates[0] == blobs[1]);
+        CHECK(counting.UnmappedPixels == 1);
+
+        // an on-pixel blob only has weight on one tap, so that's the one that has to be valid
+        const std::vector<cv::Point2f> onPixel = { cv::Point2f(102.0f, 100.0f), cv::Point2f(101.0f, 101.0f) };
+        ValidateBlobs3DBatch(depth, depth2World, onPixel, model, batch, sigma);
+        CHECK(batch.Size() == 1 && batch.PixelCoordinates[0] == onPixel[0]);
+
+        // a sigma buffer of the wrong size or type is ignored
+        ValidateBlobs3DBatch(depth, depth2World, centre, model, batch, sigma(cv::Rect(0, 0, 256, 512)).clone());
+        CHECK(batch.Size() == 1 && std::abs(batch.DepthLocation(0).norm() - 1.77375) < 1e-6);
+        cv::Mat sigma16;
+        sigma.convertTo(sigma16, CV_16UC1);
+        ValidateBlobs3DBatch(depth, depth2World, centre, model, batch, sigma16);
+        CHECK(batch.Size() == 1 && std::abs(batch.DepthLocation(0).norm() - 1.77375) < 1e-6);
+    }
+
+    //! Forwards to another model, but can't unmap anything right of \p maxX, like a lens whose fold runs through the image
+    class ClippedCameraModel : public IRTrackerUtils::CameraModel
+    {
+        public:
+            ClippedCameraModel(const IRTrackerUtils::CameraModel& model, float maxX) : m_Model(model), m_MaxX(maxX) {}
+
+            size_t UnmapPoints(const cv::Point2f* pixels, size_t count, Eigen::Vector3f* outRays, uint8_t* outValid) const override
+            {
+                size_t numValid = m_Model.UnmapPoints(pixels, count, outRays, outValid);
+                for (size_t i = 0; i < count; ++i)
+                {
+                    if (!outValid[i] || pixels[i].x <= m_MaxX) continue;
+                    outValid[i] = 0;
+                    outRays[i].setZero();
+                    --numValid;
+                }
+                return numValid;
+            }
+            size_t ProjectPoints(const Eigen::Vector3f* points, size_t count, cv::Point2f* outPixels, uint8_t* outValid) const override
+            {
+                return m_Model.ProjectPoints(points, count, outPixels, outValid);
+            }
+
+        private:
+            const IRTrackerUtils::CameraModel& m_Model;
+            const float m_MaxX;
+    };
+
+    void TestMarkerSizeFilter()
+    {
+        std::printf("blob areas against the area a marker covers at its depth\n");
+
+        // undistorted, with about the AHAT's focal length so a pixel is 1/217 rad wide at the centre
+        PinholeCameraModel::Intrinsics intrinsics;
+        intrinsics.Fx = intrinsics.Fy = 217.0f;
+        intrinsics.Cx = intrinsics.Cy = 255.5f;
+        const PinholeCameraModel model(intrinsics);
+        Eigen::Matrix4d depth2World = SomeDepth2World();
+
+        // a 12 mm sphere with its front 0.5 m away subtends asin(6 / 506) either side of its centre
+        const double angularRadius = std::asin(0.006 / 0.506), pixelAngle = 2.0 * std::atan(0.5 / 217.0);
+        const double predicted = CV_PI * (angularRadius / pixelAngle) * (angularRadius / pixelAngle);
+        std::printf("  predicted %.1f px\n", predicted);
+        CHECK(predicted > 20.0 && predicted < 22.0);
+
+        const cv::Mat depth(512, 512, CV_16UC1, cv::Scalar(500));
+        const MarkerSizeFilter filter = { 0.012f, 0.25f, 3.5f };
+        const std::vector<cv::Point2f> blobs = { { 255.5f, 255.5f }, { 240.0f, 270.0f }, { 270.0f, 240.0f }, { 250.0f, 250.0f } };
+        BlobPoints3D batch;
+
+        // a plausible marker is kept, a speck and a glint several times the marker's size are not
+        ValidateBlobs3DBatch(depth, depth2World, blobs, model, batch, cv::Mat(), { 20.0f, 3.0f, 80.0f, 20.0f }, filter);
+        CHECK(batch.Size() == 2 && batch.PixelCoordinates[0] == blobs[0] && batch.PixelCoordinates[1] == blobs[3]);
+
+        // the bounds apply to the ratio with the predicted area, to within a tenth of a percent either side
+        const float lowest = static_cast<float>(filter.MinAreaRatio * predicted), highest = static_cast<float>(filter.MaxAreaRatio * predicted);
+        const std::vector<cv::Point2f> centre = { blobs[0], blobs[0] + cv::Point2f(1.0f, 0.0f) };
+        ValidateBlobs3DBatch(depth, depth2World, centre, model, batch, cv::Mat(), { lowest * 1.001f, lowest * 0.999f }, filter);
+        CHECK(batch.Size() == 1 && batch.PixelCoordinates[0] == centre[0]);
+        ValidateBlobs3DBatch(depth, depth2World, centre, model, batch, cv::Mat(), { highest * 1.001f, highest * 0.999f }, filter);
+        CHECK(batch.Size() == 1 && batch.PixelCoordinates[0] == centre[1]);
+
+        // at half the distance the marker covers about four times the area, so only the 80 px blob fits
+        ValidateBlobs3DBatch(cv::Mat(512, 512, CV_16UC1, cv::Scalar(250)), depth2World, blobs, model, batch, cv::Mat(),
+            { 20.0f, 3.0f, 80.0f, 20.0f }, filter);
+        CHECK(batch.Size() == 1 && batch.PixelCoordinates[0] == blobs[2]);
+
+        // nothing is checked without an area, without the filter, or with areas that don't line up with the blobs
+        ValidateBlobs3DBatch(depth, depth2World, blobs, model, batch, cv::Mat(), { 0.0f, 0.0f, 80.0f, 0.0f }, filter);
+        CHECK(batch.Size() == 3);
+        ValidateBlobs3DBatch(depth, depth2World, blobs, model, batch, cv::Mat(), { 20.0f, 3.0f, 80.0f, 20.0f }, MarkerSizeFilter());
+        CHECK(batch.Size() == 4);
+        ValidateBlobs3DBatch(depth, depth2World, blobs, model, batch, cv::Mat(), { 20.0f, 3.0f, 80.0f }, filter);
+        CHECK(batch.Size() == 4);
+        ValidateBlobs3DBatch(depth, depth2World, blobs, model, batch, cv::Mat(), { 20.0f, 3.0f, 80.0f, 20.0f }, { 0.012f, 2.0f, 1.0f });
+        CHECK(batch.Size() == 4);
+
+        // a blob whose half-pixel neighbours can't all be unmapped passes unchecked, the rest are still checked
+        const ClippedCameraModel clipped(model, 270.2f);
+        ValidateBlobs3DBatch(depth, depth2World, blobs, clipped, batch, cv::Mat(), { 20.0f, 3.0f, 80.0f, 20.0f }, filter);
+        CHECK(batch.Size() == 3 && batch.PixelCoordinates[1] == blobs[2]);
+
+        // and the kept blobs' positions don't depend on the check
+        BlobPoints3D unchecked;
+        ValidateBlobs3DBatch(depth, depth2World, blobs, clipped, unchecked);
+        CHECK(unchecked.Size() == 4 && unchecked.DepthLocation(2) == batch.DepthLocation(1));
+    }
+
+    void TestRejectedFrames()
+    {
+        std::printf("ValidateBlobs3DBatch with nothing to keep\n");
+        std::mt19937 rng(14);
+        const PinholeCameraModel model(TestUtils::AhatLikeIntrinsics());
+        Eigen::Matrix4d depth2World = SomeDepth2World();
+        const std::vector<cv::Point2f> blobs = RandomBlobs(50, rng);
+
+        // stale contents are replaced even when nothing is kept
+        BlobPoints3D batch;
+        batch.Resize(7);
+        ValidateBlobs3DBatch(cv::Mat(512, 512, CV_16UC1, cv::Scalar(0)), depth2World, blobs, model, batch);
+        CHECK(batch.Size() == 0);
+        batch.Resize(7);
+        ValidateBlobs3DBatch(cv::Mat(512, 512, CV_16UC1, cv::Scalar(4091)), depth2World, blobs, model, batch);
+        CHECK(batch.Size() == 0);
+        batch.Resize(7);
+        ValidateBlobs3DBatch(cv::Mat(512, 512, CV_8UC1, cv::Scalar(100)), depth2World, blobs, model, batch);
+        CHECK(batch.Size() == 0);
+        batch.Resize(7);
+        ValidateBlobs3DBatch(RandomDepth(rng), depth2World, std::vector<cv::Point2f>(), model, batch);
+        CHECK(batch.Size() == 0);
+
+        // and a camera that can't unmap anything
+        const IRTrackerUtils::ResearchModeCameraModel noUnmap(nullptr);
+        ValidateBlobs3DBatch(cv::Mat(512, 512, CV_16UC1, cv::Scalar(500)), depth2World, blobs, noUnmap, batch);
+        CHECK(batch.Size() == 0);
+    }
+}
+
+int main()
+{
+    TestMatchesPerBlob();
+    TestRejectedFrames();
+    TestSigmaWeightedTaps();
+    TestMarkerSizeFilter();
+    return TestUtils::Report("BlobValidationTests");
+}
@@ -0,0 +1,215 @@
+/**
+ * @file        CameraModelTests.cpp
+ * @brief       Checks \ref IRTrackerUtils::PinholeCameraModel round trips and rejections, the passthrough model, and
+ *              that both \ref IRTrackerUtils::ImageProc::ValidateBlobs3D overloads agree
+ * @author      Hisham Iqbal
+ * @copyright   &copy; Hisham Iqbal 2023
+ *
+ */
+
+#include "CameraModel.h"
+#include "SyntheticCamera.h"
+#include "TestUtils.h"
+#include <random>
+
+using IRTrackerUtils::PinholeCameraModel;
+
+namespace
+{
+    //! Unmaps every pixel of the model's image and projects the rays back, returns the worst pixel error
+    double WorstRoundTrip(const PinholeCameraModel& model, size_t& outUnmapped, size_t& outProjected)
+    {
+        const PinholeCameraModel::Intrinsics& k = model.GetIntrinsics();
+        std::vector<cv::Point2f> pixels;
+        for (int v = 0; v < k.Height; ++v)
+            for (int u = 0; u < k.Width; ++u) pixels.emplace_back(static_cast<float>(u), static_cast<float>(v));
+
+        std::vector<Eigen::Vector3f> rays(pixels.size());
+        std::vector<uint8_t> rayValid(pixels.size()), pixelValid(pixels.size());
+        std::vector<cv::Point2f> projected(pixels.size());
+        outUnmapped = model.UnmapPoints(pixels.data(), pixels.size(), rays.data(), rayValid.data());
+        outProjected = model.ProjectPoints(rays.data(), rays.size(), projected.data(), pixelValid.data());
+
+        double worst = 0.0;
+        for (size_t i = 0; i < pixels.size(); ++i)
+        {
+            if (!rayValid[i] || !pixelValid[i]) continue;
+            worst = std::max(worst, static_cast<double>(cv::norm(projected[i] - pixels[i])));
+        }
+        return worst;
+    }
+
+    void TestRoundTrip()
+    {
+        std::printf("PinholeCameraModel unmap/project round trip over the whole image\n");
+        const PinholeCameraModel model(TestUtils::AhatLikeIntrinsics());
+        size_t unmapped = 0, projected = 0;
+        const double worst = WorstRoundTrip(model, unmapped, projected);
+        std::printf("  worst %.2e px\n", worst);
+        CHECK(unmapped == 512 * 512 && projected == 512 * 512);
+        CHECK(worst < 1e-3);
+
+        // rays are unit length and look out of the sensor, with the principal point straight ahead
+        const cv::Point2f centre(model.GetIntrinsics().Cx, model.GetIntrinsics().Cy);
+        Eigen::Vector3f ray;
+        uint8_t valid = 0;
+        CHECK(model.UnmapPoints(&centre, 1, &ray, &valid) == 1 && valid);
+        CHECK((ray - Eigen::Vector3f::UnitZ()).norm() < 1e-6f);
+    }
+
+    void TestFoldedCorners()
+    {
+        std::printf("strong barrel distortion, corners past the fold of the polynomial\n");
+
+        // x (1 - 0.3 r^2) peaks at r = 1.05, 0.70 on the distorted plane or 169 px from the centre, beyond which no
+        // ray maps to the pixel. Newton's method finds the jacobian's determinant go non-positive and gives up
+        PinholeCameraModel::Intrinsics intrinsics = TestUtils::AhatLikeIntrinsics();
+        intrinsics.K1 = -0.3f;
+        intrinsics.K2 = 0.0f;
+        intrinsics.P1 = intrinsics.P2 = 0.0f;
+        const PinholeCameraModel model(intrinsics);
+
+        const float foldRadius = 0.70f * intrinsics.Fx;
+        const cv::Point2f centre(intrinsics.Cx, intrinsics.Cy);
+        const cv::Point2f pixels[] = { { 0.0f, 0.0f }, { 511.0f, 0.0f }, { 0.0f, 511.0f }, { 511.0f, 511.0f },
+            centre + cv::Point2f(foldRadius + 3.0f, 0.0f), centre - cv::Point2f(0.0f, foldRadius + 3.0f),
+            centre + cv::Point2f(foldRadius - 10.0f, 0.0f), centre - cv::Point2f(0.0f, 0.8f * foldRadius) };
+        Eigen::Vector3f rays[8];
+        uint8_t valid[8];
+        CHECK(model.UnmapPoints(pixels, 8, rays, valid) == 2);
+        for (int i = 0; i < 6; ++i) CHECK(!valid[i] && rays[i].isZero());
+        CHECK(valid[6] && valid[7]);
+
+        // everything this side of the fold still round-trips
+        size_t unmapped = 0, projected = 0;
+        const double worst = WorstRoundTrip(model, unmapped, projected);
+        std::printf("  %zu of %d pixels unmapped, worst round trip %.2e px\n", unmapped, 512 * 512, worst);
+        CHECK(unmapped > 0 && unmapped < 512 * 512 && projected == unmapped);
+        CHECK(worst < 1e-3);
+    }
+
+    void TestRejectedInputs()
+    {
+        std::printf("pixels outside the image and points behind the camera\n");
+        const PinholeCameraModel model(TestUtils::AhatLikeIntrinsics());
+
+        // half a pixel past the border is still the image
+        const cv::Point2f pixels[] = { { -0.5f, -0.5f }, { 511.5f, 511.5f }, { -0.51f, 10.0f }, { 10.0f, 511.51f },
+            { 600.0f, 600.0f }, { std::nanf(""), 10.0f } };
+        Eigen::Vector3f rays[6];
+        uint8_t valid[6];
+        CHECK(model.UnmapPoints(pixels, 6, rays, valid) == 2);
+        CHECK(valid[0] && valid[1]);
+        for (int i = 2; i < 6; ++i) CHECK(!valid[i] && rays[i].isZero());
+
+        const Eigen::Vector3f points[] = { { 0.05f, 0.02f, 0.5f }, { 0.0f, 0.0f, 0.0f }, { 0.05f, 0.02f, -0.5f },
+            { 0.0f, 0.0f, std::nanf("") }, { 3.0f, 0.0f, 0.5f }, { 0.0f, -3.0f, 0.5f } };
+        cv::Point2f projected[6];
+        CHECK(model.ProjectPoints(points, 6, projected, valid) == 1);
+        CHECK(valid[0]);
+        for (int i = 1; i < 6; ++i) CHECK(!valid[i] && projected[i] == cv::Point2f(-1.0f, -1.0f));
+
+        // only the direction matters
+        cv::Point2f scaled;
+        const Eigen::Vector3f further = points[0] * 3.0f;
+        CHECK(model.ProjectPoints(&further, 1, &scaled, valid) == 1 && cv::norm(scaled - projected[0]) < 1e-3);
+    }
+
+    void TestPassthrough()
+    {
+        std::printf("ResearchModeCameraModel passing through to the sensor's functions\n");
+        const PinholeCameraModel model(TestUtils::AhatLikeIntrinsics());
+        const IRTrackerUtils::ProjectFunction project = [&](float(&xy)[2], float(&uv)[2])
+        {
+            const Eigen::Vector3f point(xy[0], xy[1], 1.0f);
+            cv::Point2f pixel;
+            uint8_t valid = 0;
+            model.ProjectPoints(&point, 1, &pixel, &valid);
+            uv[0] = pixel.x; uv[1] = pixel.y;
+            return valid != 0;
+        };
+        const IRTrackerUtils::ResearchModeCameraModel passthrough(TestUtils::UnmapFunctionOf(model), project);
+
+        const cv::Point2f pixels[] = { { 3.0f, 500.0f }, { 256.0f, 256.0f }, { 700.0f, 10.0f } };
+        Eigen::Vector3f expectedRays[3], rays[3];
+        uint8_t expectedValid[3], valid[3];
+        model.UnmapPoints(pixels, 3, expectedRays, expectedValid);
+        CHECK(passthrough.UnmapPoints(pixels, 3, rays, valid) == 2);
+        for (int i = 0; i < 3; ++i) CHECK(valid[i] == expectedValid[i] && (rays[i] - expectedRays[i]).norm() < 1e-6f);
+
+        const Eigen::Vector3f points[] = { { 0.05f, 0.02f, 0.5f }, { 0.05f, 0.02f, -0.5f } };
+        cv::Point2f projected[2], expectedPixel;
+        CHECK(passthrough.ProjectPoints(points, 2, projected, valid) == 1);
+        model.ProjectPoints(points, 1, &expectedPixel, expectedValid);
+        CHECK(valid[0] && !valid[1] && cv::norm(projected[0] - expectedPixel) < 1e-3);
+
+        // a missing function reports every point in that direction as invalid
+        const IRTrackerUtils::ResearchModeCameraModel empty(nullptr);
+        CHECK(empty.UnmapPoints(pixels, 3, rays, valid) == 0 && !valid[0] && rays[1].isZero());
+        CHECK(empty.ProjectPoints(points, 2, projected, valid) == 0 && !valid[0]);
+    }
+
+    void TestValidateBlobs3DOverloads()
+    {
+        std::printf("ValidateBlobs3D with a CameraModel against the UnmapFunction overload\n");
+        using IRTrackerUtils::InfraBlobInfo;
+        std::mt19937 rng(12);
+        std::uniform_real_distribution<float> coordinate(-20.0f, 531.0f);
+        std::uniform_int_distribution<int> depthValue(0, 5000), kind(0, 9);
+
+        // mostly plausible depths, with holes (0) and the sensor's invalid range (> 4090)
+        cv::Mat depth(512, 512, CV_16UC1);
+        for (int y = 0; y < depth.rows; ++y)
+            for (int x = 0; x < depth.cols; ++x)
+            {
+                const int k = kind(rng);
+                depth.at<uint16_t>(y, x) = static_cast<uint16_t>(k == 0 ? 0 : k == 1 ? 4091 + depthValue(rng) % 100 : 200 + depthValue(rng) % 800);
+            }
+
+        std::vector<cv::Point2f> blobs;
+        for (int i = 0; i < 2000; ++i) blobs.emplace_back(coordinate(rng), coordinate(rng));
+        blobs.emplace_back(0.0f, 0.0f);
+        blobs.emplace_back(511.0f, 511.0f);
+        blobs.emplace_back(511.9f, 3.0f);
+
+        Eigen::Matrix4d depth2World = Eigen::Matrix4d::Identity();
+        depth2World.topLeftCorner<3, 3>() = Eigen::AngleAxisd(0.7, Eigen::Vector3d(1.0, -2.0, 0.5).normalized()).toRotationMatrix();
+        depth2World.topRightCorner<3, 1>() = Eigen::Vector3d(0.3, -1.2, 2.0);
+
+        const PinholeCameraModel model(TestUtils::AhatLikeIntrinsics());
+        std::vector<InfraBlobInfo> fromFunction, fromModel(5); // stale contents are replaced
+        IRTrackerUtils::ImageProc::ValidateBlobs3D(depth, depth2World, blobs, TestUtils::UnmapFunctionOf(model), fromFunction);
+        IRTrackerUtils::ImageProc::ValidateBlobs3D(depth, depth2World, blobs, model, fromModel);
+        std::printf("  %zu of %zu blobs kept\n", fromModel.size(), blobs.size());
+
+        // the function's unit plane point is renormalised in double, so positions agree to float precision
+        CHECK(!fromModel.empty() && fromModel.size() < blobs.size());
+        if (CHECK(fromModel.size() == fromFunction.size()))
+        {
+            double worst = 0.0;
+            for (size_t i = 0; i < fromModel.size(); ++i)
+            {
+                CHECK(fromModel[i].PixelCoordinate == fromFunction[i].PixelCoordinate);
+                worst = std::max(worst, (fromModel[i].DepthLocation - fromFunction[i].DepthLocation).norm());
+                worst = std::max(worst, (fromModel[i].WorldLocation - fromFunction[i].WorldLocation).norm());
+                const Eigen::Vector3d world = depth2World.topLeftCorner<3, 3>() * fromModel[i].DepthLocation + depth2World.topRightCorner<3, 1>();
+                worst = std::max(worst, (fromModel[i].WorldLocation - world).norm());
+            }
+            CHECK(worst < 1e-6);
+        }
+
+        // no way to unmap means nothing is kept
+        IRTrackerUtils::ImageProc::ValidateBlobs3D(depth, depth2World, blobs, IRTrackerUtils::UnmapFunction(), fromFunction);
+        CHECK(fromFunction.empty());
+    }
+}
+
+int main()
+{
+    TestRoundTrip();
+    TestFoldedCorners();
+    TestRejectedInputs();
+    TestPassthrough();
+    TestValidateBlobs3DOverloads();
+    return TestUtils::Report("CameraModelTests");
+}
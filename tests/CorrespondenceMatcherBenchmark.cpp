@@ -0,0 +1,137 @@
+/**
+ * @file        CorrespondenceMatcherBenchmark.cpp
+ * @brief       Times \ref GetPointCorrespondence against \ref FindPointCorrespondence, the shortlist-seeded search and
+ *              \ref TrackPointCorrespondence for tools of 4 to 8 markers among 5 to 100 blobs
+ * @author      Hisham Iqbal
+ * @copyright   &copy; Hisham Iqbal 2023
+ *
+ */
+
+#include "CorrespondenceMatcher.h"
+#include "SyntheticScenes.h"
+#include "TestUtils.h"
+#include <cstdlib>
+
+using namespace CorrespondenceMatcher;
+
+namespace
+{
+    constexpr int SCENES = 20;
+    constexpr int REPEATS = 20;
+    constexpr double GATE_RADIUS = 0.02; // metres, TRACKING_GATE_RADIUS in Holo2IRTracker.cpp
+
+    //! Median over the scenes of each scene's median time
+    template <typename Function>
+    double MedianOverScenes(int sceneCount, Function&& timeScene)
+    {
+        std::vector<double> times(sceneCount);
+        for (int s = 0; s < sceneCount; ++s) times[s] = timeScene(s);
+        std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+        return times[times.size() / 2];
+    }
+
+    void BenchmarkMatching(std::mt19937& rng)
+    {
+        std::printf("Tool matched among triangulated blobs, 10%% of them excluded (median of %d scenes x %d runs)\n", SCENES, REPEATS);
+        std::printf("Get is timed including the input copies it needs, as it erases duplicates from them\n");
+        std::printf("%8s %6s %12s %12s %14s %12s %10s %10s\n", "markers", "blobs", "Get [us]", "Find [us]", "Shortlist [us]", "Track [us]",
+            "speed-up", "mismatch");
+
+        for (int markers = 4; markers <= 8; ++markers)
+        {
+            for (const int blobs : { 5, 10, 20, 50, 100 })
+            {
+                // the tool's only in view if it fits, otherwise every method is timed rejecting the frame
+                std::vector<std::vector<Eigen::Vector3d>> tools(SCENES);
+                std::vector<Eigen::Matrix4d> poses(SCENES);
+                std::vector<TestUtils::SyntheticScene> scenes(SCENES);
+                std::vector<PointDistanceMatrix> distances(SCENES);
+                std::vector<ToolSignatureIndex> indexes(SCENES);
+                for (int s = 0; s < SCENES; ++s)
+                {
+                    tools[s] = TestUtils::RandomToolGeometry(markers, rng);
+                    poses[s] = TestUtils::RandomPose(rng);
+                    const bool inView = markers <= blobs;
+                    scenes[s] = TestUtils::ScatterScene(inView ? std::vector<std::vector<Eigen::Vector3d>>{ tools[s] } : std::vector<std::vector<Eigen::Vector3d>>{},
+                        { poses[s] }, blobs, blobs / 20, 0.1, rng);
+                    distances[s].Compute(scenes[s].Points);
+                    indexes[s].AddTool(tools[s]);
+                    indexes[s].Finalise();
+                }
+
+                MatchScratch scratch;
+                ToolShortlist shortlist;
+                std::vector<int> indices;
+                int mismatches = 0;
+
+                const double getTime = MedianOverScenes(SCENES, [&](int s)
+                {
+                    const TestUtils::SyntheticScene& scene = scenes[s];
+                    std::vector<Eigen::Vector3d> kept;
+                    std::vector<int> keptIndex;
+                    for (size_t i = 0; i < scene.Points.size(); ++i)
+                        if (!scene.Excluded[i]) { kept.push_back(scene.Points[i]); keptIndex.push_back(static_cast<int>(i)); }
+
+                    std::vector<std::vector<int>> candidates;
+                    bool found = false;
+                    const double time = TestUtils::MedianMicroseconds([&]
+                    {
+                        std::vector<Eigen::Vector3d> reference = tools[s], collected = kept;
+                        found = GetPointCorrespondence(reference, collected, candidates);
+                    }, REPEATS);
+
+                    // a full match from each has to agree, Get's indices are into the non-duplicate survivors
+                    const bool findFound = FindPointCorrespondence(tools[s], distances[s], scene.Excluded, indices, scratch, MatchMode::First);
+                    if (found != findFound) ++mismatches;
+                    else if (found)
+                    {
+                        std::vector<Eigen::Vector3d> collected = kept, reference = tools[s];
+                        GetPointCorrespondence(reference, collected, candidates);
+                        for (size_t m = 0; m < indices.size(); ++m)
+                            if (collected[candidates.front()[m]] != scene.Points[indices[m]]) { ++mismatches; break; }
+                    }
+                    return time;
+                });
+
+                const double findTime = MedianOverScenes(SCENES, [&](int s)
+                {
+                    return TestUtils::MedianMicroseconds([&]
+                    {
+                        FindPointCorrespondence(tools[s], distances[s], scenes[s].Excluded, indices, scratch, MatchMode::First);
+                    }, REPEATS);
+                });
+
+                const double shortlistTime = MedianOverScenes(SCENES, [&](int s)
+                {
+                    return TestUtils::MedianMicroseconds([&]
+                    {
+                        indexes[s].Query(distances[s], scenes[s].Excluded, shortlist);
+                        if (shortlist.IsCandidate(0))
+                            FindPointCorrespondence(tools[s], distances[s], scenes[s].Excluded, indices, scratch, MatchMode::First, shortlist.AllowedBlobs(0));
+                    }, REPEATS);
+                });
+
+                const double trackTime = MedianOverScenes(SCENES, [&](int s)
+                {
+                    std::vector<Eigen::Vector3d> predicted;
+                    for (const Eigen::Vector3d& marker : tools[s]) predicted.push_back(TestUtils::TransformPoint(poses[s], marker));
+                    return TestUtils::MedianMicroseconds([&]
+                    {
+                        TrackPointCorrespondence(tools[s], predicted, distances[s], scenes[s].Excluded, GATE_RADIUS, indices, scratch);
+                    }, REPEATS);
+                });
+
+                std::printf("%8d %6d %12.2f %12.2f %14.2f %12.2f %9.1fx %10d\n", markers, blobs, getTime, findTime, shortlistTime, trackTime,
+                    getTime / findTime, mismatches);
+            }
+        }
+    }
+}
+
+//! Usage: CorrespondenceMatcherBenchmark [seed]
+int main(int argc, char** argv)
+{
+    std::mt19937 rng(argc > 1 ? static_cast<unsigned>(std::atoi(argv[1])) : 1u);
+    BenchmarkMatching(rng);
+    return 0;
+}
@@ -0,0 +1,224 @@
+/**
+ * @file        CorrespondenceMatcherTests.cpp
+ * @brief       Checks \ref FindPointCorrespondence (MatchMode::First) picks exactly the match \ref GetPointCorrespondence
+ *              lists first, and that the tool shortlist and pose-predicted tracking never change what is found
+ * @author      Hisham Iqbal
+ * @copyright   &copy; Hisham Iqbal 2023
+ *
+ */
+
+#include "CorrespondenceMatcher.h"
+#include "SyntheticScenes.h"
+#include "TestUtils.h"
+
+using namespace CorrespondenceMatcher;
+using TestUtils::SyntheticScene;
+
+namespace
+{
+    constexpr double GATE_RADIUS = 0.02; // metres, TRACKING_GATE_RADIUS in Holo2IRTracker.cpp
+
+    std::uniform_int_distribution<int> Range(int low, int high) { return std::uniform_int_distribution<int>(low, high); }
+
+    //! GetPointCorrespondence's first candidate among the points not \p excluded (empty for none), as indices into \p points
+    bool ReferenceMatch(std::vector<Eigen::Vector3d> reference, const std::vector<Eigen::Vector3d>& points,
+        const std::vector<uint8_t>& excluded, std::vector<int>& outIndices)
+    {
+        std::vector<Eigen::Vector3d> kept;
+        std::vector<int> keptIndex;
+        for (size_t i = 0; i < points.size(); ++i)
+        {
+            if (!excluded.empty() && excluded[i]) continue;
+            kept.push_back(points[i]);
+            keptIndex.push_back(static_cast<int>(i));
+        }
+
+        std::vector<Eigen::Vector3d> collected = kept;
+        std::vector<std::vector<int>> candidates;
+        if (!GetPointCorrespondence(reference, collected, candidates)) return false;
+
+        // duplicates are erased from collected, so its indices count the survivors, which keep their order
+        std::vector<int> survivorIndex;
+        size_t k = 0;
+        for (const Eigen::Vector3d& point : collected)
+        {
+            while (kept[k] != point) ++k;
+            survivorIndex.push_back(keptIndex[k++]);
+        }
+
+        outIndices.clear();
+        for (const int index : candidates.front()) outIndices.push_back(survivorIndex[index]);
+        return true;
+    }
+
+    void CheckSameMatch(bool found, const std::vector<int>& indices, bool expectedFound, const std::vector<int>& expected, int scene)
+    {
+        if (CHECK(found == expectedFound) && (!found || CHECK(indices == expected))) return;
+        std::printf("  scene %d: found %d, expected %d\n", scene, found, expectedFound);
+    }
+
+    void TestMatchesGetPointCorrespondence()
+    {
+        std::printf("FindPointCorrespondence (MatchMode::First) against GetPointCorrespondence\n");
+        std::mt19937 rng(21);
+        MatchScratch scratch;
+        PointDistanceMatrix distances;
+        int matches = 0;
+
+        for (int scene = 0; scene < 400; ++scene)
+        {
+            const std::vector<Eigen::Vector3d> tool = TestUtils::RandomToolGeometry(Range(4, 8)(rng), rng);
+
+            // every fourth scene has no tool, so any match is made of stray blobs
+            const bool planted = scene % 4 != 0;
+            const SyntheticScene s = TestUtils::ScatterScene(planted ? std::vector<std::vector<Eigen::Vector3d>>{ tool } : std::vector<std::vector<Eigen::Vector3d>>{},
+                { TestUtils::RandomPose(rng) }, Range(5, 60)(rng), Range(0, 4)(rng), 0.1, rng);
+
+            std::vector<int> indices, expected;
+
+            // point-list overload, which sees every point
+            const bool expectedAll = ReferenceMatch(tool, s.Points, {}, expected);
+            const bool foundAll = FindPointCorrespondence(tool, s.Points, indices, scratch, MatchMode::First);
+            CheckSameMatch(foundAll, indices, expectedAll, expected, scene);
+
+            // distance matrix overload, leaving out the excluded points
+            distances.Compute(s.Points);
+            const bool expectedKept = ReferenceMatch(tool, s.Points, s.Excluded, expected);
+            const bool foundKept = FindPointCorrespondence(tool, distances, s.Excluded, indices, scratch, MatchMode::First);
+            CheckSameMatch(foundKept, indices, expectedKept, expected, scene);
+
+            const bool visible = planted && std::all_of(s.ToolIndices[0].begin(), s.ToolIndices[0].end(), [](int i) { return i >= 0; });
+            if (visible) CHECK(foundAll && foundKept);
+            matches += foundAll + foundKept;
+        }
+        std::printf("  %d of 800 searches matched\n", matches);
+    }
+
+    void TestShortlistKeepsMatches()
+    {
+        std::printf("ToolSignatureIndex shortlist against unseeded searches\n");
+        std::mt19937 rng(23);
+        MatchScratch scratch;
+        PointDistanceMatrix distances;
+        ToolShortlist shortlist;
+
+        std::vector<std::vector<Eigen::Vector3d>> catalogue;
+        ToolSignatureIndex index;
+        for (int t = 0; t < 6; ++t)
+        {
+            catalogue.push_back(TestUtils::RandomToolGeometry(4 + t % 5, rng));
+            CHECK(index.AddTool(catalogue.back()) == static_cast<size_t>(t));
+        }
+        index.Finalise();
+
+        size_t shortlisted = 0;
+        for (int scene = 0; scene < 300; ++scene)
+        {
+            // a few of the tools are in view, the rest have to be ruled out or at least not found
+            std::vector<int> inView;
+            std::vector<std::vector<Eigen::Vector3d>> planted;
+            std::vector<Eigen::Matrix4d> poses;
+            for (int t = 0; t < static_cast<int>(catalogue.size()); ++t)
+            {
+                if (Range(0, 2)(rng) != 0) continue;
+                inView.push_back(t);
+                planted.push_back(catalogue[t]);
+                poses.push_back(TestUtils::RandomPose(rng));
+            }
+            const SyntheticScene s = TestUtils::ScatterScene(planted, poses, Range(5, 100)(rng), Range(0, 4)(rng), 0.1, rng);
+
+            // alternate scenes run without exclusions, which Query and the search both take as an empty list
+            const std::vector<uint8_t> excluded = (scene % 2) ? s.Excluded : std::vector<uint8_t>();
+            distances.Compute(s.Points);
+            index.Query(distances, excluded, shortlist);
+            shortlisted += shortlist.Count;
+
+            for (size_t t = 0; t < catalogue.size(); ++t)
+            {
+                std::vector<int> plain, seeded;
+                const bool found = FindPointCorrespondence(catalogue[t], distances, excluded, plain, scratch, MatchMode::First);
+                if (!shortlist.IsCandidate(t))
+                {
+                    if (!CHECK(!found)) std::printf("  scene %d: tool %zu ruled out but matched\n", scene, t);
+                    continue;
+                }
+
+                const bool seededFound = FindPointCorrespondence(catalogue[t], distances, excluded, seeded, scratch, MatchMode::First, shortlist.AllowedBlobs(t));
+                CheckSameMatch(seededFound, seeded, found, plain, scene);
+            }
+
+            for (size_t p = 0; p < inView.size(); ++p)
+            {
+                const std::vector<int>& markers = s.ToolIndices[p];
+                const bool visible = excluded.empty() || std::all_of(markers.begin(), markers.end(), [](int i) { return i >= 0; });
+                if (visible) CHECK(shortlist.IsCandidate(inView[p]));
+            }
+        }
+        std::printf("  %zu of %zu tools shortlisted\n", shortlisted, 300 * catalogue.size());
+    }
+
+    //! \p pose nudged by about \p angle radians and \p shift metres, like a prediction that's slightly off
+    Eigen::Matrix4d Perturb(const Eigen::Matrix4d& pose, double angle, double shift, std::mt19937& rng)
+    {
+        std::normal_distribution<double> gaussian;
+        const Eigen::Vector3d axis = Eigen::Vector3d(gaussian(rng), gaussian(rng), gaussian(rng)).normalized();
+        const Eigen::Vector3d direction = Eigen::Vector3d(gaussian(rng), gaussian(rng), gaussian(rng)).normalized();
+
+        Eigen::Matrix4d perturbed = pose;
+        perturbed.block<3, 3>(0, 0) = Eigen::AngleAxisd(angle, axis).toRotationMatrix() * pose.block<3, 3>(0, 0);
+        perturbed.block<3, 1>(0, 3) += shift * direction;
+        return perturbed;
+    }
+
+    void TestTrackingFindsPlantedTool()
+    {
+        std::printf("TrackPointCorrespondence against the planted markers\n");
+        std::mt19937 rng(24);
+        MatchScratch scratch;
+        PointDistanceMatrix distances;
+        int tracked = 0;
+
+        for (int scene = 0; scene < 300; ++scene)
+        {
+            const std::vector<Eigen::Vector3d> tool = TestUtils::RandomToolGeometry(Range(4, 8)(rng), rng);
+            const Eigen::Matrix4d pose = TestUtils::RandomPose(rng);
+            const SyntheticScene s = TestUtils::ScatterScene({ tool }, { pose }, Range(8, 100)(rng), Range(0, 3)(rng), 0.05, rng);
+            distances.Compute(s.Points);
+
+            std::vector<Eigen::Vector3d> predicted;
+            for (const Eigen::Vector3d& marker : tool) predicted.push_back(TestUtils::TransformPoint(Perturb(pose, 0.01, 0.001, rng), marker));
+
+            // each marker has to land on the marker or one of its duplicates, whichever is nearer the prediction
+            std::vector<int> indices;
+            const bool visible = std::all_of(s.ToolIndices[0].begin(), s.ToolIndices[0].end(), [](int i) { return i >= 0; });
+            const bool found = TrackPointCorrespondence(tool, predicted, distances, s.Excluded, GATE_RADIUS, indices, scratch);
+            if (!CHECK(found == visible))
+            {
+                std::printf("  scene %d: tracked %d, all markers visible %d\n", scene, found, visible);
+                continue;
+            }
+            if (!found) continue;
+
+            ++tracked;
+            for (size_t m = 0; m < tool.size(); ++m)
+            {
+                CHECK(!s.Excluded[indices[m]]);
+                CHECK((s.Points[indices[m]] - TestUtils::TransformPoint(pose, tool[m])).norm() < 0.001);
+            }
+
+            // a prediction that's centimetres out can't be confirmed, and has to be left to the full search
+            std::vector<Eigen::Vector3d> farOff;
+            for (const Eigen::Vector3d& marker : tool) farOff.push_back(TestUtils::TransformPoint(Perturb(pose, 0.0, 0.05, rng), marker));
+            CHECK(!TrackPointCorrespondence(tool, farOff, distances, s.Excluded, GATE_RADIUS, indices, scratch));
+        }
+        std::printf("  %d of 300 tools tracked\n", tracked);
+    }
+}
+
+int main()
+{
+    TestMatchesGetPointCorrespondence();
+    TestShortlistKeepsMatches();
+    TestTrackingFindsPlantedTool();
+    return TestUtils::Report("CorrespondenceMatcherTests");
+}
@@ -0,0 +1,319 @@
+/**
+ * @file        FrontEndTests.cpp
+ * @brief       Checks the fused front-end kernels are bit-exact with the OpenCV chains they replaced, and the depth
+ *              gated kernels and coarse candidate search with a scalar reference, on every SIMD path's main loop and
+ *              scalar tail
+ * @author      Hisham Iqbal
+ * @copyright   &copy; Hisham Iqbal 2023
+ *
+ */
+
+#include "IRTrackerUtils.h"
+#include "TestUtils.h"
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <random>
+
+using namespace IRTrackerUtils::ImageProc;
+
+namespace
+{
+    // the 8-bit cut-off of the original front-end, RAW_AB_THRESHOLD_DEFAULT is (this + 1) << 2
+    constexpr double LEGACY_BINARY_THRESHOLD = 180;
+
+    const char* SimdPath()
+    {
+#if defined(_M_ARM64) || defined(__aarch64__)
+        return "NEON";
+#elif defined(__AVX2__)
+        return "AVX2";
+#elif defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+        return "SSE2";
+#else
+        return "scalar";
+#endif
+    }
+
+    //! The original front-end: shift a copy of the raw image in place, let convertTo saturate it, then threshold
+    void LegacyFrontEnd(const cv::Mat& raw, cv::Mat& out8Bit, cv::Mat& outMask)
+    {
+        cv::Mat shifted = raw.clone();
+        for (int y = 0; y < shifted.rows; ++y)
+            for (int x = 0; x < shifted.cols; ++x) shifted.at<uint16_t>(y, x) >>= 2;
+        shifted.convertTo(out8Bit, CV_8UC1);
+        cv::threshold(out8Bit, outMask, LEGACY_BINARY_THRESHOLD, 255, cv::THRESH_BINARY);
+    }
+
+    bool SameImage(const cv::Mat& a, const cv::Mat& b)
+    {
+        if (a.size() != b.size() || a.type() != b.type()) return false;
+        for (int y = 0; y < a.rows; ++y)
+            if (std::memcmp(a.ptr(y), b.ptr(y), a.cols * a.elemSize()) != 0) return false;
+        return true;
+    }
+
+    //! Raw AB values, weighted towards the ones that matter: either side of the cut-off (723/724) and of the
+    //! 8-bit saturation point (1020/1023/1024), invalid and maximum values, and the rest of the 16-bit range
+    void FillRaw(cv::Mat& raw, std::mt19937& rng)
+    {
+        const uint16_t edges[] = { 0, 1, 3, 4, 719, 720, 723, 724, 725, 727, 728, 1019, 1020, 1022, 1023, 1024, 1027,
+            1028, 4090, 4095, 16383, 32767, 32768, 65532, 65535 };
+        std::uniform_int_distribution<int> pick(0, 3), edge(0, static_cast<int>(std::size(edges)) - 1);
+        std::uniform_int_distribution<int> low(0, 1200), any(0, 65535);
+        for (int y = 0; y < raw.rows; ++y)
+        {
+            for (int x = 0; x < raw.cols; ++x)
+            {
+                const int kind = pick(rng);
+                raw.at<uint16_t>(y, x) = static_cast<uint16_t>(kind == 0 ? edges[edge(rng)] : kind == 1 ? any(rng) : low(rng));
+            }
+        }
+    }
+
+    void CheckAgainstLegacy(const cv::Mat& raw, const char* description)
+    {
+        cv::Mat legacy8Bit, legacyMask, fused8Bit, fusedMask, lut8Bit;
+        LegacyFrontEnd(raw, legacy8Bit, legacyMask);
+        RebalanceAndBinarise(raw, fused8Bit, fusedMask);
+        RebalanceImgAnd8Bit(raw, lut8Bit);
+
+        const bool same = CHECK(SameImage(fused8Bit, legacy8Bit)) & CHECK(SameImage(fusedMask, legacyMask)) & CHECK(SameImage(lut8Bit, legacy8Bit));
+        if (!same) std::printf("  %s, %d x %d\n", description, raw.cols, raw.rows);
+    }
+
+    void TestMatchesLegacyChain()
+    {
+        std::printf("RebalanceAndBinarise and RebalanceImgAnd8Bit against shift + convertTo + threshold (%s build)\n", SimdPath());
+        std::mt19937 rng(1);
+
+        // every width up to a few vectors, so each loop runs 0-2 times and the tail takes 0-31 pixels. Single rows
+        // are continuous and walked as one, taller images too, so their tail is rows x cols modulo the vector width
+        for (int width = 1; width <= 100; ++width)
+        {
+            for (const int height : { 1, 3 })
+            {
+                cv::Mat raw(height, width, CV_16UC1);
+                FillRaw(raw, rng);
+                CheckAgainstLegacy(raw, "continuous");
+            }
+        }
+
+        cv::Mat frame(512, 512, CV_16UC1);
+        FillRaw(frame, rng);
+        CheckAgainstLegacy(frame, "full frame");
+
+        // non-continuous views are walked row by row, so each row ends in its own tail
+        for (const cv::Rect roi : { cv::Rect(1, 2, 37, 5), cv::Rect(3, 0, 64, 9), cv::Rect(0, 7, 95, 4), cv::Rect(31, 100, 481, 50) })
+        {
+            CheckAgainstLegacy(frame(roi), "input ROI view");
+        }
+    }
+
+    void TestWritesIntoViews()
+    {
+        std::printf("RebalanceAndBinarise writing into ROI views of larger outputs\n");
+        std::mt19937 rng(2);
+        cv::Mat frame(64, 80, CV_16UC1);
+        FillRaw(frame, rng);
+
+        const cv::Rect roi(5, 3, 45, 20);
+        cv::Mat legacy8Bit, legacyMask;
+        LegacyFrontEnd(frame(roi), legacy8Bit, legacyMask);
+
+        // outputs already sized, so the fused kernel writes through the views and leaves the rest alone
+        cv::Mat out8Bit(frame.size(), CV_8UC1, cv::Scalar(77)), outMask(frame.size(), CV_8UC1, cv::Scalar(77));
+        cv::Mat view8Bit = out8Bit(roi), viewMask = outMask(roi);
+        RebalanceAndBinarise(frame(roi), view8Bit, viewMask);
+        CHECK(view8Bit.data == out8Bit(roi).data && viewMask.data == outMask(roi).data);
+        CHECK(SameImage(view8Bit, legacy8Bit));
+        CHECK(SameImage(viewMask, legacyMask));
+
+        int untouched = 0;
+        for (int y = 0; y < frame.rows; ++y)
+            for (int x = 0; x < frame.cols; ++x)
+                if (!roi.contains(cv::Point(x, y))) untouched += (out8Bit.at<uint8_t>(y, x) == 77) + (outMask.at<uint8_t>(y, x) == 77);
+        CHECK(untouched == 2 * (frame.rows * frame.cols - roi.area()));
+    }
+
+    //! Depths weighted towards either side of the gate's ends, holes, the invalid marker and the top of the range
+    void FillDepth(cv::Mat& depth, DepthGate gate, std::mt19937& rng)
+    {
+        const int edges[] = { 0, 1, gate.NearMM - 1, gate.NearMM, gate.NearMM + 1, gate.FarMM - 1, gate.FarMM, gate.FarMM + 1,
+            4089, 4090, 4091, 65534, 65535 };
+        std::uniform_int_distribution<int> pick(0, 2), edge(0, static_cast<int>(std::size(edges)) - 1), any(0, 65535), range(0, 5000);
+        for (int y = 0; y < depth.rows; ++y)
+        {
+            for (int x = 0; x < depth.cols; ++x)
+            {
+                const int kind = pick(rng);
+                depth.at<uint16_t>(y, x) = static_cast<uint16_t>(kind == 0 ? edges[edge(rng)] : kind == 1 ? any(rng) : range(rng));
+            }
+        }
+    }
+
+    //! Scalar reference for the gated masks: bright enough and, if the gate is on, with depth in [NearMM, FarMM]
+    cv::Mat ReferenceGatedMask(const cv::Mat& raw, uint16_t rawThreshold, const cv::Mat& depth, DepthGate gate)
+    {
+        cv::Mat mask(raw.size(), CV_8UC1);
+        for (int y = 0; y < raw.rows; ++y)
+        {
+            for (int x = 0; x < raw.cols; ++x)
+            {
+                const uint16_t d = depth.at<uint16_t>(y, x);
+                const bool inside = !gate.IsEnabled() || (d >= gate.NearMM && d <= gate.FarMM);
+                mask.at<uint8_t>(y, x) = (raw.at<uint16_t>(y, x) >= rawThreshold && inside) ? 255 : 0;
+            }
+        }
+        return mask;
+    }
+
+    //! Gates to try: typical, the whole valid range, everything, one millimetre wide, and two disabled ones
+    const DepthGate GATES[] = { { 200, 1500 }, { 0, 4090 }, { 0, 65535 }, { 999, 1000 }, { 800, 800 }, { 1500, 200 } };
+
+    void CheckGated(const cv::Mat& raw, const cv::Mat& depth, DepthGate gate, const char* description)
+    {
+        cv::Mat legacy8Bit, legacyMask, gated8Bit, gatedMask, rawMask;
+        LegacyFrontEnd(raw, legacy8Bit, legacyMask);
+        RebalanceAndBinarise(raw, gated8Bit, gatedMask, depth, gate);
+
+        // the 8-bit image is for display, so only the mask is gated
+        bool same = CHECK(SameImage(gated8Bit, legacy8Bit));
+        same &= CHECK(SameImage(gatedMask, ReferenceGatedMask(raw, RAW_AB_THRESHOLD_DEFAULT, depth, gate)));
+        for (const uint16_t threshold : { uint16_t(1), RAW_AB_THRESHOLD_DEFAULT, uint16_t(4000), uint16_t(65535) })
+        {
+            BinariseRaw(raw, rawMask, threshold, depth, gate);
+            same &= CHECK(SameImage(rawMask, ReferenceGatedMask(raw, threshold, depth, gate)));
+        }
+        if (!same) std::printf("  %s, %d x %d, gate [%d, %d]\n", description, raw.cols, raw.rows, gate.NearMM, gate.FarMM);
+    }
+
+    void TestGatedKernels()
+    {
+        std::printf("RebalanceAndBinarise and BinariseRaw with a depth gate against a scalar reference (%s build)\n", SimdPath());
+        std::mt19937 rng(15);
+
+        for (const DepthGate& gate : GATES)
+        {
+            for (int width = 1; width <= 100; ++width)
+            {
+                for (const int height : { 1, 3 })
+                {
+                    cv::Mat raw(height, width, CV_16UC1), depth(height, width, CV_16UC1);
+                    FillRaw(raw, rng);
+                    FillDepth(depth, gate, rng);
+                    CheckGated(raw, depth, gate, "continuous");
+                }
+            }
+
+            cv::Mat frame(512, 512, CV_16UC1), depth(512, 512, CV_16UC1);
+            FillRaw(frame, rng);
+            FillDepth(depth, gate, rng);
+            CheckGated(frame, depth, gate, "full frame");
+            for (const cv::Rect roi : { cv::Rect(1, 2, 37, 5), cv::Rect(31, 100, 481, 50) })
+            {
+                CheckGated(frame(roi), depth(roi), gate, "ROI view");
+            }
+
+            // the strip-parallel front-end gates the same way
+            cv::Mat parallel8Bit, parallelMask;
+            std::vector<cv::Point2f> blobs;
+            DetectBlobs2DParallel(frame, parallel8Bit, parallelMask, BlobDetectionMethod::ConnectedComponents, 4, blobs, depth, gate);
+            CHECK(SameImage(parallelMask, ReferenceGatedMask(frame, RAW_AB_THRESHOLD_DEFAULT, depth, gate)));
+        }
+
+        // a depth image that doesn't match the AB image can't be used, so the gate is ignored rather than misread
+        cv::Mat raw(20, 40, CV_16UC1), mask;
+        FillRaw(raw, rng);
+        BinariseRaw(raw, mask, RAW_AB_THRESHOLD_DEFAULT, cv::Mat(20, 39, CV_16UC1, cv::Scalar(0)), GATES[0]);
+        CHECK(SameImage(mask, ReferenceGatedMask(raw, RAW_AB_THRESHOLD_DEFAULT, raw, DepthGate())));
+    }
+
+    void TestCandidateROIsRespectGate()
+    {
+        std::printf("FindCandidateROIs with a depth gate against a scalar reference\n");
+        std::mt19937 rng(16);
+        std::uniform_int_distribution<int> coordinate(0, 511), dim(0, 300), bright(724, 4000);
+        std::vector<cv::Rect> rois;
+
+        for (int frame = 0; frame < 30; ++frame)
+        {
+            const DepthGate gate = GATES[frame % std::size(GATES)];
+            const int poolFactor = 1 + frame % 4;
+
+            // dim background with a few bright pixels scattered over random depths
+            cv::Mat raw(512, 512, CV_16UC1), depth(512, 512, CV_16UC1);
+            for (int y = 0; y < raw.rows; ++y)
+                for (int x = 0; x < raw.cols; ++x) raw.at<uint16_t>(y, x) = static_cast<uint16_t>(dim(rng));
+            for (int i = 0; i < 60; ++i) raw.at<uint16_t>(coordinate(rng), coordinate(rng)) = static_cast<uint16_t>(bright(rng));
+            FillDepth(depth, gate, rng);
+
+            const cv::Mat reference = ReferenceGatedMask(raw, RAW_AB_THRESHOLD_DEFAULT, depth, gate);
+            FindCandidateROIs(raw, poolFactor, rois, depth, gate);
+
+            // every pixel that passes is covered once, and every window holds at least one of them
+            cv::Mat coverage(raw.size(), CV_8UC1, cv::Scalar(0));
+            int empty = 0;
+            for (const cv::Rect& roi : rois)
+            {
+                bool any = false;
+                for (int y = roi.y; y < roi.y + roi.height; ++y)
+                {
+                    for (int x = roi.x; x < roi.x + roi.width; ++x)
+                    {
+                        ++coverage.at<uint8_t>(y, x);
+                        any |= reference.at<uint8_t>(y, x) != 0;
+                    }
+                }
+                if (!any) ++empty;
+            }
+            int uncovered = 0, overlapping = 0;
+            for (int y = 0; y < raw.rows; ++y)
+            {
+                for (int x = 0; x < raw.cols; ++x)
+                {
+                    if (coverage.at<uint8_t>(y, x) > 1) ++overlapping;
+                    if (reference.at<uint8_t>(y, x) && coverage.at<uint8_t>(y, x) == 0) ++uncovered;
+                }
+            }
+            CHECK(uncovered == 0 && overlapping == 0 && empty == 0);
+        }
+
+        // bright pixels all outside the working volume give no candidates, however bright
+        cv::Mat raw(512, 512, CV_16UC1, cv::Scalar(100)), depth(512, 512, CV_16UC1, cv::Scalar(1000));
+        const DepthGate gate = { 200, 1500 };
+        raw(cv::Rect(100, 100, 6, 6)).setTo(cv::Scalar(65535));
+        depth(cv::Rect(100, 100, 6, 6)).setTo(cv::Scalar(gate.FarMM + 1));
+        raw(cv::Rect(300, 50, 6, 6)).setTo(cv::Scalar(3000));
+        depth(cv::Rect(300, 50, 6, 6)).setTo(cv::Scalar(gate.NearMM - 1));
+        raw(cv::Rect(50, 400, 4, 4)).setTo(cv::Scalar(3000));
+        depth(cv::Rect(50, 400, 4, 4)).setTo(cv::Scalar(0));
+        raw(cv::Rect(400, 400, 4, 4)).setTo(cv::Scalar(3000));
+        depth(cv::Rect(400, 400, 4, 4)).setTo(cv::Scalar(4090));
+        FindCandidateROIs(raw, 4, rois, depth, gate);
+        CHECK(rois.empty());
+
+        // while the ungated search finds all four, and the histogram is the same either way
+        ABHistogram gatedHistogram, ungatedHistogram;
+        FindCandidateROIs(raw, 4, rois, depth, gate, RAW_AB_THRESHOLD_DEFAULT, &gatedHistogram);
+        FindCandidateROIs(raw, 4, rois, depth, DepthGate(), RAW_AB_THRESHOLD_DEFAULT, &ungatedHistogram);
+        CHECK(rois.size() == 4);
+        CHECK(gatedHistogram.Total == ungatedHistogram.Total && std::equal(std::begin(gatedHistogram.Counts), std::end(gatedHistogram.Counts),
+            std::begin(ungatedHistogram.Counts)));
+
+        // one pixel of the marker back in range is enough to keep its window
+        depth.at<uint16_t>(103, 104) = gate.FarMM;
+        FindCandidateROIs(raw, 4, rois, depth, gate);
+        CHECK(rois.size() == 1 && rois.front().contains(cv::Point(104, 103)));
+    }
+}
+
+int main()
+{
+    TestMatchesLegacyChain();
+    TestWritesIntoViews();
+    TestGatedKernels();
+    TestCandidateROIsRespectGate();
+    return TestUtils::Report("FrontEndTests");
+}
@@ -0,0 +1,69 @@
+/**
+ * @file        ParallelDetectionBenchmark.cpp
+ * @brief       Thread scaling of the strip-split front-end and detection (\ref DetectBlobs2DParallel) from 1 to N strips,
+ *              against the serial fused front-end followed by \ref DetectBlobs2D
+ * @author      Hisham Iqbal
+ * @copyright   &copy; Hisham Iqbal 2023
+ *
+ */
+
+#include "IRTrackerUtils.h"
+#include "SyntheticFrames.h"
+#include "TestUtils.h"
+#include <algorithm>
+#include <cstdlib>
+#include <thread>
+
+using namespace IRTrackerUtils::ImageProc;
+
+namespace
+{
+    constexpr int REPEATS = 200;
+    const cv::Size IMAGE_SIZE(512, 512);
+
+    void BenchmarkScaling(int maxStrips, std::mt19937& rng)
+    {
+        // strips run on OpenCV's worker pool, which is left at its default size (all cores)
+        std::printf("Raw AB frame -> blob centres (median of %d runs, OpenCV pool of %d threads)\n", REPEATS, cv::getNumThreads());
+
+        const std::pair<BlobDetectionMethod, const char*> methods[] = {
+            { BlobDetectionMethod::ConnectedComponents, "ConnectedComponents" },
+            { BlobDetectionMethod::IntensityWeighted, "IntensityWeighted" } };
+
+        for (const auto& method : methods)
+        {
+            for (const int count : { 20, 100 })
+            {
+                cv::Mat raw, image8bit, mask;
+                TestUtils::RenderRawAB(TestUtils::ScatterBlobs(count, 2.0f, 8.0f, IMAGE_SIZE, rng), IMAGE_SIZE, rng, raw);
+
+                std::vector<cv::Point2f> centres;
+                const double serialTime = TestUtils::MedianMicroseconds([&]
+                {
+                    RebalanceAndBinarise(raw, image8bit, mask);
+                    DetectBlobs2D(mask, method.first, centres, true, raw);
+                }, REPEATS);
+
+                std::printf("\n%s, %d blobs: serial %.1f us\n", method.second, count, serialTime);
+                std::printf("%8s %10s %10s %10s\n", "strips", "time [us]", "speed-up", "found");
+                for (int strips = 1; strips <= maxStrips; ++strips)
+                {
+                    const double time = TestUtils::MedianMicroseconds([&]
+                    {
+                        DetectBlobs2DParallel(raw, image8bit, mask, method.first, strips, centres);
+                    }, REPEATS);
+                    std::printf("%8d %10.1f %9.2fx %10zu\n", strips, time, serialTime / time, centres.size());
+                }
+            }
+        }
+    }
+}
+
+//! Usage: ParallelDetectionBenchmark [max strips (default: hardware threads)] [seed]
+int main(int argc, char** argv)
+{
+    const int maxStrips = argc > 1 ? std::atoi(argv[1]) : static_cast<int>(std::max(std::thread::hardware_concurrency(), 1u));
+    std::mt19937 rng(argc > 2 ? static_cast<unsigned>(std::atoi(argv[2])) : 1u);
+    BenchmarkScaling(std::max(maxStrips, 1), rng);
+    return 0;
+}
@@ -0,0 +1,213 @@
+/**
+ * @file        ParallelDetectionTests.cpp
+ * @brief       Checks that the strip-split labeller and detectors give exactly the serial results for any strip count,
+ *              and that the raw 16-bit front-end finds exactly what the 8-bit one does, with and without a depth gate
+ * @author      Hisham Iqbal
+ * @copyright   &copy; Hisham Iqbal 2023
+ *
+ */
+
+#include "IRTrackerUtils.h"
+#include "SyntheticFrames.h"
+#include "TestUtils.h"
+#include <cstring>
+
+using namespace IRTrackerUtils::ImageProc;
+
+namespace
+{
+    bool SameComponent(const BlobComponent& a, const BlobComponent& b)
+    {
+        return a.PixelCount == b.PixelCount && a.PixelSumX == b.PixelSumX && a.PixelSumY == b.PixelSumY &&
+            a.MinX == b.MinX && a.MinY == b.MinY && a.MaxX == b.MaxX && a.MaxY == b.MaxY &&
+            a.ContourArea2 == b.ContourArea2 && a.ContourM10x6 == b.ContourM10x6 && a.ContourM01x6 == b.ContourM01x6 &&
+            a.PerimeterStraight == b.PerimeterStraight && a.PerimeterDiagonal == b.PerimeterDiagonal &&
+            a.PeakX == b.PeakX && a.PeakY == b.PeakY && a.PeakValue == b.PeakValue;
+    }
+
+    //! Every strip count from 1 to 17, plus the ones around the row count (strips of a single row, and clamping)
+    void CheckAllStripCounts(const cv::Mat& mask, const cv::Mat& peakImage = cv::Mat())
+    {
+        std::vector<BlobComponent> serial, parallel;
+        LabelBlobComponents(mask, serial, peakImage);
+
+        std::vector<int> stripCounts;
+        for (int strips = 1; strips <= 17; ++strips) stripCounts.push_back(strips);
+        for (const int strips : { mask.rows - 1, mask.rows, mask.rows + 5 }) if (strips > 0) stripCounts.push_back(strips);
+
+        for (const int strips : stripCounts)
+        {
+            LabelBlobComponentsParallel(mask, strips, parallel, nullptr, peakImage);
+            if (!CHECK(parallel.size() == serial.size()))
+            {
+                std::printf("  %d x %d mask, %d strips: %zu components, serial %zu\n", mask.cols, mask.rows, strips, parallel.size(), serial.size());
+                continue;
+            }
+            for (size_t i = 0; i < serial.size(); ++i) CHECK(SameComponent(parallel[i], serial[i]));
+        }
+    }
+
+    void TestLabellerStripCounts()
+    {
+        std::printf("labeller, 1-17 strips and single-row strips\n");
+        std::mt19937 rng(5);
+
+        for (int frame = 0; frame < 5; ++frame)
+        {
+            cv::Mat mask;
+            TestUtils::DrawBinaryDiscs(TestUtils::ScatterBlobs(60, 0.5f, 20.0f, cv::Size(512, 512), rng), cv::Size(512, 512), mask);
+            CheckAllStripCounts(mask);
+        }
+
+        // ragged components of every shape, including odd sizes so strips differ in height. Peaks are tracked on a
+        // few grey levels, so ties are common and have to be broken the same way whichever strip a pixel is in
+        std::uniform_int_distribution<int> level(0, 3);
+        for (const cv::Size size : { cv::Size(256, 256), cv::Size(53, 37), cv::Size(17, 1), cv::Size(1, 29) })
+        {
+            for (const double density : { 0.05, 0.3, 0.6 })
+            {
+                cv::Mat mask, levels(size, CV_8UC1);
+                TestUtils::DrawNoiseMask(size, density, rng, mask);
+                for (int y = 0; y < size.height; ++y)
+                    for (int x = 0; x < size.width; ++x) levels.at<uint8_t>(y, x) = static_cast<uint8_t>(level(rng));
+                CheckAllStripCounts(mask);
+                CheckAllStripCounts(mask, levels);
+            }
+        }
+
+        // shapes crossing every seam: full-height lines, a zig-zag and a frame with a hole
+        cv::Mat shapes(61, 80, CV_8UC1, cv::Scalar(0));
+        for (int y = 0; y < shapes.rows; ++y)
+        {
+            shapes.at<uint8_t>(y, 3) = 255;
+            shapes.at<uint8_t>(y, 10 + (y / 4) % 2) = 255;
+            shapes.at<uint8_t>(y, 20 + y % 7) = 255;
+        }
+        shapes(cv::Rect(40, 5, 30, 50)).setTo(cv::Scalar(255));
+        shapes(cv::Rect(45, 10, 20, 40)).setTo(cv::Scalar(0));
+        CheckAllStripCounts(shapes);
+
+        // ROI view whose rows aren't contiguous
+        CheckAllStripCounts(shapes(cv::Rect(2, 7, 60, 41)));
+    }
+
+    void CheckSameDetections(const std::vector<cv::Point2f>& centres, const std::vector<float>& areas,
+        const std::vector<cv::Point2f>& serialCentres, const std::vector<float>& serialAreas)
+    {
+        if (!CHECK(centres.size() == serialCentres.size() && areas.size() == serialAreas.size())) return;
+        for (size_t i = 0; i < centres.size(); ++i)
+        {
+            CHECK(centres[i] == serialCentres[i]);
+            CHECK(areas[i] == serialAreas[i]);
+        }
+    }
+
+    void TestDetectorsMatchSerial()
+    {
+        std::printf("DetectBlobs2DParallel and DetectBlobs2DRaw against the serial path\n");
+        std::mt19937 rng(6);
+        const cv::Size size(512, 512);
+
+        for (int frame = 0; frame < 3; ++frame)
+        {
+            cv::Mat raw;
+            TestUtils::RenderRawAB(TestUtils::ScatterBlobs(50, 1.5f, 15.0f, size, rng), size, rng, raw);
+
+            for (const BlobDetectionMethod method : { BlobDetectionMethod::ConnectedComponents, BlobDetectionMethod::IntensityWeighted,
+                BlobDetectionMethod::BlobPeak })
+            {
+                cv::Mat image8bit, mask;
+                std::vector<cv::Point2f> serialCentres, centres;
+                std::vector<float> serialAreas, areas;
+                RebalanceAndBinarise(raw, image8bit, mask);
+                DetectBlobs2D(mask, method, serialCentres, true, raw, &serialAreas);
+                CHECK(!serialCentres.empty());
+
+                std::vector<cv::Point2f> rawSerialCentres;
+                std::vector<float> rawSerialAreas;
+                DetectBlobs2DRaw(raw, mask, method, 1, rawSerialCentres, RAW_AB_THRESHOLD_DEFAULT, cv::Mat(), DepthGate(), &rawSerialAreas);
+
+                for (int strips = 1; strips <= 9; ++strips)
+                {
+                    DetectBlobs2DParallel(raw, image8bit, mask, method, strips, centres, cv::Mat(), DepthGate(), &areas);
+                    CheckSameDetections(centres, areas, serialCentres, serialAreas);
+
+                    DetectBlobs2DRaw(raw, mask, method, strips, centres, RAW_AB_THRESHOLD_DEFAULT, cv::Mat(), DepthGate(), &areas);
+                    CheckSameDetections(centres, areas, rawSerialCentres, rawSerialAreas);
+                }
+            }
+        }
+    }
+
+    bool SameMask(const cv::Mat& a, const cv::Mat& b)
+    {
+        if (a.size() != b.size() || a.type() != b.type()) return false;
+        for (int y = 0; y < a.rows; ++y)
+            if (std::memcmp(a.ptr(y), b.ptr(y), a.cols * a.elemSize()) != 0) return false;
+        return true;
+    }
+
+    //! A rendered frame, or uniform noise over the whole raw range so every pixel value meets the threshold somewhere
+    cv::Mat RandomRawFrame(int frame, std::mt19937& rng)
+    {
+        const cv::Size size(512, 512);
+        cv::Mat raw;
+        if (frame % 2 == 0)
+        {
+            TestUtils::RenderRawAB(TestUtils::ScatterBlobs(60, 0.5f, 12.0f, size, rng), size, rng, raw);
+            return raw;
+        }
+        std::uniform_int_distribution<int> value(0, 65535), dim(0, 1500), pick(0, 3);
+        raw.create(size, CV_16UC1);
+        for (int y = 0; y < size.height; ++y)
+            for (int x = 0; x < size.width; ++x) raw.at<uint16_t>(y, x) = static_cast<uint16_t>(pick(rng) ? dim(rng) : value(rng));
+        return raw;
+    }
+
+    void TestRawMatches8Bit()
+    {
+        std::printf("DetectBlobs2DRaw and BinariseRaw against the 8-bit front-end, gated and ungated\n");
+        std::mt19937 rng(18);
+        std::uniform_int_distribution<int> depthValue(0, 5000);
+
+        for (int frame = 0; frame < 6; ++frame)
+        {
+            const cv::Mat raw = RandomRawFrame(frame, rng);
+            cv::Mat depth(raw.size(), CV_16UC1);
+            for (int y = 0; y < depth.rows; ++y)
+                for (int x = 0; x < depth.cols; ++x) depth.at<uint16_t>(y, x) = static_cast<uint16_t>(depthValue(rng));
+
+            for (const DepthGate gate : { DepthGate(), DepthGate{ 200, 1500 }, DepthGate{ 0, 4090 } })
+            {
+                // the default raw cut-off picks exactly the pixels the 8-bit threshold does
+                cv::Mat image8bit, mask, rawMask;
+                RebalanceAndBinarise(raw, image8bit, mask, depth, gate);
+                BinariseRaw(raw, rawMask, RAW_AB_THRESHOLD_DEFAULT, depth, gate);
+                if (!CHECK(SameMask(mask, rawMask))) std::printf("  frame %d, gate [%d, %d]\n", frame, gate.NearMM, gate.FarMM);
+
+                for (const BlobDetectionMethod method : { BlobDetectionMethod::ConnectedComponents, BlobDetectionMethod::IntensityWeighted,
+                    BlobDetectionMethod::BlobPeak })
+                {
+                    for (const int strips : { 1, 4 })
+                    {
+                        cv::Mat parallel8bit, parallelMask;
+                        std::vector<cv::Point2f> centres, rawCentres;
+                        std::vector<float> areas, rawAreas;
+                        DetectBlobs2DParallel(raw, parallel8bit, parallelMask, method, strips, centres, depth, gate, &areas);
+                        DetectBlobs2DRaw(raw, rawMask, method, strips, rawCentres, RAW_AB_THRESHOLD_DEFAULT, depth, gate, &rawAreas);
+                        CHECK(SameMask(parallelMask, rawMask));
+                        CheckSameDetections(rawCentres, rawAreas, centres, areas);
+                    }
+                }
+            }
+        }
+    }
+}
+
+int main()
+{
+    TestLabellerStripCounts();
+    TestDetectorsMatchSerial();
+    TestRawMatches8Bit();
+    return TestUtils::Report("ParallelDetectionTests");
+}
@@ -0,0 +1,226 @@
+/**
+ * @file        PosePredictorTests.cpp
+ * @brief       Checks \ref IRTrackerUtils::PosePredictor on synthetic trajectories, and its restarts and edge cases
+ * @author      Hisham Iqbal
+ * @copyright   &copy; Hisham Iqbal 2023
+ *
+ */
+
+#include "PosePredictor.h"
+#include "TestUtils.h"
+#include <functional>
+#include <random>
+
+using IRTrackerUtils::PosePredictor;
+
+namespace
+{
+    constexpr double TICKS_PER_SECOND = 1e7;    // 100 ns host ticks, as SensorFrame::Timestamp
+    constexpr uint64_t FRAME_TICKS = 222222;    // 45 Hz, the AHAT frame rate
+    constexpr uint64_t START_TICKS = 1000000000;
+
+    typedef std::function<Eigen::Matrix4d(double)> Trajectory;
+
+    double Seconds(uint64_t ticks) { return static_cast<double>(ticks - START_TICKS) / TICKS_PER_SECOND; }
+
+    Eigen::Matrix4d MakePose(const Eigen::Matrix3d& rotation, const Eigen::Vector3d& position)
+    {
+        Eigen::Matrix4d pose = Eigen::Matrix4d::Identity();
+        pose.topLeftCorner<3, 3>() = rotation;
+        pose.topRightCorner<3, 1>() = position;
+        return pose;
+    }
+
+    double PositionError(const Eigen::Matrix4d& a, const Eigen::Matrix4d& b)
+    {
+        return (a.topRightCorner<3, 1>() - b.topRightCorner<3, 1>()).norm();
+    }
+
+    double RotationError(const Eigen::Matrix4d& a, const Eigen::Matrix4d& b)
+    {
+        const Eigen::Matrix3d difference = a.topLeftCorner<3, 3>() * b.topLeftCorner<3, 3>().transpose();
+        return Eigen::AngleAxisd(difference).angle();
+    }
+
+    //! \p pose with zero-mean gaussian noise of \p positionSigma metres and \p rotationSigma radians per axis
+    Eigen::Matrix4d AddNoise(const Eigen::Matrix4d& pose, double positionSigma, double rotationSigma, std::mt19937& rng)
+    {
+        std::normal_distribution<double> gaussian;
+        const Eigen::Vector3d rotationVector = rotationSigma * Eigen::Vector3d(gaussian(rng), gaussian(rng), gaussian(rng));
+        const Eigen::Vector3d offset = positionSigma * Eigen::Vector3d(gaussian(rng), gaussian(rng), gaussian(rng));
+
+        Eigen::Matrix3d rotation = Eigen::Matrix3d::Identity();
+        if (rotationVector.norm() > 0.0) rotation = Eigen::AngleAxisd(rotationVector.norm(), rotationVector.normalized()).toRotationMatrix();
+        return MakePose(rotation * pose.topLeftCorner<3, 3>(), pose.topRightCorner<3, 1>() + offset);
+    }
+
+    //! Feeds \p frames poses of \p trajectory at 45 Hz, returns the timestamp of the last
+    uint64_t Follow(PosePredictor& predictor, const Trajectory& trajectory, int frames, double positionSigma, double rotationSigma, std::mt19937& rng)
+    {
+        uint64_t timestamp = START_TICKS;
+        for (int f = 0; f < frames; ++f)
+        {
+            timestamp = START_TICKS + f * FRAME_TICKS;
+            predictor.Update(AddNoise(trajectory(Seconds(timestamp)), positionSigma, rotationSigma, rng), timestamp);
+        }
+        return timestamp;
+    }
+
+    //! Worst error of one-frame-ahead predictions over the second half of \p frames updates, where the filter has settled
+    void CheckOneFrameAhead(const char* name, const Trajectory& trajectory, int frames, double positionSigma, double rotationSigma,
+        double maxPositionError, double maxRotationError)
+    {
+        std::mt19937 rng(25);
+        PosePredictor predictor;
+        double worstPosition = 0.0, worstRotation = 0.0, worstHoldPosition = 0.0;
+
+        for (int f = 0; f < frames; ++f)
+        {
+            const uint64_t timestamp = START_TICKS + f * FRAME_TICKS;
+            const Eigen::Matrix4d measured = AddNoise(trajectory(Seconds(timestamp)), positionSigma, rotationSigma, rng);
+            predictor.Update(measured, timestamp);
+            if (f < frames / 2) continue;
+
+            Eigen::Matrix4d predicted;
+            const Eigen::Matrix4d truth = trajectory(Seconds(timestamp + FRAME_TICKS));
+            CHECK(predictor.Predict(timestamp + FRAME_TICKS, predicted));
+            worstPosition = std::max(worstPosition, PositionError(predicted, truth));
+            worstRotation = std::max(worstRotation, RotationError(predicted, truth));
+            worstHoldPosition = std::max(worstHoldPosition, PositionError(measured, truth));
+        }
+
+        std::printf("  %-28s worst %.3f mm, %.4f rad (holding the last pose: %.3f mm)\n", name, worstPosition * 1000.0, worstRotation, worstHoldPosition * 1000.0);
+        CHECK(worstPosition < maxPositionError);
+        CHECK(worstRotation < maxRotationError);
+        CHECK(worstPosition < worstHoldPosition);
+    }
+
+    void TestTrajectories()
+    {
+        std::printf("one-frame-ahead predictions on synthetic trajectories\n");
+
+        // 0.3 m/s in a straight line while turning at 1.5 rad/s about a fixed axis
+        const Eigen::Vector3d start(0.05, -0.1, 0.5), velocity(0.2, 0.1, -0.2);
+        const Eigen::Vector3d spinAxis = Eigen::Vector3d(1.0, 2.0, 2.0).normalized();
+        const Trajectory linear = [=](double t)
+        {
+            return MakePose(Eigen::AngleAxisd(1.5 * t, spinAxis).toRotationMatrix(), start + velocity * t);
+        };
+        CheckOneFrameAhead("linear, noise free", linear, 90, 0.0, 0.0, 1e-5, 1e-5);
+        CheckOneFrameAhead("linear, measurement noise", linear, 90, 0.0005, 0.005, 0.005, 0.04);
+
+        // 0.1 m radius at 2 rad/s, facing along the path, which the constant-velocity model can only follow with a lag
+        const Trajectory circular = [](double t)
+        {
+            const double angle = 2.0 * t;
+            return MakePose(Eigen::AngleAxisd(angle, Eigen::Vector3d::UnitZ()).toRotationMatrix(),
+                Eigen::Vector3d(0.1 * std::cos(angle), 0.1 * std::sin(angle), 0.6));
+        };
+        CheckOneFrameAhead("circular, noise free", circular, 90, 0.0, 0.0, 0.0005, 1e-5);
+        CheckOneFrameAhead("circular, measurement noise", circular, 90, 0.0005, 0.005, 0.005, 0.04);
+    }
+
+    void TestPredictBeforeUpdate()
+    {
+        std::printf("Predict before the first update\n");
+        PosePredictor predictor;
+        Eigen::Matrix4d pose = Eigen::Matrix4d::Constant(7.0);
+        PosePredictor::Matrix6d covariance = PosePredictor::Matrix6d::Constant(7.0);
+
+        CHECK(!predictor.IsInitialised());
+        CHECK(!predictor.Predict(START_TICKS, pose, &covariance));
+        CHECK(pose == Eigen::Matrix4d::Constant(7.0));
+        CHECK(covariance == PosePredictor::Matrix6d::Constant(7.0));
+
+        // a reset puts it back to the same state
+        predictor.Update(Eigen::Matrix4d::Identity(), START_TICKS);
+        CHECK(predictor.Predict(START_TICKS, pose));
+        predictor.Reset();
+        CHECK(!predictor.Predict(START_TICKS, pose));
+    }
+
+    //! Checks \p predictor was restarted from \p pose at \p timestamp, i.e. it holds that pose at rest
+    void CheckRestartedAt(const PosePredictor& predictor, const Eigen::Matrix4d& pose, uint64_t timestamp)
+    {
+        Eigen::Matrix4d predicted;
+        CHECK(predictor.GetLastTimestamp() == timestamp);
+        CHECK(predictor.GetLinearVelocity().isZero());
+        CHECK(predictor.GetAngularVelocity().isZero());
+        CHECK(predictor.Predict(timestamp + 2 * FRAME_TICKS, predicted));
+        CHECK(predicted.isApprox(pose));
+    }
+
+    void TestRestarts()
+    {
+        std::printf("restarts after a gap and on timestamps that don't move forward\n");
+        std::mt19937 rng(26);
+        const Trajectory sliding = [](double t)
+        {
+            return MakePose(Eigen::AngleAxisd(t, Eigen::Vector3d::UnitY()).toRotationMatrix(), Eigen::Vector3d(0.3 * t, 0.0, 0.5));
+        };
+        const Eigen::Matrix4d elsewhere = MakePose(Eigen::AngleAxisd(2.0, Eigen::Vector3d::UnitX()).toRotationMatrix(), Eigen::Vector3d(-0.2, 0.1, 0.4));
+
+        PosePredictor predictor;
+        const uint64_t resetTicks = static_cast<uint64_t>(predictor.GetSettings().ResetAfterSeconds * TICKS_PER_SECOND);
+
+        // a gap just inside ResetAfterSeconds keeps the motion, one just outside drops it
+        uint64_t last = Follow(predictor, sliding, 30, 0.0, 0.0, rng);
+        CHECK_NEAR(predictor.GetLinearVelocity().x(), 0.3, 0.01);
+        predictor.Update(sliding(Seconds(last + resetTicks - FRAME_TICKS)), last + resetTicks - FRAME_TICKS);
+        CHECK_NEAR(predictor.GetLinearVelocity().x(), 0.3, 0.01);
+
+        last = Follow(predictor, sliding, 30, 0.0, 0.0, rng);
+        predictor.Update(elsewhere, last + resetTicks + FRAME_TICKS);
+        CheckRestartedAt(predictor, elsewhere, last + resetTicks + FRAME_TICKS);
+
+        // the same timestamp again, and one from before the last update
+        last = Follow(predictor, sliding, 30, 0.0, 0.0, rng);
+        predictor.Update(elsewhere, last);
+        CheckRestartedAt(predictor, elsewhere, last);
+
+        last = Follow(predictor, sliding, 30, 0.0, 0.0, rng);
+        predictor.Update(elsewhere, last - 5 * FRAME_TICKS);
+        CheckRestartedAt(predictor, elsewhere, last - 5 * FRAME_TICKS);
+    }
+
+    void TestRotationThroughPi()
+    {
+        std::printf("rotation residuals across +-pi\n");
+
+        // spinning at 3 rad/s about a fixed axis from 2.5 rad, so the orientation's own angle passes pi (where its
+        // angle-axis flips sign) within the first few frames and the filter has to carry straight on through it
+        const Eigen::Vector3d axis = Eigen::Vector3d(0.0, 1.0, 1.0).normalized();
+        const Trajectory spinning = [=](double t)
+        {
+            return MakePose(Eigen::AngleAxisd(2.5 + 3.0 * t, axis).toRotationMatrix(), Eigen::Vector3d(0.0, 0.0, 0.5));
+        };
+
+        std::mt19937 rng(27);
+        PosePredictor predictor;
+        const uint64_t last = Follow(predictor, spinning, 20, 0.0, 0.0, rng);
+        CHECK((predictor.GetAngularVelocity() - 3.0 * axis).norm() < 1e-3);
+
+        Eigen::Matrix4d predicted;
+        CHECK(predictor.Predict(last + FRAME_TICKS, predicted));
+        CHECK(RotationError(predicted, spinning(Seconds(last + FRAME_TICKS))) < 1e-5);
+
+        // a measurement just short of pi away from the estimate is still pulled towards the short way round
+        const Eigen::Matrix4d held = MakePose(Eigen::Matrix3d::Identity(), Eigen::Vector3d(0.0, 0.0, 0.5));
+        const Eigen::Matrix4d flipped = MakePose(Eigen::AngleAxisd(3.1, Eigen::Vector3d::UnitZ()).toRotationMatrix(), Eigen::Vector3d(0.0, 0.0, 0.5));
+        PosePredictor jumping;
+        jumping.Update(held, START_TICKS);
+        jumping.Update(flipped, START_TICKS + FRAME_TICKS);
+        CHECK(jumping.Predict(START_TICKS + FRAME_TICKS, predicted));
+        CHECK(RotationError(predicted, flipped) < RotationError(held, flipped));
+        CHECK(jumping.GetAngularVelocity().z() > 0.0);
+    }
+}
+
+int main()
+{
+    TestPredictBeforeUpdate();
+    TestTrajectories();
+    TestRestarts();
+    TestRotationThroughPi();
+    return TestUtils::Report("PosePredictorTests");
+}
@@ -0,0 +1,282 @@
+/**
+ * @file        RayLookupTableTests.cpp
+ * @brief       Checks \ref IRTrackerUtils::RayLookupTable against the distorted pinhole camera it was sampled from,
+ *              and its rejected nodes, edge extrapolation, projection and file round trips
+ * @author      Hisham Iqbal
+ * @copyright   &copy; Hisham Iqbal 2023
+ *
+ */
+
+#include "RayLookupTable.h"
+#include "SyntheticCamera.h"
+#include "TestUtils.h"
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+
+using IRTrackerUtils::PinholeCameraModel;
+using IRTrackerUtils::RayLookupTable;
+
+namespace
+{
+    // quoted for the step-4 table built from the AHAT-like camera, on the unit plane and in pixels
+    constexpr double MAX_UNIT_PLANE_ERROR = 5e-5;
+    constexpr double MAX_ROUND_TRIP_ERROR_PX = 0.16;
+
+    const RayLookupTable::ExtrinsicsKey EXTRINSICS = { 1.0f, 0.0f, 0.0f, 0.01f, 0.0f, -1.0f, 0.0f, 0.02f, 0.0f, 0.0f, -1.0f, 0.03f,
+        0.0f, 0.0f, 0.0f, 1.0f };
+
+    //! Unit plane point of \p model's ray through (\p u, \p v)
+    bool ModelUnitPlane(const PinholeCameraModel& model, float u, float v, Eigen::Vector2d& outXY)
+    {
+        const cv::Point2f pixel(u, v);
+        Eigen::Vector3f ray;
+        uint8_t valid = 0;
+        model.UnmapPoints(&pixel, 1, &ray, &valid);
+        if (!valid) return false;
+        outXY = Eigen::Vector2d(ray.x() / ray.z(), ray.y() / ray.z());
+        return true;
+    }
+
+    //! Largest unit plane distance between \p table and \p model over every pixel and every half pixel in \p region
+    double WorstUnitPlaneError(const RayLookupTable& table, const PinholeCameraModel& model, const cv::Rect& region, int& outFailures)
+    {
+        double worst = 0.0;
+        outFailures = 0;
+        for (float v = static_cast<float>(region.y); v <= region.br().y - 1; v += 0.5f)
+        {
+            for (float u = static_cast<float>(region.x); u <= region.br().x - 1; u += 0.5f)
+            {
+                Eigen::Vector2d expected;
+                float uv[2] = { u, v }, xy[2];
+                if (!ModelUnitPlane(model, u, v, expected)) continue;
+                if (!table.MapImagePointToUnitPlane(uv, xy)) { ++outFailures; continue; }
+                worst = std::max(worst, (Eigen::Vector2d(xy[0], xy[1]) - expected).norm());
+            }
+        }
+        return worst;
+    }
+
+    void TestMatchesModel()
+    {
+        std::printf("step-4 table against the distorted pinhole camera it was built from\n");
+        const PinholeCameraModel model(TestUtils::AhatLikeIntrinsics());
+        RayLookupTable table;
+        CHECK(!table.IsValid());
+        CHECK(table.Build(TestUtils::UnmapFunctionOf(model)));
+        CHECK(table.IsValid() && table.Width() == 512 && table.Height() == 512);
+
+        int failures = 0;
+        const double worst = WorstUnitPlaneError(table, model, cv::Rect(0, 0, 512, 512), failures);
+        std::printf("  worst unit plane error %.2e\n", worst);
+        CHECK(failures == 0);
+        CHECK(worst < MAX_UNIT_PLANE_ERROR);
+
+        // unit rays, and through the batched interface
+        Eigen::Vector3d ray;
+        CHECK(table.GetUnitRay(0.0f, 0.0f, ray) && std::abs(ray.norm() - 1.0) < 1e-12 && ray.z() > 0.0);
+        const cv::Point2f pixels[] = { { 10.0f, 20.0f }, { 255.5f, 256.5f }, { 511.0f, 511.0f }, { -1.0f, 100.0f }, { 100.0f, 512.0f } };
+        Eigen::Vector3f rays[5];
+        uint8_t valid[5];
+        CHECK(table.UnmapPoints(pixels, 5, rays, valid) == 3);
+        CHECK(valid[0] && valid[1] && valid[2] && !valid[3] && !valid[4]);
+        CHECK(rays[3].isZero() && rays[4].isZero());
+        CHECK(table.GetUnitRay(pixels[1].x, pixels[1].y, ray) && (ray.cast<float>() - rays[1]).norm() < 1e-7);
+
+        // half a pixel past the border is still the image, any further (or NaN) isn't
+        CHECK(table.GetUnitRay(-0.5f, -0.5f, ray) && table.GetUnitRay(511.5f, 511.5f, ray));
+        CHECK(!table.GetUnitRay(-0.51f, 0.0f, ray) && !table.GetUnitRay(0.0f, 511.51f, ray));
+        CHECK(!table.GetUnitRay(std::nanf(""), 0.0f, ray));
+    }
+
+    void TestRejectedNodes()
+    {
+        std::printf("nodes the unmap function rejects\n");
+        const PinholeCameraModel model(TestUtils::AhatLikeIntrinsics());
+        const IRTrackerUtils::UnmapFunction unmap = TestUtils::UnmapFunctionOf(model);
+
+        // only node (50, 50), pixel (200, 200), is refused, so every lookup in the four cells around it fails
+        RayLookupTable table;
+        CHECK(table.Build([&](float(&uv)[2], float(&xy)[2]) { return !(uv[0] == 200.0f && uv[1] == 200.0f) && unmap(uv, xy); }));
+
+        Eigen::Vector3d ray;
+        CHECK(!table.GetUnitRay(200.0f, 200.0f, ray));
+        CHECK(!table.GetUnitRay(196.0f, 196.0f, ray) && !table.GetUnitRay(203.9f, 203.9f, ray));
+        CHECK(!table.GetUnitRay(196.0f, 203.0f, ray) && !table.GetUnitRay(203.0f, 196.0f, ray));
+        CHECK(table.GetUnitRay(195.9f, 200.0f, ray) && table.GetUnitRay(204.0f, 200.0f, ray));
+        CHECK(table.GetUnitRay(200.0f, 195.9f, ray) && table.GetUnitRay(200.0f, 204.0f, ray));
+
+        // the rest of the image is unaffected
+        int failures = 0;
+        CHECK(WorstUnitPlaneError(table, model, cv::Rect(0, 0, 512, 190), failures) < MAX_UNIT_PLANE_ERROR && failures == 0);
+
+        // a table with nothing in it isn't valid, and a failed build doesn't leave the old contents usable
+        CHECK(!table.Build([](float(&)[2], float(&)[2]) { return false; }));
+        CHECK(!table.IsValid() && !table.GetUnitRay(256.0f, 256.0f, ray));
+        CHECK(!table.Build(IRTrackerUtils::UnmapFunction()));
+    }
+
+    void TestExtrapolatedEdges()
+    {
+        std::printf("last node column and row extrapolated when they lie past the image\n");
+
+        // with step 4 the last nodes of a 510 x 509 image sit at pixel 512, which the camera refuses to unmap
+        PinholeCameraModel::Intrinsics intrinsics = TestUtils::AhatLikeIntrinsics();
+        intrinsics.Width = 510;
+        intrinsics.Height = 509;
+        const PinholeCameraModel model(intrinsics);
+        float corner[2] = { 512.0f, 512.0f }, xy[2];
+        CHECK(!TestUtils::UnmapFunctionOf(model)(corner, xy));
+
+        RayLookupTable table;
+        CHECK(table.Build(TestUtils::UnmapFunctionOf(model), 510, 509));
+
+        // the last pixels are a fraction of a cell from the extrapolated nodes, so they're as good as the interior
+        int failures = 0;
+        const double lastColumns = WorstUnitPlaneError(table, model, cv::Rect(504, 0, 6, 509), failures);
+        CHECK(failures == 0);
+        const double lastRows = WorstUnitPlaneError(table, model, cv::Rect(0, 503, 510, 6), failures);
+        CHECK(failures == 0);
+        std::printf("  worst unit plane error %.2e in the last columns, %.2e in the last rows\n", lastColumns, lastRows);
+        CHECK(lastColumns < MAX_UNIT_PLANE_ERROR && lastRows < MAX_UNIT_PLANE_ERROR);
+
+        Eigen::Vector3d ray;
+        CHECK(table.GetUnitRay(509.5f, 508.5f, ray) && !table.GetUnitRay(509.6f, 100.0f, ray));
+    }
+
+    void TestProjection()
+    {
+        std::printf("MapUnitPlaneToImagePoint and ProjectPoints round trips\n");
+        const PinholeCameraModel model(TestUtils::AhatLikeIntrinsics());
+        RayLookupTable table;
+        CHECK(table.Build(TestUtils::UnmapFunctionOf(model)));
+
+        // the camera's true rays projected through the table land back on their pixel, table rays exactly so
+        double worstModel = 0.0, worstTable = 0.0;
+        int failures = 0;
+        for (int v = 0; v < 512; v += 3)
+        {
+            for (int u = 0; u < 512; u += 3)
+            {
+                Eigen::Vector2d expected;
+                if (!ModelUnitPlane(model, static_cast<float>(u), static_cast<float>(v), expected)) continue;
+
+                float xy[2] = { static_cast<float>(expected.x()), static_cast<float>(expected.y()) }, uv[2];
+                if (!table.MapUnitPlaneToImagePoint(xy, uv)) { ++failures; continue; }
+                worstModel = std::max(worstModel, static_cast<double>(std::hypot(uv[0] - u, uv[1] - v)));
+
+                float pixel[2] = { static_cast<float>(u), static_cast<float>(v) };
+                if (!table.MapImagePointToUnitPlane(pixel, xy) || !table.MapUnitPlaneToImagePoint(xy, uv)) { ++failures; continue; }
+                worstTable = std::max(worstTable, static_cast<double>(std::hypot(uv[0] - u, uv[1] - v)));
+            }
+        }
+        std::printf("  worst %.3f px from the camera's rays, %.4f px from the table's own\n", worstModel, worstTable);
+        CHECK(failures == 0);
+        CHECK(worstModel < MAX_ROUND_TRIP_ERROR_PX);
+        CHECK(worstTable < 0.01);
+
+        // points behind the camera or outside its view don't project
+        const Eigen::Vector3f points[] = { { 0.1f, -0.05f, 0.5f }, { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, -1.0f }, { 5.0f, 0.0f, 0.5f } };
+        cv::Point2f pixels[4];
+        uint8_t valid[4];
+        CHECK(table.ProjectPoints(points, 4, pixels, valid) == 1);
+        CHECK(valid[0] && !valid[1] && !valid[2] && !valid[3]);
+        CHECK(pixels[3] == cv::Point2f(-1.0f, -1.0f));
+
+        cv::Point2f modelPixel;
+        uint8_t modelValid = 0;
+        model.ProjectPoints(points, 1, &modelPixel, &modelValid);
+        CHECK(modelValid && std::hypot(pixels[0].x - modelPixel.x, pixels[0].y - modelPixel.y) < MAX_ROUND_TRIP_ERROR_PX);
+
+        float nan[2] = { std::nanf(""), 0.0f }, uv[2];
+        CHECK(!table.MapUnitPlaneToImagePoint(nan, uv));
+        CHECK(!RayLookupTable().MapUnitPlaneToImagePoint(nan, uv));
+    }
+
+    //! Every lookup \p a and \p b give over the image, to the bit
+    bool SameLookups(const RayLookupTable& a, const RayLookupTable& b)
+    {
+        if (a.Width() != b.Width() || a.Height() != b.Height()) return false;
+        Eigen::Vector3d rayA, rayB;
+        for (float v = -0.5f; v <= a.Height() - 0.5f; v += 1.25f)
+        {
+            for (float u = -0.5f; u <= a.Width() - 0.5f; u += 1.25f)
+            {
+                const bool validA = a.GetUnitRay(u, v, rayA), validB = b.GetUnitRay(u, v, rayB);
+                if (validA != validB || (validA && rayA != rayB)) return false;
+            }
+        }
+        return true;
+    }
+
+    void TestSaveLoad()
+    {
+        std::printf("Save/Load round trip and rejected files\n");
+        const std::filesystem::path directory = std::filesystem::temp_directory_path();
+        const std::string path = (directory / "RayLookupTableTests.bin").string();
+        const std::string corruptPath = (directory / "RayLookupTableTests_corrupt.bin").string();
+
+        PinholeCameraModel::Intrinsics intrinsics = TestUtils::AhatLikeIntrinsics();
+        intrinsics.Width = 320;
+        intrinsics.Height = 288;
+        const PinholeCameraModel model(intrinsics);
+        RayLookupTable table;
+        CHECK(!table.Save(path, EXTRINSICS)); // nothing to save yet
+        CHECK(table.Build(TestUtils::UnmapFunctionOf(model), 320, 288, 3));
+        CHECK(table.Save(path, EXTRINSICS));
+
+        RayLookupTable loaded;
+        CHECK(loaded.Load(path, EXTRINSICS));
+        CHECK(SameLookups(table, loaded));
+
+        // within float formatting noise of the saved extrinsics still matches
+        RayLookupTable::ExtrinsicsKey nearly = EXTRINSICS;
+        nearly[3] += 5e-7f;
+        CHECK(RayLookupTable().Load(path, nearly));
+
+        // a table for other extrinsics, or a file that isn't one, is refused and leaves the current table alone
+        const PinholeCameraModel other(TestUtils::AhatLikeIntrinsics());
+        RayLookupTable current;
+        CHECK(current.Build(TestUtils::UnmapFunctionOf(other)));
+        const RayLookupTable before = current;
+
+        RayLookupTable::ExtrinsicsKey moved = EXTRINSICS;
+        moved[7] += 1e-4f;
+        CHECK(!current.Load(path, moved));
+        CHECK(SameLookups(current, before));
+
+        std::vector<char> bytes;
+        {
+            std::ifstream file(path, std::ios::binary);
+            bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        }
+        const auto writeCorrupt = [&](size_t offset, char value)
+        {
+            std::vector<char> corrupt = bytes;
+            corrupt[offset] = value;
+            std::ofstream(corruptPath, std::ios::binary | std::ios::trunc).write(corrupt.data(), corrupt.size());
+        };
+
+        writeCorrupt(0, 'X'); // magic
+        CHECK(!current.Load(corruptPath, EXTRINSICS));
+        writeCorrupt(8, 2); // version
+        CHECK(!current.Load(corruptPath, EXTRINSICS));
+        std::ofstream(corruptPath, std::ios::binary | std::ios::trunc).write(bytes.data(), bytes.size() - 4); // truncated
+        CHECK(!current.Load(corruptPath, EXTRINSICS));
+        CHECK(!current.Load((directory / "RayLookupTableTests_missing.bin").string(), EXTRINSICS));
+        CHECK(SameLookups(current, before));
+
+        std::filesystem::remove(path);
+        std::filesystem::remove(corruptPath);
+    }
+}
+
+int main()
+{
+    TestMatchesModel();
+    TestRejectedNodes();
+    TestExtrapolatedEdges();
+    TestProjection();
+    TestSaveLoad();
+    return TestUtils::Report("RayLookupTableTests");
+}
@@ -0,0 +1,284 @@
+/**
+ * @file        ReflectionBackgroundModelTests.cpp
+ * @brief       Checks how \ref IRTrackerUtils::ReflectionBackgroundModel learns, suppresses, clears and forgets
+ *              world-fixed reflections
+ * @author      Hisham Iqbal
+ * @copyright   &copy; Hisham Iqbal 2023
+ *
+ */
+
+#include "ReflectionBackgroundModel.h"
+#include "TestUtils.h"
+
+using IRTrackerUtils::BlobPoints3D;
+using IRTrackerUtils::ReflectionBackgroundModel;
+
+namespace
+{
+    //! Same as PRUNE_INTERVAL_FRAMES in ReflectionBackgroundModel.cpp
+    constexpr uint64_t PRUNE_INTERVAL = 64;
+
+    //! Middle of a 1 cm voxel, well clear of its faces
+    const Eigen::Vector3d REFLECTOR(0.105, -0.205, 0.505);
+
+    ReflectionBackgroundModel::Settings TestSettings()
+    {
+        ReflectionBackgroundModel::Settings settings;
+        settings.LearnFrames = 10;
+        settings.ForgetFrames = 100;
+        return settings;
+    }
+
+    BlobPoints3D Blobs(std::initializer_list<Eigen::Vector3d> positions)
+    {
+        BlobPoints3D blobs;
+        blobs.Resize(positions.size());
+        size_t i = 0;
+        for (const Eigen::Vector3d& position : positions) blobs.WorldLocations().row(i++) = position.transpose();
+        return blobs;
+    }
+
+    //! Runs \p frames updates with \p blobs, none of them assigned to a tool
+    void See(ReflectionBackgroundModel& model, const BlobPoints3D& blobs, uint32_t frames = 1)
+    {
+        for (uint32_t f = 0; f < frames; ++f) model.Update(blobs, std::vector<uint8_t>(blobs.Size(), 0));
+    }
+
+    void Skip(ReflectionBackgroundModel& model, uint32_t frames)
+    {
+        See(model, BlobPoints3D(), frames);
+    }
+
+    //! Flags from \ref ReflectionBackgroundModel::Suppress, which also updates the counters
+    std::vector<uint8_t> Suppressed(ReflectionBackgroundModel& model, const BlobPoints3D& blobs)
+    {
+        std::vector<uint8_t> suppressed;
+        model.Suppress(blobs, suppressed);
+        return suppressed;
+    }
+
+    bool IsSuppressed(ReflectionBackgroundModel& model, const Eigen::Vector3d& position)
+    {
+        return Suppressed(model, Blobs({ position }))[0] != 0;
+    }
+
+    void TestLearning()
+    {
+        std::printf("learning a reflection after LearnFrames sightings\n");
+        ReflectionBackgroundModel model(TestSettings());
+
+        // two blobs in the one cell count as one sighting, so it still takes LearnFrames frames
+        const BlobPoints3D pair = Blobs({ REFLECTOR, REFLECTOR + Eigen::Vector3d(0.002, 0.0, 0.0) });
+        See(model, pair, 9);
+        CHECK(model.GetLearnedCount() == 0 && !IsSuppressed(model, REFLECTOR));
+        See(model, pair);
+        CHECK(model.GetLearnedCount() == 1);
+
+        // anything within a voxel's length of the learned position is suppressed, further away isn't
+        CHECK(IsSuppressed(model, REFLECTOR) && IsSuppressed(model, REFLECTOR + Eigen::Vector3d(0.0, 0.007, -0.007)));
+        CHECK(!IsSuppressed(model, REFLECTOR + Eigen::Vector3d(0.0, 0.008, -0.008)));
+        CHECK(!IsSuppressed(model, REFLECTOR + Eigen::Vector3d(0.02, 0.0, 0.0)));
+    }
+
+    void TestGaps()
+    {
+        std::printf("runs of sightings with dropped frames\n");
+        const ReflectionBackgroundModel::Settings settings = TestSettings();
+        const BlobPoints3D reflector = Blobs({ REFLECTOR });
+
+        // MaxGapFrames missed frames between every sighting don't break the run
+        ReflectionBackgroundModel model(settings);
+        for (uint32_t sighting = 0; sighting < settings.LearnFrames; ++sighting)
+        {
+            CHECK(model.GetLearnedCount() == 0);
+            See(model, reflector);
+            Skip(model, settings.MaxGapFrames);
+        }
+        CHECK(model.GetLearnedCount() == 1);
+
+        // one more and it starts again from the next sighting
+        model.Reset();
+        See(model, reflector, settings.LearnFrames - 1);
+        Skip(model, settings.MaxGapFrames + 1);
+        See(model, reflector, settings.LearnFrames - 1);
+        CHECK(model.GetLearnedCount() == 0);
+        See(model, reflector);
+        CHECK(model.GetLearnedCount() == 1);
+    }
+
+    void TestToolMarkers()
+    {
+        std::printf("blobs assigned to tools\n");
+        const ReflectionBackgroundModel::Settings settings = TestSettings();
+        const BlobPoints3D marker = Blobs({ REFLECTOR });
+        const std::vector<uint8_t> assigned = { 1 };
+
+        // a tool's marker never becomes background however long it stays still
+        ReflectionBackgroundModel model(settings);
+        for (uint32_t frame = 0; frame < 5 * settings.LearnFrames; ++frame) model.Update(marker, assigned);
+        CHECK(model.GetLearnedCount() == 0 && !IsSuppressed(model, REFLECTOR));
+
+        // nor does it count towards a run, the run starts again after it
+        See(model, marker, settings.LearnFrames - 1);
+        model.Update(marker, assigned);
+        See(model, marker, settings.LearnFrames - 1);
+        CHECK(model.GetLearnedCount() == 0);
+
+        // assignments that don't line up with the blobs are ignored, so the blobs count as unassigned
+        for (uint32_t frame = 0; frame < settings.LearnFrames; ++frame) model.Update(marker, { 1, 1 });
+        CHECK(model.GetLearnedCount() == 1);
+
+        // matching a tool's marker clears learned cells around it, including one in the next voxel over. Others stay
+        model.Reset();
+        const Eigen::Vector3d nearFace(0.1095, -0.205, 0.505), farAway(0.3, 0.0, 0.5);
+        See(model, Blobs({ nearFace, farAway }), settings.LearnFrames);
+        CHECK(model.GetLearnedCount() == 2);
+        model.Update(Blobs({ nearFace + Eigen::Vector3d(0.003, 0.0, 0.0) }), assigned);
+        CHECK(model.GetLearnedCount() == 1 && !IsSuppressed(model, nearFace) && IsSuppressed(model, farAway));
+
+        // but not ones further than a voxel's length away
+        model.Update(Blobs({ farAway + Eigen::Vector3d(0.0, 0.0, 0.012) }), assigned);
+        CHECK(model.GetLearnedCount() == 1 && IsSuppressed(model, farAway));
+    }
+
+    void TestForgetting()
+    {
+        std::printf("forgetting reflections, pruned every %llu frames\n", static_cast<unsigned long long>(PRUNE_INTERVAL));
+        const ReflectionBackgroundModel::Settings settings = TestSettings();
+        const BlobPoints3D reflector = Blobs({ REFLECTOR });
+
+        // last seen on frame 10, unseen for more than ForgetFrames from frame 111, dropped at the next prune on 128
+        ReflectionBackgroundModel model(settings);
+        See(model, reflector, settings.LearnFrames);
+        Skip(model, 2 * PRUNE_INTERVAL - 1 - settings.LearnFrames);
+        CHECK(model.GetLearnedCount() == 1 && IsSuppressed(model, REFLECTOR));
+        Skip(model, 1);
+        CHECK(model.GetLearnedCount() == 0 && !IsSuppressed(model, REFLECTOR));
+
+        // seen again before then it's kept through the prune
+        model.Reset();
+        See(model, reflector, settings.LearnFrames);
+        Skip(model, settings.ForgetFrames - settings.LearnFrames);
+        See(model, reflector);
+        Skip(model, 2 * PRUNE_INTERVAL - settings.ForgetFrames - 1);
+        CHECK(model.GetLearnedCount() == 1);
+
+        // and then forgotten at the first prune more than ForgetFrames after that sighting, frame 101 + 100 -> 256
+        Skip(model, 2 * PRUNE_INTERVAL - 1);
+        CHECK(model.GetLearnedCount() == 1);
+        Skip(model, 1);
+        CHECK(model.GetLearnedCount() == 0);
+    }
+
+    void TestFrozen()
+    {
+        std::printf("frozen model\n");
+        const ReflectionBackgroundModel::Settings settings = TestSettings();
+        const Eigen::Vector3d other(-0.4, 0.2, 1.1);
+
+        ReflectionBackgroundModel model(settings);
+        See(model, Blobs({ REFLECTOR }), settings.LearnFrames);
+        model.SetFrozen(true);
+        CHECK(model.IsFrozen());
+
+        // nothing new is learned, nothing is forgotten or cleared by tools, but what was learned still suppresses
+        See(model, Blobs({ other }), 3 * settings.ForgetFrames);
+        model.Update(Blobs({ REFLECTOR }), { 1 });
+        CHECK(model.GetLearnedCount() == 1);
+        CHECK(Suppressed(model, Blobs({ REFLECTOR, other })) == std::vector<uint8_t>({ 1, 0 }));
+        CHECK(model.GetSuppressedLastFrame() == 1);
+
+        // thawed, it carries on from where it was frozen
+        model.SetFrozen(false);
+        See(model, Blobs({ other }), settings.LearnFrames);
+        CHECK(model.GetLearnedCount() == 2 && IsSuppressed(model, other));
+    }
+
+    void TestReset()
+    {
+        std::printf("reset\n");
+        const ReflectionBackgroundModel::Settings settings = TestSettings();
+        ReflectionBackgroundModel model(settings);
+        See(model, Blobs({ REFLECTOR }), settings.LearnFrames);
+        IsSuppressed(model, REFLECTOR);
+        model.SetFrozen(true);
+
+        // everything learned and counted goes, the frozen state and the settings stay
+        model.Reset();
+        CHECK(model.GetLearnedCount() == 0 && model.GetSuppressedLastFrame() == 0 && model.GetSuppressedTotal() == 0);
+        CHECK(model.IsFrozen() && model.GetSettings().LearnFrames == settings.LearnFrames);
+        CHECK(!IsSuppressed(model, REFLECTOR));
+
+        // learning starts from scratch, the run before the reset doesn't count
+        model.SetFrozen(false);
+        See(model, Blobs({ REFLECTOR }), settings.LearnFrames - 1);
+        CHECK(model.GetLearnedCount() == 0);
+        See(model, Blobs({ REFLECTOR }));
+        CHECK(model.GetLearnedCount() == 1);
+    }
+
+    void TestCounters()
+    {
+        std::printf("suppression flags and counters\n");
+        const ReflectionBackgroundModel::Settings settings = TestSettings();
+        ReflectionBackgroundModel model(settings);
+        const Eigen::Vector3d elsewhere(0.5, 0.5, 0.5);
+        const BlobPoints3D frame = Blobs({ elsewhere, REFLECTOR, REFLECTOR + Eigen::Vector3d(0.0, 0.0, 0.004), elsewhere });
+
+        // nothing learned yet, flags are still sized to the blobs (replacing whatever was there) and all clear
+        std::vector<uint8_t> suppressed(7, 1);
+        CHECK(model.Suppress(frame, suppressed) == 0 && suppressed == std::vector<uint8_t>(4, 0));
+        CHECK(model.GetSuppressedLastFrame() == 0 && model.GetSuppressedTotal() == 0);
+
+        See(model, Blobs({ REFLECTOR }), settings.LearnFrames);
+        CHECK(model.Suppress(frame, suppressed) == 2 && suppressed == std::vector<uint8_t>({ 0, 1, 1, 0 }));
+        CHECK(model.Suppress(Blobs({ REFLECTOR }), suppressed) == 1);
+        CHECK(model.GetSuppressedLastFrame() == 1 && model.GetSuppressedTotal() == 3);
+
+        // an empty frame clears the last frame's count but not the total
+        CHECK(model.Suppress(BlobPoints3D(), suppressed) == 0 && suppressed.empty());
+        CHECK(model.GetSuppressedLastFrame() == 0 && model.GetSuppressedTotal() == 3);
+    }
+
+    void TestVoxelBoundaries()
+    {
+        std::printf("reflections on voxel boundaries\n");
+        const ReflectionBackgroundModel::Settings settings = TestSettings();
+
+        // a reflection jittering across a voxel face every frame is seen in each cell every other frame, inside the
+        // allowed gap, so both cells learn it once each has LearnFrames sightings
+        for (const double face : { 0.1, 0.0, -0.2 })
+        {
+            ReflectionBackgroundModel model(settings);
+            const Eigen::Vector3d below(face - 0.0002, 0.055, 0.405), above(face + 0.0002, 0.055, 0.405);
+            for (uint32_t frame = 0; frame < 2 * settings.LearnFrames - 2; ++frame) See(model, Blobs({ frame % 2 ? above : below }));
+            CHECK(model.GetLearnedCount() == 0);
+            See(model, Blobs({ below }));
+            CHECK(model.GetLearnedCount() == 1);
+            See(model, Blobs({ above }));
+            CHECK(model.GetLearnedCount() == 2);
+            CHECK(IsSuppressed(model, below) && IsSuppressed(model, above));
+        }
+
+        // a cell learned on one side of a face suppresses blobs just across it, found through the neighbouring voxels
+        ReflectionBackgroundModel model(settings);
+        const Eigen::Vector3d corner(0.0998, 0.0998, 0.0998);
+        See(model, Blobs({ corner }), settings.LearnFrames);
+        CHECK(IsSuppressed(model, Eigen::Vector3d(0.1004, 0.1004, 0.1004)));
+        CHECK(IsSuppressed(model, Eigen::Vector3d(0.0998, 0.1050, 0.0998)));
+        CHECK(!IsSuppressed(model, Eigen::Vector3d(0.0998, 0.1101, 0.0998)));
+    }
+}
+
+int main()
+{
+    TestLearning();
+    TestGaps();
+    TestToolMarkers();
+    TestForgetting();
+    TestFrozen();
+    TestReset();
+    TestCounters();
+    TestVoxelBoundaries();
+    return TestUtils::Report("ReflectionBackgroundModelTests");
+}
@@ -0,0 +1,48 @@
+/** @file       SyntheticCamera.h
+ *  @brief      An AHAT-like distorted pinhole camera, for the tests of the 3D stage and the camera models
+ *
+ *  @author     Hisham Iqbal
+ *  @copyright  &copy; 2023 Hisham Iqbal
+ */
+
+#ifndef SYNTHETIC_CAMERA_H
+#define SYNTHETIC_CAMERA_H
+
+#include "CameraModel.h"
+
+namespace TestUtils
+{
+    //! @brief  512 x 512 with a wide field of view and mostly barrel distortion, monotonic out to the corners
+    inline IRTrackerUtils::PinholeCameraModel::Intrinsics AhatLikeIntrinsics()
+    {
+        IRTrackerUtils::PinholeCameraModel::Intrinsics intrinsics;
+        intrinsics.Fx = 240.0f;
+        intrinsics.Fy = 238.0f;
+        intrinsics.Cx = 255.3f;
+        intrinsics.Cy = 257.1f;
+        intrinsics.K1 = -0.05f;
+        intrinsics.K2 = 0.005f;
+        intrinsics.P1 = 1e-4f;
+        intrinsics.P2 = -2e-4f;
+        return intrinsics;
+    }
+
+    //! @brief  \p model's unmap direction with the Research Mode API's signature, \p model must outlive it
+    inline IRTrackerUtils::UnmapFunction UnmapFunctionOf(const IRTrackerUtils::CameraModel& model)
+    {
+        return [&model](float(&uv)[2], float(&xy)[2])
+        {
+            const cv::Point2f pixel(uv[0], uv[1]);
+            Eigen::Vector3f ray;
+            uint8_t valid = 0;
+            model.UnmapPoints(&pixel, 1, &ray, &valid);
+            if (!valid) return false;
+
+            xy[0] = ray.x() / ray.z();
+            xy[1] = ray.y() / ray.z();
+            return true;
+        };
+    }
+}
+
+#endif // SYNTHETIC_CAMERA_H
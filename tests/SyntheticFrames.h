@@ -0,0 +1,135 @@
+/** @file       SyntheticFrames.h
+ *  @brief      Synthetic AHAT-like masks and raw AB frames with known marker centres, for the image processing tests
+ *
+ *  @author     Hisham Iqbal
+ *  @copyright  &copy; 2023 Hisham Iqbal
+ */
+
+#ifndef SYNTHETIC_FRAMES_H
+#define SYNTHETIC_FRAMES_H
+
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace TestUtils
+{
+    //! One marker as it appears in the image
+    struct SyntheticBlob
+    {
+        cv::Point2f     Centre;     /*!< True centre, sub-pixel */
+        float           Radius;     /*!< Radius of the bright disc, pixels */
+    };
+
+    //! @brief  Scatters \p count non-touching blobs over an image of \p imageSize
+    //! @param gap   Smallest number of background pixels between two blobs
+    inline std::vector<SyntheticBlob> ScatterBlobs(int count, float minRadius, float maxRadius, cv::Size imageSize,
+        std::mt19937& rng, float gap = 3.0f)
+    {
+        std::uniform_real_distribution<float> radius(minRadius, maxRadius);
+        std::vector<SyntheticBlob> blobs;
+        for (int attempt = 0; static_cast<int>(blobs.size()) < count && attempt < 100000; ++attempt)
+        {
+            SyntheticBlob blob;
+            blob.Radius = radius(rng);
+            const float margin = blob.Radius + 3.0f;
+            std::uniform_real_distribution<float> x(margin, imageSize.width - 1 - margin), y(margin, imageSize.height - 1 - margin);
+            blob.Centre = cv::Point2f(x(rng), y(rng));
+
+            const bool clear = std::none_of(blobs.begin(), blobs.end(), [&](const SyntheticBlob& other)
+            {
+                const cv::Point2f offset = other.Centre - blob.Centre;
+                return std::hypot(offset.x, offset.y) < other.Radius + blob.Radius + gap + 2.0f;
+            });
+            if (clear) blobs.push_back(blob);
+        }
+        return blobs;
+    }
+
+    //! Binary mask (0/255) with every pixel whose centre lies inside a blob's disc set
+    inline void DrawBinaryDiscs(const std::vector<SyntheticBlob>& blobs, cv::Size imageSize, cv::Mat& outMask)
+    {
+        outMask.create(imageSize, CV_8UC1);
+        outMask.setTo(cv::Scalar(0));
+        for (const SyntheticBlob& blob : blobs)
+        {
+            const int ymin = std::max(static_cast<int>(std::floor(blob.Centre.y - blob.Radius)), 0);
+            const int ymax = std::min(static_cast<int>(std::ceil(blob.Centre.y + blob.Radius)), imageSize.height - 1);
+            const int xmin = std::max(static_cast<int>(std::floor(blob.Centre.x - blob.Radius)), 0);
+            const int xmax = std::min(static_cast<int>(std::ceil(blob.Centre.x + blob.Radius)), imageSize.width - 1);
+            for (int y = ymin; y <= ymax; ++y)
+            {
+                uint8_t* row = outMask.ptr<uint8_t>(y);
+                for (int x = xmin; x <= xmax; ++x)
+                {
+                    const float dx = x - blob.Centre.x, dy = y - blob.Centre.y;
+                    if (dx * dx + dy * dy <= blob.Radius * blob.Radius) row[x] = 255;
+                }
+            }
+        }
+    }
+
+    //! Binary mask (0/255) with each pixel set with probability \p density, giving ragged components of every shape
+    inline void DrawNoiseMask(cv::Size imageSize, double density, std::mt19937& rng, cv::Mat& outMask)
+    {
+        std::bernoulli_distribution set(density);
+        outMask.create(imageSize, CV_8UC1);
+        for (int y = 0; y < imageSize.height; ++y)
+        {
+            uint8_t* row = outMask.ptr<uint8_t>(y);
+            for (int x = 0; x < imageSize.width; ++x) row[x] = set(rng) ? 255 : 0;
+        }
+    }
+
+    //! @brief  Raw 16-bit AB frame: noisy background plus a radially symmetric, anti-aliased spot per blob
+    //!
+    //! Each spot is brightest in the middle and dims towards its rim like a retro-reflective sphere, and is
+    //! supersampled 4x4 per pixel, so its intensity-weighted centre is the blob's true centre.
+    inline void RenderRawAB(const std::vector<SyntheticBlob>& blobs, cv::Size imageSize, std::mt19937& rng, cv::Mat& outRaw,
+        float background = 150.0f, float peak = 3000.0f, float noiseSigma = 15.0f)
+    {
+        constexpr int SUBSAMPLES = 4;
+        cv::Mat signal(imageSize, CV_32FC1, cv::Scalar(0));
+        for (const SyntheticBlob& blob : blobs)
+        {
+            const int ymin = std::max(static_cast<int>(std::floor(blob.Centre.y - blob.Radius)) - 1, 0);
+            const int ymax = std::min(static_cast<int>(std::ceil(blob.Centre.y + blob.Radius)) + 1, imageSize.height - 1);
+            const int xmin = std::max(static_cast<int>(std::floor(blob.Centre.x - blob.Radius)) - 1, 0);
+            const int xmax = std::min(static_cast<int>(std::ceil(blob.Centre.x + blob.Radius)) + 1, imageSize.width - 1);
+            for (int y = ymin; y <= ymax; ++y)
+            {
+                float* row = signal.ptr<float>(y);
+                for (int x = xmin; x <= xmax; ++x)
+                {
+                    float sum = 0.0f;
+                    for (int sy = 0; sy < SUBSAMPLES; ++sy)
+                        for (int sx = 0; sx < SUBSAMPLES; ++sx)
+                        {
+                            const float dx = x - 0.5f + (sx + 0.5f) / SUBSAMPLES - blob.Centre.x;
+                            const float dy = y - 0.5f + (sy + 0.5f) / SUBSAMPLES - blob.Centre.y;
+                            const float r2 = (dx * dx + dy * dy) / (blob.Radius * blob.Radius);
+                            if (r2 <= 1.0f) sum += 1.0f - 0.4f * r2;
+                        }
+                    row[x] += peak * sum / (SUBSAMPLES * SUBSAMPLES);
+                }
+            }
+        }
+
+        std::normal_distribution<float> noise(0.0f, noiseSigma);
+        outRaw.create(imageSize, CV_16UC1);
+        for (int y = 0; y < imageSize.height; ++y)
+        {
+            const float* in = signal.ptr<float>(y);
+            uint16_t* out = outRaw.ptr<uint16_t>(y);
+            for (int x = 0; x < imageSize.width; ++x)
+            {
+                out[x] = static_cast<uint16_t>(std::clamp(background + in[x] + noise(rng), 0.0f, 65535.0f));
+            }
+        }
+    }
+}
+
+#endif // SYNTHETIC_FRAMES_H
@@ -0,0 +1,105 @@
+/** @file       SyntheticScenes.h
+ *  @brief      Random tool geometries and triangulated-blob scenes with known marker positions, for the matching tests
+ *
+ *  @author     Hisham Iqbal
+ *  @copyright  &copy; 2023 Hisham Iqbal
+ */
+
+#ifndef SYNTHETIC_SCENES_H
+#define SYNTHETIC_SCENES_H
+
+#include <Eigen/Dense>
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace TestUtils
+{
+    //! Blobs of one frame in the tracking camera's frame, with where each planted tool ended up
+    struct SyntheticScene
+    {
+        std::vector<Eigen::Vector3d>    Points;         /*!< Stray blobs, planted markers and duplicates, shuffled */
+        std::vector<uint8_t>            Excluded;       /*!< One entry per point, 1 for points the matcher is told to skip */
+        std::vector<std::vector<int>>   ToolIndices;    /*!< Per planted tool and marker, the first point not excluded that
+                                                             is that marker (or its duplicate), -1 if there's none */
+    };
+
+    //! @brief  \p markers points within a \p size cube, no two closer than \p minSpacing (all in metres)
+    inline std::vector<Eigen::Vector3d> RandomToolGeometry(int markers, std::mt19937& rng, double size = 0.1, double minSpacing = 0.015)
+    {
+        std::uniform_real_distribution<double> coordinate(0.0, size);
+        std::vector<Eigen::Vector3d> geometry;
+        while (static_cast<int>(geometry.size()) < markers)
+        {
+            const Eigen::Vector3d point(coordinate(rng), coordinate(rng), coordinate(rng));
+            const bool clear = std::all_of(geometry.begin(), geometry.end(), [&](const Eigen::Vector3d& other) { return (point - other).norm() >= minSpacing; });
+            if (clear) geometry.push_back(point);
+        }
+        return geometry;
+    }
+
+    //! @brief  A random rotation, translated somewhere in front of the camera
+    inline Eigen::Matrix4d RandomPose(std::mt19937& rng)
+    {
+        std::normal_distribution<double> gaussian;
+        std::uniform_real_distribution<double> lateral(-0.2, 0.2), depth(0.3, 0.7);
+
+        Eigen::Matrix4d pose = Eigen::Matrix4d::Identity();
+        pose.block<3, 3>(0, 0) = Eigen::Quaterniond(gaussian(rng), gaussian(rng), gaussian(rng), gaussian(rng)).normalized().toRotationMatrix();
+        pose.block<3, 1>(0, 3) = Eigen::Vector3d(lateral(rng), lateral(rng), depth(rng));
+        return pose;
+    }
+
+    inline Eigen::Vector3d TransformPoint(const Eigen::Matrix4d& pose, const Eigen::Vector3d& point)
+    {
+        return pose.block<3, 3>(0, 0) * point + pose.block<3, 1>(0, 3);
+    }
+
+    //! @brief  Places each tool at its pose among stray blobs, then shuffles everything
+    //! @param blobCount            Total number of points, strays fill whatever the markers and duplicates leave
+    //! @param duplicates           Extra points within a millimetre of a random earlier one (which may be a marker)
+    //! @param excludedFraction     Chance of each point being marked as excluded
+    inline SyntheticScene ScatterScene(const std::vector<std::vector<Eigen::Vector3d>>& tools, const std::vector<Eigen::Matrix4d>& poses,
+        int blobCount, int duplicates, double excludedFraction, std::mt19937& rng)
+    {
+        std::uniform_real_distribution<double> lateral(-0.3, 0.3), depth(0.2, 0.8), unit(0.0, 1.0), offset(0.0001, 0.0008);
+        std::normal_distribution<double> gaussian;
+
+        // (point, tool, marker), strays have tool -1
+        struct Source { Eigen::Vector3d Point; int Tool, Marker; };
+        std::vector<Source> sources;
+        for (size_t t = 0; t < tools.size(); ++t)
+            for (size_t m = 0; m < tools[t].size(); ++m)
+                sources.push_back({ TransformPoint(poses[t], tools[t][m]), static_cast<int>(t), static_cast<int>(m) });
+
+        while (static_cast<int>(sources.size()) + duplicates < blobCount)
+            sources.push_back({ Eigen::Vector3d(lateral(rng), lateral(rng), depth(rng)), -1, -1 });
+
+        for (int d = 0; d < duplicates && !sources.empty(); ++d)
+        {
+            const Source& original = sources[std::uniform_int_distribution<size_t>(0, sources.size() - 1)(rng)];
+            const Eigen::Vector3d direction = Eigen::Vector3d(gaussian(rng), gaussian(rng), gaussian(rng)).normalized();
+            sources.push_back({ original.Point + offset(rng) * direction, original.Tool, original.Marker });
+        }
+        std::shuffle(sources.begin(), sources.end(), rng);
+
+        SyntheticScene scene;
+        scene.ToolIndices.resize(tools.size());
+        for (size_t t = 0; t < tools.size(); ++t) scene.ToolIndices[t].assign(tools[t].size(), -1);
+
+        for (size_t i = 0; i < sources.size(); ++i)
+        {
+            const bool excluded = unit(rng) < excludedFraction;
+            scene.Points.push_back(sources[i].Point);
+            scene.Excluded.push_back(excluded ? 1 : 0);
+
+            const Source& source = sources[i];
+            if (!excluded && source.Tool >= 0 && scene.ToolIndices[source.Tool][source.Marker] < 0)
+                scene.ToolIndices[source.Tool][source.Marker] = static_cast<int>(i);
+        }
+        return scene;
+    }
+}
+
+#endif // SYNTHETIC_SCENES_H
@@ -0,0 +1,70 @@
+/** @file       TestUtils.h
+ *  @brief      Check macros and timing helpers shared by the off-device tests and benchmarks
+ *
+ *  @author     Hisham Iqbal
+ *  @copyright  &copy; 2023 Hisham Iqbal
+ */
+
+#ifndef TEST_UTILS_H
+#define TEST_UTILS_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+namespace TestUtils
+{
+    //! Failed checks so far in this executable
+    inline int& FailureCount() { static int failures = 0; return failures; }
+
+    inline bool Check(bool passed, const char* expression, const char* file, int line)
+    {
+        if (passed) return true;
+        std::printf("  FAILED %s:%d: %s\n", file, line, expression);
+        ++FailureCount();
+        return false;
+    }
+
+    inline bool CheckNear(double actual, double expected, double tolerance, const char* expression, const char* file, int line)
+    {
+        if (std::abs(actual - expected) <= tolerance) return true;
+        std::printf("  FAILED %s:%d: %s (got %.9g, expected %.9g +- %.3g)\n", file, line, expression, actual, expected, tolerance);
+        ++FailureCount();
+        return false;
+    }
+
+    //! Prints a summary line, returns the process exit code for the test
+    inline int Report(const char* suite)
+    {
+        if (FailureCount() == 0) std::printf("%s: all checks passed\n", suite);
+        else std::printf("%s: %d check(s) failed\n", suite, FailureCount());
+        return FailureCount() == 0 ? 0 : 1;
+    }
+
+    //! Median wall time of \p repeats calls of \p function, in microseconds
+    template <typename Function>
+    double MedianMicroseconds(Function&& function, int repeats)
+    {
+        std::vector<double> times(std::max(repeats, 1));
+        for (double& time : times)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            function();
+            time = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        }
+        std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+        return times[times.size() / 2];
+    }
+}
+
+//! Records a failure (and carries on) if \p condition is false, evaluates to the result
+#define CHECK(condition) TestUtils::Check(static_cast<bool>(condition), #condition, __FILE__, __LINE__)
+
+//! Records a failure (and carries on) unless |actual - expected| <= tolerance
+#define CHECK_NEAR(actual, expected, tolerance) \
+    TestUtils::CheckNear(static_cast<double>(actual), static_cast<double>(expected), static_cast<double>(tolerance), \
+        #actual " ~ " #expected, __FILE__, __LINE__)
+
+#endif // TEST_UTILS_H
@@ -0,0 +1,5 @@
+#pragma once
+// Stands in for HL2DinoPlugin/pch.h in the desktop test build, the portable sources need none of its WinRT headers
+
+// Shiny is compiled out here (SHINY_IS_COMPILED=FALSE), and its no-op macro set lacks PROFILE_END
+#define PROFILE_END()